@@ -0,0 +1,335 @@
+#include "ds1077l-addrplan.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-writee2.h"
+#include "ds1077l-xfer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Parse a device to provision: ADAPTER[/MUX/CHANNEL]/ADDRESS[=NEW_ADDRESS].
+ * Without a new address one is picked by addrplan_make.
+ */
+int
+addrplan_parse (const char *arg, addrplan_device_t *device)
+{
+    char buf[64] = { 0 };
+    const char *equals = strchr (arg, '=');
+    size_t len = equals ? equals - arg : strlen (arg);
+    char *end = NULL;
+    long address = 0;
+
+    memset (device, 0, sizeof (*device));
+    if (len >= sizeof (buf))
+        return -1;
+    memcpy (buf, arg, len);
+    if (topo_parse_target (buf, &device->target))
+        return -1;
+    if (equals == NULL)
+        return 0;
+    address = strtol (equals + 1, &end, 16);
+    if (end == equals + 1 || *end != '\0' ||
+        address < ADDRPLAN_ADDR_MIN || address > ADDRPLAN_ADDR_MAX)
+        return -1;
+    device->address = address;
+    return 0;
+}
+
+int
+addrplan_scope_parse (const char *arg, addrplan_scope_t *scope)
+{
+    if (strcmp (arg, "segment") == 0)
+        *scope = SCOPE_SEGMENT;
+    else if (strcmp (arg, "adapter") == 0)
+        *scope = SCOPE_ADAPTER;
+    else
+        return -1;
+    return 0;
+}
+
+static int
+device_compare (const void *first, const void *second)
+{
+    const addrplan_device_t *a = first;
+    const addrplan_device_t *b = second;
+
+    return topo_compare (&a->target, &b->target);
+}
+
+/* Whether two devices have to end up with different addresses.
+ */
+static bool
+in_scope (const addrplan_device_t *a,
+          const addrplan_device_t *b,
+          addrplan_scope_t scope)
+{
+    if (scope == SCOPE_ADAPTER)
+        return strcmp (a->target.bus_dev, b->target.bus_dev) == 0;
+    return topo_visible (&a->target, &b->target);
+}
+
+static bool
+address_taken (addrplan_device_t *devices,
+               size_t count,
+               size_t self,
+               addrplan_scope_t scope,
+               uint8_t address)
+{
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i)
+        if (i != self && devices[i].final == address &&
+            in_scope (&devices[self], &devices[i], scope))
+            return true;
+    return false;
+}
+
+/* Give every device its final address. Requested addresses go first, then
+ * the remaining devices keep their current address if it's free and take
+ * the lowest free one otherwise.
+ */
+static int
+assign (addrplan_device_t *devices, size_t count, addrplan_scope_t scope)
+{
+    uint8_t address = 0;
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i)
+        devices[i].final = devices[i].address;
+    for (i = 0; i < count; ++i) {
+        if (devices[i].address == 0)
+            continue;
+        if (address_taken (devices, count, i, scope, devices[i].address)) {
+            errno = EADDRINUSE;
+            return -1;
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        if (devices[i].final != 0)
+            continue;
+        address = devices[i].target.address;
+        if (!address_taken (devices, count, i, scope, address)) {
+            devices[i].final = address;
+            continue;
+        }
+        for (address = ADDRPLAN_ADDR_MIN;
+             address <= ADDRPLAN_ADDR_MAX;
+             ++address)
+            if (!address_taken (devices, count, i, scope, address))
+                break;
+        if (address > ADDRPLAN_ADDR_MAX) {
+            errno = ENOSPC;
+            return -1;
+        }
+        devices[i].final = address;
+    }
+    return 0;
+}
+
+/* Whether a device visible from 'self' currently answers at 'address'.
+ */
+static bool
+address_occupied (addrplan_device_t *devices,
+                  uint8_t *current,
+                  size_t count,
+                  size_t self,
+                  uint8_t address)
+{
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i)
+        if (i != self && current[i] == address &&
+            topo_visible (&devices[self].target, &devices[i].target))
+            return true;
+    return false;
+}
+
+static bool
+same_segment (const topo_target_t *a, const topo_target_t *b)
+{
+    return strcmp (a->bus_dev, b->bus_dev) == 0 &&
+           a->mux == b->mux && a->channel == b->channel;
+}
+
+/* Plan the re-addressing of 'devices'. The devices are sorted by adapter,
+ * mux, channel and address first, step device indexes refer to the sorted
+ * list. 'steps' must hold ADDRPLAN_STEPS_MAX entries. Fails with ENOTUNIQ if
+ * two devices can't be told apart, EADDRINUSE if two requested addresses
+ * clash and ENOSPC if the address range is exhausted.
+ */
+int
+addrplan_make (addrplan_device_t *devices,
+               size_t count,
+               addrplan_scope_t scope,
+               addrplan_step_t *steps,
+               size_t *step_count)
+{
+    uint8_t current[ADDRPLAN_DEVICES_MAX] = { 0 };
+    const topo_target_t *last = NULL;
+    size_t pending = 0;
+    size_t next = 0;
+    size_t i = 0;
+    size_t j = 0;
+    uint8_t spare = 0;
+
+    *step_count = 0;
+    if (count > ADDRPLAN_DEVICES_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+    qsort (devices, count, sizeof (*devices), device_compare);
+    for (i = 0; i < count; ++i) {
+        for (j = i + 1; j < count; ++j) {
+            if (devices[i].target.address == devices[j].target.address &&
+                topo_visible (&devices[i].target, &devices[j].target)) {
+                errno = ENOTUNIQ;
+                return -1;
+            }
+        }
+    }
+    if (assign (devices, count, scope))
+        return -1;
+    for (i = 0; i < count; ++i) {
+        current[i] = devices[i].target.address;
+        if (current[i] != devices[i].final)
+            ++pending;
+    }
+    while (pending > 0) {
+        /* a device that can move now, preferring the segment of the last
+         * step so the mux isn't switched back and forth */
+        next = count;
+        for (i = 0; i < count; ++i) {
+            if (current[i] == devices[i].final ||
+                address_occupied (devices, current, count, i,
+                                  devices[i].final))
+                continue;
+            if (next == count)
+                next = i;
+            if (last != NULL && same_segment (last, &devices[i].target)) {
+                next = i;
+                break;
+            }
+        }
+        if (*step_count == ADDRPLAN_STEPS_MAX) {
+            errno = E2BIG;
+            return -1;
+        }
+        if (next != count) {
+            steps[*step_count] = (addrplan_step_t) {
+                .device = next,
+                .from   = current[next],
+                .to     = devices[next].final,
+                .commit = true,
+            };
+            current[next] = devices[next].final;
+            --pending;
+        } else {
+            /* every pending device waits on another one: a cycle, park the
+             * first one on a spare address */
+            for (next = 0; current[next] == devices[next].final; ++next)
+                ;
+            for (spare = ADDRPLAN_ADDR_MIN; spare <= ADDRPLAN_ADDR_MAX; ++spare)
+                if (spare != current[next] &&
+                    !address_occupied (devices, current, count, next, spare))
+                    break;
+            if (spare > ADDRPLAN_ADDR_MAX) {
+                errno = ENOSPC;
+                return -1;
+            }
+            steps[*step_count] = (addrplan_step_t) {
+                .device = next,
+                .from   = current[next],
+                .to     = spare,
+                .commit = false,
+            };
+            current[next] = spare;
+        }
+        last = &devices[next].target;
+        ++*step_count;
+    }
+    return 0;
+}
+
+/* Read the BUS register of the device at 'fd' and check it answers at
+ * 'address'.
+ */
+static int
+bus_verify (int fd, uint8_t address, bool wc)
+{
+    int32_t ret = 0;
+
+    ret = xfer_read_byte (fd, COMMAND_BUS);
+    if (ret == -1)
+        return -1;
+    if (ADDRESS_UNPACK (ret) != address || WC_UNPACK (ret) != wc) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* The rest of a step once the device answers at its new address on 'fd':
+ * verify it there and, on the last step, commit the address to EEPROM.
+ */
+static int
+addrplan_settle (int fd,
+                 addrplan_device_t *device,
+                 const addrplan_step_t *step,
+                 ds1077l_bus_t *bus)
+{
+    if (bus_verify (fd, step->to, true))
+        return -1;
+    if (!step->commit)
+        return 0;
+    if (device->wc) {
+        if (xfer_command (fd, COMMAND_E2_WRITE) == -1)
+            return -1;
+    } else {
+        bus->wc = false;
+        if (xfer_write_byte (fd, COMMAND_BUS, BUS_PACK (bus)) == -1)
+            return -1;
+    }
+    if (bus_verify (fd, step->to, device->wc))
+        return -1;
+    device->committed = true;
+    return 0;
+}
+
+/* Carry out one step of a plan. The device is moved with WC set so the
+ * address only changes in SRAM, then verified at its new address. On the
+ * last step the address is committed to EEPROM, either through E2_WRITE or,
+ * if the device had WC clear, by clearing WC again which writes the EEPROM
+ * by itself. Either way it's a single EEPROM write.
+ */
+int
+addrplan_move (addrplan_device_t *device, const addrplan_step_t *step)
+{
+    topo_target_t *target = &device->target;
+    ds1077l_bus_t bus = { 0 };
+    int32_t ret = 0;
+    int fd = 0;
+
+    fd = pool_get (target->bus_dev, target->mux, target->channel, step->from);
+    if (fd == -1)
+        return -1;
+    ret = xfer_read_byte (fd, COMMAND_BUS);
+    if (ret != -1) {
+        if (!device->moved) {
+            device->wc = WC_UNPACK (ret);
+            device->moved = true;
+        }
+        bus.address = step->to;
+        bus.wc = true;
+        ret = xfer_write_byte (fd, COMMAND_BUS, BUS_PACK ((&bus)));
+    }
+    pool_put (fd);
+    if (ret == -1)
+        return -1;
+    fd = pool_get (target->bus_dev, target->mux, target->channel, step->to);
+    if (fd == -1)
+        return -1;
+    ret = addrplan_settle (fd, device, step, &bus);
+    pool_put (fd);
+    return ret;
+}
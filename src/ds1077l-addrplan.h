@@ -0,0 +1,61 @@
+#ifndef _DS1077L_ADDRPLAN_H_
+#define _DS1077L_ADDRPLAN_H_
+
+#include "ds1077l-topo.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Address planning for bulk re-addressing.
+ *
+ * Factory-fresh DS1077Ls all answer at 0x58. Giving a board's worth of them
+ * unique addresses is planned up front: every device gets a final address
+ * that's unique in its scope (its segment, i.e. adapter + mux channel, or the
+ * whole adapter) and the moves are ordered so a device never lands on an
+ * address another visible device is still sitting on. Cycles are broken
+ * through a spare address. Devices on the bare adapter are visible from every
+ * mux channel and are planned with all of them.
+ *
+ * Each step moves a device by rewriting the address bits of its BUS register
+ * with WC set, so nothing is written to EEPROM, and verifies the device at
+ * its new address. Only a device's last step commits, so every device sees
+ * exactly one EEPROM write. Steps for different adapters are independent;
+ * steps on one adapter share the wire and are grouped by mux channel.
+ */
+#define ADDRPLAN_ADDR_MIN 0x58
+#define ADDRPLAN_ADDR_MAX 0x5f
+#define ADDRPLAN_DEVICES_MAX 256
+#define ADDRPLAN_STEPS_MAX (2 * ADDRPLAN_DEVICES_MAX)
+
+typedef enum addrplan_scope {
+    SCOPE_SEGMENT = 0,
+    SCOPE_ADAPTER,
+} addrplan_scope_t;
+
+typedef struct addrplan_device {
+    topo_target_t target;       /* target.address is the current address */
+    uint8_t address;            /* requested address, 0 to pick one */
+    uint8_t final;              /* filled in by addrplan_make */
+    bool moved;                 /* filled in by addrplan_move */
+    bool wc;                    /* WC bit found before the first move */
+    bool committed;             /* at its final address in EEPROM */
+} addrplan_device_t;
+
+typedef struct addrplan_step {
+    size_t device;              /* index into the device list */
+    uint8_t from;
+    uint8_t to;
+    bool commit;                /* last step for the device */
+} addrplan_step_t;
+
+int addrplan_parse (const char *arg, addrplan_device_t *device);
+int addrplan_scope_parse (const char *arg, addrplan_scope_t *scope);
+int addrplan_make (addrplan_device_t *devices,
+                   size_t count,
+                   addrplan_scope_t scope,
+                   addrplan_step_t *steps,
+                   size_t *step_count);
+int addrplan_move (addrplan_device_t *device, const addrplan_step_t *step);
+
+#endif // #ifndef _DS1077L_ADDRPLAN_H_
@@ -0,0 +1,448 @@
+#include "ds1077l.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-preset.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct preset_args {
+    ds1077l_common_args_t common_args;
+    char *index;
+    char *compile;
+    char *file;
+    bool list;
+    char *name;
+    transition_band_t band;
+    bool banded;
+    topo_target_t *targets;
+    size_t count;
+    size_t size;
+} preset_args_t;
+
+/* Devices on one adapter, written one after the other by their own thread. */
+typedef struct preset_job {
+    pthread_t thread;
+    const preset_t *preset;
+    const transition_band_t *band;
+    const at_t *at;
+    const char *bus_dev;
+    topo_target_t *targets;
+    preset_staged_t *staged;
+    int64_t *late;              /* ns after --at each device was written */
+    int *errs;
+    size_t count;
+} preset_job_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "index",
+        .key   = 'i',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Compiled preset index. Defaults to $" PRESET_ENV " or "
+                 PRESET_DEFAULT ".",
+        .group = 1
+    },
+    {
+        .name  = "compile",
+        .key   = 'c',
+        .arg   = "TEXT",
+        .flags = 0,
+        .doc   = "Compile the presets in TEXT into the index.",
+        .group = 1
+    },
+    {
+        .name  = "list",
+        .key   = 'l',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "List the presets in the index.",
+        .group = 1
+    },
+    {
+        .name  = "file",
+        .key   = 'f',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Read devices to apply the preset to from FILE, one per "
+                 "line. Lines starting with '#' are ignored.",
+        .group = 1
+    },
+    {
+        .name  = "band",
+        .key   = 'b',
+        .arg   = "MIN-MAX",
+        .flags = 0,
+        .doc   = TRANSITION_BAND_DOC,
+        .group = 1
+    },
+    {
+        .name  = "master-hz",
+        .key   = 'm',
+        .arg   = "HZ",
+        .flags = 0,
+        .doc   = TRANSITION_MASTER_HZ_DOC,
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    {
+        .argp   = &at_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "[NAME [ADAPTER[/MUX/CHANNEL]/ADDRESS...]]",
+    .doc         = "Apply a named preset to Maxim DS1077L programmable "
+                   "oscillators. Without devices it's applied to the one "
+                   "selected by the common options. Adapters are written in "
+                   "parallel.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+/* Make room for one more device in the list, which grows as needed; only
+ * a --at run holds all of their handles at once.
+ */
+static topo_target_t *
+target_next (preset_args_t *args)
+{
+    topo_target_t *targets = NULL;
+    size_t size = args->size == 0 ? 16 : args->size * 2;
+
+    if (args->count == args->size) {
+        targets = realloc (args->targets, size * sizeof (*targets));
+        if (targets == NULL)
+            return NULL;
+        args->targets = targets;
+        args->size = size;
+    }
+    memset (&args->targets[args->count], 0, sizeof (*targets));
+    return &args->targets[args->count];
+}
+
+static int
+target_add (preset_args_t *args, const char *arg)
+{
+    topo_target_t *target = target_next (args);
+
+    if (target == NULL)
+        return -1;
+    if (topo_parse_target (arg, target)) {
+        errno = EINVAL;
+        return -1;
+    }
+    ++args->count;
+    return 0;
+}
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    preset_args_t *args = state->input;
+    char *end = NULL;
+
+    switch (key) {
+        case 'i':
+            args->index = arg;
+            break;
+        case 'c':
+            args->compile = arg;
+            break;
+        case 'l':
+            args->list = true;
+            break;
+        case 'f':
+            args->file = arg;
+            break;
+        case ARGP_KEY_ARG:
+            if (args->name == NULL)
+                args->name = arg;
+            else if (target_add (args, arg))
+                argp_failure (state, 1, errno, "%s", arg);
+            break;
+        case ARGP_KEY_END:
+            if (args->name == NULL && args->compile == NULL && !args->list)
+                argp_usage (state);
+            break;
+        case 'b':
+            if (transition_parse_band (arg, &args->band))
+                argp_failure (state, 1, errno, "--band %s", arg);
+            args->banded = true;
+            break;
+        case 'm':
+            args->band.master_hz = strtoul (arg, &end, 10);
+            if (*end != '\0' || args->band.master_hz == 0)
+                argp_failure (state, 1, EINVAL, "--master-hz %s", arg);
+            break;
+        case ARGP_KEY_INIT:
+            args->band.master_hz = TRANSITION_MASTER_HZ_DEFAULT;
+            args->banded = false;
+            args->index = getenv (PRESET_ENV);
+            if (args->index == NULL)
+                args->index = PRESET_DEFAULT;
+            args->compile = NULL;
+            args->file = NULL;
+            args->list = false;
+            args->name = NULL;
+            state->child_inputs[0] = &(args->common_args);
+            state->child_inputs[1] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Add the devices listed in a file.
+ */
+static int
+preset_load (preset_args_t *args, const char *path)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len = 0;
+    FILE *file = NULL;
+    int ret = 0;
+
+    file = fopen (path, "r");
+    if (file == NULL)
+        return -1;
+    while ((len = getline (&line, &size, file)) != -1) {
+        while (len > 0 && strchr (" \t\r\n", line[len - 1]) != NULL)
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+        ret = target_add (args, line);
+        if (ret) {
+            fprintf (stderr, "%s: %s\n", path, line);
+            break;
+        }
+    }
+    free (line);
+    fclose (file);
+    return ret;
+}
+
+static void
+target_print (FILE *out, const topo_target_t *target)
+{
+    if (target->mux == 0)
+        fprintf (out, "%s/%#x", target->bus_dev, target->address);
+    else
+        fprintf (out, "%s/%#x/%d/%#x", target->bus_dev, target->mux,
+                 target->channel, target->address);
+}
+
+static void
+preset_pretty (const preset_t *preset)
+{
+    printf ("%s:", preset->name);
+    if (preset->regs & PRESET_DIV)
+        printf (" DIV 0x%04x", preset->div);
+    if (preset->regs & PRESET_MUX)
+        printf (" MUX 0x%04x", preset->mux);
+    if (preset->regs & PRESET_BUS)
+        printf (" WC %d", preset->wc ? 1 : 0);
+    printf ("\n");
+}
+
+/* Stage the preset on every device of the job, wait for --at and write
+ * them one after the other. Devices that fail staging are left out.
+ */
+static void
+preset_run_at (preset_job_t *job)
+{
+    struct timespec now = { 0 };
+    int err = 0;
+    size_t i = 0;
+
+    for (i = 0; i < job->count; ++i) {
+        if (strcmp (job->targets[i].bus_dev, job->bus_dev) != 0)
+            continue;
+        job->errs[i] = preset_stage (job->preset, &job->targets[i],
+                                     job->band, &job->staged[i]) ? errno : 0;
+    }
+    err = at_wait (job->at, &now) ? errno : 0;
+    for (i = 0; i < job->count; ++i) {
+        if (strcmp (job->targets[i].bus_dev, job->bus_dev) != 0 ||
+            job->errs[i] != 0)
+            continue;
+        if (err != 0) {
+            preset_cancel (&job->staged[i]);
+            job->errs[i] = err;
+            continue;
+        }
+        clock_gettime (job->at->clock, &now);
+        job->late[i] = at_late_ns (job->at, &now);
+        job->errs[i] = preset_fire (&job->staged[i]) ? errno : 0;
+    }
+}
+
+static void *
+preset_run (void *arg)
+{
+    preset_job_t *job = arg;
+    size_t i = 0;
+
+    if (job->at != NULL) {
+        preset_run_at (job);
+        return NULL;
+    }
+    for (i = 0; i < job->count; ++i) {
+        if (strcmp (job->targets[i].bus_dev, job->bus_dev) != 0)
+            continue;
+        job->errs[i] = preset_apply_band (job->preset, &job->targets[i],
+                                          job->band) ? errno : 0;
+    }
+    return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+    topo_target_t *targets = NULL;
+    preset_staged_t *staged = NULL;
+    int64_t *late = NULL;
+    int *errs = NULL;
+    preset_job_t jobs[XFER_ADAPTERS_MAX] = { 0 };
+    preset_args_t args = { .targets = NULL };
+    ds1077l_common_args_t *common_args = &args.common_args;
+    const preset_t *preset = NULL;
+    size_t job_count = 0;
+    size_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int ret = 0;
+
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    if (args.file != NULL && preset_load (&args, args.file)) {
+        perror ("preset_load: ");
+        exit (1);
+    }
+    if (common_args->verbose)
+        dump_common_opts (common_args);
+    if (args.compile != NULL && preset_compile (args.compile, args.index)) {
+        perror ("preset_compile: ");
+        exit (1);
+    }
+    if (args.name == NULL && !args.list)
+        exit (0);
+    if (preset_open (args.index)) {
+        perror ("preset_open: ");
+        exit (1);
+    }
+    if (args.list) {
+        preset = preset_list (&count);
+        for (i = 0; i < count; ++i)
+            preset_pretty (&preset[i]);
+    }
+    if (args.name == NULL)
+        exit (0);
+    preset = preset_find (args.name);
+    if (preset == NULL) {
+        fprintf (stderr, "No preset named %s.\n", args.name);
+        exit (1);
+    }
+    if (common_args->verbose)
+        preset_pretty (preset);
+    if (args.count == 0) {
+        targets = target_next (&args);
+        if (targets == NULL) {
+            perror ("target_next: ");
+            exit (1);
+        }
+        strncpy (targets[0].bus_dev, common_args->bus_dev,
+                 sizeof (targets[0].bus_dev) - 1);
+        targets[0].mux = common_args->mux;
+        targets[0].channel = common_args->channel;
+        targets[0].address = common_args->address;
+        args.count = 1;
+    }
+    /* staged devices keep their handles from the pool until the deadline */
+    if (common_args->scheduled && args.count > POOL_SIZE) {
+        fprintf (stderr, "--at takes at most %d devices, %zu given.\n",
+                 POOL_SIZE, args.count);
+        exit (1);
+    }
+    targets = args.targets;
+    staged = calloc (args.count, sizeof (*staged));
+    late = calloc (args.count, sizeof (*late));
+    errs = calloc (args.count, sizeof (*errs));
+    if (staged == NULL || late == NULL || errs == NULL) {
+        perror ("calloc: ");
+        exit (1);
+    }
+    /* each mux channel is selected once rather than once per device */
+    topo_sort (targets, args.count);
+    /* one job per adapter, they share nothing */
+    for (i = 0; i < args.count; ++i) {
+        for (j = 0; j < job_count; ++j)
+            if (strcmp (jobs[j].bus_dev, targets[i].bus_dev) == 0)
+                break;
+        if (j < job_count)
+            continue;
+        if (job_count == XFER_ADAPTERS_MAX) {
+            fprintf (stderr, "Too many adapters.\n");
+            exit (1);
+        }
+        jobs[job_count++] = (preset_job_t) {
+            .preset  = preset,
+            .band    = args.banded ? &args.band : NULL,
+            .at      = common_args->scheduled ? &common_args->at : NULL,
+            .bus_dev = targets[i].bus_dev,
+            .targets = targets,
+            .staged  = staged,
+            .late    = late,
+            .errs    = errs,
+            .count   = args.count,
+        };
+    }
+    for (i = 0; i < job_count; ++i) {
+        errno = pthread_create (&jobs[i].thread, NULL, preset_run, &jobs[i]);
+        if (errno != 0) {
+            perror ("pthread_create: ");
+            exit (1);
+        }
+    }
+    for (i = 0; i < job_count; ++i)
+        pthread_join (jobs[i].thread, NULL);
+    for (i = 0; i < args.count; ++i) {
+        if (errs[i] == 0 && !common_args->verbose && !common_args->scheduled)
+            continue;
+        target_print (errs[i] ? stderr : stdout, &targets[i]);
+        if (errs[i] == 0 && common_args->scheduled)
+            printf (": %s issued %+lld ns from the deadline\n", args.name,
+                    (long long)late[i]);
+        else
+            fprintf (errs[i] ? stderr : stdout, ": %s\n",
+                     errs[i] ? strerror (errs[i]) : args.name);
+        if (errs[i])
+            ret = 1;
+    }
+    exit (ret);
+}
@@ -0,0 +1,117 @@
+#include "ds1077l-at.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+static int64_t
+ts_ns (const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static struct timespec
+ns_ts (int64_t ns)
+{
+    return (struct timespec) {
+        .tv_sec  = ns / 1000000000,
+        .tv_nsec = ns % 1000000000,
+    };
+}
+
+/* Parse a deadline, see ds1077l-at.h. Returns 0 or -1 with errno set.
+ */
+int
+at_parse (const char *arg, at_t *at)
+{
+    struct timespec now = { 0 };
+    bool relative = false;
+    int64_t seconds = 0;
+    int64_t ns = 0;
+    int digits = 0;
+
+    at->clock = CLOCK_REALTIME;
+    if (strncmp (arg, "tai:", 4) == 0) {
+        at->clock = CLOCK_TAI;
+        arg += 4;
+    } else if (strncmp (arg, "realtime:", 9) == 0) {
+        arg += 9;
+    }
+    if (*arg == '+') {
+        relative = true;
+        ++arg;
+    }
+    if (!isdigit ((unsigned char)*arg))
+        goto err_inval;
+    for (; isdigit ((unsigned char)*arg); ++arg) {
+        seconds = seconds * 10 + (*arg - '0');
+        if (seconds > INT32_MAX * 4ll)
+            goto err_inval;
+    }
+    if (*arg == '.')
+        for (++arg; isdigit ((unsigned char)*arg); ++arg, ++digits)
+            if (digits < 9)
+                ns = ns * 10 + (*arg - '0');
+    if (*arg != '\0')
+        goto err_inval;
+    for (; digits < 9; ++digits)
+        ns *= 10;
+    ns += seconds * 1000000000;
+    if (relative) {
+        if (clock_gettime (at->clock, &now))
+            return -1;
+        ns += ts_ns (&now);
+    }
+    at->deadline = ns_ts (ns);
+    return 0;
+err_inval:
+    errno = EINVAL;
+    return -1;
+}
+
+const char *
+at_clock_name (const at_t *at)
+{
+    return at->clock == CLOCK_TAI ? "tai" : "realtime";
+}
+
+/* Wait for the deadline and store the time it was left at in 'issued'.
+ * Returns 0 or -1 with errno set, ETIME if the deadline was already past.
+ */
+int
+at_wait (const at_t *at, struct timespec *issued)
+{
+    struct timespec wake = { 0 };
+    int64_t deadline = ts_ns (&at->deadline);
+    int err = 0;
+
+    if (clock_gettime (at->clock, issued))
+        return -1;
+    if (ts_ns (issued) > deadline) {
+        errno = ETIME;
+        return -1;
+    }
+    if (deadline - ts_ns (issued) > AT_SPIN_NS) {
+        wake = ns_ts (deadline - AT_SPIN_NS);
+        /* it returns the error rather than setting errno */
+        while ((err = clock_nanosleep (at->clock, TIMER_ABSTIME, &wake,
+                                       NULL)) == EINTR)
+            ;
+        if (err != 0) {
+            errno = err;
+            return -1;
+        }
+    }
+    do {
+        clock_gettime (at->clock, issued);
+    } while (ts_ns (issued) < deadline);
+    return 0;
+}
+
+/* How long after the deadline 'issued' is, in ns. */
+int64_t
+at_late_ns (const at_t *at, const struct timespec *issued)
+{
+    return ts_ns (issued) - ts_ns (&at->deadline);
+}
@@ -0,0 +1,35 @@
+#ifndef _DS1077L_AT_H_
+#define _DS1077L_AT_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* Writes issued at an agreed instant.
+ *
+ * --at takes a deadline as [tai:|realtime:]SECONDS[.FRACTION] since the
+ * epoch of that clock, CLOCK_REALTIME if none is named, or as +SECONDS to
+ * count from now. Hosts whose clocks are disciplined by PTP agree on
+ * CLOCK_TAI to well below a bus transaction, without the leap second
+ * ambiguity of CLOCK_REALTIME; where nothing sets the kernel's TAI offset
+ * the two are the same.
+ *
+ * Tools do everything that can be done ahead first: the words are packed,
+ * handles opened, the mux channel selected and the device addressed with a
+ * read, and the device lock taken. at_wait then sleeps on the deadline with
+ * clock_nanosleep and TIMER_ABSTIME, up to AT_SPIN_NS before it so that
+ * wake-up latency doesn't count, and spins the rest. A deadline that has
+ * already passed fails with ETIME rather than firing late.
+ */
+#define AT_SPIN_NS 200000
+
+typedef struct at {
+    clockid_t clock;
+    struct timespec deadline;
+} at_t;
+
+int at_parse (const char *arg, at_t *at);
+const char *at_clock_name (const at_t *at);
+int at_wait (const at_t *at, struct timespec *issued);
+int64_t at_late_ns (const at_t *at, const struct timespec *issued);
+
+#endif // #ifndef _DS1077L_AT_H_
@@ -0,0 +1,181 @@
+#include "ds1077l-bulk.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-writee2.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* The operations of one adapter, run one after the other by their own
+ * thread.
+ */
+typedef struct bulk_job {
+    pthread_t thread;
+    bool started;
+    bool write;
+    uint16_t adapter;
+    size_t count;
+    const uint16_t *adapters;
+    const uint8_t *addresses;
+    const uint8_t *commands;
+    uint16_t *words;
+    int *errs;
+} bulk_job_t;
+
+static int
+bulk_one (int fd, bool write, uint8_t command, uint16_t *word)
+{
+    int32_t ret = 0;
+
+    switch (command) {
+        case COMMAND_DIV:
+        case COMMAND_MUX:
+            if (write)
+                return xfer_write_word (fd, command, *word) == -1 ? -1 : 0;
+            ret = xfer_read_word (fd, command);
+            break;
+        case COMMAND_BUS:
+            if (write)
+                return xfer_write_byte (fd, command, *word) == -1 ? -1 : 0;
+            ret = xfer_read_byte (fd, command);
+            break;
+        case COMMAND_E2_WRITE:
+            if (write)
+                return xfer_command (fd, command) == -1 ? -1 : 0;
+            /* fall through */
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    if (ret == -1)
+        return -1;
+    *word = ret;
+    return 0;
+}
+
+/* The handle of one device, taken from the pool on the job's first
+ * operation on it and held until the job is done.
+ */
+typedef struct bulk_pin {
+    bool tried;
+    int fd;
+    int err;
+} bulk_pin_t;
+
+static void *
+bulk_run (void *arg)
+{
+    bulk_job_t *job = arg;
+    bulk_pin_t pins[UINT8_MAX + 1] = { { 0 } };
+    bulk_pin_t *pin = NULL;
+    char bus_dev[32];
+    size_t i = 0;
+
+    snprintf (bus_dev, sizeof (bus_dev), "/dev/i2c-%u", job->adapter);
+    for (i = 0; i < job->count; ++i) {
+        if (job->adapters[i] != job->adapter)
+            continue;
+        /* held, so no other adapter's thread can evict it meanwhile */
+        pin = &pins[job->addresses[i]];
+        if (!pin->tried) {
+            pin->tried = true;
+            pin->fd = pool_get (bus_dev, 0, 0, job->addresses[i]);
+            pin->err = pin->fd == -1 ? errno : 0;
+        }
+        if (pin->fd == -1)
+            job->errs[i] = pin->err;
+        else
+            job->errs[i] = bulk_one (pin->fd, job->write, job->commands[i],
+                                     &job->words[i]) ? errno : 0;
+    }
+    for (i = 0; i <= UINT8_MAX; ++i)
+        if (pins[i].tried)
+            pool_put (pins[i].fd);
+    return NULL;
+}
+
+static int
+bulk (bool write,
+      size_t count,
+      const uint16_t *adapters,
+      const uint8_t *addresses,
+      const uint8_t *commands,
+      uint16_t *words,
+      int *errs)
+{
+    bulk_job_t jobs[XFER_ADAPTERS_MAX];
+    size_t job_count = 0;
+    int failed = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < job_count; ++j)
+            if (jobs[j].adapter == adapters[i])
+                break;
+        if (j < job_count)
+            continue;
+        if (job_count == XFER_ADAPTERS_MAX) {
+            errno = E2BIG;
+            return -1;
+        }
+        jobs[job_count++] = (bulk_job_t) {
+            .write     = write,
+            .adapter   = adapters[i],
+            .count     = count,
+            .adapters  = adapters,
+            .addresses = addresses,
+            .commands  = commands,
+            .words     = words,
+            .errs      = errs,
+        };
+    }
+    /* a single adapter runs on the caller's thread, and so does one whose
+     * thread couldn't be started
+     */
+    for (i = 1; i < job_count; ++i)
+        jobs[i].started = pthread_create (&jobs[i].thread, NULL, bulk_run,
+                                          &jobs[i]) == 0;
+    if (job_count > 0)
+        bulk_run (&jobs[0]);
+    for (i = 1; i < job_count; ++i) {
+        if (jobs[i].started)
+            pthread_join (jobs[i].thread, NULL);
+        else
+            bulk_run (&jobs[i]);
+    }
+    for (i = 0; i < count; ++i)
+        if (errs[i] != 0)
+            ++failed;
+    return failed;
+}
+
+/* Read the registers of a job into 'words'. */
+int
+bulk_read (size_t count,
+           const uint16_t *adapters,
+           const uint8_t *addresses,
+           const uint8_t *commands,
+           uint16_t *words,
+           int *errs)
+{
+    return bulk (false, count, adapters, addresses, commands, words, errs);
+}
+
+/* Write the packed 'words' of a job, nothing for E2_WRITE. */
+int
+bulk_write (size_t count,
+            const uint16_t *adapters,
+            const uint8_t *addresses,
+            const uint8_t *commands,
+            const uint16_t *words,
+            int *errs)
+{
+    /* only ever read from when writing */
+    return bulk (true, count, adapters, addresses, commands,
+                 (uint16_t *)words, errs);
+}
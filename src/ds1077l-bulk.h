@@ -0,0 +1,42 @@
+#ifndef _DS1077L_BULK_H_
+#define _DS1077L_BULK_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bulk register access for language bindings and fleet tools.
+ *
+ * A job is 'count' operations given as parallel arrays: the adapter number
+ * (N of /dev/i2c-N), the device address and the register command of each,
+ * and the packed words to write or room for the words read. BUS is a byte,
+ * DIV and MUX are words, E2_WRITE takes no data and can't be read. Each
+ * operation's errno, or 0, goes to 'errs', so one call does the whole job
+ * and nothing is allocated per operation.
+ *
+ * The operations are grouped by adapter and every adapter gets its own
+ * thread, as in ds1077l-apply-preset, up to XFER_ADAPTERS_MAX of them.
+ * Operations on one adapter run in the order given, so a read after a write
+ * sees it. Devices behind a mux aren't reachable this way. Each device's
+ * handle is taken from the pool once and held for the whole job, so a job
+ * can't touch more than POOL_SIZE devices at once; operations on the rest
+ * fail with EBUSY.
+ *
+ * Both return the number of operations that failed, or -1 with errno set
+ * when the job couldn't be started.
+ */
+int bulk_read (size_t count,
+               const uint16_t *adapters,
+               const uint8_t *addresses,
+               const uint8_t *commands,
+               uint16_t *words,
+               int *errs);
+int bulk_write (size_t count,
+                const uint16_t *adapters,
+                const uint8_t *addresses,
+                const uint8_t *commands,
+                const uint16_t *words,
+                int *errs);
+
+#endif // #ifndef _DS1077L_BULK_H_
@@ -1,5 +1,6 @@
 #include "ds1077l.h"
 #include "ds1077l-bus.h"
+#include "ds1077l-probe.h"
 
 #include <argp.h>
 #include <linux/i2c-dev.h>
@@ -66,6 +67,12 @@ const struct argp_child argp_children[] = {
         .header = 0,
         .group = 0
     },
+    {
+        .argp = &at_argp,
+        .flags = 0,
+        .header = 0,
+        .group = 0
+    },
     { 0 }
 };
 
@@ -85,13 +92,14 @@ bus_get (int fd, ds1077l_bus_t* bus)
 {
     int ret = 0;
 
-    ret = i2c_smbus_read_byte_data(fd, COMMAND_BUS); 
+    ret = xfer_read_byte (fd, COMMAND_BUS); 
     if (ret == -1)
         return ret;
     /* wc bit is the 4th bit in the first byte */
     bus->wc = WC_UNPACK(ret);
     /* address is 0x58 + low 3 bits in the first byte */
     bus->address = ADDRESS_UNPACK(ret);
+    DS1077L_PROBE3 (bus__decode, ret, bus->address, bus->wc);
     return 0;
 }
 
@@ -105,7 +113,8 @@ bus_set (int fd, ds1077l_bus_t *bus)
     uint8_t bus_packed = 0;
 
     bus_packed = BUS_PACK (bus);
-    ret = i2c_smbus_write_byte_data (fd, COMMAND_BUS, bus_packed);
+    DS1077L_PROBE3 (bus__encode, bus->address, bus->wc, bus_packed);
+    ret = xfer_write_byte (fd, COMMAND_BUS, bus_packed);
     if (ret == -1)
         return ret;
     return 0;
@@ -123,6 +132,28 @@ bus_pretty (ds1077l_bus_t* bus)
     printf("  WC: %s\n", bus->wc ? "true" : "false");
 }
 
+/* Append BUS structure to the output buffer in a machine readable format.
+ */
+static void
+bus_format (fmt_buf_t *out, ds1077l_common_args_t *common_args,
+            ds1077l_bus_t* bus)
+{
+    fmt_record_t record = {
+        .bus_dev   = common_args->bus_dev,
+        .address   = common_args->address,
+        .reg       = "BUS",
+        .raw       = BUS_PACK (bus),
+        .raw_width = 2,
+    };
+    fmt_field_t fields[] = {
+        { .name = "bus_address", .type = FIELD_HEX,  .value = bus->address },
+        { .name = "wc",          .type = FIELD_BOOL, .value = bus->wc },
+    };
+
+    fmt_register (out, common_args->format, &record, fields,
+                  sizeof (fields) / sizeof (fields[0]));
+}
+
 static error_t
 parse_opts (int key, char *arg, struct argp_state *state)
 {
@@ -158,6 +189,7 @@ parse_opts (int key, char *arg, struct argp_state *state)
             bus_args->wc = DS1077L_WC_DEFAULT,
             bus_args->wc_set = false,
             state->child_inputs[0] = &(bus_args->common_args);
+            state->child_inputs[1] = &(bus_args->common_args);
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -183,7 +215,10 @@ main (int argc, char *argv[])
     /* argument structure populated with defaults */
     bus_args_t bus_args = {0};
     ds1077l_bus_t bus = {0};
+    struct timespec issued = { 0 };
+    static fmt_buf_t out;
 
+    fmt_init (&out, STDOUT_FILENO);
     if (argp_parse (&argps, argc, argv, 0, NULL, &bus_args)) {
         perror ("argp_parse: \n");
         exit (1);
@@ -196,24 +231,39 @@ main (int argc, char *argv[])
         fprintf (stderr, "--new-addr and --wc make no sense with --get.\n");
         exit (1);
     }
+    if (bus_args.get && bus_args.common_args.scheduled) {
+        fprintf (stderr, "--at only applies to --set.\n");
+        exit (1);
+    }
     if (bus_args.set && ! (bus_args.new_addr_set || bus_args.wc_set)) {
         fprintf(stderr, "Either a new address or a new value for the wc bit must be provided.\n");
         exit (1);
     }
     if (bus_args.common_args.verbose)
         bus_args_dump (&bus_args);
-    fd = handle_get (bus_args.common_args.bus_dev,
-                     bus_args.common_args.address);
+    fd = handle_get_common (&bus_args.common_args);
     if (fd == -1) {
         perror ("handle_get: ");
         exit (1);
     }
+    /* a new address can't be verified by reading it back, hold the lock
+     * from reading the register until it's written */
+    if (bus_args.set && lock_acquire (fd)) {
+        perror ("lock_acquire: ");
+        exit (1);
+    }
     /* get current register state and display to user */
     if (bus_get (fd, &bus)) {
         perror ("bus_set: ");
         exit (1);
     }
-    if (bus_args.common_args.verbose || bus_args.get) {
+    if (bus_args.get && bus_args.common_args.format != FORMAT_HUMAN) {
+        bus_format (&out, &bus_args.common_args, &bus);
+        if (fmt_flush (&out)) {
+            perror ("fmt_flush: ");
+            exit (1);
+        }
+    } else if (bus_args.common_args.verbose || bus_args.get) {
         printf ("Current BUS register state:\n");
         bus_pretty (&bus);
     }
@@ -229,10 +279,21 @@ main (int argc, char *argv[])
                 bus_args.common_args.address, bus_args.common_args.bus_dev);
         bus_pretty (&bus);
     }
+    if (bus_args.common_args.scheduled &&
+        at_wait (&bus_args.common_args.at, &issued)) {
+        perror ("at_wait: ");
+        exit (1);
+    }
     if (bus_set (fd, &bus)) {
         perror ("bus_set: ");
         exit (1);
     }
+    if (bus_args.common_args.scheduled)
+        dump_at (&bus_args.common_args, &issued);
+    if (lock_release (fd)) {
+        perror ("lock_release: ");
+        exit (1);
+    }
     exit (0);
 }
 
@@ -1,3 +1,6 @@
+#ifndef _DS1077L_BUS_H_
+#define _DS1077L_BUS_H_
+
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -34,3 +37,5 @@ typedef struct ds1077l_bus {
     bool wc;
     uint8_t address;
 } ds1077l_bus_t;
+
+#endif // #ifndef _DS1077L_BUS_H_
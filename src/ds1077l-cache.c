@@ -0,0 +1,303 @@
+#include "ds1077l-cache.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-writee2.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+bool cache_on = false;
+static uint64_t ttl_ns = 0;
+static cache_entry_t entries[CACHE_DEVICES_MAX];
+static size_t entry_count = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_stats_t stats = { 0 };
+
+void
+cache_init (unsigned ttl_ms)
+{
+    ttl_ns = (uint64_t)ttl_ms * 1000000;
+    cache_on = ttl_ms > 0;
+}
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Array index of register 'command', -1 for anything else. */
+static int
+cache_index (uint8_t command)
+{
+    switch (command) {
+    case COMMAND_DIV:
+        return 0;
+    case COMMAND_MUX:
+        return 1;
+    case COMMAND_BUS:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+static bool
+entry_match (const cache_entry_t *entry,
+             const xfer_target_t *target,
+             uint8_t address)
+{
+    return entry->adapter == target->adapter && entry->mux == target->mux &&
+           entry->channel == target->channel && entry->address == address;
+}
+
+/* Find the entry of the device 'target' is bound to, adding it if 'create'
+ * is set. When the table is full the entry fetched least recently goes.
+ * Called with cache_lock held.
+ */
+static cache_entry_t *
+entry_find (const xfer_target_t *target, bool create)
+{
+    cache_entry_t *entry = NULL;
+    uint64_t oldest = UINT64_MAX;
+    uint64_t newest = 0;
+    size_t victim = 0;
+    size_t i = 0;
+    int r = 0;
+
+    for (i = 0; i < entry_count; ++i)
+        if (entry_match (&entries[i], target, target->address))
+            return &entries[i];
+    if (!create)
+        return NULL;
+    if (entry_count < CACHE_DEVICES_MAX) {
+        entry = &entries[entry_count++];
+    } else {
+        for (i = 0; i < entry_count; ++i) {
+            newest = 0;
+            for (r = 0; r < CACHE_REGS; ++r)
+                if (entries[i].fetched_ns[r] > newest)
+                    newest = entries[i].fetched_ns[r];
+            if (newest < oldest) {
+                oldest = newest;
+                victim = i;
+            }
+        }
+        entry = &entries[victim];
+    }
+    memset (entry, 0, sizeof (*entry));
+    entry->adapter = target->adapter;
+    entry->mux = target->mux;
+    entry->channel = target->channel;
+    entry->address = target->address;
+    return entry;
+}
+
+/* Answer a read of register 'command' from the cache. Returns 0 and the
+ * register in 'value' on a hit, -1 on a miss.
+ */
+int
+cache_lookup (int fd, uint8_t command, uint16_t *value)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    cache_entry_t *entry = NULL;
+    int index = cache_index (command);
+    int ret = -1;
+
+    if (index == -1 || target == NULL)
+        return -1;
+    pthread_mutex_lock (&cache_lock);
+    entry = entry_find (target, false);
+    if (entry == NULL || !(entry->live_valid & 1 << index)) {
+        ++stats.misses;
+    } else if (now_ns () - entry->fetched_ns[index] >= ttl_ns) {
+        ++stats.misses;
+        ++stats.expired;
+    } else {
+        ++stats.hits;
+        *value = entry->live[index];
+        ret = 0;
+    }
+    pthread_mutex_unlock (&cache_lock);
+    return ret;
+}
+
+/* Record a register read from the device.
+ */
+void
+cache_read (int fd, uint8_t command, uint16_t value)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    cache_entry_t *entry = NULL;
+    int index = cache_index (command);
+
+    if (index == -1 || target == NULL)
+        return;
+    pthread_mutex_lock (&cache_lock);
+    entry = entry_find (target, true);
+    entry->live[index] = value;
+    entry->live_valid |= 1 << index;
+    entry->fetched_ns[index] = now_ns ();
+    pthread_mutex_unlock (&cache_lock);
+}
+
+/* Whatever the EEPROM gets on a commit: all registers we know. */
+static void
+entry_commit (cache_entry_t *entry)
+{
+    memcpy (entry->committed, entry->live, sizeof (entry->committed));
+    entry->committed_valid = entry->live_valid;
+}
+
+/* Move an entry to the device's new address, dropping whatever was cached
+ * for that address. Called with cache_lock held.
+ */
+static cache_entry_t *
+entry_move (cache_entry_t *entry,
+            const xfer_target_t *target,
+            uint8_t address)
+{
+    size_t i = 0;
+
+    for (i = 0; i < entry_count; ++i) {
+        if (&entries[i] == entry || !entry_match (&entries[i], target, address))
+            continue;
+        entries[i] = entries[--entry_count];
+        if (entry == &entries[entry_count])
+            entry = &entries[i];
+        break;
+    }
+    entry->address = address;
+    ++stats.moves;
+    return entry;
+}
+
+/* Record a write of 'value' to register 'command', or E2_WRITE, that
+ * succeeded if 'ok' is set.
+ */
+void
+cache_written (int fd, uint8_t command, uint16_t value, bool ok)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    cache_entry_t *entry = NULL;
+    int index = cache_index (command);
+    bool wc_known = false;
+    bool wc = false;
+
+    if ((index == -1 && command != COMMAND_E2_WRITE) || target == NULL)
+        return;
+    pthread_mutex_lock (&cache_lock);
+    entry = entry_find (target, ok);
+    if (entry == NULL)
+        goto out;
+    if (!ok) {
+        /* it may or may not have happened */
+        if (index == -1)
+            entry->committed_valid = 0;
+        else
+            entry->live_valid &= ~(1 << index);
+        goto out;
+    }
+    if (command == COMMAND_E2_WRITE) {
+        entry_commit (entry);
+        goto out;
+    }
+    entry->live[index] = value;
+    entry->live_valid |= 1 << index;
+    entry->fetched_ns[index] = now_ns ();
+    if (command == COMMAND_BUS) {
+        if (!WC_UNPACK (value))
+            entry_commit (entry);
+        if (ADDRESS_UNPACK (value) != entry->address)
+            entry_move (entry, target, ADDRESS_UNPACK (value));
+        goto out;
+    }
+    wc_known = entry->live_valid & CACHE_BUS;
+    wc = WC_UNPACK (entry->live[2]);
+    if (wc_known && !wc) {
+        entry->committed[index] = value;
+        entry->committed_valid |= 1 << index;
+    } else if (!wc_known) {
+        entry->committed_valid &= ~(1 << index);
+    }
+out:
+    pthread_mutex_unlock (&cache_lock);
+}
+
+/* Forget everything about the device 'fd' is bound to, so the next reads go
+ * to the bus.
+ */
+void
+cache_invalidate (int fd)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    cache_entry_t *entry = NULL;
+
+    if (target == NULL)
+        return;
+    pthread_mutex_lock (&cache_lock);
+    entry = entry_find (target, false);
+    if (entry != NULL) {
+        entry->live_valid = 0;
+        entry->committed_valid = 0;
+    }
+    pthread_mutex_unlock (&cache_lock);
+}
+
+/* Make the next read of register 'command' go to the bus, keeping what we
+ * know about the EEPROM.
+ */
+void
+cache_expire (int fd, uint8_t command)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    cache_entry_t *entry = NULL;
+    int index = cache_index (command);
+
+    if (index == -1 || target == NULL)
+        return;
+    pthread_mutex_lock (&cache_lock);
+    entry = entry_find (target, false);
+    if (entry != NULL)
+        entry->live_valid &= ~(1 << index);
+    pthread_mutex_unlock (&cache_lock);
+}
+
+/* Copy out the entry of the device 'fd' is bound to. Returns -1 with errno
+ * set to ENOENT if there is none.
+ */
+int
+cache_get (int fd, cache_entry_t *out)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    cache_entry_t *entry = NULL;
+
+    if (target == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    pthread_mutex_lock (&cache_lock);
+    entry = entry_find (target, false);
+    if (entry != NULL)
+        *out = *entry;
+    pthread_mutex_unlock (&cache_lock);
+    if (entry == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+void
+cache_stats (cache_stats_t *out)
+{
+    pthread_mutex_lock (&cache_lock);
+    *out = stats;
+    pthread_mutex_unlock (&cache_lock);
+}
@@ -0,0 +1,67 @@
+#ifndef _DS1077L_CACHE_H_
+#define _DS1077L_CACHE_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Register cache.
+ *
+ * With --cache-ttl the transaction layer keeps the last known DIV, MUX and
+ * BUS words of every device it talks to and answers reads from them for up
+ * to the TTL after they were last read or written, so a long running
+ * process doesn't pay a bus transaction for every query. Writes go through
+ * to the device and update the cache; a failed write leaves the register
+ * unknown.
+ *
+ * Besides the live registers the cache tracks what the device's EEPROM
+ * holds, following the DS1077L's rules: with WC clear every register write
+ * is committed, including a BUS write clearing WC, which commits everything;
+ * with WC set only E2_WRITE commits, and it commits all live registers. A
+ * BUS write changing the address moves the entry to the new address.
+ *
+ * The cache is per process. Changes made by other processes go unnoticed
+ * until the TTL runs out, so locked read-modify-write updates (lock_rmw) and
+ * drift checks (xfer_read_regs) always read the device.
+ */
+#define CACHE_DEVICES_MAX XFER_TARGETS_MAX
+
+/* Registers, as bit masks and array indices. */
+#define CACHE_DIV 0x1
+#define CACHE_MUX 0x2
+#define CACHE_BUS 0x4
+#define CACHE_REGS 3
+
+typedef struct cache_entry {
+    uint8_t adapter;
+    uint8_t mux;
+    uint8_t channel;
+    uint8_t address;            /* follows the BUS register */
+    uint8_t live_valid;         /* CACHE_* masks */
+    uint8_t committed_valid;
+    uint16_t live[CACHE_REGS];
+    uint16_t committed[CACHE_REGS];
+    uint64_t fetched_ns[CACHE_REGS];
+} cache_entry_t;
+
+typedef struct cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t expired;           /* misses on entries older than the TTL */
+    uint64_t moves;             /* entries re-keyed by an address change */
+} cache_stats_t;
+
+extern bool cache_on;
+
+void cache_init (unsigned ttl_ms);
+int cache_lookup (int fd, uint8_t command, uint16_t *value);
+void cache_read (int fd, uint8_t command, uint16_t value);
+void cache_written (int fd, uint8_t command, uint16_t value, bool ok);
+void cache_expire (int fd, uint8_t command);
+void cache_invalidate (int fd);
+int cache_get (int fd, cache_entry_t *entry);
+void cache_stats (cache_stats_t *stats);
+
+#endif // #ifndef _DS1077L_CACHE_H_
@@ -1,8 +1,11 @@
 #include "ds1077l-div.h"
+#include "ds1077l-probe.h"
 
 #include <argp.h>
 #include <linux/i2c-dev.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 static error_t parse_opts (int key, char *arg, struct argp_state *state);
 
@@ -41,6 +44,12 @@ const struct argp_child argp_children[] = {
         .header = NULL,
         .group  = 0
     },
+    {
+        .argp   = &at_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
     { 0 }
 };
 
@@ -80,6 +89,7 @@ parse_opts (int key, char *arg, struct argp_state *state)
             div_args->divider = DS1077L_DIV_DEFAULT_UNPACKED;
             div_args->divider_set = false;
             state->child_inputs[0] = &(div_args->common_args);
+            state->child_inputs[1] = &(div_args->common_args);
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -104,10 +114,11 @@ div_get(int fd, ds1077l_div_t* div)
 {
     uint32_t ret = 0;
 
-    ret = i2c_smbus_read_word_data(fd, COMMAND_DIV);
+    ret = xfer_read_word (fd, COMMAND_DIV);
     if (ret == -1)
         return -1;
     div->n = DIV_UNPACK(ret);
+    DS1077L_PROBE2 (div__decode, ret, div->n);
     return 0;
 }
 
@@ -121,7 +132,8 @@ div_set (int fd, ds1077l_div_t *div)
     uint16_t div_packed = 0;
 
     div_packed = DIV_PACK(div->n);
-    ret = i2c_smbus_write_word_data (fd, COMMAND_DIV, div_packed);
+    DS1077L_PROBE2 (div__encode, div->n, div_packed);
+    ret = xfer_write_word (fd, COMMAND_DIV, div_packed);
     if (ret == -1)
         return ret;
     return 0;
@@ -136,6 +148,27 @@ div_pretty (ds1077l_div_t* div)
     printf("  N: %d\n", div->n);
 }
 
+/* Append DIV structure to the output buffer in a machine readable format.
+ */
+static void
+div_format (fmt_buf_t *out, ds1077l_common_args_t *common_args,
+            ds1077l_div_t* div)
+{
+    fmt_record_t record = {
+        .bus_dev   = common_args->bus_dev,
+        .address   = common_args->address,
+        .reg       = "DIV",
+        .raw       = DIV_PACK (div->n),
+        .raw_width = 4,
+    };
+    fmt_field_t fields[] = {
+        { .name = "n", .type = FIELD_UINT, .value = div->n },
+    };
+
+    fmt_register (out, common_args->format, &record, fields,
+                  sizeof (fields) / sizeof (fields[0]));
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -143,7 +176,10 @@ main (int argc, char *argv[])
     /* argument structure populated with defaults */
     div_args_t div_args = { 0 };
     ds1077l_div_t div = {0};
+    struct timespec issued = { 0 };
+    static fmt_buf_t out;
 
+    fmt_init (&out, STDOUT_FILENO);
     if (argp_parse (&argps, argc, argv, 0, NULL, &div_args)) {
         perror ("argp_parse: \n");
         exit (1);
@@ -156,6 +192,10 @@ main (int argc, char *argv[])
         fprintf (stderr, "--divider cannot be provided with --get.\n");
         exit (1);
     }
+    if (div_args.get && div_args.common_args.scheduled) {
+        fprintf (stderr, "--at only applies to --set.\n");
+        exit (1);
+    }
     if (div_args.set && !div_args.divider_set) {
         fprintf (stderr, "Must specificy divider value when setting "
                          "register.\n");
@@ -163,8 +203,7 @@ main (int argc, char *argv[])
     }
     if (div_args.common_args.verbose)
         div_args_dump (&div_args);
-    fd = handle_get (div_args.common_args.bus_dev,
-                     div_args.common_args.address);
+    fd = handle_get_common (&div_args.common_args);
     if (fd == -1) {
         perror ("handle_get: ");
         exit (1);
@@ -177,8 +216,15 @@ main (int argc, char *argv[])
         perror ("div_set: ");
         exit (1);
     }
-    if (div_args.get || div_args.common_args.verbose)
+    if (div_args.get && div_args.common_args.format != FORMAT_HUMAN) {
+        div_format (&out, &div_args.common_args, &div);
+        if (fmt_flush (&out)) {
+            perror ("fmt_flush: ");
+            exit (1);
+        }
+    } else if (div_args.get || div_args.common_args.verbose) {
         div_pretty (&div);
+    }
     if (div_args.get)
         exit (0);
     /* populate new structure, display to user, and make change */
@@ -188,9 +234,17 @@ main (int argc, char *argv[])
                 div_args.common_args.address, div_args.common_args.bus_dev);
         div_pretty (&div);
     }
+    /* the read above left the handle ready for the write */
+    if (div_args.common_args.scheduled &&
+        at_wait (&div_args.common_args.at, &issued)) {
+        perror ("at_wait: ");
+        exit (1);
+    }
     if (div_set (fd, &div)) {
         perror ("div_set: ");
         exit (1);
     }
+    if (div_args.common_args.scheduled)
+        dump_at (&div_args.common_args, &issued);
     exit (1);
 }
@@ -1,3 +1,6 @@
+#ifndef _DS1077L_DIV_H_
+#define _DS1077L_DIV_H_
+
 #include "ds1077l.h"
 
 #include <stdbool.h>
@@ -46,3 +49,5 @@ typedef struct div_args {
     uint16_t divider;
     bool divider_set;
 } div_args_t;
+
+#endif // #ifndef _DS1077L_DIV_H_
@@ -0,0 +1,292 @@
+#include "ds1077l-fmt.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Map the argument to --format to a ds1077l_format_t.
+ * Returns 0 on success, -1 if the format is unknown.
+ */
+int
+format_parse (const char *arg, ds1077l_format_t *format)
+{
+    if (strcmp (arg, "human") == 0)
+        *format = FORMAT_HUMAN;
+    else if (strcmp (arg, "json") == 0)
+        *format = FORMAT_JSON;
+    else if (strcmp (arg, "kv") == 0)
+        *format = FORMAT_KV;
+    else if (strcmp (arg, "raw") == 0)
+        *format = FORMAT_RAW;
+    else
+        return -1;
+    return 0;
+}
+
+const char *
+format_name (ds1077l_format_t format)
+{
+    switch (format) {
+    case FORMAT_HUMAN:
+        return "human";
+    case FORMAT_JSON:
+        return "json";
+    case FORMAT_KV:
+        return "kv";
+    case FORMAT_RAW:
+        return "raw";
+    }
+    return "unknown";
+}
+
+void
+fmt_init (fmt_buf_t *buf, int fd)
+{
+    buf->fd = fd;
+    buf->err = 0;
+    buf->len = 0;
+}
+
+static int
+fmt_write (fmt_buf_t *buf)
+{
+    size_t done = 0;
+    ssize_t ret = 0;
+
+    while (done < buf->len) {
+        ret = write (buf->fd, buf->data + done, buf->len - done);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            buf->len = 0;
+            return -1;
+        }
+        done += ret;
+    }
+    buf->len = 0;
+    return 0;
+}
+
+/* Write the buffered output to the file descriptor the buffer was initialized
+ * with. Returns 0 on success, -1 with errno set otherwise, including for a
+ * write that failed earlier while appending.
+ */
+int
+fmt_flush (fmt_buf_t *buf)
+{
+    if (buf->err != 0) {
+        errno = buf->err;
+        buf->err = 0;
+        buf->len = 0;
+        return -1;
+    }
+    return fmt_write (buf);
+}
+
+/* Make room for at least 'size' bytes, flushing if necessary. Returns false
+ * if nothing may be appended because a write failed.
+ */
+static inline bool
+fmt_reserve (fmt_buf_t *buf, size_t size)
+{
+    if (buf->err != 0)
+        return false;
+    if (buf->len + size > FMT_BUF_SIZE && fmt_write (buf)) {
+        buf->err = errno;
+        return false;
+    }
+    return true;
+}
+
+static inline void
+fmt_char (fmt_buf_t *buf, char c)
+{
+    if (fmt_reserve (buf, 1))
+        buf->data[buf->len++] = c;
+}
+
+void
+fmt_str (fmt_buf_t *buf, const char *str)
+{
+    size_t len = strlen (str);
+    size_t chunk = 0;
+
+    while (len > 0) {
+        if (!fmt_reserve (buf, len < FMT_BUF_SIZE ? len : FMT_BUF_SIZE))
+            return;
+        chunk = FMT_BUF_SIZE - buf->len;
+        if (chunk > len)
+            chunk = len;
+        memcpy (buf->data + buf->len, str, chunk);
+        buf->len += chunk;
+        str += chunk;
+        len -= chunk;
+    }
+}
+
+/* Append a string as the body of a JSON string literal.
+ */
+static void
+fmt_json_str (fmt_buf_t *buf, const char *str)
+{
+    for (; *str != '\0'; ++str) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\') {
+            fmt_char (buf, '\\');
+            fmt_char (buf, c);
+        } else if (c < 0x20) {
+            fmt_str (buf, "\\u00");
+            fmt_char (buf, hex_digits[c >> 4]);
+            fmt_char (buf, hex_digits[c & 0xf]);
+        } else {
+            fmt_char (buf, c);
+        }
+    }
+}
+
+void
+fmt_uint (fmt_buf_t *buf, uint32_t value)
+{
+    char tmp[10];
+    size_t i = sizeof (tmp);
+
+    do {
+        tmp[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    if (!fmt_reserve (buf, sizeof (tmp) - i))
+        return;
+    memcpy (buf->data + buf->len, tmp + i, sizeof (tmp) - i);
+    buf->len += sizeof (tmp) - i;
+}
+
+/* Append value as a 0x prefixed hex number padded to 'width' digits.
+ */
+void
+fmt_hex (fmt_buf_t *buf, uint32_t value, unsigned width)
+{
+    unsigned digits = 1;
+
+    while (digits < 8 && (value >> (digits * 4)) != 0)
+        ++digits;
+    if (width > digits)
+        digits = width;
+    if (!fmt_reserve (buf, digits + 2))
+        return;
+    buf->data[buf->len++] = '0';
+    buf->data[buf->len++] = 'x';
+    while (digits-- > 0)
+        buf->data[buf->len++] = hex_digits[(value >> (digits * 4)) & 0xf];
+}
+
+static void
+fmt_value (fmt_buf_t *buf, ds1077l_format_t format, const fmt_field_t *field)
+{
+    switch (field->type) {
+    case FIELD_BOOL:
+        if (format == FORMAT_JSON)
+            fmt_str (buf, field->value ? "true" : "false");
+        else
+            fmt_char (buf, field->value ? '1' : '0');
+        break;
+    case FIELD_UINT:
+        fmt_uint (buf, field->value);
+        break;
+    case FIELD_HEX:
+        if (format == FORMAT_JSON)
+            fmt_char (buf, '"');
+        fmt_hex (buf, field->value, 2);
+        if (format == FORMAT_JSON)
+            fmt_char (buf, '"');
+        break;
+    }
+}
+
+static void
+fmt_json (fmt_buf_t *buf,
+          const fmt_record_t *record,
+          const fmt_field_t *fields,
+          size_t count)
+{
+    size_t i = 0;
+
+    fmt_str (buf, "{\"bus_dev\":\"");
+    fmt_json_str (buf, record->bus_dev);
+    fmt_str (buf, "\",\"address\":\"");
+    fmt_hex (buf, record->address, 2);
+    fmt_str (buf, "\",\"register\":\"");
+    fmt_str (buf, record->reg);
+    fmt_char (buf, '"');
+    if (record->raw_width > 0) {
+        fmt_str (buf, ",\"raw\":\"");
+        fmt_hex (buf, record->raw, record->raw_width);
+        fmt_char (buf, '"');
+    }
+    for (i = 0; i < count; ++i) {
+        fmt_str (buf, ",\"");
+        fmt_str (buf, fields[i].name);
+        fmt_str (buf, "\":");
+        fmt_value (buf, FORMAT_JSON, &fields[i]);
+    }
+    fmt_str (buf, "}\n");
+}
+
+static void
+fmt_kv (fmt_buf_t *buf,
+        const fmt_record_t *record,
+        const fmt_field_t *fields,
+        size_t count)
+{
+    size_t i = 0;
+
+    fmt_str (buf, "bus_dev=");
+    fmt_str (buf, record->bus_dev);
+    fmt_str (buf, " address=");
+    fmt_hex (buf, record->address, 2);
+    fmt_str (buf, " register=");
+    fmt_str (buf, record->reg);
+    if (record->raw_width > 0) {
+        fmt_str (buf, " raw=");
+        fmt_hex (buf, record->raw, record->raw_width);
+    }
+    for (i = 0; i < count; ++i) {
+        fmt_char (buf, ' ');
+        fmt_str (buf, fields[i].name);
+        fmt_char (buf, '=');
+        fmt_value (buf, FORMAT_KV, &fields[i]);
+    }
+    fmt_char (buf, '\n');
+}
+
+/* Append one record describing a register to the output buffer in the
+ * requested machine readable format. FORMAT_HUMAN is handled by the
+ * *_pretty functions in each utility and is ignored here.
+ */
+void
+fmt_register (fmt_buf_t *buf,
+              ds1077l_format_t format,
+              const fmt_record_t *record,
+              const fmt_field_t *fields,
+              size_t count)
+{
+    switch (format) {
+    case FORMAT_JSON:
+        fmt_json (buf, record, fields, count);
+        break;
+    case FORMAT_KV:
+        fmt_kv (buf, record, fields, count);
+        break;
+    case FORMAT_RAW:
+        if (record->raw_width == 0)
+            break;
+        fmt_hex (buf, record->raw, record->raw_width);
+        fmt_char (buf, '\n');
+        break;
+    case FORMAT_HUMAN:
+        break;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef _DS1077L_FMT_H_
+#define _DS1077L_FMT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Output formats understood by the --format option. FORMAT_HUMAN is the
+ * indented text produced by the *_pretty functions, everything else is meant
+ * for machines and is produced through a fmt_buf_t.
+ */
+typedef enum ds1077l_format {
+    FORMAT_HUMAN = 0,
+    FORMAT_JSON,
+    FORMAT_KV,
+    FORMAT_RAW,
+} ds1077l_format_t;
+
+/* Size of the output buffer. A single record is well under 256 bytes so this
+ * holds a few hundred devices worth of output between write calls.
+ */
+#define FMT_BUF_SIZE 65536
+
+/* Single preallocated output buffer. Records are appended with the fmt_*
+ * functions below and only handed to the kernel when the buffer fills up or
+ * fmt_flush is called. A write failing while appending is kept in 'err',
+ * nothing more is appended and the next fmt_flush returns it. A failed
+ * fmt_flush drops whatever was buffered, so the buffer can be used again.
+ */
+typedef struct fmt_buf {
+    int fd;
+    int err;
+    size_t len;
+    char data[FMT_BUF_SIZE];
+} fmt_buf_t;
+
+typedef enum fmt_type {
+    FIELD_BOOL,
+    FIELD_UINT,
+    FIELD_HEX,
+} fmt_type_t;
+
+/* One decoded register field. The name is used verbatim as the JSON key or
+ * the left hand side of a key=value pair.
+ */
+typedef struct fmt_field {
+    const char *name;
+    fmt_type_t type;
+    uint32_t value;
+} fmt_field_t;
+
+/* Identifies the device and register a record describes. raw_width is the
+ * number of hex digits used to print the packed register word, 0 when there
+ * is no register word to print.
+ */
+typedef struct fmt_record {
+    const char *bus_dev;
+    uint8_t address;
+    const char *reg;
+    uint16_t raw;
+    uint8_t raw_width;
+} fmt_record_t;
+
+int format_parse (const char *arg, ds1077l_format_t *format);
+const char *format_name (ds1077l_format_t format);
+void fmt_init (fmt_buf_t *buf, int fd);
+int fmt_flush (fmt_buf_t *buf);
+void fmt_str (fmt_buf_t *buf, const char *str);
+void fmt_uint (fmt_buf_t *buf, uint32_t value);
+void fmt_hex (fmt_buf_t *buf, uint32_t value, unsigned width);
+void fmt_register (fmt_buf_t *buf,
+                   ds1077l_format_t format,
+                   const fmt_record_t *record,
+                   const fmt_field_t *fields,
+                   size_t count);
+
+#endif // #ifndef _DS1077L_FMT_H_
@@ -0,0 +1,342 @@
+#include "ds1077l-inventory.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-xfer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INVENTORY_ADDR_MIN 0x58
+#define INVENTORY_ADDR_MAX 0x5f
+
+static inventory_file_t *inventory = NULL;
+static int inventory_fd = -1;
+/* flock only serializes processes, threads share the open file */
+static pthread_mutex_t inventory_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Map the inventory file, creating it if need be.
+ */
+int
+inventory_open (const char *path)
+{
+    struct stat st;
+    void *map = NULL;
+    int fd = 0;
+
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    if (flock (fd, LOCK_EX))
+        goto err_close;
+    if (fstat (fd, &st))
+        goto err_close;
+    if (st.st_size == 0) {
+        if (ftruncate (fd, sizeof (inventory_file_t)))
+            goto err_close;
+    } else if (st.st_size != sizeof (inventory_file_t)) {
+        errno = EINVAL;
+        goto err_close;
+    }
+    map = mmap (NULL, sizeof (inventory_file_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto err_close;
+    inventory = map;
+    if (st.st_size == 0) {
+        inventory->magic = INVENTORY_MAGIC;
+        inventory->version = INVENTORY_VERSION;
+    }
+    if (inventory->magic != INVENTORY_MAGIC ||
+        inventory->version != INVENTORY_VERSION) {
+        munmap (map, sizeof (inventory_file_t));
+        inventory = NULL;
+        errno = EINVAL;
+        goto err_close;
+    }
+    flock (fd, LOCK_UN);
+    inventory_fd = fd;
+    return 0;
+err_close:
+    close (fd);
+    return -1;
+}
+
+void
+inventory_close (void)
+{
+    if (inventory == NULL)
+        return;
+    munmap (inventory, sizeof (inventory_file_t));
+    close (inventory_fd);
+    inventory = NULL;
+    inventory_fd = -1;
+}
+
+static void
+inventory_lock_file (void)
+{
+    pthread_mutex_lock (&inventory_lock);
+    flock (inventory_fd, LOCK_EX);
+}
+
+static void
+inventory_unlock_file (void)
+{
+    flock (inventory_fd, LOCK_UN);
+    pthread_mutex_unlock (&inventory_lock);
+}
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Copy out up to 'max' devices. Returns the number copied.
+ */
+size_t
+inventory_list (inventory_device_t *devices, size_t max)
+{
+    size_t count = 0;
+
+    if (inventory == NULL)
+        return 0;
+    inventory_lock_file ();
+    count = inventory->count < max ? inventory->count : max;
+    memcpy (devices, inventory->devices, count * sizeof (*devices));
+    inventory_unlock_file ();
+    return count;
+}
+
+/* Name of the adapter behind 'bus_dev' as the kernel reports it, e.g.
+ * "i2c-tiny-usb at bus 001 device 004". Empty if it isn't known.
+ */
+static void
+adapter_name (const char *bus_dev, char *name, size_t size)
+{
+    const char *node = strrchr (bus_dev, '/');
+    char path[96];
+    ssize_t len = 0;
+    int fd = 0;
+
+    name[0] = '\0';
+    node = node == NULL ? bus_dev : node + 1;
+    snprintf (path, sizeof (path), "/sys/class/i2c-dev/%.31s/name", node);
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    len = read (fd, name, size - 1);
+    close (fd);
+    if (len < 0)
+        len = 0;
+    while (len > 0 && name[len - 1] == '\n')
+        --len;
+    name[len] = '\0';
+}
+
+/* Whether a failed probe means nobody answered rather than trouble with the
+ * adapter itself.
+ */
+static bool
+probe_absent (int err)
+{
+    switch (err) {
+    case ENXIO:
+    case EREMOTEIO:
+    case ETIMEDOUT:
+    case EIO:
+    case EHOSTDOWN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Read the registers of the device at 'address', if there is one. Returns 1
+ * if it answered, 0 if not and -1 with errno set if the adapter failed.
+ */
+static int
+probe (const char *bus_dev, uint8_t address, inventory_device_t *device)
+{
+    int32_t bus = 0;
+    int32_t div = 0;
+    int32_t mux = 0;
+    int fd = 0;
+
+    fd = pool_get (bus_dev, 0, 0, address);
+    if (fd == -1)
+        return -1;
+    if ((bus = xfer_read_byte (fd, COMMAND_BUS)) == -1 ||
+        (div = xfer_read_word (fd, COMMAND_DIV)) == -1 ||
+        (mux = xfer_read_word (fd, COMMAND_MUX)) == -1) {
+        pool_put (fd);
+        return probe_absent (errno) ? 0 : -1;
+    }
+    pool_put (fd);
+    /* something else living at this address won't know its own BUS */
+    if (ADDRESS_UNPACK (bus) != address)
+        return 0;
+    memset (device, 0, sizeof (*device));
+    snprintf (device->target.bus_dev, sizeof (device->target.bus_dev), "%s",
+              bus_dev);
+    device->target.address = address;
+    device->div = div;
+    device->mux = mux;
+    device->bus = bus;
+    device->seen_ns = now_ns ();
+    return 1;
+}
+
+/* Drop the devices on 'bus_dev', only those on the bare adapter if
+ * 'bare_only' is set. Called with the file locked, returns the number
+ * dropped.
+ */
+static size_t
+inventory_drop (const char *bus_dev, bool bare_only)
+{
+    inventory_device_t *device = NULL;
+    size_t dropped = 0;
+    uint32_t i = 0;
+
+    while (i < inventory->count) {
+        device = &inventory->devices[i];
+        if (strcmp (device->target.bus_dev, bus_dev) != 0 ||
+            (bare_only && device->target.mux != 0)) {
+            ++i;
+            continue;
+        }
+        *device = inventory->devices[--inventory->count];
+        ++dropped;
+    }
+    return dropped;
+}
+
+static int
+device_compare (const void *a, const void *b)
+{
+    return topo_compare (&((const inventory_device_t *)a)->target,
+                         &((const inventory_device_t *)b)->target);
+}
+
+/* Probe every DS1077L address on the bare adapter 'bus_dev' and replace what
+ * the inventory knows about it with the result. The number of devices found
+ * goes to 'found'. Returns 0 or -1 with errno set.
+ */
+int
+inventory_scan (const char *bus_dev, size_t *found)
+{
+    inventory_device_t probed[INVENTORY_ADDR_MAX - INVENTORY_ADDR_MIN + 1];
+    char name[INVENTORY_NAME_MAX];
+    size_t count = 0;
+    size_t i = 0;
+    int address = 0;
+    int ret = 0;
+
+    if (inventory == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    adapter_name (bus_dev, name, sizeof (name));
+    for (address = INVENTORY_ADDR_MIN; address <= INVENTORY_ADDR_MAX;
+         ++address) {
+        ret = probe (bus_dev, address, &probed[count]);
+        if (ret == -1)
+            return -1;
+        if (ret == 1)
+            memcpy (probed[count++].adapter_name, name, sizeof (name));
+    }
+    inventory_lock_file ();
+    inventory_drop (bus_dev, true);
+    if (inventory->count + count > INVENTORY_DEVICES_MAX) {
+        inventory_unlock_file ();
+        errno = ENOSPC;
+        return -1;
+    }
+    for (i = 0; i < count; ++i)
+        inventory->devices[inventory->count++] = probed[i];
+    /* listed in bus order */
+    qsort (inventory->devices, inventory->count, sizeof (inventory_device_t),
+           device_compare);
+    inventory_unlock_file ();
+    if (found != NULL)
+        *found = count;
+    return 0;
+}
+
+/* Drop everything on the adapter 'bus_dev', which went away. The number of
+ * devices dropped goes to 'removed'.
+ */
+int
+inventory_forget (const char *bus_dev, size_t *removed)
+{
+    size_t dropped = 0;
+
+    if (inventory == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    inventory_lock_file ();
+    dropped = inventory_drop (bus_dev, false);
+    inventory_unlock_file ();
+    if (removed != NULL)
+        *removed = dropped;
+    return 0;
+}
+
+/* Pick adapters coming and going out of a kernel uevent: a header like
+ * "add@/devices/.../i2c-dev/i2c-3" followed by NUL separated KEY=VALUE
+ * pairs, of which ACTION, SUBSYSTEM and DEVNAME matter. Returns 0 for an
+ * i2c-dev node being added or removed, -1 for anything else.
+ */
+int
+inventory_uevent_parse (const char *buf,
+                        size_t len,
+                        inventory_event_t *event)
+{
+    const char *action = NULL;
+    const char *subsystem = NULL;
+    const char *devname = NULL;
+    const char *end = buf + len;
+    const char *p = buf;
+
+    /* every pair is NUL terminated, so must the message be */
+    if (len == 0 || buf[len - 1] != '\0')
+        return -1;
+    while (p < end) {
+        if (strncmp (p, "ACTION=", 7) == 0)
+            action = p + 7;
+        else if (strncmp (p, "SUBSYSTEM=", 10) == 0)
+            subsystem = p + 10;
+        else if (strncmp (p, "DEVNAME=", 8) == 0)
+            devname = p + 8;
+        p += strlen (p) + 1;
+    }
+    if (action == NULL || subsystem == NULL || devname == NULL ||
+        strcmp (subsystem, "i2c-dev") != 0)
+        return -1;
+    if (strcmp (action, "add") == 0)
+        event->action = INVENTORY_ADD;
+    else if (strcmp (action, "remove") == 0)
+        event->action = INVENTORY_REMOVE;
+    else
+        return -1;
+    if (strchr (devname, '/') != NULL ||
+        snprintf (event->bus_dev, sizeof (event->bus_dev), "/dev/%s",
+                  devname) >= (int)sizeof (event->bus_dev))
+        return -1;
+    return 0;
+}
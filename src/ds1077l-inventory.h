@@ -0,0 +1,68 @@
+#ifndef _DS1077L_INVENTORY_H_
+#define _DS1077L_INVENTORY_H_
+
+#include "ds1077l-topo.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Device inventory.
+ *
+ * Finding the DS1077Ls in a system means probing all eight addresses on
+ * every adapter, which is slow with adapters on USB bridges and needs to be
+ * redone when adapters come and go. The inventory keeps the result in a
+ * file shared by all processes: every device found with the adapter it sits
+ * on, the adapter's name in sysfs and the register image read when it was
+ * last probed. Tools start from the file instead of scanning, and adapters
+ * are rescanned one at a time as they appear, or forgotten as they
+ * disappear, driven by ds1077l-scan --watch listening to kernel uevents.
+ *
+ * Scanning probes the bare adapter only. Devices behind a mux can't be found
+ * that way; they are kept across rescans and dropped with their adapter.
+ */
+#define INVENTORY_ENV         "DS1077L_INVENTORY"
+#define INVENTORY_DEFAULT     "/var/lib/ds1077l/inventory"
+#define INVENTORY_MAGIC       0x564e495737373031ull
+#define INVENTORY_VERSION     1
+#define INVENTORY_DEVICES_MAX 256
+#define INVENTORY_NAME_MAX    48
+
+typedef struct inventory_device {
+    topo_target_t target;
+    char adapter_name[INVENTORY_NAME_MAX];  /* as in sysfs, "" if unknown */
+    uint16_t div;
+    uint16_t mux;
+    uint8_t bus;
+    uint8_t reserved[3];
+    uint64_t seen_ns;           /* CLOCK_REALTIME of the last probe */
+} inventory_device_t;
+
+typedef struct inventory_file {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+    inventory_device_t devices[INVENTORY_DEVICES_MAX];
+} inventory_file_t;
+
+typedef enum inventory_action {
+    INVENTORY_ADD,
+    INVENTORY_REMOVE,
+} inventory_action_t;
+
+/* An adapter coming or going, as parsed from a uevent. */
+typedef struct inventory_event {
+    inventory_action_t action;
+    char bus_dev[32];
+} inventory_event_t;
+
+int inventory_open (const char *path);
+void inventory_close (void);
+size_t inventory_list (inventory_device_t *devices, size_t max);
+int inventory_scan (const char *bus_dev, size_t *found);
+int inventory_forget (const char *bus_dev, size_t *removed);
+int inventory_uevent_parse (const char *buf,
+                            size_t len,
+                            inventory_event_t *event);
+
+#endif // #ifndef _DS1077L_INVENTORY_H_
@@ -0,0 +1,311 @@
+/* F_OFD_SETLK and friends */
+#define _GNU_SOURCE
+
+#include "ds1077l-lock.h"
+#include "ds1077l-cache.h"
+#include "ds1077l-probe.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-xfer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *lock_path = LOCK_FILE_DEFAULT;
+static lock_mode_t lock_mode = LOCK_EXCLUSIVE;
+/* opened on first use, one per thread so OFD locks exclude threads too */
+static __thread int lock_fd = -1;
+static lock_stats_t stats = { 0 };
+
+int
+lock_mode_parse (const char *arg, lock_mode_t *mode)
+{
+    if (strcmp (arg, "exclusive") == 0)
+        *mode = LOCK_EXCLUSIVE;
+    else if (strcmp (arg, "optimistic") == 0)
+        *mode = LOCK_OPTIMISTIC;
+    else if (strcmp (arg, "none") == 0)
+        *mode = LOCK_NONE;
+    else
+        return -1;
+    return 0;
+}
+
+const char *
+lock_mode_name (lock_mode_t mode)
+{
+    switch (mode) {
+    case LOCK_EXCLUSIVE:
+        return "exclusive";
+    case LOCK_OPTIMISTIC:
+        return "optimistic";
+    case LOCK_NONE:
+        return "none";
+    default:
+        return "unknown";
+    }
+}
+
+/* Set the lock file and mode. The file is only opened when a lock is first
+ * taken so utilities that never modify a register don't need it.
+ */
+void
+lock_init (const char *path, lock_mode_t mode)
+{
+    if (path != NULL)
+        lock_path = path;
+    lock_mode = mode;
+}
+
+static int
+lock_file (void)
+{
+    if (lock_fd != -1)
+        return lock_fd;
+    lock_fd = open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (lock_fd == -1)
+        return -1;
+    /* every user has to be able to lock, whatever their umask */
+    fchmod (lock_fd, 0666);
+    return lock_fd;
+}
+
+/* The bytes of the lock file for the adapter of 'target': one per device it
+ * may carry, by mux, channel and address. Address 0 is never a device, its
+ * byte locks the adapter itself and the select count follows it.
+ */
+static off_t
+lock_adapter_offset (const xfer_target_t *target)
+{
+    return (off_t)xfer_adapter_number (target->adapter) *
+           (TOPO_CHANNELS + 1) * TOPO_CHANNELS * 128;
+}
+
+/* The byte of the lock file standing for the device 'fd' is bound to. */
+static off_t
+lock_offset (const xfer_target_t *target)
+{
+    return lock_adapter_offset (target) +
+           ((target->mux ? target->mux - TOPO_MUX_MIN + 1 : 0) *
+            TOPO_CHANNELS + target->channel) * 128 + target->address;
+}
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+lock_range (off_t offset, short type, int cmd)
+{
+    struct flock lock = {
+        .l_type   = type,
+        .l_whence = SEEK_SET,
+        .l_start  = offset,
+        .l_len    = 1,
+        .l_pid    = 0,
+    };
+    int file = 0;
+
+    file = lock_file ();
+    if (file == -1)
+        return -1;
+    return fcntl (file, cmd, &lock);
+}
+
+static int
+lock_set (int fd, short type, int cmd)
+{
+    return lock_range (lock_offset (xfer_target (fd)), type, cmd);
+}
+
+/* Lock the device 'fd' is bound to, waiting for other holders if need be.
+ */
+static int
+lock_take (int fd)
+{
+    uint64_t start = 0;
+    uint64_t waited = 0;
+
+    if (lock_set (fd, F_WRLCK, F_OFD_SETLK) == 0)
+        goto out;
+    if (errno != EAGAIN && errno != EACCES)
+        return -1;
+    start = now_ns ();
+    while (lock_set (fd, F_WRLCK, F_OFD_SETLKW))
+        if (errno != EINTR)
+            return -1;
+    waited = now_ns () - start;
+    __atomic_add_fetch (&stats.contended, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&stats.wait_ns, waited, __ATOMIC_RELAXED);
+    DS1077L_PROBE2 (lock__wait, xfer_target (fd)->address, waited);
+out:
+    __atomic_add_fetch (&stats.acquired, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int
+lock_drop (int fd)
+{
+    return lock_set (fd, F_UNLCK, F_OFD_SETLK);
+}
+
+/* Lock the device 'fd' is bound to for an update that can't be verified by
+ * reading it back, e.g. because it moves the device. Only a no-op with
+ * locking disabled.
+ */
+int
+lock_acquire (int fd)
+{
+    if (lock_mode == LOCK_NONE)
+        return 0;
+    return lock_take (fd);
+}
+
+int
+lock_release (int fd)
+{
+    if (lock_mode == LOCK_NONE)
+        return 0;
+    return lock_drop (fd);
+}
+
+static int32_t
+rmw_read (int fd, uint8_t command, int size)
+{
+    /* the lock is there to read what other processes wrote */
+    if (lock_mode != LOCK_NONE)
+        cache_expire (fd, command);
+    if (size == I2C_SMBUS_WORD_DATA)
+        return xfer_read_word (fd, command);
+    return xfer_read_byte (fd, command);
+}
+
+static int32_t
+rmw_write (int fd, uint8_t command, int size, uint16_t value)
+{
+    if (size == I2C_SMBUS_WORD_DATA)
+        return xfer_write_word (fd, command, value);
+    return xfer_write_byte (fd, command, value);
+}
+
+/* Read-modify-write the register 'command' of size I2C_SMBUS_BYTE_DATA or
+ * I2C_SMBUS_WORD_DATA on the device 'fd' is bound to, in the current mode.
+ * Returns 0 once written, 1 if 'update' found nothing to change and -1 with
+ * errno set on failure.
+ */
+int
+lock_rmw (int fd,
+          uint8_t command,
+          int size,
+          lock_update_t update,
+          void *arg)
+{
+    bool locked = false;
+    uint16_t next = 0;
+    int32_t current = 0;
+    int attempt = 0;
+    int ret = 0;
+    int err = 0;
+
+    for (attempt = 0; ; ++attempt) {
+        if (!locked && (lock_mode == LOCK_EXCLUSIVE ||
+                        (lock_mode == LOCK_OPTIMISTIC &&
+                         attempt == LOCK_RETRIES))) {
+            if (lock_take (fd))
+                return -1;
+            if (attempt == LOCK_RETRIES)
+                __atomic_add_fetch (&stats.fallbacks, 1, __ATOMIC_RELAXED);
+            locked = true;
+        }
+        current = rmw_read (fd, command, size);
+        if (current == -1)
+            goto err_out;
+        ret = update (current, &next, arg);
+        if (ret != 0)
+            break;
+        if (rmw_write (fd, command, size, next) == -1)
+            goto err_out;
+        if (locked || lock_mode == LOCK_NONE)
+            break;
+        current = rmw_read (fd, command, size);
+        if (current == -1)
+            goto err_out;
+        if (current == next)
+            break;
+        /* somebody else wrote the register after we read it */
+        __atomic_add_fetch (&stats.conflicts, 1, __ATOMIC_RELAXED);
+        DS1077L_PROBE3 (lock__conflict, xfer_target (fd)->address, next,
+                        current);
+    }
+    if (locked && lock_drop (fd))
+        return -1;
+    return ret;
+err_out:
+    err = errno;
+    if (locked)
+        lock_drop (fd);
+    errno = err;
+    return -1;
+}
+
+/* Lock the adapter of 'target' against mux selects by other processes and
+ * read what they last routed on it into 'adapter'. A lock file that doesn't
+ * keep what's written, like /dev/null, reads as nothing ever selected.
+ * Leaves 'adapter' alone with locking disabled.
+ */
+int
+lock_adapter_acquire (const xfer_target_t *target, lock_adapter_t *adapter)
+{
+    off_t offset = lock_adapter_offset (target);
+
+    if (lock_mode == LOCK_NONE)
+        return 0;
+    while (lock_range (offset, F_WRLCK, F_OFD_SETLKW))
+        if (errno != EINTR)
+            return -1;
+    if (pread (lock_fd, adapter, sizeof (*adapter), offset + 8) !=
+        sizeof (*adapter))
+        memset (adapter, 0, sizeof (*adapter));
+    return 0;
+}
+
+/* Store a select about to be written, with the adapter locked. */
+int
+lock_adapter_update (const xfer_target_t *target,
+                     const lock_adapter_t *adapter)
+{
+    if (lock_mode == LOCK_NONE)
+        return 0;
+    if (pwrite (lock_fd, adapter, sizeof (*adapter),
+                lock_adapter_offset (target) + 8) != sizeof (*adapter))
+        return -1;
+    return 0;
+}
+
+int
+lock_adapter_release (const xfer_target_t *target)
+{
+    if (lock_mode == LOCK_NONE)
+        return 0;
+    return lock_range (lock_adapter_offset (target), F_UNLCK, F_OFD_SETLK);
+}
+
+void
+lock_stats (lock_stats_t *out)
+{
+    out->acquired  = __atomic_load_n (&stats.acquired, __ATOMIC_RELAXED);
+    out->contended = __atomic_load_n (&stats.contended, __ATOMIC_RELAXED);
+    out->wait_ns   = __atomic_load_n (&stats.wait_ns, __ATOMIC_RELAXED);
+    out->conflicts = __atomic_load_n (&stats.conflicts, __ATOMIC_RELAXED);
+    out->fallbacks = __atomic_load_n (&stats.fallbacks, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,90 @@
+#ifndef _DS1077L_LOCK_H_
+#define _DS1077L_LOCK_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdint.h>
+
+/* Serializing read-modify-write of registers between processes.
+ *
+ * Changing a few fields of a register means reading it, modifying the word
+ * and writing it back. Two processes doing that to the same register at
+ * once lose one of the updates. lock_rmw runs such an update in one of three
+ * modes:
+ *
+ *   exclusive   the device is locked for the duration of the update with an
+ *               OFD byte-range lock on the byte of a shared lock file that
+ *               stands for the device, so only updates of the same device
+ *               (adapter, mux, channel, address) ever wait on each other.
+ *               OFD locks belong to the open file, each thread opens its
+ *               own so threads exclude each other too.
+ *   optimistic  nothing is locked, the written word is read back and the
+ *               update retried if somebody else's write got in between.
+ *               After LOCK_RETRIES conflicts it falls back to exclusive.
+ *               This catches most but not all lost updates: a write landing
+ *               after ours and before another writer's read back goes
+ *               unnoticed by us. Use exclusive when that matters.
+ *   none        plain read-modify-write.
+ *
+ * Updates that can't be read back, like moving a device to a new address,
+ * lock with lock_acquire / lock_release in both exclusive and optimistic
+ * mode.
+ *
+ * Selecting a mux channel and the transaction behind it hold the lock on
+ * the adapter's own byte in the same file, in both exclusive and optimistic
+ * mode, see topo_select.
+ *
+ * Lock waits and conflicts are counted, see lock_stats, and fire the
+ * lock__wait and lock__conflict probes.
+ */
+#define LOCK_FILE_ENV     "DS1077L_LOCK_FILE"
+#define LOCK_FILE_DEFAULT "/run/lock/ds1077l.lock"
+#define LOCK_RETRIES      8
+
+typedef enum lock_mode {
+    LOCK_EXCLUSIVE = 0,
+    LOCK_OPTIMISTIC,
+    LOCK_NONE,
+} lock_mode_t;
+
+typedef struct lock_stats {
+    uint64_t acquired;          /* exclusive locks taken */
+    uint64_t contended;         /* of which had to wait */
+    uint64_t wait_ns;           /* total time spent waiting */
+    uint64_t conflicts;         /* optimistic updates that were retried */
+    uint64_t fallbacks;         /* optimistic updates that had to lock */
+} lock_stats_t;
+
+/* Mux selects on an adapter as all processes see them, kept in the lock
+ * file next to the adapter's byte.
+ */
+typedef struct lock_adapter {
+    uint64_t selects;           /* written on the adapter so far */
+    uint8_t mux;                /* the last, 0 for none */
+    uint8_t channel;
+} lock_adapter_t;
+
+/* Compute the new value of a register from its current one. Returns 0 to
+ * write 'next', 1 if the register doesn't need to change and -1 with errno
+ * set on error.
+ */
+typedef int (*lock_update_t) (uint16_t current, uint16_t *next, void *arg);
+
+int lock_mode_parse (const char *arg, lock_mode_t *mode);
+const char *lock_mode_name (lock_mode_t mode);
+void lock_init (const char *path, lock_mode_t mode);
+int lock_acquire (int fd);
+int lock_release (int fd);
+int lock_rmw (int fd,
+              uint8_t command,
+              int size,
+              lock_update_t update,
+              void *arg);
+int lock_adapter_acquire (const xfer_target_t *target,
+                          lock_adapter_t *adapter);
+int lock_adapter_update (const xfer_target_t *target,
+                         const lock_adapter_t *adapter);
+int lock_adapter_release (const xfer_target_t *target);
+void lock_stats (lock_stats_t *stats);
+
+#endif // #ifndef _DS1077L_LOCK_H_
@@ -0,0 +1,479 @@
+#include "ds1077l-metrics.h"
+#include "ds1077l-fmt.h"
+#include "ds1077l-topo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/i2c-dev.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#define METRICS_MAGIC   0x4d4c37373031ull
+#define METRICS_VERSION 2
+
+const uint64_t metrics_bucket_ns[METRICS_BUCKETS] = {
+    100000, 250000, 500000, 1000000, 2500000,
+    5000000, 10000000, 25000000, 50000000, 100000000,
+};
+
+/* One time series. In a shard the adapter is the interned index from the
+ * transaction layer, in the shared file it is stored by name since indexes
+ * differ between processes.
+ */
+typedef struct metrics_key {
+    char adapter[32];
+    uint8_t address;
+    uint8_t mux;                /* 0 when not behind a mux */
+    uint8_t channel;
+    uint8_t command;
+    uint8_t read_write;
+    uint8_t result;
+} metrics_key_t;
+
+typedef struct metrics_counts {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[METRICS_BUCKETS];
+} metrics_counts_t;
+
+/* The counts of a series as its shard's thread keeps them. Only that thread
+ * writes them, metrics_flush reads them from another one: 'seq' is odd while
+ * an update is under way and the counters are atomics so neither side ever
+ * sees a torn value.
+ */
+typedef struct metrics_live {
+    _Atomic uint32_t seq;
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t buckets[METRICS_BUCKETS];
+} metrics_live_t;
+
+typedef struct metrics_series {
+    uint8_t adapter;
+    uint8_t address;
+    uint8_t mux;
+    uint8_t channel;
+    uint8_t command;
+    uint8_t read_write;
+    uint8_t result;
+    metrics_live_t counts;
+    metrics_counts_t flushed;
+} metrics_series_t;
+
+typedef struct metrics_shard {
+    struct metrics_shard *next;
+    _Atomic size_t used;
+    metrics_series_t series[METRICS_SERIES_MAX];
+} metrics_shard_t;
+
+typedef struct metrics_state_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+} metrics_state_header_t;
+
+typedef struct metrics_record {
+    metrics_key_t key;
+    metrics_counts_t counts;
+} metrics_record_t;
+
+/* Results are stored as small integers so a series key stays compact. The
+ * names are the ones used by xfer_result_name.
+ */
+static const int result_errnos[] = { 0, ENXIO, ETIMEDOUT, EAGAIN, EIO, -1 };
+#define RESULTS_COUNT (sizeof (result_errnos) / sizeof (result_errnos[0]))
+
+bool metrics_on = false;
+static char metrics_dir[PATH_MAX];
+static _Atomic (metrics_shard_t *) shards = NULL;
+static __thread metrics_shard_t *shard = NULL;
+
+static uint8_t
+result_index (int err)
+{
+    uint8_t i = 0;
+
+    if (err == EREMOTEIO)
+        err = ENXIO;
+    for (i = 0; i < RESULTS_COUNT - 1; ++i)
+        if (result_errnos[i] == err)
+            return i;
+    return RESULTS_COUNT - 1;
+}
+
+/* Add to a counter only the calling thread writes, no read-modify-write
+ * needed.
+ */
+static inline void
+live_add (_Atomic uint64_t *counter, uint64_t n)
+{
+    atomic_store_explicit (counter, n +
+                           atomic_load_explicit (counter, memory_order_relaxed),
+                           memory_order_relaxed);
+}
+
+/* Allocate the calling thread's shard and publish it on the shard list. The
+ * list is only ever pushed to so a compare and swap is all that's needed.
+ */
+static metrics_shard_t *
+shard_get (void)
+{
+    metrics_shard_t *head = NULL;
+
+    if (shard != NULL)
+        return shard;
+    shard = calloc (1, sizeof (*shard));
+    if (shard == NULL)
+        return NULL;
+    head = atomic_load (&shards);
+    do {
+        shard->next = head;
+    } while (!atomic_compare_exchange_weak (&shards, &head, shard));
+    return shard;
+}
+
+/* Account for one transaction. Only the owning thread writes to a shard, the
+ * series count is published with release semantics so metrics_flush never
+ * sees a half initialized key.
+ */
+void
+metrics_observe (const xfer_target_t *target,
+                 uint8_t command,
+                 char read_write,
+                 int err,
+                 uint64_t nsec)
+{
+    metrics_shard_t *s = shard_get ();
+    metrics_series_t *series = NULL;
+    uint8_t result = result_index (err);
+    uint32_t seq = 0;
+    size_t used = 0;
+    size_t i = 0;
+
+    if (s == NULL)
+        return;
+    /* every channel mask written to a mux is one MUX_SELECT series */
+    if (target->address >= TOPO_MUX_MIN && target->address <= TOPO_MUX_MAX)
+        command = 0;
+    used = atomic_load_explicit (&s->used, memory_order_relaxed);
+    for (i = 0; i < used; ++i) {
+        series = &s->series[i];
+        if (series->adapter == target->adapter &&
+            series->address == target->address &&
+            series->mux == target->mux &&
+            series->channel == target->channel &&
+            series->command == command &&
+            series->read_write == read_write &&
+            series->result == result)
+            break;
+    }
+    if (i == used) {
+        if (used == METRICS_SERIES_MAX)
+            return;
+        series = &s->series[used];
+        series->adapter    = target->adapter;
+        series->address    = target->address;
+        series->mux        = target->mux;
+        series->channel    = target->channel;
+        series->command    = command;
+        series->read_write = read_write;
+        series->result     = result;
+        atomic_store_explicit (&s->used, used + 1, memory_order_release);
+    }
+    seq = atomic_load_explicit (&series->counts.seq, memory_order_relaxed);
+    atomic_store_explicit (&series->counts.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence (memory_order_release);
+    live_add (&series->counts.count, 1);
+    live_add (&series->counts.sum_ns, nsec);
+    for (i = 0; i < METRICS_BUCKETS; ++i)
+        if (nsec <= metrics_bucket_ns[i])
+            live_add (&series->counts.buckets[i], 1);
+    atomic_store_explicit (&series->counts.seq, seq + 2, memory_order_release);
+}
+
+/* Copy the counts of a series as they were between two updates, retrying
+ * while its thread is in one.
+ */
+static void
+counts_snapshot (metrics_counts_t *dst, metrics_live_t *live)
+{
+    uint32_t seq = 0;
+    size_t i = 0;
+
+    do {
+        seq = atomic_load_explicit (&live->seq, memory_order_acquire);
+        dst->count = atomic_load_explicit (&live->count, memory_order_relaxed);
+        dst->sum_ns = atomic_load_explicit (&live->sum_ns,
+                                            memory_order_relaxed);
+        for (i = 0; i < METRICS_BUCKETS; ++i)
+            dst->buckets[i] = atomic_load_explicit (&live->buckets[i],
+                                                    memory_order_relaxed);
+        atomic_thread_fence (memory_order_acquire);
+    } while ((seq & 1) != 0 ||
+             atomic_load_explicit (&live->seq, memory_order_relaxed) != seq);
+}
+
+/* Add what was counted in a series since the last flush to 'dst'. The owning
+ * thread may still be counting so work from a snapshot.
+ */
+static void
+counts_fold (metrics_counts_t *dst, metrics_series_t *series)
+{
+    metrics_counts_t now = { 0 };
+    size_t i = 0;
+
+    counts_snapshot (&now, &series->counts);
+    dst->count  += now.count - series->flushed.count;
+    dst->sum_ns += now.sum_ns - series->flushed.sum_ns;
+    for (i = 0; i < METRICS_BUCKETS; ++i)
+        dst->buckets[i] += now.buckets[i] - series->flushed.buckets[i];
+    series->flushed = now;
+}
+
+static metrics_record_t *
+record_find (metrics_record_t *records, uint32_t *count, metrics_key_t *key)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < *count; ++i)
+        if (memcmp (&records[i].key, key, sizeof (*key)) == 0)
+            return &records[i];
+    if (*count == METRICS_STATE_MAX)
+        return NULL;
+    memset (&records[*count], 0, sizeof (records[0]));
+    records[*count].key = *key;
+    return &records[(*count)++];
+}
+
+/* Append the label set for one series to the output buffer, without the
+ * closing brace so the caller can add the histogram 'le' label. mux and
+ * channel are empty for devices not behind a mux.
+ */
+static void
+prom_labels (fmt_buf_t *out, const metrics_key_t *key)
+{
+    fmt_str (out, "{adapter=\"");
+    fmt_str (out, key->adapter);
+    fmt_str (out, "\",address=\"");
+    fmt_hex (out, key->address, 2);
+    fmt_str (out, "\",mux=\"");
+    if (key->mux != 0) {
+        fmt_hex (out, key->mux, 2);
+        fmt_str (out, "\",channel=\"");
+        fmt_uint (out, key->channel);
+    } else {
+        fmt_str (out, "\",channel=\"");
+    }
+    fmt_str (out, "\",register=\"");
+    fmt_str (out, xfer_command_name (key->address, key->command));
+    fmt_str (out, "\",op=\"");
+    fmt_str (out, key->read_write == I2C_SMBUS_READ ? "read" : "write");
+    fmt_str (out, "\",result=\"");
+    fmt_str (out, xfer_result_name (result_errnos[key->result]));
+    fmt_str (out, "\"");
+}
+
+/* Append 'nsec' as seconds with nanosecond precision.
+ */
+static void
+prom_seconds (fmt_buf_t *out, uint64_t nsec)
+{
+    char frac[10];
+    uint64_t rem = nsec % 1000000000;
+    int i = 0;
+
+    fmt_uint (out, nsec / 1000000000);
+    for (i = 8; i >= 0; --i) {
+        frac[i] = '0' + rem % 10;
+        rem /= 10;
+    }
+    frac[9] = '\0';
+    fmt_str (out, ".");
+    fmt_str (out, frac);
+}
+
+static void
+prom_u64 (fmt_buf_t *out, uint64_t value)
+{
+    char tmp[21];
+    size_t i = sizeof (tmp) - 1;
+
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    fmt_str (out, tmp + i);
+}
+
+static int
+prom_write (const metrics_record_t *records, uint32_t count)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    static fmt_buf_t out;
+    uint32_t i = 0;
+    size_t b = 0;
+    int fd = 0;
+
+    if (snprintf (path, sizeof (path), "%s/%s", metrics_dir,
+                  METRICS_PROM_FILE) >= sizeof (path) ||
+        snprintf (tmp, sizeof (tmp), "%s.%d", path, getpid ())
+            >= sizeof (tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    fmt_init (&out, fd);
+    fmt_str (&out, "# HELP ds1077l_ops_total Register operations issued to "
+                   "DS1077L devices.\n"
+                   "# TYPE ds1077l_ops_total counter\n");
+    for (i = 0; i < count; ++i) {
+        fmt_str (&out, "ds1077l_ops_total");
+        prom_labels (&out, &records[i].key);
+        fmt_str (&out, "} ");
+        prom_u64 (&out, records[i].counts.count);
+        fmt_str (&out, "\n");
+    }
+    fmt_str (&out, "# HELP ds1077l_op_duration_seconds Time spent in register "
+                   "operations.\n"
+                   "# TYPE ds1077l_op_duration_seconds histogram\n");
+    for (i = 0; i < count; ++i) {
+        for (b = 0; b < METRICS_BUCKETS; ++b) {
+            fmt_str (&out, "ds1077l_op_duration_seconds_bucket");
+            prom_labels (&out, &records[i].key);
+            fmt_str (&out, ",le=\"");
+            prom_seconds (&out, metrics_bucket_ns[b]);
+            fmt_str (&out, "\"} ");
+            prom_u64 (&out, records[i].counts.buckets[b]);
+            fmt_str (&out, "\n");
+        }
+        fmt_str (&out, "ds1077l_op_duration_seconds_bucket");
+        prom_labels (&out, &records[i].key);
+        fmt_str (&out, ",le=\"+Inf\"} ");
+        prom_u64 (&out, records[i].counts.count);
+        fmt_str (&out, "\nds1077l_op_duration_seconds_sum");
+        prom_labels (&out, &records[i].key);
+        fmt_str (&out, "} ");
+        prom_seconds (&out, records[i].counts.sum_ns);
+        fmt_str (&out, "\nds1077l_op_duration_seconds_count");
+        prom_labels (&out, &records[i].key);
+        fmt_str (&out, "} ");
+        prom_u64 (&out, records[i].counts.count);
+        fmt_str (&out, "\n");
+    }
+    if (fmt_flush (&out) || close (fd)) {
+        unlink (tmp);
+        return -1;
+    }
+    return rename (tmp, path);
+}
+
+/* Fold the per-thread shards into the shared counter file and regenerate the
+ * Prometheus text file from it. The counter file is locked for the duration
+ * so concurrent processes don't lose updates. Returns 0 on success and -1
+ * with errno set otherwise.
+ */
+int
+metrics_flush (void)
+{
+    char path[PATH_MAX];
+    metrics_state_header_t header = { 0 };
+    metrics_record_t *records = NULL;
+    metrics_record_t *record = NULL;
+    metrics_shard_t *s = NULL;
+    metrics_key_t key;
+    ssize_t len = 0;
+    size_t used = 0;
+    size_t i = 0;
+    int ret = -1;
+    int fd = 0;
+
+    if (!metrics_on)
+        return 0;
+    if (snprintf (path, sizeof (path), "%s/%s", metrics_dir,
+                  METRICS_STATE_FILE) >= sizeof (path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = open (path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return -1;
+    if (flock (fd, LOCK_EX))
+        goto out_close;
+    records = calloc (METRICS_STATE_MAX, sizeof (*records));
+    if (records == NULL)
+        goto out_close;
+    len = pread (fd, &header, sizeof (header), 0);
+    if (len != sizeof (header) || header.magic != METRICS_MAGIC ||
+        header.version != METRICS_VERSION ||
+        header.count > METRICS_STATE_MAX) {
+        header.magic = METRICS_MAGIC;
+        header.version = METRICS_VERSION;
+        header.count = 0;
+    }
+    len = header.count * sizeof (*records);
+    if (pread (fd, records, len, sizeof (header)) != len)
+        header.count = 0;
+    for (s = atomic_load (&shards); s != NULL; s = s->next) {
+        used = atomic_load_explicit (&s->used, memory_order_acquire);
+        for (i = 0; i < used; ++i) {
+            memset (&key, 0, sizeof (key));
+            strncpy (key.adapter, xfer_adapter_name (s->series[i].adapter),
+                     sizeof (key.adapter) - 1);
+            key.address    = s->series[i].address;
+            key.mux        = s->series[i].mux;
+            key.channel    = s->series[i].channel;
+            key.command    = s->series[i].command;
+            key.read_write = s->series[i].read_write;
+            key.result     = s->series[i].result;
+            record = record_find (records, &header.count, &key);
+            if (record == NULL)
+                continue;
+            counts_fold (&record->counts, &s->series[i]);
+        }
+    }
+    len = header.count * sizeof (*records);
+    if (pwrite (fd, &header, sizeof (header), 0) != sizeof (header) ||
+        pwrite (fd, records, len, sizeof (header)) != len)
+        goto out_free;
+    ret = prom_write (records, header.count);
+out_free:
+    free (records);
+out_close:
+    close (fd);
+    return ret;
+}
+
+static void
+metrics_atexit (void)
+{
+    if (metrics_flush ())
+        perror ("metrics_flush: ");
+}
+
+/* Enable metrics collection. Counters are written to 'dir' when the process
+ * exits.
+ */
+int
+metrics_init (const char *dir)
+{
+    if (strlen (dir) >= sizeof (metrics_dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (access (dir, W_OK))
+        return -1;
+    strcpy (metrics_dir, dir);
+    if (!metrics_on && atexit (metrics_atexit))
+        return -1;
+    metrics_on = true;
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef _DS1077L_METRICS_H_
+#define _DS1077L_METRICS_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Metrics for register operations.
+ *
+ * Every transaction is counted in a per-thread shard. Shards are only written
+ * by the thread owning them so the hot path is a handful of plain increments.
+ * When the process exits the shards are folded into a counter file shared by
+ * all processes (METRICS_STATE_FILE in the metrics directory) and the totals
+ * are rendered in the Prometheus text format to METRICS_PROM_FILE, which is
+ * what the node_exporter textfile collector picks up.
+ */
+#define METRICS_DIR_ENV    "DS1077L_METRICS_DIR"
+#define METRICS_STATE_FILE "ds1077l.metrics"
+#define METRICS_PROM_FILE  "ds1077l.prom"
+
+/* Distinct (adapter, address, register, op, result) tuples kept per thread
+ * and in the shared counter file.
+ */
+#define METRICS_SERIES_MAX 128
+#define METRICS_STATE_MAX  4096
+
+/* Upper bounds of the latency histogram buckets in nanoseconds. An SMBus word
+ * transfer at 100kHz takes ~400us, an EEPROM write cycle up to 10ms.
+ */
+#define METRICS_BUCKETS 10
+extern const uint64_t metrics_bucket_ns[METRICS_BUCKETS];
+
+extern bool metrics_on;
+
+int metrics_init (const char *dir);
+int metrics_flush (void);
+void metrics_observe (const xfer_target_t *target,
+                      uint8_t command,
+                      char read_write,
+                      int err,
+                      uint64_t nsec);
+
+#endif // #ifndef _DS1077L_METRICS_H_
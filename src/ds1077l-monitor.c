@@ -0,0 +1,635 @@
+#include "ds1077l.h"
+#include "ds1077l-metrics.h"
+#include "ds1077l-sub.h"
+#include "ds1077l-watch.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <grp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How often metrics are folded into the metrics directory while running,
+ * short of the usual node_exporter scrape interval.
+ */
+#define MONITOR_METRICS_MS 10000
+
+typedef struct monitor_args {
+    ds1077l_common_args_t common_args;
+    char *file;
+    char *exec;
+    char *socket;
+    gid_t socket_group;
+    watch_policy_t policy;
+    unsigned long count;
+    unsigned long commit_ms;
+    watch_device_t *devices;
+    size_t device_count;
+    size_t fixed_count;         /* devices not watched for subscribers */
+    topo_target_t *released;    /* subscribed devices nobody wants any more */
+    size_t released_count;
+} monitor_args_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "file",
+        .key   = 'f',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Read devices to watch from FILE, one per line. Lines "
+                 "starting with '#' are ignored.",
+        .group = 1
+    },
+    {
+        .name  = "interval",
+        .key   = 'i',
+        .arg   = "MIN_MS[:MAX_MS]",
+        .flags = 0,
+        .doc   = "Polling interval after an anomaly and the interval stable "
+                 "devices back off to. Defaults to 1000:60000.",
+        .group = 1
+    },
+    {
+        .name  = "remediate",
+        .key   = 'r',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Write the expected register contents back to drifted "
+                 "devices.",
+        .group = 1
+    },
+    {
+        .name  = "exec",
+        .key   = 'x',
+        .arg   = "COMMAND",
+        .flags = 0,
+        .doc   = "Run COMMAND through the shell on drift and errors with "
+                 "DS1077L_DEVICE, DS1077L_EVENT, DS1077L_EXPECTED and "
+                 "DS1077L_ACTUAL in its environment.",
+        .group = 1
+    },
+    {
+        .name  = "socket",
+        .key   = 'S',
+        .arg   = "PATH",
+        .flags = 0,
+        .doc   = "Serve register change subscriptions on the Unix socket "
+                 "PATH. Subscribed devices are watched too.",
+        .group = 1
+    },
+    {
+        .name  = "socket-group",
+        .key   = 'G',
+        .arg   = "GROUP",
+        .flags = 0,
+        .doc   = "Group allowed to connect to --socket, besides its owner. "
+                 "Defaults to our own.",
+        .group = 1
+    },
+    {
+        .name  = "commit-after",
+        .key   = 'C',
+        .arg   = "QUIET_MS",
+        .flags = 0,
+        .doc   = "Commit register changes left in SRAM by --write-behind to "
+                 "EEPROM once a device has been left alone for QUIET_MS, and "
+                 "all of them on exit. Needs a wear file.",
+        .group = 1
+    },
+    {
+        .name  = "count",
+        .key   = 'c',
+        .arg   = "POLLS",
+        .flags = 0,
+        .doc   = "Exit after POLLS polls. Defaults to running until "
+                 "interrupted.",
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "[ADAPTER[/MUX/CHANNEL]/ADDRESS[=DIV:MUX:BUS]...]",
+    .doc         = "Watch Maxim DS1077L programmable oscillators for register "
+                   "drift, e.g. after a brownout reset. Expected packed "
+                   "register words are given in hex or taken from the first "
+                   "poll. Without devices, --socket or --commit-after the "
+                   "one selected by the common options is watched.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void
+on_signal (int signo)
+{
+    stop = 1;
+}
+
+static int
+device_add (monitor_args_t *args, const char *arg)
+{
+    if (args->device_count == WATCH_DEVICES_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (watch_parse (arg, &args->devices[args->device_count])) {
+        errno = EINVAL;
+        return -1;
+    }
+    ++args->device_count;
+    return 0;
+}
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    monitor_args_t *args = state->input;
+    struct group *group = NULL;
+    char *end = NULL;
+
+    switch (key) {
+        case 'f':
+            args->file = arg;
+            break;
+        case 'i':
+            if (watch_interval_parse (arg, &args->policy))
+                argp_usage (state);
+            break;
+        case 'r':
+            args->policy.remediate = true;
+            break;
+        case 'x':
+            args->exec = arg;
+            break;
+        case 'S':
+            args->socket = arg;
+            break;
+        case 'G':
+            group = getgrnam (arg);
+            if (group != NULL) {
+                args->socket_group = group->gr_gid;
+                break;
+            }
+            args->socket_group = strtoul (arg, &end, 10);
+            if (end == arg || *end != '\0')
+                argp_failure (state, 1, EINVAL, "--socket-group %s", arg);
+            break;
+        case 'c':
+            args->count = strtoul (arg, &end, 10);
+            if (end == arg || *end != '\0')
+                argp_usage (state);
+            break;
+        case 'C':
+            args->commit_ms = strtoul (arg, &end, 10);
+            if (end == arg || *end != '\0' || args->commit_ms == 0)
+                argp_usage (state);
+            break;
+        case ARGP_KEY_ARG:
+            if (device_add (args, arg))
+                argp_failure (state, 1, errno, "%s", arg);
+            break;
+        case ARGP_KEY_INIT:
+            args->file = NULL;
+            args->exec = NULL;
+            args->socket = NULL;
+            args->socket_group = -1;
+            args->policy.min_ms = WATCH_INTERVAL_MS_DEFAULT;
+            args->policy.max_ms = WATCH_INTERVAL_MAX_MS_DEFAULT;
+            args->policy.remediate = false;
+            args->count = 0;
+            args->commit_ms = 0;
+            state->child_inputs[0] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Add the devices listed in a file.
+ */
+static int
+monitor_load (monitor_args_t *args, const char *path)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len = 0;
+    FILE *file = NULL;
+    int ret = 0;
+
+    file = fopen (path, "r");
+    if (file == NULL)
+        return -1;
+    while ((len = getline (&line, &size, file)) != -1) {
+        while (len > 0 && strchr (" \t\r\n", line[len - 1]) != NULL)
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+        ret = device_add (args, line);
+        if (ret) {
+            fprintf (stderr, "%s: %s\n", path, line);
+            break;
+        }
+    }
+    free (line);
+    fclose (file);
+    return ret;
+}
+
+/* Watch the device selected by the common options.
+ */
+static void
+device_from_common (monitor_args_t *args)
+{
+    watch_device_t *device = &args->devices[args->device_count++];
+    ds1077l_common_args_t *common_args = &args->common_args;
+
+    memset (device, 0, sizeof (*device));
+    strncpy (device->target.bus_dev, common_args->bus_dev,
+             sizeof (device->target.bus_dev) - 1);
+    device->target.mux = common_args->mux;
+    device->target.channel = common_args->channel;
+    device->target.address = common_args->address;
+}
+
+static void
+device_name (char *buf, size_t size, const topo_target_t *target)
+{
+    if (target->mux == 0)
+        snprintf (buf, size, "%s/%#x", target->bus_dev, target->address);
+    else
+        snprintf (buf, size, "%s/%#x/%d/%#x", target->bus_dev, target->mux,
+                  target->channel, target->address);
+}
+
+static void
+image_string (char *buf, size_t size, const watch_image_t *image)
+{
+    snprintf (buf, size, "0x%04x:0x%04x:0x%02x", image->div, image->mux,
+              image->bus);
+}
+
+/* Run the --exec command for an event and wait for it, the next poll can
+ * wait a moment.
+ */
+static void
+monitor_exec (const char *command,
+              const watch_device_t *device,
+              watch_event_t event)
+{
+    char name[64];
+    char expected[32];
+    char actual[32];
+    pid_t pid = 0;
+
+    device_name (name, sizeof (name), &device->target);
+    image_string (expected, sizeof (expected), &device->expected);
+    image_string (actual, sizeof (actual), &device->image);
+    fflush (stdout);
+    pid = fork ();
+    if (pid == -1) {
+        perror ("fork: ");
+        return;
+    }
+    if (pid == 0) {
+        setenv ("DS1077L_DEVICE", name, 1);
+        setenv ("DS1077L_EVENT", watch_event_name (event), 1);
+        setenv ("DS1077L_EXPECTED", expected, 1);
+        /* an unreadable device has no actual image */
+        if (event == WATCH_ERROR && device->drifted == 0)
+            actual[0] = '\0';
+        setenv ("DS1077L_ACTUAL", actual, 1);
+        execl ("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit (127);
+    }
+    while (waitpid (pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+}
+
+/* Append one record per drifted register in a machine readable format.
+ */
+static void
+drift_format (fmt_buf_t *out,
+              ds1077l_format_t format,
+              const watch_device_t *device,
+              watch_event_t event)
+{
+    static const struct {
+        uint8_t mask;
+        const char *reg;
+        uint8_t width;
+    } regs[] = {
+        { WATCH_DIV, "DIV", 4 },
+        { WATCH_MUX, "MUX", 4 },
+        { WATCH_BUS, "BUS", 2 },
+    };
+    const uint16_t actual[] = {
+        device->image.div, device->image.mux, device->image.bus
+    };
+    const uint16_t expected[] = {
+        device->expected.div, device->expected.mux, device->expected.bus
+    };
+    size_t i = 0;
+
+    for (i = 0; i < 3; ++i) {
+        fmt_record_t record = {
+            .bus_dev   = device->target.bus_dev,
+            .address   = device->target.address,
+            .reg       = regs[i].reg,
+            .raw       = actual[i],
+            .raw_width = regs[i].width,
+        };
+        fmt_field_t fields[] = {
+            { .name = "expected", .type = FIELD_HEX, .value = expected[i] },
+            { .name = "remediated", .type = FIELD_BOOL,
+              .value = event == WATCH_REMEDIATED },
+        };
+
+        if (!(device->drifted & regs[i].mask))
+            continue;
+        fmt_register (out, format, &record, fields,
+                      sizeof (fields) / sizeof (fields[0]));
+    }
+}
+
+static void
+drift_pretty (const char *name, const watch_device_t *device,
+              watch_event_t event)
+{
+    printf ("%s: %s", name, event == WATCH_ERROR ? "drift" :
+                            watch_event_name (event));
+    if (device->drifted & WATCH_DIV)
+        printf (" DIV 0x%04x expected 0x%04x", device->image.div,
+                device->expected.div);
+    if (device->drifted & WATCH_MUX)
+        printf (" MUX 0x%04x expected 0x%04x", device->image.mux,
+                device->expected.mux);
+    if (device->drifted & WATCH_BUS)
+        printf (" BUS 0x%02x expected 0x%02x", device->image.bus,
+                device->expected.bus);
+    printf ("\n");
+}
+
+static void
+monitor_report (monitor_args_t *args,
+                fmt_buf_t *out,
+                const watch_device_t *device,
+                watch_event_t event)
+{
+    ds1077l_common_args_t *common_args = &args->common_args;
+    char name[64];
+    int err = errno;
+
+    device_name (name, sizeof (name), &device->target);
+    if (device->drifted != 0) {
+        if (common_args->format == FORMAT_HUMAN) {
+            drift_pretty (name, device, event);
+        } else {
+            drift_format (out, common_args->format, device, event);
+            /* a failed flush drops the records, the next drift starts over */
+            if (fmt_flush (out))
+                perror ("fmt_flush: ");
+        }
+    }
+    if (event == WATCH_ERROR)
+        fprintf (stderr, "%s: %s\n", name, strerror (err));
+    else if (common_args->verbose && device->drifted == 0)
+        printf ("%s: %s, next poll in %u ms\n", name,
+                watch_event_name (event), device->interval_ms);
+    fflush (stdout);
+    if (args->exec != NULL && (device->drifted != 0 || event == WATCH_ERROR))
+        monitor_exec (args->exec, device, event);
+}
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Start watching a device somebody subscribed to, polling it right away,
+ * or stop once nobody is. Stopping waits for monitor_release, this may be
+ * called with a device in use.
+ */
+static void
+monitor_subscribed (const topo_target_t *target, bool subscribed, void *arg)
+{
+    monitor_args_t *args = arg;
+    watch_device_t *device = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < args->released_count; ++i) {
+        if (topo_compare (&args->released[i], target) == 0) {
+            args->released[i] = args->released[--args->released_count];
+            break;
+        }
+    }
+    if (!subscribed) {
+        if (args->released_count < WATCH_DEVICES_MAX)
+            args->released[args->released_count++] = *target;
+        return;
+    }
+    for (i = 0; i < args->device_count; ++i)
+        if (topo_compare (&args->devices[i].target, target) == 0)
+            return;
+    if (args->device_count == WATCH_DEVICES_MAX)
+        return;
+    device = &args->devices[args->device_count++];
+    memset (device, 0, sizeof (*device));
+    device->target = *target;
+    device->interval_ms = args->policy.min_ms;
+    device->next_ns = now_ns ();
+}
+
+/* Stop watching the devices released by subscribers, except those we were
+ * asked to watch anyway.
+ */
+static void
+monitor_release (monitor_args_t *args)
+{
+    size_t i = 0;
+    size_t j = 0;
+
+    for (i = 0; i < args->released_count; ++i) {
+        for (j = args->fixed_count; j < args->device_count; ++j) {
+            if (topo_compare (&args->devices[j].target,
+                              &args->released[i]) == 0) {
+                args->devices[j] = args->devices[--args->device_count];
+                break;
+            }
+        }
+    }
+    args->released_count = 0;
+}
+
+/* Wait for the next poll to come due, serving subscribers in the meantime
+ * if there's a socket. Returns 0 once 'deadline' has passed.
+ */
+static int
+monitor_wait (monitor_args_t *args, uint64_t deadline)
+{
+    struct pollfd fds[SUB_CLIENTS_MAX + 1];
+    struct timespec ts;
+    size_t count = 0;
+    uint64_t now = 0;
+    int timeout = -1;
+
+    if (args->socket == NULL) {
+        ts.tv_sec = deadline / 1000000000;
+        ts.tv_nsec = deadline % 1000000000;
+        return clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    count = sub_pollfds (fds, SUB_CLIENTS_MAX + 1);
+    if (deadline != UINT64_MAX) {
+        now = now_ns ();
+        if (deadline <= now)
+            return 0;
+        /* round up so we don't wake up just short of the deadline */
+        timeout = (deadline - now + 999999) / 1000000;
+    }
+    if (poll (fds, count, timeout) > 0)
+        sub_dispatch (fds, count);
+    return now_ns () < deadline ? -1 : 0;
+}
+
+/* Commit devices that have been quiet for 'quiet_ms' to EEPROM.
+ */
+static void
+monitor_commit (monitor_args_t *args, uint64_t quiet_ms)
+{
+    size_t committed = 0;
+
+    if (wear_commit (quiet_ms, &committed))
+        perror ("wear_commit: ");
+    if (args->common_args.verbose && committed > 0)
+        printf ("committed %zu devices to EEPROM\n", committed);
+    fflush (stdout);
+}
+
+int
+main (int argc, char *argv[])
+{
+    static watch_device_t devices[WATCH_DEVICES_MAX];
+    static topo_target_t released[WATCH_DEVICES_MAX];
+    static fmt_buf_t out;
+    monitor_args_t args = { .devices = devices, .released = released };
+    struct sigaction action = { .sa_handler = on_signal };
+    watch_device_t *device = NULL;
+    watch_event_t event = WATCH_STABLE;
+    unsigned long polls = 0;
+    uint64_t commit_period = 0;
+    uint64_t next_commit = UINT64_MAX;
+    uint64_t next_metrics = UINT64_MAX;
+    uint64_t deadline = 0;
+    size_t i = 0;
+
+    fmt_init (&out, STDOUT_FILENO);
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    if (args.file != NULL && monitor_load (&args, args.file)) {
+        perror ("monitor_load: ");
+        exit (1);
+    }
+    if (args.commit_ms != 0 && !wear_on) {
+        fprintf (stderr, "--commit-after needs a --wear-file.\n");
+        exit (1);
+    }
+    if (args.device_count == 0 && args.socket == NULL && args.commit_ms == 0)
+        device_from_common (&args);
+    args.fixed_count = args.device_count;
+    if (args.socket != NULL &&
+        sub_listen (args.socket, args.socket_group, monitor_subscribed,
+                    &args)) {
+        perror ("sub_listen: ");
+        exit (1);
+    }
+    if (args.common_args.verbose)
+        dump_common_opts (&args.common_args);
+    /* no SA_RESTART, a signal has to cut the sleep short */
+    sigaction (SIGINT, &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+    watch_start (devices, args.device_count, &args.policy, now_ns ());
+    if (args.commit_ms != 0) {
+        /* a device is committed at most a quarter period late */
+        commit_period = args.commit_ms * 1000000 / 4;
+        next_commit = now_ns () + commit_period;
+    }
+    if (metrics_on)
+        next_metrics = now_ns () + MONITOR_METRICS_MS * 1000000ull;
+    while (!stop && (args.count == 0 || polls < args.count)) {
+        monitor_release (&args);
+        device = NULL;
+        for (i = 0; i < args.device_count; ++i)
+            if (device == NULL || devices[i].next_ns < device->next_ns)
+                device = &devices[i];
+        deadline = device ? device->next_ns : UINT64_MAX;
+        if (next_commit < deadline)
+            deadline = next_commit;
+        if (next_metrics < deadline)
+            deadline = next_metrics;
+        if (monitor_wait (&args, deadline))
+            continue;
+        if (now_ns () >= next_commit) {
+            monitor_commit (&args, args.commit_ms);
+            next_commit = now_ns () + commit_period;
+        }
+        if (now_ns () >= next_metrics) {
+            if (metrics_flush ())
+                perror ("metrics_flush: ");
+            next_metrics = now_ns () + MONITOR_METRICS_MS * 1000000ull;
+        }
+        if (device == NULL || now_ns () < device->next_ns)
+            continue;
+        event = watch_poll (device, &args.policy, now_ns ());
+        if (event != WATCH_ERROR && args.socket != NULL)
+            sub_publish (&device->target, &device->image);
+        monitor_report (&args, &out, device, event);
+        ++polls;
+    }
+    sub_close ();
+    if (args.commit_ms != 0)
+        monitor_commit (&args, 0);
+    if (args.common_args.verbose) {
+        printf ("Devices:\n");
+        for (i = 0; i < args.device_count; ++i) {
+            char name[64];
+
+            device_name (name, sizeof (name), &devices[i].target);
+            printf ("  %s: %llu polls, %llu drifts, %llu errors, "
+                    "interval %u ms\n", name,
+                    (unsigned long long)devices[i].polls,
+                    (unsigned long long)devices[i].drifts,
+                    (unsigned long long)devices[i].errors,
+                    devices[i].interval_ms);
+        }
+    }
+    exit (0);
+}
@@ -1,10 +1,12 @@
 #include "ds1077l.h"
 #include "ds1077l-mux.h"
+#include "ds1077l-probe.h"
 
 #include <argp.h>
 #include <linux/i2c-dev.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 static error_t parse_opts (int key, char *arg, struct argp_state *state);
 static void mux_args_init (mux_args_t *mux_args);
@@ -95,6 +97,12 @@ const struct argp_child argp_children[] = {
         .header = NULL,
         .group  = 0
     },
+    {
+        .argp   = &at_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
     { 0 }
 };
 
@@ -175,6 +183,7 @@ parse_opts (int key, char *arg, struct argp_state *state)
         case ARGP_KEY_INIT:
             mux_args_init (mux_args);
             state->child_inputs[0] = &(mux_args->common_args);
+            state->child_inputs[1] = &(mux_args->common_args);
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -216,6 +225,7 @@ mux_from_int (ds1077l_mux_t* mux, int32_t word)
      */
     mux->m1   = M1_UNPACK(word);
     mux->div1 = DIV1_UNPACK(word);
+    DS1077L_PROBE1 (mux__decode, word);
     return 0;
 }
 
@@ -287,31 +297,59 @@ mux_compare (ds1077l_mux_t *first, ds1077l_mux_t *second)
     return 0;
 }
 
+/* Pack a ds1077l_mux_t into the MUX WORD as it is sent over the bus.
+ */
+static uint16_t
+mux_to_int (ds1077l_mux_t *mux)
+{
+    return (PDN1_PACK(mux->pdn1) | PDN0_PACK(mux->pdn0) | \
+            SEL0_PACK(mux->sel0) | EN0_PACK(mux->en0)   | \
+            M0_PACK(mux->m0)     | M1_PACK(mux->m1)     | \
+            DIV1_PACK(mux->div1));
+}
+
 static int
 mux_get (int fd, ds1077l_mux_t* mux)
 {
     int32_t ret = 0;
 
-    ret = i2c_smbus_read_word_data(fd, COMMAND_MUX);
+    ret = xfer_read_word (fd, COMMAND_MUX);
     if (ret == -1)
         return ret;
     mux_from_int(mux, ret);
     return 0;
 }
 
+/* State threaded through lock_rmw: the register as found on the device and
+ * with the requested changes applied.
+ */
+typedef struct mux_update_ctx {
+    mux_args_t *args;
+    ds1077l_mux_t *current;
+    ds1077l_mux_t *next;
+    const at_t *at;             /* write no sooner than this, or NULL */
+    struct timespec issued;
+} mux_update_ctx_t;
+
 static int
-mux_set (int fd, ds1077l_mux_t *mux)
+mux_update (uint16_t current, uint16_t *next, void *arg)
 {
-    int32_t ret = 0;
-    uint16_t mux_word = 0;
+    mux_update_ctx_t *ctx = arg;
 
-    mux_word = (PDN1_PACK(mux->pdn1) | PDN0_PACK(mux->pdn0) | \
-                SEL0_PACK(mux->sel0) | EN0_PACK(mux->en0)   | \
-                M0_PACK(mux->m0)     | M1_PACK(mux->m1)     | \
-                DIV1_PACK(mux->div1));
-    ret = i2c_smbus_write_word_data (fd, COMMAND_MUX, mux_word);
-    if (ret == -1)
+    mux_from_int (ctx->current, current);
+    *ctx->next = *ctx->current;
+    mux_from_args (ctx->args, ctx->next);
+    if (mux_compare (ctx->current, ctx->next) == 0)
+        return 1;
+    *next = mux_to_int (ctx->next);
+    DS1077L_PROBE1 (mux__encode, *next);
+    /* between the read and the write, under the lock if it's taken. Only
+     * once: an optimistic retry re-runs this after the deadline and writes
+     * right away.
+     */
+    if (ctx->at != NULL && at_wait (ctx->at, &ctx->issued))
         return -1;
+    ctx->at = NULL;
     return 0;
 }
 
@@ -330,6 +368,33 @@ mux_pretty (ds1077l_mux_t* mux)
     printf("  DIV1: %s\n", mux->div1 ? "true" : "false");
 }
 
+/* Append MUX structure to the output buffer in a machine readable format.
+ */
+static void
+mux_format (fmt_buf_t *out, ds1077l_common_args_t *common_args,
+            ds1077l_mux_t* mux)
+{
+    fmt_record_t record = {
+        .bus_dev   = common_args->bus_dev,
+        .address   = common_args->address,
+        .reg       = "MUX",
+        .raw       = mux_to_int (mux),
+        .raw_width = 4,
+    };
+    fmt_field_t fields[] = {
+        { .name = "pdn1", .type = FIELD_BOOL, .value = mux->pdn1 },
+        { .name = "pdn0", .type = FIELD_BOOL, .value = mux->pdn0 },
+        { .name = "sel0", .type = FIELD_BOOL, .value = mux->sel0 },
+        { .name = "en0",  .type = FIELD_BOOL, .value = mux->en0 },
+        { .name = "m0",   .type = FIELD_UINT, .value = mux->m0 },
+        { .name = "m1",   .type = FIELD_UINT, .value = mux->m1 },
+        { .name = "div1", .type = FIELD_BOOL, .value = mux->div1 },
+    };
+
+    fmt_register (out, common_args->format, &record, fields,
+                  sizeof (fields) / sizeof (fields[0]));
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -337,7 +402,15 @@ main (int argc, char *argv[])
     mux_args_t mux_args = {0};
     ds1077l_mux_t mux_new = {0};
     ds1077l_mux_t mux_current = {0};
+    mux_update_ctx_t ctx = {
+        .args    = &mux_args,
+        .current = &mux_current,
+        .next    = &mux_new,
+    };
+    static fmt_buf_t out;
+    int ret = 0;
 
+    fmt_init (&out, STDOUT_FILENO);
     if (argp_parse (&argps, argc, argv, 0, NULL, &mux_args)) {
         perror ("argp_parse: \n");
         exit (1);
@@ -346,45 +419,58 @@ main (int argc, char *argv[])
         fprintf (stderr, "Specify either --get or --set.\n");
         exit (1);
     }
+    if (mux_args.get && mux_args.common_args.scheduled) {
+        fprintf (stderr, "--at only applies to --set.\n");
+        exit (1);
+    }
+    if (mux_args.common_args.scheduled)
+        ctx.at = &mux_args.common_args.at;
     if (mux_args.common_args.verbose)
         mux_args_dump (&mux_args);
-    fd = handle_get (mux_args.common_args.bus_dev,
-                     mux_args.common_args.address);
+    fd = handle_get_common (&mux_args.common_args);
     if (fd == -1) {
         perror ("handle_get: ");
         exit (1);
     }
-    if (mux_args.common_args.verbose)
-        printf ("Querying state of MUX register for device 0x%x on bus %s\n",
-               mux_args.common_args.address, mux_args.common_args.bus_dev);
-    /* get current register state and display to user */
-    if (mux_get (fd, &mux_current)) {
-        perror ("mux_set: ");
-        exit (1);
+    if (mux_args.get || mux_args.common_args.verbose) {
+        if (mux_args.common_args.verbose)
+            printf ("Querying state of MUX register for device 0x%x on bus "
+                    "%s\n", mux_args.common_args.address,
+                    mux_args.common_args.bus_dev);
+        /* get current register state and display to user */
+        if (mux_get (fd, &mux_current)) {
+            perror ("mux_get: ");
+            exit (1);
+        }
     }
-    if (mux_args.get || mux_args.common_args.verbose)
+    if (mux_args.get && mux_args.common_args.format != FORMAT_HUMAN) {
+        mux_format (&out, &mux_args.common_args, &mux_current);
+        if (fmt_flush (&out)) {
+            perror ("fmt_flush: ");
+            exit (1);
+        }
+    } else if (mux_args.get || mux_args.common_args.verbose) {
         mux_pretty (&mux_current);
+    }
     if (mux_args.get)
         exit (0);
-    /* determine whether any values are bing changed, exit if not */
-    mux_new = mux_current;
-    mux_from_args (&mux_args, &mux_new);
-    if (mux_args.common_args.verbose) {
-        printf ("Requested MUX register state:\n");
-        mux_pretty (&mux_new);
+    /* apply the requested changes to the register as it is on the device,
+     * nothing is written if they don't change anything */
+    ret = lock_rmw (fd, COMMAND_MUX, I2C_SMBUS_WORD_DATA, mux_update, &ctx);
+    if (ret == -1) {
+        perror ("mux_set: ");
+        exit (1);
     }
-    if (mux_compare (&mux_current, &mux_new) == 0) {
+    if (ret == 1) {
         printf ("No change requested in MUX register. Abort.\n");
         exit (0);
     }
+    if (mux_args.common_args.scheduled)
+        dump_at (&mux_args.common_args, &ctx.issued);
     if (mux_args.common_args.verbose) {
-        printf ("Setting MUX register for device 0x%x on bus %s to:\n",
+        printf ("Set MUX register for device 0x%x on bus %s to:\n",
                 mux_args.common_args.address, mux_args.common_args.bus_dev);
         mux_pretty (&mux_new);
     }
-    if (mux_set (fd, &mux_new)) {
-        perror ("mux_set: ");
-        exit (1);
-    }
     exit (0);
 }
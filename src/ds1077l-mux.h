@@ -1,3 +1,6 @@
+#ifndef _DS1077L_MUX_H_
+#define _DS1077L_MUX_H_
+
 #include "ds1077l.h"
 
 #include <stdbool.h>
@@ -85,7 +88,7 @@ typedef struct mux_args {
 
 /* Map divisor values to prescalar.
  */
-inline uint8_t
+static inline uint8_t
 encode_prescalar (uint8_t m)
 {
     switch (m) {
@@ -104,7 +107,7 @@ encode_prescalar (uint8_t m)
 
 /* Map prescalar values to divisor.
  */
-inline uint8_t decode_prescalar(uint8_t m)
+static inline uint8_t decode_prescalar(uint8_t m)
 {
     switch (m) {
     case 0:
@@ -119,3 +122,5 @@ inline uint8_t decode_prescalar(uint8_t m)
         return -1;
     }
 }
+
+#endif // #ifndef _DS1077L_MUX_H_
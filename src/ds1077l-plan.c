@@ -0,0 +1,363 @@
+#include "ds1077l-plan.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-writee2.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static int plan_open (const char *bus_dev, uint8_t address);
+static int32_t plan_access (int fd,
+                            char read_write,
+                            uint8_t command,
+                            int size,
+                            union i2c_smbus_data *data);
+static int plan_read_regs (int fd,
+                           const xfer_reg_t *regs,
+                           size_t count,
+                           uint16_t *values);
+
+const xfer_transport_t xfer_plan = {
+    .name   = "plan",
+    .open   = plan_open,
+    .access = plan_access,
+};
+
+const xfer_transport_t xfer_plan_rdwr = {
+    .name      = "plan",
+    .open      = plan_open,
+    .access    = plan_access,
+    .read_regs = plan_read_regs,
+};
+
+/* Register image of one device, DS1077L or PCA954x. */
+typedef struct plan_device {
+    uint8_t adapter;
+    uint8_t mux;
+    uint8_t channel;
+    uint8_t address;            /* follows the BUS register */
+    uint8_t bus;
+    uint8_t control;            /* PCA954x channel enable mask */
+    uint16_t div;
+    uint16_t mux_word;
+} plan_device_t;
+
+typedef struct plan_adapter {
+    uint32_t clock_hz;          /* 0 until looked up */
+    plan_stats_t stats;
+} plan_adapter_t;
+
+static plan_device_t devices[PLAN_DEVICES_MAX];
+static size_t device_count = 0;
+static plan_adapter_t adapters[XFER_ADAPTERS_MAX];
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Switch the transaction layer to the plan transport.
+ */
+int
+plan_init (bool rdwr)
+{
+    xfer_transport_set (rdwr ? &xfer_plan_rdwr : &xfer_plan);
+    return 0;
+}
+
+/* Nothing is opened, but the transaction layer identifies devices by file
+ * descriptor so hand out a real one.
+ */
+static int
+plan_open (const char *bus_dev, uint8_t address)
+{
+    return open ("/dev/null", O_RDWR);
+}
+
+/* SCL rate of adapter number 'adapter' as set in the device tree. */
+uint32_t
+plan_clock_hz (uint16_t adapter)
+{
+    char path[64];
+    uint8_t be[4] = { 0 };
+    uint32_t hz = 0;
+    int fd = 0;
+
+    snprintf (path, sizeof (path),
+              "/sys/class/i2c-adapter/i2c-%u/of_node/clock-frequency",
+              adapter);
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+    if (read (fd, be, sizeof (be)) == sizeof (be))
+        hz = (uint32_t)be[0] << 24 | be[1] << 16 | be[2] << 8 | be[3];
+    close (fd);
+    return hz;
+}
+
+/* SCL cycles an SMBus transaction keeps the bus busy: 9 per byte including
+ * the address, plus start and stop and a repeated start for reads with a
+ * command byte.
+ */
+uint32_t
+plan_cycles (char read_write, int size)
+{
+    uint32_t bytes = 0;
+    uint32_t conditions = 2;
+
+    switch (size) {
+    case I2C_SMBUS_QUICK:
+        /* as used for E2_WRITE: address and command */
+    case I2C_SMBUS_BYTE:
+        bytes = 2;
+        break;
+    case I2C_SMBUS_BYTE_DATA:
+        bytes = 3;
+        break;
+    case I2C_SMBUS_WORD_DATA:
+        bytes = 4;
+        break;
+    default:
+        bytes = 2;
+        break;
+    }
+    if (read_write == I2C_SMBUS_READ && size != I2C_SMBUS_BYTE &&
+        size != I2C_SMBUS_QUICK) {
+        /* the address goes out again after the repeated start */
+        ++bytes;
+        ++conditions;
+    }
+    return bytes * 9 + conditions;
+}
+
+static plan_device_t *
+plan_find (const xfer_target_t *target)
+{
+    plan_device_t *device = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < device_count; ++i) {
+        device = &devices[i];
+        if (device->adapter == target->adapter &&
+            device->mux == target->mux &&
+            device->channel == target->channel &&
+            device->address == target->address)
+            return device;
+    }
+    if (device_count == PLAN_DEVICES_MAX) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    device = &devices[device_count++];
+    memset (device, 0, sizeof (*device));
+    device->adapter = target->adapter;
+    device->mux = target->mux;
+    device->channel = target->channel;
+    device->address = target->address;
+    /* power-on defaults */
+    device->bus = ADDRESS_PACK (target->address);
+    device->div = DS1077L_DIV_DEFAULT_PACKED;
+    device->mux_word = SEL0_PACK (DS1077L_SEL0_DEFAULT) |
+                       EN0_PACK (DS1077L_EN0_DEFAULT);
+    return device;
+}
+
+/* Account for a transaction and print it, called with plan_lock held. */
+static void
+plan_record (const xfer_target_t *target,
+             const char *op,
+             const char *reg,
+             int width,
+             uint16_t value,
+             uint32_t cycles,
+             bool eeprom)
+{
+    plan_adapter_t *adapter = &adapters[target->adapter];
+    uint16_t number = xfer_adapter_number (target->adapter);
+    uint64_t us = 0;
+
+    if (adapter->clock_hz == 0) {
+        adapter->clock_hz = plan_clock_hz (number);
+        if (adapter->clock_hz == 0)
+            adapter->clock_hz = PLAN_CLOCK_HZ_DEFAULT;
+    }
+    us = ((uint64_t)cycles * 1000000 + adapter->clock_hz - 1) /
+         adapter->clock_hz;
+    ++adapter->stats.transactions;
+    adapter->stats.cycles += cycles;
+    if (eeprom) {
+        ++adapter->stats.eeprom_writes;
+        adapter->stats.eeprom_us += PLAN_EEPROM_US;
+    }
+    printf ("plan: %s", xfer_adapter_name (target->adapter));
+    if (target->mux != 0)
+        printf ("/%#x/%d", target->mux, target->channel);
+    printf ("/%#x %s %s", target->address, op, reg);
+    if (width > 0)
+        printf (" 0x%0*x", width, value);
+    printf (" (%u cycles, %llu us%s)\n", cycles, (unsigned long long)us,
+            eeprom ? ", EEPROM write" : "");
+}
+
+static int32_t
+plan_access (int fd,
+             char read_write,
+             uint8_t command,
+             int size,
+             union i2c_smbus_data *data)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    const char *op = read_write == I2C_SMBUS_READ ? "read" : "write";
+    uint32_t cycles = plan_cycles (read_write, size);
+    plan_device_t *device = NULL;
+    uint16_t *word = NULL;
+    bool eeprom = false;
+
+    pthread_mutex_lock (&plan_lock);
+    device = plan_find (target);
+    if (device == NULL) {
+        pthread_mutex_unlock (&plan_lock);
+        return -1;
+    }
+    if (size == I2C_SMBUS_BYTE) {
+        /* PCA954x control register, no command byte */
+        if (read_write == I2C_SMBUS_WRITE)
+            device->control = command;
+        else if (data != NULL)
+            data->byte = device->control;
+        plan_record (target, op, "control", 2, device->control, cycles,
+                     false);
+        pthread_mutex_unlock (&plan_lock);
+        return 0;
+    }
+    switch (command) {
+    case COMMAND_DIV:
+        word = &device->div;
+        break;
+    case COMMAND_MUX:
+        word = &device->mux_word;
+        break;
+    case COMMAND_BUS:
+        if (read_write == I2C_SMBUS_READ) {
+            data->byte = device->bus;
+        } else {
+            device->bus = data->byte & 0x0f;
+            device->address = ADDRESS_UNPACK (device->bus);
+            eeprom = !WC_UNPACK (device->bus);
+        }
+        plan_record (target, op, "BUS", 2, device->bus, cycles, eeprom);
+        pthread_mutex_unlock (&plan_lock);
+        return 0;
+    case COMMAND_E2_WRITE:
+        plan_record (target, op, "E2_WRITE", 0, 0, cycles, true);
+        pthread_mutex_unlock (&plan_lock);
+        return 0;
+    default:
+        pthread_mutex_unlock (&plan_lock);
+        errno = EIO;
+        return -1;
+    }
+    if (read_write == I2C_SMBUS_READ) {
+        data->word = *word;
+    } else {
+        *word = data->word;
+        eeprom = !WC_UNPACK (device->bus);
+    }
+    plan_record (target, op, xfer_command_name (target->address, command), 4, *word, cycles,
+                 eeprom);
+    pthread_mutex_unlock (&plan_lock);
+    return 0;
+}
+
+/* A combined read as issued by the rdwr transport: one message writing the
+ * command and one reading the register per register, separated by repeated
+ * starts, with a single start and stop around all of them.
+ */
+static int
+plan_read_regs (int fd,
+                const xfer_reg_t *regs,
+                size_t count,
+                uint16_t *values)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    union i2c_smbus_data data;
+    plan_adapter_t *adapter = NULL;
+    uint32_t cycles = 0;
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (plan_access (fd, I2C_SMBUS_READ, regs[i].command, regs[i].size,
+                         &data))
+            return -1;
+        values[i] = regs[i].size == I2C_SMBUS_WORD_DATA ? data.word :
+                                                           data.byte;
+    }
+    if (count < 2)
+        return 0;
+    /* hand back what merging the transactions saves: 'count' starts, stops
+     * and repeated starts turn into one start, one stop and 2 * count - 1
+     * repeated starts
+     */
+    pthread_mutex_lock (&plan_lock);
+    adapter = &adapters[target->adapter];
+    cycles = count - 1;
+    adapter->stats.cycles -= cycles;
+    adapter->stats.transactions -= count - 1;
+    printf ("plan: combined into one transfer, %u cycles saved\n", cycles);
+    pthread_mutex_unlock (&plan_lock);
+    return 0;
+}
+
+/* Totals for the interned adapter 'adapter'. Bus time is worked out from
+ * the cycle count so combined transfers are costed as a whole.
+ */
+int
+plan_stats (uint8_t adapter, plan_stats_t *stats)
+{
+    if (adapter >= XFER_ADAPTERS_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock (&plan_lock);
+    *stats = adapters[adapter].stats;
+    if (adapters[adapter].clock_hz != 0)
+        stats->bus_us = (stats->cycles * 1000000 +
+                         adapters[adapter].clock_hz - 1) /
+                        adapters[adapter].clock_hz;
+    pthread_mutex_unlock (&plan_lock);
+    return 0;
+}
+
+/* Print the estimated cost per adapter, registered to run at exit.
+ */
+void
+plan_report (void)
+{
+    plan_stats_t total = { 0 };
+    plan_stats_t stats = { 0 };
+    size_t i = 0;
+
+    printf ("Plan:\n");
+    for (i = 0; i < XFER_ADAPTERS_MAX; ++i) {
+        plan_stats (i, &stats);
+        if (stats.transactions == 0)
+            continue;
+        printf ("  %s: %llu transactions, %llu cycles at %u Hz%s, "
+                "%llu us on the bus, %llu EEPROM writes (%llu us)\n",
+                xfer_adapter_name (i),
+                (unsigned long long)stats.transactions,
+                (unsigned long long)stats.cycles, adapters[i].clock_hz,
+                plan_clock_hz (xfer_adapter_number (i)) ? "" : " (assumed)",
+                (unsigned long long)stats.bus_us,
+                (unsigned long long)stats.eeprom_writes,
+                (unsigned long long)stats.eeprom_us);
+        total.transactions += stats.transactions;
+        total.bus_us += stats.bus_us;
+        total.eeprom_us += stats.eeprom_us;
+    }
+    printf ("  total:   %llu transactions, %llu us\n",
+            (unsigned long long)total.transactions,
+            (unsigned long long)(total.bus_us + total.eeprom_us));
+}
@@ -0,0 +1,48 @@
+#ifndef _DS1077L_PLAN_H_
+#define _DS1077L_PLAN_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Planning: running a utility against a model of the bus.
+ *
+ * With --plan the utilities talk to the plan transport instead of the bus.
+ * It prints every transaction they issue (adapter, address, command, packed
+ * word) and answers reads from a register image of each device, starting
+ * out at the data sheet defaults and following the writes. So
+ * read-modify-write updates, mux selects and address changes come out the
+ * way they would on the bus, but no hardware is touched.
+ *
+ * Each transaction is costed by the clock cycles it keeps the bus busy: 9
+ * per byte (8 bits and the ACK) plus start, repeated start and stop
+ * conditions, at the adapter's clock rate read from the device tree in
+ * sysfs (100 kHz if it doesn't say). Every write that reaches the EEPROM,
+ * with WC clear or through E2_WRITE, adds the EEPROM write cycle time, during
+ * which the device doesn't answer. With --rdwr combined reads are costed as
+ * one transfer. The totals per adapter are printed on exit.
+ */
+#define PLAN_CLOCK_HZ_DEFAULT 100000
+#define PLAN_EEPROM_US        10000
+#define PLAN_DEVICES_MAX      XFER_TARGETS_MAX
+
+typedef struct plan_stats {
+    uint64_t transactions;
+    uint64_t cycles;            /* SCL cycles on the bus */
+    uint64_t eeprom_writes;
+    uint64_t bus_us;            /* cycles at the adapter's clock rate */
+    uint64_t eeprom_us;
+} plan_stats_t;
+
+extern const xfer_transport_t xfer_plan;
+extern const xfer_transport_t xfer_plan_rdwr;
+
+int plan_init (bool rdwr);
+uint32_t plan_clock_hz (uint16_t adapter);
+uint32_t plan_cycles (char read_write, int size);
+int plan_stats (uint8_t adapter, plan_stats_t *stats);
+void plan_report (void);
+
+#endif // #ifndef _DS1077L_PLAN_H_
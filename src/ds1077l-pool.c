@@ -0,0 +1,341 @@
+#include "ds1077l-pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef struct pool_entry {
+    char bus_dev[32];
+    uint8_t mux;
+    uint8_t channel;
+    uint8_t address;
+    int fd;
+    unsigned refs;              /* pool_get calls not yet put back */
+    uint64_t last_used;
+} pool_entry_t;
+
+static pool_entry_t pool[POOL_SIZE];
+static size_t pool_count = 0;
+static uint64_t pool_clock = 0;
+static pool_stats_t stats = { 0 };
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Adapter descriptors shared by all devices when using I2C_RDWR. */
+static struct {
+    char bus_dev[32];
+    int fd;
+} rdwr_adapters[XFER_ADAPTERS_MAX];
+static size_t rdwr_count = 0;
+
+static int rdwr_open (const char *bus_dev, uint8_t address);
+static int32_t rdwr_access (int fd,
+                            char read_write,
+                            uint8_t command,
+                            int size,
+                            union i2c_smbus_data *data);
+static int rdwr_read_regs (int fd,
+                           const xfer_reg_t *regs,
+                           size_t count,
+                           uint16_t *values);
+
+static int kernel_open (const char *bus_dev);
+static int kernel_transfer (int fd, struct i2c_rdwr_ioctl_data *rdwr);
+
+static const pool_rdwr_ops_t kernel_ops = {
+    .open     = kernel_open,
+    .transfer = kernel_transfer,
+};
+static const pool_rdwr_ops_t *rdwr_ops = &kernel_ops;
+
+const xfer_transport_t xfer_rdwr = {
+    .name      = "rdwr",
+    .open      = rdwr_open,
+    .access    = rdwr_access,
+    .read_regs = rdwr_read_regs,
+};
+
+/* Drop the least recently used handle nobody holds to make room for a new
+ * one. Returns -1 with errno set to EBUSY if every handle is held.
+ */
+static int
+pool_evict (void)
+{
+    size_t victim = POOL_SIZE;
+    size_t i = 0;
+
+    for (i = 0; i < pool_count; ++i)
+        if (pool[i].refs == 0 &&
+            (victim == POOL_SIZE || pool[i].last_used < pool[victim].last_used))
+            victim = i;
+    if (victim == POOL_SIZE) {
+        errno = EBUSY;
+        return -1;
+    }
+    xfer_unbind (pool[victim].fd);
+    close (pool[victim].fd);
+    pool[victim] = pool[--pool_count];
+    ++stats.evictions;
+    return 0;
+}
+
+static pool_entry_t *
+pool_find (int fd)
+{
+    size_t i = 0;
+
+    for (i = 0; i < pool_count; ++i)
+        if (pool[i].fd == fd)
+            return &pool[i];
+    return NULL;
+}
+
+/* Get a file descriptor for the device at 'address' on 'bus_dev', behind
+ * channel 'channel' of the mux at 'mux' if 'mux' isn't 0. A descriptor is
+ * only opened if the pool doesn't already hold one. The handle is held, and
+ * so never closed, until given back with pool_put. Returns -1 with errno
+ * set on failure.
+ */
+int
+pool_get (const char *bus_dev, uint8_t mux, uint8_t channel, uint8_t address)
+{
+    pool_entry_t *entry = NULL;
+    size_t i = 0;
+    int fd = -1;
+
+    pthread_mutex_lock (&pool_lock);
+    for (i = 0; i < pool_count; ++i) {
+        if (pool[i].address == address &&
+            pool[i].mux == mux &&
+            pool[i].channel == channel &&
+            strncmp (pool[i].bus_dev, bus_dev, sizeof (pool[i].bus_dev) - 1)
+                == 0) {
+            ++stats.hits;
+            ++pool[i].refs;
+            pool[i].last_used = ++pool_clock;
+            fd = pool[i].fd;
+            goto out;
+        }
+    }
+    ++stats.misses;
+    if (pool_count == POOL_SIZE && pool_evict ())
+        goto out;
+    fd = xfer_open (bus_dev, address);
+    if (fd == -1)
+        goto out;
+    if (mux != 0 && xfer_route (fd, mux, channel)) {
+        xfer_unbind (fd);
+        close (fd);
+        fd = -1;
+        goto out;
+    }
+    entry = &pool[pool_count++];
+    memset (entry->bus_dev, 0, sizeof (entry->bus_dev));
+    strncpy (entry->bus_dev, bus_dev, sizeof (entry->bus_dev) - 1);
+    entry->mux = mux;
+    entry->channel = channel;
+    entry->address = address;
+    entry->fd = fd;
+    entry->refs = 1;
+    entry->last_used = ++pool_clock;
+out:
+    pthread_mutex_unlock (&pool_lock);
+    return fd;
+}
+
+/* Hold a handle from pool_get once more, e.g. for a copy of it.
+ */
+void
+pool_hold (int fd)
+{
+    pool_entry_t *entry = NULL;
+
+    pthread_mutex_lock (&pool_lock);
+    entry = pool_find (fd);
+    if (entry != NULL)
+        ++entry->refs;
+    pthread_mutex_unlock (&pool_lock);
+}
+
+/* Give back a handle from pool_get or pool_hold. It stays open for the next
+ * pool_get but may be evicted once nobody holds it. -1 is ignored.
+ */
+void
+pool_put (int fd)
+{
+    pool_entry_t *entry = NULL;
+
+    if (fd == -1)
+        return;
+    pthread_mutex_lock (&pool_lock);
+    entry = pool_find (fd);
+    if (entry != NULL && entry->refs > 0)
+        --entry->refs;
+    pthread_mutex_unlock (&pool_lock);
+}
+
+/* Close every pooled handle.
+ */
+void
+pool_close (void)
+{
+    size_t i = 0;
+
+    pthread_mutex_lock (&pool_lock);
+    for (i = 0; i < pool_count; ++i) {
+        xfer_unbind (pool[i].fd);
+        close (pool[i].fd);
+    }
+    pool_count = 0;
+    for (i = 0; i < rdwr_count; ++i)
+        close (rdwr_adapters[i].fd);
+    rdwr_count = 0;
+    pthread_mutex_unlock (&pool_lock);
+}
+
+void
+pool_stats (pool_stats_t *out)
+{
+    pthread_mutex_lock (&pool_lock);
+    *out = stats;
+    pthread_mutex_unlock (&pool_lock);
+}
+
+/* Route xfer_rdwr through 'ops', NULL for the kernel. Set before the first
+ * pool_get.
+ */
+void
+pool_rdwr_set (const pool_rdwr_ops_t *ops)
+{
+    rdwr_ops = ops != NULL ? ops : &kernel_ops;
+}
+
+static int
+kernel_open (const char *bus_dev)
+{
+    return open (bus_dev, O_RDWR);
+}
+
+static int
+kernel_transfer (int fd, struct i2c_rdwr_ioctl_data *rdwr)
+{
+    return ioctl (fd, I2C_RDWR, rdwr);
+}
+
+/* Open an adapter once and hand out a duplicate of its descriptor per device.
+ * The slave address is never set on the descriptor, rdwr_access puts it in
+ * every message instead. Called with pool_lock held by pool_get.
+ */
+static int
+rdwr_open (const char *bus_dev, uint8_t address)
+{
+    size_t i = 0;
+    int fd = 0;
+
+    for (i = 0; i < rdwr_count; ++i)
+        if (strncmp (rdwr_adapters[i].bus_dev, bus_dev,
+                     sizeof (rdwr_adapters[i].bus_dev) - 1) == 0)
+            return dup (rdwr_adapters[i].fd);
+    if (rdwr_count == XFER_ADAPTERS_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+    fd = rdwr_ops->open (bus_dev);
+    if (fd == -1)
+        return -1;
+    strncpy (rdwr_adapters[rdwr_count].bus_dev, bus_dev,
+             sizeof (rdwr_adapters[0].bus_dev) - 1);
+    rdwr_adapters[rdwr_count++].fd = fd;
+    return dup (fd);
+}
+
+/* SMBus transactions expressed as I2C_RDWR messages. Word data goes over the
+ * wire low byte first, same as with the SMBus ioctl.
+ */
+static int32_t
+rdwr_access (int fd,
+             char read_write,
+             uint8_t command,
+             int size,
+             union i2c_smbus_data *data)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    struct i2c_rdwr_ioctl_data rdwr;
+    struct i2c_msg msgs[2];
+    uint8_t out[3] = { command, 0, 0 };
+    uint8_t in[2] = { 0, 0 };
+
+    msgs[0].addr  = target->address;
+    msgs[0].flags = 0;
+    msgs[0].len   = 1;
+    msgs[0].buf   = out;
+    rdwr.msgs  = msgs;
+    rdwr.nmsgs = 1;
+    if (read_write == I2C_SMBUS_READ) {
+        msgs[1].addr  = target->address;
+        msgs[1].flags = I2C_M_RD;
+        msgs[1].len   = size == I2C_SMBUS_WORD_DATA ? 2 : 1;
+        msgs[1].buf   = in;
+        rdwr.nmsgs = 2;
+    } else if (size == I2C_SMBUS_WORD_DATA) {
+        out[1] = data->word & 0xff;
+        out[2] = data->word >> 8;
+        msgs[0].len = 3;
+    } else if (size == I2C_SMBUS_BYTE_DATA) {
+        out[1] = data->byte;
+        msgs[0].len = 2;
+    }
+    if (rdwr_ops->transfer (fd, &rdwr) == -1)
+        return -1;
+    if (read_write == I2C_SMBUS_READ) {
+        if (size == I2C_SMBUS_WORD_DATA)
+            data->word = in[0] | in[1] << 8;
+        else
+            data->byte = in[0];
+    }
+    return 0;
+}
+
+/* Several register reads as one I2C_RDWR transfer: a command byte and a read
+ * per register, joined by repeated starts so the bus is held throughout.
+ */
+static int
+rdwr_read_regs (int fd,
+                const xfer_reg_t *regs,
+                size_t count,
+                uint16_t *values)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    struct i2c_rdwr_ioctl_data rdwr;
+    struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+    uint8_t out[I2C_RDWR_IOCTL_MAX_MSGS / 2];
+    uint8_t in[I2C_RDWR_IOCTL_MAX_MSGS / 2][2];
+    size_t i = 0;
+
+    if (count > I2C_RDWR_IOCTL_MAX_MSGS / 2) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < count; ++i) {
+        out[i] = regs[i].command;
+        msgs[2 * i].addr      = target->address;
+        msgs[2 * i].flags     = 0;
+        msgs[2 * i].len       = 1;
+        msgs[2 * i].buf       = &out[i];
+        msgs[2 * i + 1].addr  = target->address;
+        msgs[2 * i + 1].flags = I2C_M_RD;
+        msgs[2 * i + 1].len   = regs[i].size == I2C_SMBUS_WORD_DATA ? 2 : 1;
+        msgs[2 * i + 1].buf   = in[i];
+    }
+    rdwr.msgs  = msgs;
+    rdwr.nmsgs = 2 * count;
+    if (rdwr_ops->transfer (fd, &rdwr) == -1)
+        return -1;
+    for (i = 0; i < count; ++i)
+        values[i] = regs[i].size == I2C_SMBUS_WORD_DATA ?
+                    in[i][0] | in[i][1] << 8 : in[i][0];
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef _DS1077L_POOL_H_
+#define _DS1077L_POOL_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Pool of device handles keyed by (adapter, mux, channel, address).
+ *
+ * Getting a handle for a device that was used before returns the cached file
+ * descriptor, so hopping between devices doesn't re-open the adapter or
+ * re-issue I2C_SLAVE. With the I2C_RDWR transport (xfer_rdwr) each adapter
+ * is opened once and every message carries its own slave address, so no
+ * slave switching happens at all; the pool then hands out dup()s of the
+ * adapter descriptor, one per device.
+ *
+ * A handle is held from pool_get until pool_put, and only handles nobody
+ * holds are evicted, so a descriptor never gets closed, and its number
+ * reused for another device, under a thread still using it. Tools working
+ * on one device for their whole run never put theirs back.
+ */
+#define POOL_SIZE XFER_TARGETS_MAX
+
+struct i2c_rdwr_ioctl_data;
+
+/* How xfer_rdwr opens an adapter and runs an I2C_RDWR transfer on it,
+ * open(2) and the ioctl unless set otherwise, e.g. by the simulator.
+ */
+typedef struct pool_rdwr_ops {
+    int (*open) (const char *bus_dev);
+    int (*transfer) (int fd, struct i2c_rdwr_ioctl_data *rdwr);
+} pool_rdwr_ops_t;
+
+typedef struct pool_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} pool_stats_t;
+
+extern const xfer_transport_t xfer_rdwr;
+
+int pool_get (const char *bus_dev,
+              uint8_t mux,
+              uint8_t channel,
+              uint8_t address);
+void pool_hold (int fd);
+void pool_put (int fd);
+void pool_close (void);
+void pool_stats (pool_stats_t *stats);
+void pool_rdwr_set (const pool_rdwr_ops_t *ops);
+
+#endif // #ifndef _DS1077L_POOL_H_
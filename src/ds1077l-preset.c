@@ -0,0 +1,430 @@
+#include "ds1077l-preset.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-lock.h"
+#include "ds1077l-pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const preset_index_t *store = NULL;
+static size_t store_size = 0;
+
+static int
+parse_value (const char *arg, long min, long max, long *value)
+{
+    char *stop = NULL;
+
+    *value = strtol (arg, &stop, 0);
+    if (stop == arg || *stop != '\0' || *value < min || *value > max)
+        return -1;
+    return 0;
+}
+
+static bool
+prescalar_valid (long m)
+{
+    return m == 1 || m == 2 || m == 4 || m == 8;
+}
+
+/* Parse one line of a preset file. Returns 1 for blank lines and comments.
+ */
+int
+preset_parse (const char *line, preset_t *preset)
+{
+    char buf[256] = { 0 };
+    char *save = NULL;
+    char *token = NULL;
+    char *equals = NULL;
+    ds1077l_mux_t mux = {
+        .pdn1 = DS1077L_PDN1_DEFAULT,
+        .pdn0 = DS1077L_PDN0_DEFAULT,
+        .sel0 = DS1077L_SEL0_DEFAULT,
+        .en0  = DS1077L_EN0_DEFAULT,
+        /* the M*_DEFAULTs are the field contents, these are divisors */
+        .m0   = 1,
+        .m1   = 1,
+        .div1 = DS1077L_DIV1_DEFAULT,
+    };
+    long value = 0;
+
+    memset (preset, 0, sizeof (*preset));
+    if (strlen (line) >= sizeof (buf))
+        return -1;
+    strcpy (buf, line);
+    token = strtok_r (buf, " \t\r\n", &save);
+    if (token == NULL || token[0] == '#')
+        return 1;
+    if (strlen (token) >= sizeof (preset->name))
+        return -1;
+    strcpy (preset->name, token);
+    while ((token = strtok_r (NULL, " \t\r\n", &save)) != NULL) {
+        if (token[0] == '#')
+            break;
+        equals = strchr (token, '=');
+        if (equals == NULL)
+            return -1;
+        *equals = '\0';
+        if (strcmp (token, "n") == 0) {
+            if (parse_value (equals + 1, 2, 1025, &value))
+                return -1;
+            preset->div = DIV_PACK (value);
+            preset->regs |= PRESET_DIV;
+            continue;
+        }
+        if (strcmp (token, "wc") == 0) {
+            if (parse_value (equals + 1, 0, 1, &value))
+                return -1;
+            preset->wc = WC_PACK (value);
+            preset->regs |= PRESET_BUS;
+            continue;
+        }
+        if (strcmp (token, "m0") == 0 || strcmp (token, "m1") == 0) {
+            if (parse_value (equals + 1, 1, 8, &value) ||
+                !prescalar_valid (value))
+                return -1;
+        } else if (parse_value (equals + 1, 0, 1, &value)) {
+            return -1;
+        }
+        if (strcmp (token, "m0") == 0)
+            mux.m0 = value;
+        else if (strcmp (token, "m1") == 0)
+            mux.m1 = value;
+        else if (strcmp (token, "div1") == 0)
+            mux.div1 = value;
+        else if (strcmp (token, "en0") == 0)
+            mux.en0 = value;
+        else if (strcmp (token, "sel0") == 0)
+            mux.sel0 = value;
+        else if (strcmp (token, "pdn0") == 0)
+            mux.pdn0 = value;
+        else if (strcmp (token, "pdn1") == 0)
+            mux.pdn1 = value;
+        else
+            return -1;
+        preset->regs |= PRESET_MUX;
+    }
+    if (preset->regs & PRESET_MUX)
+        preset->mux = PDN1_PACK (mux.pdn1) | PDN0_PACK (mux.pdn0) |
+                      SEL0_PACK (mux.sel0) | EN0_PACK (mux.en0) |
+                      M0_PACK (mux.m0) | M1_PACK (mux.m1) |
+                      DIV1_PACK (mux.div1);
+    return preset->regs ? 0 : -1;
+}
+
+static int
+preset_compare (const void *a, const void *b)
+{
+    return strcmp (((const preset_t *)a)->name, ((const preset_t *)b)->name);
+}
+
+/* Compile the presets in the text file 'text' into the index file 'index'.
+ * The index is replaced atomically so running appliers never see half of
+ * one. Errors in the text are reported on stderr with their line number.
+ */
+int
+preset_compile (const char *text, const char *index)
+{
+    static preset_t presets[PRESET_MAX];
+    preset_index_t header = {
+        .magic   = PRESET_MAGIC,
+        .version = PRESET_VERSION,
+    };
+    char tmp[PATH_MAX];
+    char *line = NULL;
+    size_t size = 0;
+    size_t count = 0;
+    size_t lineno = 0;
+    size_t i = 0;
+    FILE *file = NULL;
+    int ret = 0;
+    int fd = 0;
+
+    file = fopen (text, "r");
+    if (file == NULL)
+        return -1;
+    while (getline (&line, &size, file) != -1) {
+        ++lineno;
+        if (count == PRESET_MAX) {
+            errno = E2BIG;
+            ret = -1;
+            break;
+        }
+        ret = preset_parse (line, &presets[count]);
+        if (ret == 1) {
+            ret = 0;
+            continue;
+        }
+        if (ret) {
+            fprintf (stderr, "%s:%zu: invalid preset\n", text, lineno);
+            errno = EINVAL;
+            break;
+        }
+        ++count;
+    }
+    free (line);
+    fclose (file);
+    if (ret)
+        return -1;
+    qsort (presets, count, sizeof (presets[0]), preset_compare);
+    for (i = 1; i < count; ++i) {
+        if (strcmp (presets[i - 1].name, presets[i].name) == 0) {
+            fprintf (stderr, "%s: preset %s defined twice\n", text,
+                     presets[i].name);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    header.count = count;
+    if (snprintf (tmp, sizeof (tmp), "%s.tmp", index) >= sizeof (tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    if (write (fd, &header, sizeof (header)) != sizeof (header) ||
+        write (fd, presets, count * sizeof (presets[0])) !=
+        count * sizeof (presets[0]) || close (fd)) {
+        unlink (tmp);
+        return -1;
+    }
+    return rename (tmp, index);
+}
+
+/* Map a compiled index for preset_find.
+ */
+int
+preset_open (const char *index)
+{
+    struct stat st;
+    void *map = NULL;
+    const preset_index_t *header = NULL;
+    int fd = 0;
+
+    fd = open (index, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat (fd, &st)) {
+        close (fd);
+        return -1;
+    }
+    if (st.st_size < sizeof (preset_index_t)) {
+        close (fd);
+        errno = EINVAL;
+        return -1;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return -1;
+    header = map;
+    if (header->magic != PRESET_MAGIC || header->version != PRESET_VERSION ||
+        st.st_size != sizeof (*header) +
+                      (size_t)header->count * sizeof (preset_t)) {
+        munmap (map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    preset_close ();
+    store = header;
+    store_size = st.st_size;
+    return 0;
+}
+
+/* Look up a preset by name. Returns NULL with errno set to ENOENT if there
+ * is none.
+ */
+const preset_t *
+preset_find (const char *name)
+{
+    preset_t key = { 0 };
+    const preset_t *preset = NULL;
+
+    if (store == NULL || strlen (name) >= sizeof (key.name)) {
+        errno = ENOENT;
+        return NULL;
+    }
+    strcpy (key.name, name);
+    preset = bsearch (&key, store->presets, store->count, sizeof (preset_t),
+                      preset_compare);
+    if (preset == NULL)
+        errno = ENOENT;
+    return preset;
+}
+
+const preset_t *
+preset_list (size_t *count)
+{
+    *count = store ? store->count : 0;
+    return store ? store->presets : NULL;
+}
+
+/* Write a preset to a device. BUS goes first so setting WC keeps the DIV
+ * and MUX writes out of the EEPROM. The registers are written whole, so
+ * there's no read-modify-write to protect with the device lock.
+ */
+int
+preset_apply (const preset_t *preset, const topo_target_t *target)
+{
+    int ret = -1;
+    int fd = 0;
+
+    fd = pool_get (target->bus_dev, target->mux, target->channel,
+                   target->address);
+    if (fd == -1)
+        return -1;
+    if ((preset->regs & PRESET_BUS) &&
+        xfer_write_byte (fd, COMMAND_BUS,
+                         ADDRESS_PACK (target->address) | preset->wc) == -1)
+        goto out;
+    if ((preset->regs & PRESET_DIV) &&
+        xfer_write_word (fd, COMMAND_DIV, preset->div) == -1)
+        goto out;
+    if ((preset->regs & PRESET_MUX) &&
+        xfer_write_word (fd, COMMAND_MUX, preset->mux) == -1)
+        goto out;
+    ret = 0;
+out:
+    pool_put (fd);
+    return ret;
+}
+
+/* Stage a preset on a device for preset_fire: address it and work out the
+ * writes, with a band under the device lock from reading DIV and MUX, see
+ * preset_apply_band. The handle is held until the preset is fired or
+ * cancelled. Returns 0 or -1 with errno set, nothing held.
+ */
+int
+preset_stage (const preset_t *preset,
+              const topo_target_t *target,
+              const transition_band_t *band,
+              preset_staged_t *staged)
+{
+    static const xfer_reg_t regs[] = {
+        { .command = COMMAND_DIV, .size = I2C_SMBUS_WORD_DATA },
+        { .command = COMMAND_MUX, .size = I2C_SMBUS_WORD_DATA },
+    };
+    transition_t *transition = &staged->transition;
+    uint16_t values[2];
+    int err = 0;
+
+    staged->fd = pool_get (target->bus_dev, target->mux, target->channel,
+                           target->address);
+    if (staged->fd == -1)
+        return -1;
+    staged->locked = false;
+    staged->bus = preset->regs & PRESET_BUS;
+    staged->bus_byte = ADDRESS_PACK (target->address) | preset->wc;
+    transition->count = 0;
+    if (band == NULL || !(preset->regs & (PRESET_DIV | PRESET_MUX))) {
+        /* selects the mux channel and the address, the writes are all
+         * that's left */
+        if (xfer_read_byte (staged->fd, COMMAND_BUS) == -1)
+            goto err_put;
+        if (preset->regs & PRESET_DIV)
+            transition->writes[transition->count++] = (transition_write_t) {
+                .command = COMMAND_DIV,
+                .word    = preset->div,
+            };
+        if (preset->regs & PRESET_MUX)
+            transition->writes[transition->count++] = (transition_write_t) {
+                .command = COMMAND_MUX,
+                .word    = preset->mux,
+            };
+        return 0;
+    }
+    if (lock_acquire (staged->fd))
+        goto err_put;
+    staged->locked = true;
+    if (xfer_read_regs (staged->fd, regs, 2, values) ||
+        transition_plan (band, values[0], values[1],
+                         preset->regs & PRESET_DIV ? preset->div : values[0],
+                         preset->regs & PRESET_MUX ? preset->mux : values[1],
+                         transition)) {
+        err = errno;
+        preset_cancel (staged);
+        errno = err;
+        return -1;
+    }
+    return 0;
+err_put:
+    err = errno;
+    pool_put (staged->fd);
+    errno = err;
+    return -1;
+}
+
+/* Issue the writes of a staged preset, BUS first as in preset_apply, and
+ * drop the device lock and handle. Returns 0 or -1 with errno set.
+ */
+int
+preset_fire (preset_staged_t *staged)
+{
+    bool locked = false;
+    int ret = 0;
+    int err = 0;
+
+    if (staged->bus &&
+        xfer_write_byte (staged->fd, COMMAND_BUS, staged->bus_byte) == -1)
+        ret = -1;
+    if (ret == 0)
+        ret = transition_apply (staged->fd, &staged->transition);
+    err = errno;
+    locked = staged->locked;
+    staged->locked = false;
+    if (locked && lock_release (staged->fd) && ret == 0) {
+        err = errno;
+        ret = -1;
+    }
+    pool_put (staged->fd);
+    errno = err;
+    return ret;
+}
+
+/* Drop a staged preset without writing it. */
+void
+preset_cancel (preset_staged_t *staged)
+{
+    if (staged->locked)
+        lock_release (staged->fd);
+    staged->locked = false;
+    pool_put (staged->fd);
+}
+
+/* Write a preset to a device keeping OUT1 inside 'band' on the way, see
+ * transition_plan. DIV and MUX are read first, under the device lock so the
+ * plan starts from where the device is, and only what differs is written.
+ * Without a band, or a DIV or MUX setting, it's preset_apply.
+ */
+int
+preset_apply_band (const preset_t *preset,
+                   const topo_target_t *target,
+                   const transition_band_t *band)
+{
+    preset_staged_t staged = { 0 };
+
+    if (band == NULL || !(preset->regs & (PRESET_DIV | PRESET_MUX)))
+        return preset_apply (preset, target);
+    if (preset_stage (preset, target, band, &staged))
+        return -1;
+    return preset_fire (&staged);
+}
+
+void
+preset_close (void)
+{
+    if (store == NULL)
+        return;
+    munmap ((void *)store, store_size);
+    store = NULL;
+    store_size = 0;
+}
@@ -0,0 +1,90 @@
+#ifndef _DS1077L_PRESET_H_
+#define _DS1077L_PRESET_H_
+
+#include "ds1077l-topo.h"
+#include "ds1077l-transition.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Named register presets.
+ *
+ * Presets are written one per line in a text file as a name followed by
+ * settings, e.g.:
+ *
+ *   # NAME       SETTING...
+ *   test-clock   n=10 m0=2 en0=1 sel0=1
+ *   low-power    pdn0=1 pdn1=1
+ *   production   n=4 m0=1 wc=1
+ *
+ * n sets the DIV register. m0, m1, div1, en0, sel0, pdn0 and pdn1 set the
+ * MUX register, fields left out take their data sheet defaults. wc sets
+ * the WC bit of the BUS register, whose address bits are the device's own.
+ * Only registers with settings are written.
+ *
+ * preset_compile turns the text into an index of register words packed
+ * ahead of time, sorted by name. Applying a preset maps the index, finds
+ * the name with a binary search and writes the words as they are: nothing
+ * is parsed, packed or read back from the device. preset_apply_band reads
+ * DIV and MUX first, to change OUT1 without leaving a band on the way.
+ *
+ * preset_stage does all of that but the writes, which preset_fire issues
+ * later, e.g. at an agreed time. A staged device is addressed and, with a
+ * band, holds the device lock until it's fired or dropped with
+ * preset_cancel.
+ */
+#define PRESET_ENV      "DS1077L_PRESETS"
+#define PRESET_DEFAULT  "/etc/ds1077l.presets"
+#define PRESET_MAGIC    0x5453455237373031ull
+#define PRESET_VERSION  1
+#define PRESET_NAME_MAX 32
+#define PRESET_MAX      1024
+
+/* Registers a preset writes. */
+#define PRESET_DIV 0x1
+#define PRESET_MUX 0x2
+#define PRESET_BUS 0x4
+
+typedef struct preset {
+    char name[PRESET_NAME_MAX];
+    uint16_t div;
+    uint16_t mux;
+    uint8_t wc;                 /* packed, ORed with the address bits */
+    uint8_t regs;
+    uint16_t reserved;
+} preset_t;
+
+typedef struct preset_index {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+    preset_t presets[];
+} preset_index_t;
+
+typedef struct preset_staged {
+    int fd;
+    bool locked;
+    bool bus;
+    uint8_t bus_byte;
+    transition_t transition;
+} preset_staged_t;
+
+int preset_parse (const char *line, preset_t *preset);
+int preset_compile (const char *text, const char *index);
+int preset_open (const char *index);
+const preset_t *preset_find (const char *name);
+const preset_t *preset_list (size_t *count);
+int preset_apply (const preset_t *preset, const topo_target_t *target);
+int preset_apply_band (const preset_t *preset,
+                       const topo_target_t *target,
+                       const transition_band_t *band);
+int preset_stage (const preset_t *preset,
+                  const topo_target_t *target,
+                  const transition_band_t *band,
+                  preset_staged_t *staged);
+int preset_fire (preset_staged_t *staged);
+void preset_cancel (preset_staged_t *staged);
+void preset_close (void);
+
+#endif // #ifndef _DS1077L_PRESET_H_
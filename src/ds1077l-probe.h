@@ -0,0 +1,64 @@
+#ifndef _DS1077L_PROBE_H_
+#define _DS1077L_PROBE_H_
+
+/* USDT probes for bpftrace / perf. When built against systemtap's sys/sdt.h
+ * each probe is a nop instruction plus an ELF note describing its arguments,
+ * they cost nothing unless a tracer is attached. Without the header the
+ * probes compile away entirely.
+ *
+ * Probes (provider ds1077l):
+ *   xfer__start  (adapter, address, command, read_write, payload)
+ *   xfer__done   (adapter, address, command, read_write, payload, errno,
+ *                 duration_ns)
+ *   xfer__retry  (adapter, address, command, attempt, errno)
+ *   div__decode  (raw, n)            div__encode  (n, raw)
+ *   mux__decode  (raw)               mux__encode  (raw)
+ *   bus__decode  (raw, address, wc)  bus__encode  (address, wc, raw)
+ *   lock__wait   (address, wait_ns)
+ *   lock__conflict (address, written, read_back)
+ *
+ * 'adapter' is the bus device node as a C string. 'payload' is only
+ * meaningful for writes on xfer__start and for successful reads on
+ * xfer__done.
+ *
+ * Every probe has a semaphore that tracers count up while attached to it.
+ * Arguments that take work to compute, like the timestamps behind
+ * duration_ns, are only computed while DS1077L_PROBE_ENABLED says the probe
+ * is traced. The semaphores are defined once, in ds1077l-xfer.c.
+ */
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define DS1077L_PROBE1(name, a)                  DTRACE_PROBE1 (ds1077l, name, a)
+#define DS1077L_PROBE2(name, a, b)               DTRACE_PROBE2 (ds1077l, name, a, b)
+#define DS1077L_PROBE3(name, a, b, c)            DTRACE_PROBE3 (ds1077l, name, a, b, c)
+#define DS1077L_PROBE5(name, a, b, c, d, e)      DTRACE_PROBE5 (ds1077l, name, a, b, c, d, e)
+#define DS1077L_PROBE7(name, a, b, c, d, e, f, g) \
+    DTRACE_PROBE7 (ds1077l, name, a, b, c, d, e, f, g)
+#define DS1077L_SEMAPHORE(name) ds1077l_##name##_semaphore
+#define DS1077L_SEMAPHORE_DEFINE(name) \
+    volatile unsigned short DS1077L_SEMAPHORE (name) \
+        __attribute__ ((section (".probes")))
+#define DS1077L_PROBE_ENABLED(name) \
+    __builtin_expect (DS1077L_SEMAPHORE (name) != 0, 0)
+extern volatile unsigned short DS1077L_SEMAPHORE (xfer__start);
+extern volatile unsigned short DS1077L_SEMAPHORE (xfer__done);
+extern volatile unsigned short DS1077L_SEMAPHORE (xfer__retry);
+extern volatile unsigned short DS1077L_SEMAPHORE (div__decode);
+extern volatile unsigned short DS1077L_SEMAPHORE (div__encode);
+extern volatile unsigned short DS1077L_SEMAPHORE (mux__decode);
+extern volatile unsigned short DS1077L_SEMAPHORE (mux__encode);
+extern volatile unsigned short DS1077L_SEMAPHORE (bus__decode);
+extern volatile unsigned short DS1077L_SEMAPHORE (bus__encode);
+extern volatile unsigned short DS1077L_SEMAPHORE (lock__wait);
+extern volatile unsigned short DS1077L_SEMAPHORE (lock__conflict);
+#else
+#define DS1077L_PROBE1(name, a)
+#define DS1077L_PROBE2(name, a, b)
+#define DS1077L_PROBE3(name, a, b, c)
+#define DS1077L_PROBE5(name, a, b, c, d, e)
+#define DS1077L_PROBE7(name, a, b, c, d, e, f, g)
+#define DS1077L_PROBE_ENABLED(name) 0
+#endif
+
+#endif // #ifndef _DS1077L_PROBE_H_
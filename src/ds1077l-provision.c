@@ -0,0 +1,295 @@
+#include "ds1077l.h"
+#include "ds1077l-addrplan.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct provision_args {
+    ds1077l_common_args_t common_args;
+    char *file;
+    addrplan_scope_t scope;
+    bool dry_run;
+    addrplan_device_t *devices;
+    size_t count;
+} provision_args_t;
+
+/* Steps for one adapter, run by their own thread. */
+typedef struct provision_job {
+    pthread_t thread;
+    const char *bus_dev;
+    addrplan_device_t *devices;
+    addrplan_step_t *steps;
+    size_t step_count;
+    size_t failed;              /* index of the failed step or step_count */
+    int err;
+} provision_job_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "file",
+        .key   = 'f',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Read devices to provision from FILE, one per line. Lines "
+                 "starting with '#' are ignored.",
+        .group = 1
+    },
+    {
+        .name  = "scope",
+        .key   = 's',
+        .arg   = "segment|adapter",
+        .flags = 0,
+        .doc   = "Make addresses unique per mux channel or per adapter. "
+                 "Defaults to segment.",
+        .group = 1
+    },
+    {
+        .name  = "dry-run",
+        .key   = 'n',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Print the plan without touching any device.",
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "[ADAPTER[/MUX/CHANNEL]/ADDRESS[=NEW_ADDRESS]...]",
+    .doc         = "Give a set of Maxim DS1077L programmable oscillators "
+                   "unique addresses. Devices without a new address are "
+                   "assigned one. Adapters are provisioned in parallel.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static int
+device_add (provision_args_t *args, const char *arg)
+{
+    if (args->count == ADDRPLAN_DEVICES_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (addrplan_parse (arg, &args->devices[args->count])) {
+        errno = EINVAL;
+        return -1;
+    }
+    ++args->count;
+    return 0;
+}
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    provision_args_t *args = state->input;
+
+    switch (key) {
+        case 'f':
+            args->file = arg;
+            break;
+        case 's':
+            if (addrplan_scope_parse (arg, &args->scope))
+                argp_usage (state);
+            break;
+        case 'n':
+            args->dry_run = true;
+            break;
+        case ARGP_KEY_ARG:
+            if (device_add (args, arg))
+                argp_failure (state, 1, errno, "%s", arg);
+            break;
+        case ARGP_KEY_INIT:
+            args->file = NULL;
+            args->scope = SCOPE_SEGMENT;
+            args->dry_run = false;
+            state->child_inputs[0] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Add the devices listed in a file.
+ */
+static int
+provision_load (provision_args_t *args, const char *path)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len = 0;
+    FILE *file = NULL;
+    int ret = 0;
+
+    file = fopen (path, "r");
+    if (file == NULL)
+        return -1;
+    while ((len = getline (&line, &size, file)) != -1) {
+        while (len > 0 && strchr (" \t\r\n", line[len - 1]) != NULL)
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+        ret = device_add (args, line);
+        if (ret) {
+            fprintf (stderr, "%s: %s\n", path, line);
+            break;
+        }
+    }
+    free (line);
+    fclose (file);
+    return ret;
+}
+
+static void
+target_print (FILE *out, const topo_target_t *target, uint8_t address)
+{
+    if (target->mux == 0)
+        fprintf (out, "%s/%#x", target->bus_dev, address);
+    else
+        fprintf (out, "%s/%#x/%d/%#x", target->bus_dev, target->mux,
+                 target->channel, address);
+}
+
+static void
+plan_pretty (addrplan_device_t *devices,
+             addrplan_step_t *steps,
+             size_t step_count)
+{
+    size_t i = 0;
+
+    printf ("Plan:\n");
+    for (i = 0; i < step_count; ++i) {
+        printf ("  ");
+        target_print (stdout, &devices[steps[i].device].target, steps[i].from);
+        printf (" -> %#x%s\n", steps[i].to, steps[i].commit ? " commit" : "");
+    }
+}
+
+static void *
+provision_run (void *arg)
+{
+    provision_job_t *job = arg;
+    addrplan_step_t *step = NULL;
+    addrplan_device_t *device = NULL;
+    size_t i = 0;
+
+    job->failed = job->step_count;
+    for (i = 0; i < job->step_count; ++i) {
+        step = &job->steps[i];
+        device = &job->devices[step->device];
+        if (strcmp (device->target.bus_dev, job->bus_dev) != 0)
+            continue;
+        if (addrplan_move (device, step)) {
+            /* later steps on this adapter may depend on this one */
+            job->err = errno;
+            job->failed = i;
+            break;
+        }
+    }
+    return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+    static addrplan_device_t devices[ADDRPLAN_DEVICES_MAX];
+    static addrplan_step_t steps[ADDRPLAN_STEPS_MAX];
+    provision_job_t jobs[XFER_ADAPTERS_MAX] = { 0 };
+    provision_args_t args = { .devices = devices };
+    provision_job_t *job = NULL;
+    size_t step_count = 0;
+    size_t job_count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int ret = 0;
+
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    if (args.file != NULL && provision_load (&args, args.file)) {
+        perror ("provision_load: ");
+        exit (1);
+    }
+    if (args.count == 0) {
+        fprintf (stderr, "No devices to provision.\n");
+        exit (1);
+    }
+    if (args.common_args.verbose)
+        dump_common_opts (&args.common_args);
+    if (addrplan_make (devices, args.count, args.scope, steps, &step_count)) {
+        perror ("addrplan_make: ");
+        exit (1);
+    }
+    if (args.dry_run || args.common_args.verbose)
+        plan_pretty (devices, steps, step_count);
+    if (args.dry_run)
+        exit (0);
+    /* one job per adapter, they share nothing */
+    for (i = 0; i < step_count; ++i) {
+        const char *bus_dev = devices[steps[i].device].target.bus_dev;
+
+        for (j = 0; j < job_count; ++j)
+            if (strcmp (jobs[j].bus_dev, bus_dev) == 0)
+                break;
+        if (j < job_count)
+            continue;
+        if (job_count == XFER_ADAPTERS_MAX) {
+            fprintf (stderr, "Too many adapters.\n");
+            exit (1);
+        }
+        jobs[job_count++] = (provision_job_t) {
+            .bus_dev    = bus_dev,
+            .devices    = devices,
+            .steps      = steps,
+            .step_count = step_count,
+        };
+    }
+    for (i = 0; i < job_count; ++i) {
+        errno = pthread_create (&jobs[i].thread, NULL, provision_run, &jobs[i]);
+        if (errno != 0) {
+            perror ("pthread_create: ");
+            exit (1);
+        }
+    }
+    for (i = 0; i < job_count; ++i) {
+        job = &jobs[i];
+        pthread_join (job->thread, NULL);
+        if (job->failed == job->step_count)
+            continue;
+        fprintf (stderr, "Failed to move ");
+        target_print (stderr, &devices[steps[job->failed].device].target,
+                      steps[job->failed].from);
+        fprintf (stderr, " to %#x: %s\n", steps[job->failed].to,
+                 strerror (job->err));
+        ret = 1;
+    }
+    for (i = 0; i < args.count; ++i) {
+        target_print (stdout, &devices[i].target, devices[i].target.address);
+        if (devices[i].committed ||
+            devices[i].final == devices[i].target.address)
+            printf (" %#x\n", devices[i].final);
+        else
+            printf (" failed\n");
+    }
+    exit (ret);
+}
@@ -0,0 +1,349 @@
+#include "ds1077l-record.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+bool record_on = false;
+static int record_fd = -1;
+static record_entry_t record_buffer[RECORD_BUFFER];
+static size_t record_count = 0;
+/* transactions on different adapters are recorded from different threads */
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static record_entry_t *replay_entries = NULL;
+static size_t replay_count = 0;
+static size_t replay_cursor = 0;
+static replay_pacing_t replay_pacing = REPLAY_FAST;
+static uint64_t replay_base = 0;
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int replay_open (const char *bus_dev, uint8_t address);
+static int32_t replay_access (int fd,
+                              char read_write,
+                              uint8_t command,
+                              int size,
+                              union i2c_smbus_data *data);
+
+const xfer_transport_t xfer_replay = {
+    .name   = "replay",
+    .open   = replay_open,
+    .access = replay_access,
+};
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+write_all (int fd, const void *buf, size_t len)
+{
+    const char *ptr = buf;
+    ssize_t ret = 0;
+
+    while (len > 0) {
+        ret = write (fd, ptr, len);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static int
+record_write_buffer (void)
+{
+    if (record_count == 0)
+        return 0;
+    if (write_all (record_fd, record_buffer,
+                   record_count * sizeof (record_buffer[0])))
+        return -1;
+    record_count = 0;
+    return 0;
+}
+
+/* Append the buffered records to the capture file.
+ */
+int
+record_flush (void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock (&record_lock);
+    ret = record_write_buffer ();
+    pthread_mutex_unlock (&record_lock);
+    return ret;
+}
+
+static void
+record_atexit (void)
+{
+    if (record_flush ())
+        perror ("record_flush: ");
+}
+
+/* Start capturing transactions to 'path', creating it if needed.
+ */
+int
+record_init (const char *path)
+{
+    record_header_t header = {
+        .magic   = RECORD_MAGIC,
+        .version = RECORD_VERSION,
+    };
+    record_header_t existing = { 0 };
+    record_entry_t *run = NULL;
+    struct stat st;
+    int err = 0;
+
+    record_fd = open (path, O_RDWR | O_APPEND | O_CREAT, 0644);
+    if (record_fd == -1)
+        return -1;
+    if (fstat (record_fd, &st))
+        goto err_close;
+    if (st.st_size == 0) {
+        if (write_all (record_fd, &header, sizeof (header)))
+            goto err_close;
+    } else if (pread (record_fd, &existing, sizeof (existing), 0) !=
+                   sizeof (existing) ||
+               existing.magic != RECORD_MAGIC ||
+               existing.version != RECORD_VERSION) {
+        errno = EINVAL;
+        goto err_close;
+    }
+    if (atexit (record_atexit))
+        goto err_close;
+    /* where this run's clock starts, replay doesn't wait for the gap to
+     * the runs before it
+     */
+    pthread_mutex_lock (&record_lock);
+    run = &record_buffer[record_count++];
+    memset (run, 0, sizeof (*run));
+    run->timestamp_ns = now_ns ();
+    run->read_write = RECORD_RUN;
+    pthread_mutex_unlock (&record_lock);
+    record_on = true;
+    return 0;
+err_close:
+    err = errno;
+    close (record_fd);
+    record_fd = -1;
+    errno = err;
+    return -1;
+}
+
+void
+record_write (const xfer_target_t *target,
+              uint8_t command,
+              char read_write,
+              int size,
+              uint16_t payload,
+              int err,
+              uint64_t start_ns,
+              uint64_t duration_ns)
+{
+    record_entry_t *entry = NULL;
+
+    pthread_mutex_lock (&record_lock);
+    if (record_count == RECORD_BUFFER && record_write_buffer ())
+        goto out;
+    entry = &record_buffer[record_count++];
+    memset (entry, 0, sizeof (*entry));
+    entry->timestamp_ns = start_ns;
+    entry->duration_ns  = duration_ns > UINT32_MAX ? UINT32_MAX : duration_ns;
+    entry->adapter      = xfer_adapter_number (target->adapter);
+    entry->payload      = payload;
+    entry->err          = err;
+    entry->mux          = target->mux;
+    entry->channel      = target->channel;
+    entry->address      = target->address;
+    entry->command      = command;
+    entry->read_write   = read_write;
+    entry->size         = size;
+out:
+    pthread_mutex_unlock (&record_lock);
+}
+
+int
+replay_pacing_parse (const char *arg, replay_pacing_t *pacing)
+{
+    if (strcmp (arg, "fast") == 0)
+        *pacing = REPLAY_FAST;
+    else if (strcmp (arg, "recorded") == 0)
+        *pacing = REPLAY_RECORDED;
+    else
+        return -1;
+    return 0;
+}
+
+/* Turn the recorded start times into offsets from the start of the capture,
+ * each run following on from where the one before it ended. Runs are made
+ * hours apart, or on either side of a reboot resetting CLOCK_MONOTONIC, and
+ * only the timing within a run means anything. A capture without run
+ * records is one run.
+ */
+static void
+replay_timeline (record_entry_t *entries, size_t count)
+{
+    uint64_t start = count > 0 ? entries[0].timestamp_ns : 0;
+    uint64_t offset = 0;
+    uint64_t end = 0;
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (entries[i].read_write == RECORD_RUN) {
+            start = entries[i].timestamp_ns;
+            offset = end;
+            /* never answers anything */
+            entries[i].used = 1;
+        }
+        entries[i].timestamp_ns = offset + (entries[i].timestamp_ns > start ?
+                                            entries[i].timestamp_ns - start :
+                                            0);
+        if (entries[i].timestamp_ns + entries[i].duration_ns > end)
+            end = entries[i].timestamp_ns + entries[i].duration_ns;
+    }
+}
+
+/* Load a capture and make the replay transport the current transport.
+ */
+int
+replay_init (const char *path, replay_pacing_t pacing)
+{
+    record_header_t *header = NULL;
+    struct stat st;
+    void *map = NULL;
+    int fd = 0;
+
+    fd = open (path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (fstat (fd, &st))
+        goto err_close;
+    if (st.st_size < sizeof (*header) ||
+        (st.st_size - sizeof (*header)) % sizeof (record_entry_t) != 0) {
+        errno = EINVAL;
+        goto err_close;
+    }
+    /* private mapping, the 'used' flags are never written back */
+    map = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        goto err_close;
+    close (fd);
+    header = map;
+    if (header->magic != RECORD_MAGIC || header->version != RECORD_VERSION) {
+        munmap (map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock (&replay_lock);
+    replay_entries = (record_entry_t *)(header + 1);
+    replay_count = (st.st_size - sizeof (*header)) / sizeof (record_entry_t);
+    replay_timeline (replay_entries, replay_count);
+    replay_cursor = 0;
+    replay_pacing = pacing;
+    replay_base = 0;
+    pthread_mutex_unlock (&replay_lock);
+    xfer_transport_set (&xfer_replay);
+    return 0;
+err_close:
+    close (fd);
+    return -1;
+}
+
+/* Nothing is opened, but the transaction layer identifies devices by file
+ * descriptor so hand out a real one.
+ */
+static int
+replay_open (const char *bus_dev, uint8_t address)
+{
+    return open ("/dev/null", O_RDWR);
+}
+
+/* Sleep until the point relative to the start of the replay at which the
+ * recorded transaction completed, on the timeline replay_timeline made.
+ */
+static void
+replay_wait (const record_entry_t *entry)
+{
+    uint64_t deadline = 0;
+    struct timespec ts;
+
+    pthread_mutex_lock (&replay_lock);
+    if (replay_base == 0)
+        replay_base = now_ns () - entry->timestamp_ns;
+    deadline = replay_base + entry->timestamp_ns + entry->duration_ns;
+    pthread_mutex_unlock (&replay_lock);
+    ts.tv_sec  = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR)
+        ;
+}
+
+static int32_t
+replay_access (int fd,
+               char read_write,
+               uint8_t command,
+               int size,
+               union i2c_smbus_data *data)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    uint16_t adapter = xfer_adapter_number (target->adapter);
+    record_entry_t *entry = NULL;
+    size_t i = 0;
+
+    /* claiming the record is locked, waiting for its time isn't */
+    pthread_mutex_lock (&replay_lock);
+    for (i = replay_cursor; i < replay_count; ++i) {
+        entry = &replay_entries[i];
+        if (!entry->used &&
+            entry->adapter == adapter &&
+            entry->mux == target->mux &&
+            entry->channel == target->channel &&
+            entry->address == target->address &&
+            entry->command == command &&
+            entry->read_write == read_write &&
+            entry->size == size)
+            break;
+    }
+    if (i == replay_count) {
+        pthread_mutex_unlock (&replay_lock);
+        /* the capture has nothing more to say about this device */
+        errno = EPROTO;
+        return -1;
+    }
+    entry->used = 1;
+    while (replay_cursor < replay_count && replay_entries[replay_cursor].used)
+        ++replay_cursor;
+    pthread_mutex_unlock (&replay_lock);
+    if (replay_pacing == REPLAY_RECORDED)
+        replay_wait (entry);
+    if (entry->err != 0) {
+        errno = entry->err;
+        return -1;
+    }
+    if (read_write == I2C_SMBUS_READ && data != NULL) {
+        if (size == I2C_SMBUS_WORD_DATA)
+            data->word = entry->payload;
+        else
+            data->byte = entry->payload;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef _DS1077L_RECORD_H_
+#define _DS1077L_RECORD_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Record and replay of bus traffic.
+ *
+ * With recording enabled every transaction is appended to a capture file as a
+ * fixed size record_entry_t. Records are buffered in memory and written when
+ * the buffer fills up and when the process exits, so a capture adds no
+ * system calls to the transactions themselves. Several runs can append to the
+ * same capture, each starting with a RECORD_RUN record.
+ *
+ * The replay transport serves a capture back through the transaction layer
+ * without touching any hardware. A transaction is answered by the next
+ * unused record for the same adapter, mux, channel, address, command,
+ * direction and size, so a run that issues fewer or reordered transactions
+ * than the recorded one (e.g. with caching) still replays. Reads return the recorded payload and
+ * every transaction returns the recorded errno, NAKs included. Replay either
+ * reproduces the recorded timing or runs as fast as possible; recorded runs
+ * are replayed back to back, whatever the time between them.
+ */
+#define RECORD_MAGIC   0x50414337373031ull
+#define RECORD_VERSION 2
+#define RECORD_BUFFER  4096
+/* read_write of the record starting a run, never matching a transaction */
+#define RECORD_RUN     0xff
+
+typedef struct record_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+} record_header_t;
+
+typedef struct record_entry {
+    uint64_t timestamp_ns;      /* CLOCK_MONOTONIC at start */
+    uint32_t duration_ns;
+    uint16_t adapter;           /* see xfer_adapter_number */
+    uint16_t payload;
+    uint16_t err;
+    uint8_t address;
+    uint8_t command;
+    uint8_t read_write;
+    uint8_t size;
+    uint8_t used;               /* replay only, always 0 on disk */
+    uint8_t mux;                /* 0 when not behind a mux */
+    uint8_t channel;
+    uint8_t reserved[7];
+} record_entry_t;
+
+typedef enum replay_pacing {
+    REPLAY_FAST = 0,
+    REPLAY_RECORDED,
+} replay_pacing_t;
+
+extern bool record_on;
+extern const xfer_transport_t xfer_replay;
+
+int record_init (const char *path);
+int record_flush (void);
+void record_write (const xfer_target_t *target,
+                   uint8_t command,
+                   char read_write,
+                   int size,
+                   uint16_t payload,
+                   int err,
+                   uint64_t start_ns,
+                   uint64_t duration_ns);
+int replay_pacing_parse (const char *arg, replay_pacing_t *pacing);
+int replay_init (const char *path, replay_pacing_t pacing);
+
+#endif // #ifndef _DS1077L_RECORD_H_
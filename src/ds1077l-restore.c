@@ -0,0 +1,452 @@
+#include "ds1077l.h"
+#include "ds1077l-preset.h"
+#include "ds1077l-state.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* First descriptor systemd passes on socket activation */
+#define LISTEN_FDS_START 3
+
+typedef struct restore_args {
+    ds1077l_common_args_t common_args;
+    char *state;
+    char *index;
+    bool live;
+    bool save;
+    transition_band_t band;
+    bool banded;
+    topo_target_t *targets;
+    size_t count;
+} restore_args_t;
+
+/* Devices on one adapter, restored one after the other by their own
+ * thread.
+ */
+typedef struct restore_job {
+    pthread_t thread;
+    const char *bus_dev;
+    state_entry_t *entries;
+    state_result_t *results;
+    int *errs;
+    size_t count;
+    bool commit;
+    const transition_band_t *band;
+} restore_job_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "state",
+        .key   = 's',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Desired state of the devices. Defaults to $" STATE_ENV
+                 " or " STATE_DEFAULT ".",
+        .group = 1
+    },
+    {
+        .name  = "index",
+        .key   = 'i',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Compiled preset index for devices whose state is a "
+                 "preset. Defaults to $" PRESET_ENV " or " PRESET_DEFAULT
+                 ".",
+        .group = 1
+    },
+    {
+        .name  = "live",
+        .key   = 'l',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Don't commit restored devices to EEPROM. They will be "
+                 "restored again on the next boot.",
+        .group = 1
+    },
+    {
+        .name  = "save",
+        .key   = 'S',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Save the current state of the given devices as their "
+                 "desired state instead.",
+        .group = 1
+    },
+    {
+        .name  = "band",
+        .key   = 'b',
+        .arg   = "MIN-MAX",
+        .flags = 0,
+        .doc   = TRANSITION_BAND_DOC,
+        .group = 1
+    },
+    {
+        .name  = "master-hz",
+        .key   = 'm',
+        .arg   = "HZ",
+        .flags = 0,
+        .doc   = TRANSITION_MASTER_HZ_DOC,
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "[ADAPTER[/MUX/CHANNEL]/ADDRESS...]",
+    .doc         = "Restore Maxim DS1077L programmable oscillators to their "
+                   "desired state, at boot: the devices given, or all in "
+                   "the state file. Devices already there are left alone. "
+                   "Adapters are restored in parallel, readiness is "
+                   "signalled to systemd.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    restore_args_t *args = state->input;
+    char *end = NULL;
+
+    switch (key) {
+        case 's':
+            args->state = arg;
+            break;
+        case 'i':
+            args->index = arg;
+            break;
+        case 'l':
+            args->live = true;
+            break;
+        case 'S':
+            args->save = true;
+            break;
+        case ARGP_KEY_ARG:
+            if (args->count == XFER_TARGETS_MAX)
+                argp_failure (state, 1, E2BIG, "%s", arg);
+            if (topo_parse_target (arg, &args->targets[args->count]))
+                argp_failure (state, 1, EINVAL, "%s", arg);
+            ++args->count;
+            break;
+        case ARGP_KEY_END:
+            if (args->save && args->count == 0)
+                argp_usage (state);
+            break;
+        case 'b':
+            if (transition_parse_band (arg, &args->band))
+                argp_failure (state, 1, errno, "--band %s", arg);
+            args->banded = true;
+            break;
+        case 'm':
+            args->band.master_hz = strtoul (arg, &end, 10);
+            if (*end != '\0' || args->band.master_hz == 0)
+                argp_failure (state, 1, EINVAL, "--master-hz %s", arg);
+            break;
+        case ARGP_KEY_INIT:
+            args->band.master_hz = TRANSITION_MASTER_HZ_DEFAULT;
+            args->banded = false;
+            args->state = getenv (STATE_ENV);
+            if (args->state == NULL)
+                args->state = STATE_DEFAULT;
+            args->index = getenv (PRESET_ENV);
+            if (args->index == NULL)
+                args->index = PRESET_DEFAULT;
+            args->live = false;
+            args->save = false;
+            state->child_inputs[0] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Read the state file. Returns the number of devices or -1 with errno set.
+ */
+static ssize_t
+restore_load (const char *path, state_entry_t *entries, size_t max)
+{
+    char *line = NULL;
+    size_t size = 0;
+    size_t lineno = 0;
+    size_t count = 0;
+    FILE *file = NULL;
+    int ret = 0;
+
+    file = fopen (path, "r");
+    if (file == NULL)
+        return -1;
+    while (getline (&line, &size, file) != -1) {
+        ++lineno;
+        if (count == max) {
+            errno = E2BIG;
+            ret = -1;
+            break;
+        }
+        ret = state_parse (line, &entries[count]);
+        if (ret == 1) {
+            ret = 0;
+            continue;
+        }
+        if (ret) {
+            fprintf (stderr, "%s:%zu: %s\n", path, lineno, strerror (errno));
+            break;
+        }
+        ++count;
+    }
+    free (line);
+    fclose (file);
+    return ret ? -1 : count;
+}
+
+/* Write the current state of 'targets' to the state file, replacing it
+ * atomically.
+ */
+static int
+restore_store (const char *path, const topo_target_t *targets, size_t count)
+{
+    char line[256];
+    char tmp[PATH_MAX];
+    FILE *file = NULL;
+    size_t i = 0;
+
+    if (snprintf (tmp, sizeof (tmp), "%s.tmp", path) >= sizeof (tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    file = fopen (tmp, "w");
+    if (file == NULL)
+        return -1;
+    fprintf (file, "# DEVICE STATE\n");
+    for (i = 0; i < count; ++i) {
+        if (state_save (&targets[i], line, sizeof (line)))
+            goto err_unlink;
+        fprintf (file, "%s\n", line);
+    }
+    if (fclose (file)) {
+        unlink (tmp);
+        return -1;
+    }
+    return rename (tmp, path);
+err_unlink:
+    fclose (file);
+    unlink (tmp);
+    return -1;
+}
+
+static void
+target_print (FILE *out, const topo_target_t *target)
+{
+    if (target->mux == 0)
+        fprintf (out, "%s/%#x", target->bus_dev, target->address);
+    else
+        fprintf (out, "%s/%#x/%d/%#x", target->bus_dev, target->mux,
+                 target->channel, target->address);
+}
+
+/* Keep only the entries of the devices given, in the order of the file.
+ * Devices the file has no state for are reported and counted in 'failed'.
+ * Returns the number of entries kept.
+ */
+static size_t
+restore_select (state_entry_t *entries,
+                size_t count,
+                const topo_target_t *targets,
+                size_t target_count,
+                size_t *failed)
+{
+    size_t kept = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    for (i = 0; i < target_count; ++i) {
+        for (j = 0; j < count; ++j)
+            if (topo_compare (&entries[j].target, &targets[i]) == 0)
+                break;
+        if (j < count)
+            continue;
+        target_print (stderr, &targets[i]);
+        fprintf (stderr, ": no desired state in the state file\n");
+        ++*failed;
+    }
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < target_count; ++j)
+            if (topo_compare (&entries[i].target, &targets[j]) == 0)
+                break;
+        if (j < target_count)
+            entries[kept++] = entries[i];
+    }
+    return kept;
+}
+
+static int
+entry_compare (const void *first, const void *second)
+{
+    const state_entry_t *a = first;
+    const state_entry_t *b = second;
+
+    return topo_compare (&a->target, &b->target);
+}
+
+static void *
+restore_run (void *arg)
+{
+    restore_job_t *job = arg;
+    size_t i = 0;
+
+    for (i = 0; i < job->count; ++i) {
+        if (strcmp (job->entries[i].target.bus_dev, job->bus_dev) != 0)
+            continue;
+        job->errs[i] = state_restore (&job->entries[i], job->commit,
+                                      job->band, &job->results[i]) ?
+                       errno : 0;
+    }
+    return NULL;
+}
+
+/* Under socket activation, answer whoever connected, and whoever is
+ * already queued behind them, with 'status' and go. Later clients start us
+ * again, to find everything restored.
+ */
+static void
+restore_serve (const char *status)
+{
+    const char *pid = getenv ("LISTEN_PID");
+    const char *fds = getenv ("LISTEN_FDS");
+    int fd = 0;
+
+    if (pid == NULL || fds == NULL || atoi (pid) != getpid () ||
+        atoi (fds) < 1)
+        return;
+    fcntl (LISTEN_FDS_START, F_SETFL, O_NONBLOCK);
+    while ((fd = accept (LISTEN_FDS_START, NULL, NULL)) != -1) {
+        if (dprintf (fd, "%s\n", status) < 0)
+            perror ("dprintf: ");
+        close (fd);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    static state_entry_t entries[XFER_TARGETS_MAX];
+    static state_result_t results[XFER_TARGETS_MAX];
+    static topo_target_t targets[XFER_TARGETS_MAX];
+    static int errs[XFER_TARGETS_MAX];
+    restore_job_t jobs[XFER_ADAPTERS_MAX] = { 0 };
+    restore_args_t args = { .targets = targets };
+    ds1077l_common_args_t *common_args = &args.common_args;
+    size_t counts[2] = { 0 };
+    size_t failed = 0;
+    size_t job_count = 0;
+    ssize_t count = 0;
+    char status[128];
+    char notify[160];
+    size_t i = 0;
+    size_t j = 0;
+
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    if (common_args->verbose)
+        dump_common_opts (common_args);
+    if (args.save) {
+        if (restore_store (args.state, targets, args.count)) {
+            perror ("restore_store: ");
+            exit (1);
+        }
+        exit (0);
+    }
+    /* only needed for states naming a preset */
+    if (preset_open (args.index) && errno != ENOENT) {
+        perror ("preset_open: ");
+        exit (1);
+    }
+    count = restore_load (args.state, entries, XFER_TARGETS_MAX);
+    if (count == -1) {
+        perror ("restore_load: ");
+        exit (1);
+    }
+    if (args.count > 0)
+        count = restore_select (entries, count, targets, args.count, &failed);
+    /* each mux channel is selected once rather than once per device */
+    qsort (entries, count, sizeof (*entries), entry_compare);
+    /* one job per adapter, the slowest one decides how long it takes */
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < job_count; ++j)
+            if (strcmp (jobs[j].bus_dev, entries[i].target.bus_dev) == 0)
+                break;
+        if (j < job_count)
+            continue;
+        if (job_count == XFER_ADAPTERS_MAX) {
+            fprintf (stderr, "Too many adapters.\n");
+            exit (1);
+        }
+        jobs[job_count++] = (restore_job_t) {
+            .bus_dev = entries[i].target.bus_dev,
+            .entries = entries,
+            .results = results,
+            .errs    = errs,
+            .count   = count,
+            .commit  = !args.live,
+            .band    = args.banded ? &args.band : NULL,
+        };
+    }
+    for (i = 0; i < job_count; ++i) {
+        errno = pthread_create (&jobs[i].thread, NULL, restore_run, &jobs[i]);
+        if (errno != 0) {
+            perror ("pthread_create: ");
+            exit (1);
+        }
+    }
+    for (i = 0; i < job_count; ++i)
+        pthread_join (jobs[i].thread, NULL);
+    for (i = 0; i < count; ++i) {
+        if (errs[i] == 0) {
+            ++counts[results[i]];
+            if (!common_args->verbose)
+                continue;
+        } else {
+            ++failed;
+        }
+        target_print (errs[i] ? stderr : stdout, &entries[i].target);
+        fprintf (errs[i] ? stderr : stdout, ": %s\n",
+                 errs[i] ? strerror (errs[i]) :
+                 results[i] == STATE_WRITTEN ? "restored" : "unchanged");
+    }
+    snprintf (status, sizeof (status), "%zu restored, %zu unchanged, "
+              "%zu failed", counts[STATE_WRITTEN], counts[STATE_SKIPPED],
+              failed);
+    if (common_args->verbose)
+        printf ("%s\n", status);
+    /* ready either way, a failed device shouldn't hold up the boot */
+    snprintf (notify, sizeof (notify), "READY=1\nSTATUS=%s", status);
+    if (state_notify (notify))
+        perror ("state_notify: ");
+    restore_serve (status);
+    exit (failed ? 1 : 0);
+}
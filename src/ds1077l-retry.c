@@ -0,0 +1,334 @@
+#include "ds1077l-retry.h"
+
+#include <errno.h>
+#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct retry_adapter {
+    char bus_dev[32];           /* empty for the default */
+    int timeout_ms;
+    int retries;
+} retry_adapter_t;
+
+typedef struct retry_breaker {
+    uint8_t adapter;
+    uint8_t mux;
+    uint8_t channel;
+    uint8_t address;
+    unsigned failures;          /* transactions failed in a row */
+    unsigned cooldown_ms;
+    uint64_t open_until_ns;     /* 0 while closed */
+    bool probing;               /* half open, a probe is in flight */
+} retry_breaker_t;
+
+static retry_policy_t policy = {
+    .attempts = RETRY_ATTEMPTS_DEFAULT,
+    .base_us  = RETRY_BASE_US_DEFAULT,
+    .max_us   = RETRY_MAX_US_DEFAULT,
+};
+static retry_adapter_t adapters[RETRY_ADAPTERS_MAX + 1];
+static size_t adapter_count = 0;
+static retry_breaker_t breakers[XFER_TARGETS_MAX];
+static size_t breaker_count = 0;
+static pthread_mutex_t breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+static retry_stats_t stats = { 0 };
+static __thread unsigned int seed = 0;
+
+static int
+parse_uint (const char *arg, char end, unsigned *out)
+{
+    char *stop = NULL;
+    long value = 0;
+
+    value = strtol (arg, &stop, 10);
+    if (stop == arg || *stop != end || value < 0)
+        return -1;
+    *out = value;
+    return 0;
+}
+
+/* Parse the argument to --retry: ATTEMPTS[:BASE_US[:MAX_US]].
+ */
+int
+retry_policy_parse (const char *arg, retry_policy_t *out)
+{
+    const char *colon = strchr (arg, ':');
+    const char *second = colon ? strchr (colon + 1, ':') : NULL;
+
+    *out = policy;
+    if (parse_uint (arg, colon ? ':' : '\0', &out->attempts) ||
+        out->attempts == 0)
+        return -1;
+    if (colon == NULL)
+        return 0;
+    if (parse_uint (colon + 1, second ? ':' : '\0', &out->base_us))
+        return -1;
+    if (second == NULL)
+        return 0;
+    if (parse_uint (second + 1, '\0', &out->max_us) ||
+        out->max_us < out->base_us)
+        return -1;
+    return 0;
+}
+
+static retry_adapter_t *
+adapter_find (const char *bus_dev, bool create)
+{
+    retry_adapter_t *adapter = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < adapter_count; ++i)
+        if (strcmp (adapters[i].bus_dev, bus_dev) == 0)
+            return &adapters[i];
+    if (!create || adapter_count == RETRY_ADAPTERS_MAX + 1)
+        return NULL;
+    adapter = &adapters[adapter_count++];
+    strncpy (adapter->bus_dev, bus_dev, sizeof (adapter->bus_dev) - 1);
+    adapter->timeout_ms = RETRY_UNSET;
+    adapter->retries = RETRY_UNSET;
+    return adapter;
+}
+
+/* Parse the argument to --i2c-timeout (milliseconds) or --i2c-retries:
+ * [ADAPTER=]VALUE. Without an adapter the value applies to all adapters
+ * that don't have one of their own.
+ */
+int
+retry_adapter_parse (const char *arg, bool timeout)
+{
+    const char *equals = strchr (arg, '=');
+    retry_adapter_t *adapter = NULL;
+    char bus_dev[32] = { 0 };
+    size_t len = 0;
+    unsigned value = 0;
+
+    if (equals != NULL) {
+        len = equals - arg;
+        if (len == 0 || len + 5 >= sizeof (bus_dev))
+            return -1;
+        if (arg[0] != '/')
+            strcpy (bus_dev, "/dev/");
+        strncat (bus_dev, arg, len);
+        arg = equals + 1;
+    }
+    if (parse_uint (arg, '\0', &value))
+        return -1;
+    adapter = adapter_find (bus_dev, true);
+    if (adapter == NULL)
+        return -1;
+    if (timeout)
+        adapter->timeout_ms = value;
+    else
+        adapter->retries = value;
+    return 0;
+}
+
+void
+retry_init (const retry_policy_t *new_policy)
+{
+    policy = *new_policy;
+}
+
+/* Apply the kernel timeout and retry count configured for 'bus_dev' to a
+ * freshly opened descriptor. Descriptors that aren't i2c adapters, like the
+ * ones handed out by the simulator, are left alone.
+ */
+int
+retry_configure (int fd, const char *bus_dev)
+{
+    retry_adapter_t *adapter = adapter_find (bus_dev, false);
+    retry_adapter_t *fallback = adapter_find ("", false);
+    int timeout = RETRY_UNSET;
+    int retries = RETRY_UNSET;
+
+    if (adapter != NULL) {
+        timeout = adapter->timeout_ms;
+        retries = adapter->retries;
+    }
+    if (fallback != NULL && timeout == RETRY_UNSET)
+        timeout = fallback->timeout_ms;
+    if (fallback != NULL && retries == RETRY_UNSET)
+        retries = fallback->retries;
+    /* I2C_TIMEOUT is in units of 10ms */
+    if (timeout != RETRY_UNSET &&
+        ioctl (fd, I2C_TIMEOUT, (timeout + 9) / 10) && errno != ENOTTY)
+        return -1;
+    if (retries != RETRY_UNSET &&
+        ioctl (fd, I2C_RETRIES, retries) && errno != ENOTTY)
+        return -1;
+    return 0;
+}
+
+/* Whether an errno returned by an adapter is worth retrying. A missing ACK
+ * can be noise on a long trace as much as a missing device, the breaker
+ * takes care of the latter.
+ */
+retry_class_t
+retry_classify (int err)
+{
+    switch (err) {
+    case 0:
+        return RETRY_OK;
+    case ENXIO:
+    case EREMOTEIO:
+    case ETIMEDOUT:
+    case EAGAIN:
+    case EBUSY:
+    case EIO:
+    case EINTR:
+        return RETRY_TRANSIENT;
+    default:
+        return RETRY_FATAL;
+    }
+}
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Find the breaker of the device 'target' is bound to, called with
+ * breaker_lock held. When the table is full the breaker of the device
+ * failed least recently is reused, closed ones first.
+ */
+static retry_breaker_t *
+breaker_get (const xfer_target_t *target)
+{
+    retry_breaker_t *breaker = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < breaker_count; ++i) {
+        breaker = &breakers[i];
+        if (breaker->adapter == target->adapter &&
+            breaker->mux == target->mux &&
+            breaker->channel == target->channel &&
+            breaker->address == target->address)
+            return breaker;
+    }
+    if (breaker_count < XFER_TARGETS_MAX) {
+        breaker = &breakers[breaker_count++];
+    } else {
+        breaker = &breakers[0];
+        for (i = 1; i < breaker_count; ++i)
+            if (breakers[i].open_until_ns < breaker->open_until_ns)
+                breaker = &breakers[i];
+    }
+    memset (breaker, 0, sizeof (*breaker));
+    breaker->adapter = target->adapter;
+    breaker->mux = target->mux;
+    breaker->channel = target->channel;
+    breaker->address = target->address;
+    breaker->cooldown_ms = RETRY_COOLDOWN_MS;
+    return breaker;
+}
+
+/* Check the breaker before a transaction. Returns -1 with errno set to
+ * EHOSTDOWN if the transaction must not be attempted.
+ */
+int
+retry_admit (const xfer_target_t *target)
+{
+    retry_breaker_t *breaker = NULL;
+    int ret = 0;
+
+    pthread_mutex_lock (&breaker_lock);
+    breaker = breaker_get (target);
+    if (breaker->open_until_ns == 0)
+        goto out;
+    if (breaker->probing || now_ns () < breaker->open_until_ns) {
+        ++stats.rejected;
+        errno = EHOSTDOWN;
+        ret = -1;
+        goto out;
+    }
+    /* half open, let this one through */
+    breaker->probing = true;
+out:
+    pthread_mutex_unlock (&breaker_lock);
+    return ret;
+}
+
+/* Decide whether to retry after attempt 'attempt' (0 based) failed with
+ * 'err' and if so wait out the backoff first.
+ */
+bool
+retry_again (const xfer_target_t *target, int err, unsigned attempt)
+{
+    uint64_t window = 0;
+    uint64_t wait_us = 0;
+    struct timespec ts;
+
+    if (retry_classify (err) != RETRY_TRANSIENT ||
+        attempt + 1 >= policy.attempts)
+        return false;
+    if (seed == 0)
+        seed = now_ns () ^ (uintptr_t)&seed;
+    window = (uint64_t)policy.base_us << (attempt < 20 ? attempt : 20);
+    if (window > policy.max_us)
+        window = policy.max_us;
+    wait_us = window ? rand_r (&seed) % (window + 1) : 0;
+    ts.tv_sec = wait_us / 1000000;
+    ts.tv_nsec = (wait_us % 1000000) * 1000;
+    while (nanosleep (&ts, &ts) == -1 && errno == EINTR)
+        ;
+    __atomic_add_fetch (&stats.retries, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* Account for the outcome of a transaction after 'attempt' retries.
+ */
+void
+retry_done (const xfer_target_t *target, int err, unsigned attempt)
+{
+    retry_breaker_t *breaker = NULL;
+
+    pthread_mutex_lock (&breaker_lock);
+    breaker = breaker_get (target);
+    breaker->probing = false;
+    if (err == 0) {
+        if (attempt > 0)
+            ++stats.recovered;
+        breaker->failures = 0;
+        breaker->open_until_ns = 0;
+        breaker->cooldown_ms = RETRY_COOLDOWN_MS;
+        goto out;
+    }
+    if (retry_classify (err) == RETRY_FATAL) {
+        ++stats.fatal;
+        goto out;
+    }
+    ++stats.exhausted;
+    if (breaker->open_until_ns != 0) {
+        /* the probe failed */
+        if (breaker->cooldown_ms < RETRY_COOLDOWN_MAX_MS)
+            breaker->cooldown_ms *= 2;
+        if (breaker->cooldown_ms > RETRY_COOLDOWN_MAX_MS)
+            breaker->cooldown_ms = RETRY_COOLDOWN_MAX_MS;
+    } else if (++breaker->failures < RETRY_BREAKER_THRESHOLD) {
+        goto out;
+    } else {
+        ++stats.trips;
+    }
+    breaker->open_until_ns = now_ns () +
+                             (uint64_t)breaker->cooldown_ms * 1000000;
+out:
+    pthread_mutex_unlock (&breaker_lock);
+}
+
+void
+retry_stats (retry_stats_t *out)
+{
+    pthread_mutex_lock (&breaker_lock);
+    *out = stats;
+    out->retries = __atomic_load_n (&stats.retries, __ATOMIC_RELAXED);
+    pthread_mutex_unlock (&breaker_lock);
+}
@@ -0,0 +1,68 @@
+#ifndef _DS1077L_RETRY_H_
+#define _DS1077L_RETRY_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Retries and bus error recovery.
+ *
+ * Long traces pick up the odd NAK or arbitration loss, so the transaction
+ * layer retries transactions that failed with a transient error (see
+ * retry_classify) with exponential backoff and full jitter: attempt n waits
+ * a random time up to min(max, base * 2^n). No lock is held while waiting so
+ * other devices on the adapter carry on.
+ *
+ * A device that keeps failing trips its circuit breaker: after
+ * RETRY_BREAKER_THRESHOLD transactions in a row failed even after retrying,
+ * transactions for it fail straight away with EHOSTDOWN for a cooldown
+ * period. Once that's over a single transaction is let through as a probe,
+ * success closes the breaker, failure opens it again for twice as long (up
+ * to RETRY_COOLDOWN_MAX_MS).
+ *
+ * The kernel's own per-adapter timeout and retry count (I2C_TIMEOUT and
+ * I2C_RETRIES) are set when a device is opened if configured, either for all
+ * adapters or for specific ones.
+ */
+#define RETRY_ATTEMPTS_DEFAULT   3
+#define RETRY_BASE_US_DEFAULT    500
+#define RETRY_MAX_US_DEFAULT     50000
+#define RETRY_BREAKER_THRESHOLD  5
+#define RETRY_COOLDOWN_MS        1000
+#define RETRY_COOLDOWN_MAX_MS    60000
+#define RETRY_ADAPTERS_MAX       XFER_ADAPTERS_MAX
+#define RETRY_UNSET              -1
+
+typedef enum retry_class {
+    RETRY_OK = 0,
+    RETRY_TRANSIENT,            /* worth trying again */
+    RETRY_FATAL,                /* won't go away by itself */
+} retry_class_t;
+
+typedef struct retry_policy {
+    unsigned attempts;          /* including the first one */
+    unsigned base_us;
+    unsigned max_us;
+} retry_policy_t;
+
+typedef struct retry_stats {
+    uint64_t retries;           /* attempts after the first */
+    uint64_t recovered;         /* transactions that succeeded on a retry */
+    uint64_t exhausted;         /* transient failures that ran out of retries */
+    uint64_t fatal;             /* failures that weren't retried */
+    uint64_t trips;             /* breakers opened */
+    uint64_t rejected;          /* transactions failed by an open breaker */
+} retry_stats_t;
+
+int retry_policy_parse (const char *arg, retry_policy_t *policy);
+int retry_adapter_parse (const char *arg, bool timeout);
+void retry_init (const retry_policy_t *policy);
+int retry_configure (int fd, const char *bus_dev);
+retry_class_t retry_classify (int err);
+int retry_admit (const xfer_target_t *target);
+bool retry_again (const xfer_target_t *target, int err, unsigned attempt);
+void retry_done (const xfer_target_t *target, int err, unsigned attempt);
+void retry_stats (retry_stats_t *stats);
+
+#endif // #ifndef _DS1077L_RETRY_H_
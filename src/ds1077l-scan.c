@@ -0,0 +1,380 @@
+#include "ds1077l.h"
+#include "ds1077l-inventory.h"
+#include "ds1077l-pool.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <glob.h>
+#include <linux/netlink.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Time udev gets to create the device node of a new adapter. */
+#define SCAN_SETTLE_MS 2000
+#define SCAN_ADAPTERS_MAX XFER_ADAPTERS_MAX
+
+typedef struct scan_args {
+    ds1077l_common_args_t common_args;
+    char *inventory;
+    bool rescan;
+    bool watch;
+    bool targets;
+    char *adapters[SCAN_ADAPTERS_MAX];
+    size_t count;
+} scan_args_t;
+
+static volatile sig_atomic_t stop = 0;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "inventory",
+        .key   = 'i',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Inventory file. Defaults to $" INVENTORY_ENV " or "
+                 INVENTORY_DEFAULT ".",
+        .group = 1
+    },
+    {
+        .name  = "rescan",
+        .key   = 'r',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Scan all adapters in /dev and forget the ones that are "
+                 "gone. Done anyway while the inventory is empty.",
+        .group = 1
+    },
+    {
+        .name  = "watch",
+        .key   = 'w',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Keep running and scan adapters as they appear, forget them "
+                 "as they disappear.",
+        .group = 1
+    },
+    {
+        .name  = "targets",
+        .key   = 't',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "List devices one per line as ADAPTER/ADDRESS, for the "
+                 "--file option of the other utilities.",
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "[ADAPTER...]",
+    .doc         = "Keep an inventory of the Maxim DS1077L programmable "
+                   "oscillators in the system and list it. Given adapters "
+                   "are scanned again.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    scan_args_t *args = state->input;
+
+    switch (key) {
+        case 'i':
+            args->inventory = arg;
+            break;
+        case 'r':
+            args->rescan = true;
+            break;
+        case 'w':
+            args->watch = true;
+            break;
+        case 't':
+            args->targets = true;
+            break;
+        case ARGP_KEY_ARG:
+            if (args->count == SCAN_ADAPTERS_MAX)
+                argp_failure (state, 1, E2BIG, "%s", arg);
+            args->adapters[args->count++] = arg;
+            break;
+        case ARGP_KEY_INIT:
+            args->inventory = getenv (INVENTORY_ENV);
+            if (args->inventory == NULL)
+                args->inventory = INVENTORY_DEFAULT;
+            args->rescan = false;
+            args->watch = false;
+            args->targets = false;
+            state->child_inputs[0] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static void
+on_signal (int signo)
+{
+    stop = 1;
+}
+
+/* Adapters may be given as a device node or just its name. */
+static void
+adapter_path (const char *arg, char *path, size_t size)
+{
+    if (arg[0] == '/')
+        snprintf (path, size, "%s", arg);
+    else
+        snprintf (path, size, "/dev/%s", arg);
+}
+
+static int
+scan_one (const char *bus_dev, bool verbose)
+{
+    size_t found = 0;
+
+    if (inventory_scan (bus_dev, &found)) {
+        fprintf (stderr, "%s: %s\n", bus_dev, strerror (errno));
+        return -1;
+    }
+    if (verbose)
+        printf ("scan: %s: %zu devices\n", bus_dev, found);
+    return 0;
+}
+
+/* Scan every adapter there is and forget the ones that went away while
+ * nobody was watching.
+ */
+static int
+scan_all (bool verbose)
+{
+    static inventory_device_t devices[INVENTORY_DEVICES_MAX];
+    glob_t nodes = { 0 };
+    size_t count = 0;
+    size_t i = 0;
+    size_t n = 0;
+    int ret = 0;
+
+    ret = glob ("/dev/i2c-[0-9]*", 0, NULL, &nodes);
+    if (ret != 0 && ret != GLOB_NOMATCH) {
+        errno = ENOMEM;
+        return -1;
+    }
+    count = inventory_list (devices, INVENTORY_DEVICES_MAX);
+    for (i = 0; i < count; ++i) {
+        for (n = 0; n < nodes.gl_pathc; ++n)
+            if (strcmp (devices[i].target.bus_dev, nodes.gl_pathv[n]) == 0)
+                break;
+        if (n == nodes.gl_pathc)
+            inventory_forget (devices[i].target.bus_dev, NULL);
+    }
+    ret = 0;
+    for (n = 0; n < nodes.gl_pathc; ++n)
+        if (scan_one (nodes.gl_pathv[n], verbose))
+            ret = -1;
+    globfree (&nodes);
+    return ret;
+}
+
+/* Print the inventory, as targets or records.
+ */
+static int
+scan_dump (fmt_buf_t *out, ds1077l_format_t format, bool targets)
+{
+    static inventory_device_t devices[INVENTORY_DEVICES_MAX];
+    size_t count = inventory_list (devices, INVENTORY_DEVICES_MAX);
+    topo_target_t *target = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i) {
+        target = &devices[i].target;
+        fmt_record_t record = {
+            .bus_dev   = target->bus_dev,
+            .address   = target->address,
+            .reg       = "INV",
+            .raw_width = 0,
+        };
+        fmt_field_t fields[] = {
+            { .name = "mux", .type = FIELD_HEX, .value = target->mux },
+            { .name = "channel", .type = FIELD_UINT,
+              .value = target->channel },
+            { .name = "DIV", .type = FIELD_HEX, .value = devices[i].div },
+            { .name = "MUX", .type = FIELD_HEX, .value = devices[i].mux },
+            { .name = "BUS", .type = FIELD_HEX, .value = devices[i].bus },
+            { .name = "seen", .type = FIELD_UINT,
+              .value = devices[i].seen_ns / 1000000000 },
+        };
+
+        if (!targets && format != FORMAT_HUMAN) {
+            fmt_register (out, format, &record, fields,
+                          sizeof (fields) / sizeof (fields[0]));
+            continue;
+        }
+        if (target->mux == 0)
+            printf ("%s/%#x", target->bus_dev, target->address);
+        else
+            printf ("%s/%#x/%d/%#x", target->bus_dev, target->mux,
+                    target->channel, target->address);
+        if (targets) {
+            printf ("\n");
+            continue;
+        }
+        printf (": DIV 0x%04x MUX 0x%04x BUS 0x%02x", devices[i].div,
+                devices[i].mux, devices[i].bus);
+        if (devices[i].adapter_name[0] != '\0')
+            printf (" on \"%s\"", devices[i].adapter_name);
+        printf ("\n");
+    }
+    return fmt_flush (out);
+}
+
+static int
+uevent_open (void)
+{
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = 1,         /* kernel events, udev's come later */
+    };
+    int fd = 0;
+
+    fd = socket (AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                 NETLINK_KOBJECT_UEVENT);
+    if (fd == -1)
+        return -1;
+    if (bind (fd, (struct sockaddr *)&addr, sizeof (addr))) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* The kernel announces adapters before udev has created their device
+ * node, give it a moment.
+ */
+static void
+node_settle (const char *bus_dev)
+{
+    struct timespec step = { .tv_sec = 0, .tv_nsec = 50000000 };
+    int waited = 0;
+
+    while (access (bus_dev, R_OK | W_OK) && waited < SCAN_SETTLE_MS) {
+        nanosleep (&step, NULL);
+        waited += 50;
+    }
+}
+
+/* Follow adapters coming and going until interrupted.
+ */
+static int
+scan_watch (bool verbose)
+{
+    struct sigaction action = { .sa_handler = on_signal };
+    inventory_event_t event;
+    char buf[8192];
+    size_t removed = 0;
+    ssize_t len = 0;
+    int fd = 0;
+
+    fd = uevent_open ();
+    if (fd == -1)
+        return -1;
+    /* no SA_RESTART, a signal has to cut the wait short */
+    sigaction (SIGINT, &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+    while (!stop) {
+        len = recv (fd, buf, sizeof (buf), 0);
+        if (len == -1) {
+            if (errno == EINTR || errno == ENOBUFS)
+                continue;
+            close (fd);
+            return -1;
+        }
+        if (inventory_uevent_parse (buf, len, &event))
+            continue;
+        /* handles to a vanished adapter are dead, and one coming back
+         * under the same name is a different one
+         */
+        pool_close ();
+        if (event.action == INVENTORY_REMOVE) {
+            inventory_forget (event.bus_dev, &removed);
+            if (verbose)
+                printf ("scan: %s removed, %zu devices forgotten\n",
+                        event.bus_dev, removed);
+            continue;
+        }
+        node_settle (event.bus_dev);
+        scan_one (event.bus_dev, verbose);
+    }
+    close (fd);
+    return 0;
+}
+
+int
+main (int argc, char* argv[])
+{
+    static inventory_device_t devices[1];
+    static fmt_buf_t out;
+    scan_args_t args = { 0 };
+    ds1077l_common_args_t *common_args = &args.common_args;
+    char bus_dev[32];
+    bool verbose = false;
+    size_t i = 0;
+
+    fmt_init (&out, STDOUT_FILENO);
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    verbose = common_args->verbose || args.watch;
+    if (common_args->verbose)
+        dump_common_opts (common_args);
+    if (inventory_open (args.inventory)) {
+        perror ("inventory_open: ");
+        exit (1);
+    }
+    /* cold start: nothing to go on yet */
+    if (args.rescan || (args.count == 0 &&
+                        inventory_list (devices, 1) == 0)) {
+        if (scan_all (common_args->verbose))
+            exit (1);
+    }
+    for (i = 0; i < args.count; ++i) {
+        adapter_path (args.adapters[i], bus_dev, sizeof (bus_dev));
+        if (scan_one (bus_dev, common_args->verbose))
+            exit (1);
+    }
+    if (args.watch) {
+        if (scan_watch (verbose)) {
+            perror ("scan_watch: ");
+            exit (1);
+        }
+        inventory_close ();
+        exit (0);
+    }
+    if (scan_dump (&out, common_args->format, args.targets)) {
+        perror ("scan_dump: ");
+        exit (1);
+    }
+    inventory_close ();
+    exit (0);
+}
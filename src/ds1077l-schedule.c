@@ -0,0 +1,363 @@
+#include "ds1077l-schedule.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-xfer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Encodings kept per step while looking for the fewest writes. */
+#define SCHEDULE_STATES_MAX    8
+#define SCHEDULE_ENCODINGS_MAX 4
+
+#define M0_MASK   0x0006
+#define M1_MASK   0x8001
+#define DIV1_MASK 0x4000
+
+/* A prescaler code and N, 0 for DIV1 set. */
+typedef struct schedule_encoding {
+    uint8_t code;
+    uint16_t n;
+} schedule_encoding_t;
+
+/* Register words after a step, with the cheapest way there. */
+typedef struct schedule_state {
+    uint16_t div;
+    uint16_t mux;
+    uint32_t cost;              /* writes since the start */
+    uint8_t prev;               /* state of the step before */
+} schedule_state_t;
+
+static double
+divisor_error (uint32_t master_hz, uint32_t divisor, uint32_t hz)
+{
+    double error = (double)master_hz / divisor - hz;
+
+    return error < 0 ? -error : error;
+}
+
+/* What a step divides the master clock by. */
+static uint32_t
+step_divisor (schedule_output_t output, const schedule_step_t *step)
+{
+    if (output == SCHEDULE_OUT0)
+        return M0_UNPACK (step->mux);
+    if (DIV1_UNPACK (step->mux))
+        return M1_UNPACK (step->mux);
+    return M1_UNPACK (step->mux) * DIV_UNPACK (step->div);
+}
+
+/* The encodings of the divisor closest to 'hz'. Returns their number.
+ */
+static size_t
+encodings (uint32_t master_hz,
+           schedule_output_t output,
+           uint32_t hz,
+           schedule_encoding_t *encoding)
+{
+    uint32_t best = 0;
+    uint32_t divisor = 0;
+    uint32_t n = 0;
+    size_t count = 0;
+    uint8_t code = 0;
+    int i = 0;
+
+    for (code = 0; code < 4; ++code) {
+        /* OUT0 only has the prescaler, OUT1 can bypass N with DIV1 */
+        divisor = 1 << code;
+        if (best == 0 || divisor_error (master_hz, divisor, hz) <
+                         divisor_error (master_hz, best, hz))
+            best = divisor;
+        if (output == SCHEDULE_OUT0)
+            continue;
+        /* the closest N is one of the two around the exact quotient */
+        for (i = 0; i < 2; ++i) {
+            n = master_hz / ((uint64_t)hz << code) + i;
+            if (n < 2)
+                n = 2;
+            if (n > 1025)
+                n = 1025;
+            divisor = n << code;
+            if (divisor_error (master_hz, divisor, hz) <
+                divisor_error (master_hz, best, hz))
+                best = divisor;
+        }
+    }
+    for (code = 0; code < 4; ++code) {
+        if (best == 1u << code)
+            encoding[count++] = (schedule_encoding_t) { .code = code, .n = 0 };
+        if (output == SCHEDULE_OUT0 || best % (1 << code) != 0)
+            continue;
+        n = best >> code;
+        if (n >= 2 && n <= 1025)
+            encoding[count++] = (schedule_encoding_t) { .code = code, .n = n };
+    }
+    return count;
+}
+
+/* Keep the cheaper of two ways to the same words, and the cheapest states
+ * when there are too many.
+ */
+static void
+state_add (schedule_state_t *states, uint8_t *count, schedule_state_t state)
+{
+    uint8_t worst = 0;
+    uint8_t i = 0;
+
+    for (i = 0; i < *count; ++i) {
+        if (states[i].div == state.div && states[i].mux == state.mux) {
+            if (state.cost < states[i].cost)
+                states[i] = state;
+            return;
+        }
+        if (states[i].cost > states[worst].cost)
+            worst = i;
+    }
+    if (*count < SCHEDULE_STATES_MAX)
+        states[(*count)++] = state;
+    else if (state.cost < states[worst].cost)
+        states[worst] = state;
+}
+
+/* Compile the frequencies 'hz' for 'header->count' steps into 'steps',
+ * starting from the registers in 'header'. Returns 0 or -1 with errno set.
+ */
+int
+schedule_compile (const schedule_header_t *header,
+                  const uint32_t *hz,
+                  schedule_step_t *steps)
+{
+    schedule_state_t (*states)[SCHEDULE_STATES_MAX] = NULL;
+    schedule_encoding_t encoding[SCHEDULE_ENCODINGS_MAX];
+    schedule_state_t start = {
+        .div = header->div,
+        .mux = header->mux,
+    };
+    schedule_state_t *prev = NULL;
+    schedule_state_t next = { 0 };
+    uint8_t *counts = NULL;
+    uint32_t divisor = 0;
+    uint8_t prev_count = 0;
+    uint8_t best = 0;
+    size_t count = 0;
+    size_t i = 0;
+    size_t e = 0;
+    uint8_t k = 0;
+
+    if (header->count == 0 || header->count > SCHEDULE_STEPS_MAX ||
+        header->master_hz == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < header->count; ++i) {
+        if (hz[i] == 0 || hz[i] > header->master_hz) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    states = calloc (header->count, sizeof (*states));
+    counts = calloc (header->count, sizeof (*counts));
+    if (states == NULL || counts == NULL) {
+        free (states);
+        free (counts);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < header->count; ++i) {
+        prev = i == 0 ? &start : states[i - 1];
+        prev_count = i == 0 ? 1 : counts[i - 1];
+        count = encodings (header->master_hz, header->output, hz[i],
+                           encoding);
+        for (e = 0; e < count; ++e) {
+            for (k = 0; k < prev_count; ++k) {
+                next.prev = k;
+                if (header->output == SCHEDULE_OUT0) {
+                    next.div = prev[k].div;
+                    next.mux = (prev[k].mux & ~M0_MASK) |
+                               M0_PACK (1 << encoding[e].code);
+                } else {
+                    /* with DIV1 set, DIV stays whatever it was */
+                    next.div = encoding[e].n == 0 ? prev[k].div :
+                               DIV_PACK (encoding[e].n);
+                    next.mux = (prev[k].mux & ~(M1_MASK | DIV1_MASK)) |
+                               M1_PACK (1 << encoding[e].code) |
+                               DIV1_PACK (encoding[e].n == 0);
+                }
+                next.cost = prev[k].cost + (next.div != prev[k].div) +
+                            (next.mux != prev[k].mux);
+                state_add (states[i], &counts[i], next);
+            }
+        }
+    }
+    /* back from the cheapest end */
+    i = header->count - 1;
+    for (k = 1; k < counts[i]; ++k)
+        if (states[i][k].cost < states[i][best].cost)
+            best = k;
+    for (;;) {
+        steps[i] = (schedule_step_t) {
+            .div = states[i][best].div,
+            .mux = states[i][best].mux,
+        };
+        best = states[i][best].prev;
+        if (i-- == 0)
+            break;
+    }
+    free (states);
+    free (counts);
+    for (i = 0; i < header->count; ++i) {
+        prev = i == 0 ? &start : &next;
+        steps[i].regs = (steps[i].div != prev->div ? SCHEDULE_DIV : 0) |
+                        (steps[i].mux != prev->mux ? SCHEDULE_MUX : 0);
+        divisor = step_divisor (header->output, &steps[i]);
+        steps[i].hz = (header->master_hz + divisor / 2) / divisor;
+        next.div = steps[i].div;
+        next.mux = steps[i].mux;
+    }
+    return 0;
+}
+
+/* Count the writes of a compiled sweep and how far it is off 'hz'.
+ */
+void
+schedule_stats (const schedule_header_t *header,
+                const uint32_t *hz,
+                const schedule_step_t *steps,
+                schedule_stats_t *stats)
+{
+    uint32_t divisor = 0;
+    uint32_t ppm = 0;
+    int writes = 0;
+    size_t i = 0;
+
+    memset (stats, 0, sizeof (*stats));
+    for (i = 0; i < header->count; ++i) {
+        writes = (steps[i].regs & SCHEDULE_DIV ? 1 : 0) +
+                 (steps[i].regs & SCHEDULE_MUX ? 1 : 0);
+        stats->writes += writes;
+        if (writes == 1)
+            ++stats->single;
+        else if (writes == 0)
+            ++stats->unchanged;
+        divisor = step_divisor (header->output, &steps[i]);
+        ppm = divisor_error (header->master_hz, divisor, hz[i]) / hz[i] *
+              1000000 + 0.5;
+        if (ppm > stats->max_error_ppm)
+            stats->max_error_ppm = ppm;
+    }
+}
+
+/* Write a schedule to 'path', replacing it atomically.
+ */
+int
+schedule_save (const char *path,
+               const schedule_header_t *header,
+               const schedule_step_t *steps)
+{
+    char tmp[PATH_MAX];
+    size_t size = header->count * sizeof (*steps);
+    int fd = 0;
+
+    if (snprintf (tmp, sizeof (tmp), "%s.tmp", path) >= sizeof (tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    if (write (fd, header, sizeof (*header)) != sizeof (*header) ||
+        write (fd, steps, size) != size || close (fd)) {
+        unlink (tmp);
+        return -1;
+    }
+    return rename (tmp, path);
+}
+
+/* Read a schedule of up to 'max' steps.
+ */
+int
+schedule_load (const char *path,
+               schedule_header_t *header,
+               schedule_step_t *steps,
+               size_t max)
+{
+    size_t size = 0;
+    int fd = 0;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (read (fd, header, sizeof (*header)) != sizeof (*header) ||
+        header->magic != SCHEDULE_MAGIC ||
+        header->version != SCHEDULE_VERSION) {
+        close (fd);
+        errno = EINVAL;
+        return -1;
+    }
+    if (header->count > max) {
+        close (fd);
+        errno = E2BIG;
+        return -1;
+    }
+    size = header->count * sizeof (*steps);
+    if (read (fd, steps, size) != size) {
+        close (fd);
+        errno = EINVAL;
+        return -1;
+    }
+    close (fd);
+    return 0;
+}
+
+/* Play a schedule on the device 'fd' is bound to, a step every 'dwell_ns'
+ * or as fast as the bus goes for 0. The first step writes whatever differs
+ * from the device, which needn't be where the schedule starts.
+ */
+int
+schedule_play (int fd,
+               const schedule_header_t *header,
+               const schedule_step_t *steps,
+               uint64_t dwell_ns)
+{
+    static const xfer_reg_t regs[] = {
+        { .command = COMMAND_DIV, .size = I2C_SMBUS_WORD_DATA },
+        { .command = COMMAND_MUX, .size = I2C_SMBUS_WORD_DATA },
+    };
+    struct timespec start;
+    struct timespec deadline;
+    uint16_t values[2];
+    uint64_t offset_ns = 0;
+    uint8_t write = 0;
+    size_t i = 0;
+
+    if (xfer_read_regs (fd, regs, 2, values))
+        return -1;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (i = 0; i < header->count; ++i) {
+        if (dwell_ns != 0 && i != 0) {
+            offset_ns = start.tv_nsec + i * dwell_ns;
+            deadline.tv_sec = start.tv_sec + offset_ns / 1000000000;
+            deadline.tv_nsec = offset_ns % 1000000000;
+            while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                                    NULL) == EINTR)
+                ;
+        }
+        write = steps[i].regs;
+        if (i == 0)
+            write = (values[0] != steps[0].div ? SCHEDULE_DIV : 0) |
+                    (values[1] != steps[0].mux ? SCHEDULE_MUX : 0);
+        if ((write & SCHEDULE_DIV) &&
+            xfer_write_word (fd, COMMAND_DIV, steps[i].div) == -1)
+            return -1;
+        if ((write & SCHEDULE_MUX) &&
+            xfer_write_word (fd, COMMAND_MUX, steps[i].mux) == -1)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#ifndef _DS1077L_SCHEDULE_H_
+#define _DS1077L_SCHEDULE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Frequency sweep schedules.
+ *
+ * A sweep is compiled into a schedule of register states, one per
+ * frequency. OUT1 runs at MCLK / P1 / N, or MCLK / P1 with DIV1 set, so most
+ * frequencies have several encodings: P1 = 2, N = 10 gives the same output
+ * as P1 = 1, N = 20, and with DIV1 set N doesn't matter at all. For every
+ * step schedule_compile picks the divisor closest to the frequency asked for
+ * and, among the encodings of that divisor, the ones that change the fewest
+ * registers over the whole sweep (a shortest path through the encodings of
+ * all steps). Sweeps within one prescaler range come out as a single DIV
+ * write per step. OUT0 runs at MCLK / P0 and has one encoding per
+ * frequency; only MUX is written, and only when P0 changes.
+ *
+ * Schedules are stored as a header followed by fixed size steps and played
+ * back with one step per dwell period, the periods counted from the start
+ * so late steps don't push the ones after them back.
+ */
+#define SCHEDULE_MAGIC             0x5045575337373031ull
+#define SCHEDULE_VERSION           1
+#define SCHEDULE_STEPS_MAX         65536
+#define SCHEDULE_MASTER_HZ_DEFAULT 66666667    /* DS1077L-66 */
+
+/* Registers a step writes. */
+#define SCHEDULE_DIV 0x1
+#define SCHEDULE_MUX 0x2
+
+typedef enum schedule_output {
+    SCHEDULE_OUT1 = 0,
+    SCHEDULE_OUT0,
+} schedule_output_t;
+
+typedef struct schedule_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t master_hz;
+    uint8_t output;
+    uint8_t reserved;
+    uint16_t div;               /* registers before the first step */
+    uint16_t mux;
+    uint16_t reserved2[3];
+} schedule_header_t;
+
+typedef struct schedule_step {
+    uint32_t hz;                /* output frequency, rounded */
+    uint16_t div;
+    uint16_t mux;
+    uint8_t regs;               /* SCHEDULE_DIV and SCHEDULE_MUX to write */
+    uint8_t reserved[3];
+} schedule_step_t;
+
+typedef struct schedule_stats {
+    uint64_t writes;
+    uint64_t single;            /* steps of one write */
+    uint64_t unchanged;         /* steps of none */
+    uint32_t max_error_ppm;     /* off the frequencies asked for */
+} schedule_stats_t;
+
+int schedule_compile (const schedule_header_t *header,
+                      const uint32_t *hz,
+                      schedule_step_t *steps);
+void schedule_stats (const schedule_header_t *header,
+                     const uint32_t *hz,
+                     const schedule_step_t *steps,
+                     schedule_stats_t *stats);
+int schedule_save (const char *path,
+                   const schedule_header_t *header,
+                   const schedule_step_t *steps);
+int schedule_load (const char *path,
+                   schedule_header_t *header,
+                   schedule_step_t *steps,
+                   size_t max);
+int schedule_play (int fd,
+                   const schedule_header_t *header,
+                   const schedule_step_t *steps,
+                   uint64_t dwell_ns);
+
+#endif // #ifndef _DS1077L_SCHEDULE_H_
@@ -0,0 +1,666 @@
+#include "ds1077l-sim.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-writee2.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static int sim_open (const char *bus_dev, uint8_t address);
+static int32_t sim_access (int fd,
+                           char read_write,
+                           uint8_t command,
+                           int size,
+                           union i2c_smbus_data *data);
+
+static int sim_rdwr_open (const char *bus_dev);
+static int sim_transfer (int fd, struct i2c_rdwr_ioctl_data *rdwr);
+
+const xfer_transport_t xfer_sim = {
+    .name   = "sim",
+    .open   = sim_open,
+    .access = sim_access,
+};
+
+const pool_rdwr_ops_t sim_rdwr = {
+    .open     = sim_rdwr_open,
+    .transfer = sim_transfer,
+};
+
+static sim_file_t *sim = NULL;
+static int sim_fd = -1;
+/* flock only serializes processes, threads share the open file */
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Faults of this process, and what they did to each device of the file,
+ * all under sim_lock.
+ */
+static sim_fault_t faults[SIM_FAULTS_MAX];
+static size_t fault_count = 0;
+static uint64_t fault_state = 1;
+static uint32_t fault_seen[SIM_DEVICES_MAX];
+static uint64_t fault_busy_until[SIM_DEVICES_MAX];
+static sim_fault_stats_t fault_stats;
+
+static sim_device_t *
+sim_add (uint16_t adapter, uint8_t kind, uint8_t address)
+{
+    sim_device_t *device = NULL;
+
+    if (sim->count == SIM_DEVICES_MAX) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    device = &sim->devices[sim->count++];
+    memset (device, 0, sizeof (*device));
+    device->adapter = adapter;
+    device->kind = kind;
+    device->address = address;
+    return device;
+}
+
+static bool
+sim_has_mux (uint16_t adapter, uint8_t mux)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < sim->count; ++i)
+        if (sim->devices[i].kind == SIM_PCA954X &&
+            sim->devices[i].adapter == adapter &&
+            sim->devices[i].address == mux)
+            return true;
+    return false;
+}
+
+/* The factory defaults, apart from the address. */
+static void
+ds1077l_defaults (sim_device_t *device)
+{
+    device->bus = ADDRESS_PACK (device->address);
+    device->div = DS1077L_DIV_DEFAULT_PACKED;
+    device->mux_word = SEL0_PACK (DS1077L_SEL0_DEFAULT) |
+                       EN0_PACK (DS1077L_EN0_DEFAULT);
+}
+
+/* Populate a new state file from a device list, see ds1077l-sim.h. DS1077Ls
+ * start out with the factory defaults apart from the address.
+ */
+static int
+sim_populate (const char *devices)
+{
+    topo_target_t target = { 0 };
+    sim_device_t *device = NULL;
+    uint16_t adapter = 0;
+    char *list = NULL;
+    char *save = NULL;
+    char *item = NULL;
+
+    list = strdup (devices);
+    if (list == NULL)
+        return -1;
+    sim->magic = SIM_MAGIC;
+    sim->version = SIM_VERSION;
+    sim->count = 0;
+    for (item = strtok_r (list, ",", &save);
+         item != NULL;
+         item = strtok_r (NULL, ",", &save)) {
+        if (topo_parse_target (item, &target)) {
+            errno = EINVAL;
+            goto err_out;
+        }
+        adapter = xfer_parse_adapter (target.bus_dev);
+        if (target.mux != 0 && !sim_has_mux (adapter, target.mux) &&
+            sim_add (adapter, SIM_PCA954X, target.mux) == NULL)
+            goto err_out;
+        device = sim_add (adapter, SIM_DS1077L, target.address);
+        if (device == NULL)
+            goto err_out;
+        device->mux = target.mux;
+        device->channel = target.channel;
+        ds1077l_defaults (device);
+        device->e2_bus = device->bus;
+        device->e2_div = device->div;
+        device->e2_mux = device->mux_word;
+    }
+    free (list);
+    return 0;
+err_out:
+    free (list);
+    return -1;
+}
+
+/* Map the simulator state file, creating it from 'devices' if it doesn't
+ * exist yet, and make the simulator the current transport. 'devices' is
+ * ignored for an existing file.
+ */
+int
+sim_init (const char *path, const char *devices)
+{
+    struct stat st;
+    void *map = NULL;
+    int fd = 0;
+
+    fd = open (path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return -1;
+    if (flock (fd, LOCK_EX))
+        goto err_close;
+    if (fstat (fd, &st))
+        goto err_close;
+    if (st.st_size == 0) {
+        if (devices == NULL) {
+            errno = ENOENT;
+            goto err_close;
+        }
+        if (ftruncate (fd, sizeof (sim_file_t)))
+            goto err_close;
+    } else if (st.st_size != sizeof (sim_file_t)) {
+        errno = EINVAL;
+        goto err_close;
+    }
+    map = mmap (NULL, sizeof (sim_file_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    if (map == MAP_FAILED)
+        goto err_close;
+    sim = map;
+    if (st.st_size == 0 && sim_populate (devices)) {
+        ftruncate (fd, 0);
+        goto err_unmap;
+    }
+    if (sim->magic != SIM_MAGIC || sim->version != SIM_VERSION) {
+        errno = EINVAL;
+        goto err_unmap;
+    }
+    flock (fd, LOCK_UN);
+    sim_fd = fd;
+    xfer_transport_set (&xfer_sim);
+    return 0;
+err_unmap:
+    munmap (map, sizeof (sim_file_t));
+    sim = NULL;
+err_close:
+    close (fd);
+    return -1;
+}
+
+/* Nothing is opened, but the transaction layer identifies devices by file
+ * descriptor so hand out a real one.
+ */
+static int
+sim_open (const char *bus_dev, uint8_t address)
+{
+    return open ("/dev/null", O_RDWR);
+}
+
+static int
+sim_rdwr_open (const char *bus_dev)
+{
+    return open ("/dev/null", O_RDWR);
+}
+
+static bool
+sim_routed (uint16_t adapter, uint8_t mux, uint8_t channel)
+{
+    uint32_t i = 0;
+
+    if (mux == 0)
+        return true;
+    for (i = 0; i < sim->count; ++i)
+        if (sim->devices[i].kind == SIM_PCA954X &&
+            sim->devices[i].adapter == adapter &&
+            sim->devices[i].address == mux)
+            return sim->devices[i].control & (1 << channel);
+    return false;
+}
+
+/* Find the one device answering at 'address' on 'adapter'.
+ */
+static sim_device_t *
+sim_find (uint16_t adapter, uint8_t address)
+{
+    sim_device_t *found = NULL;
+    sim_device_t *device = NULL;
+    uint32_t i = 0;
+
+    for (i = 0; i < sim->count; ++i) {
+        device = &sim->devices[i];
+        if (device->adapter != adapter || device->address != address ||
+            !sim_routed (adapter, device->mux, device->channel))
+            continue;
+        if (found != NULL) {
+            /* two devices driving the bus */
+            errno = EIO;
+            return NULL;
+        }
+        found = device;
+    }
+    if (found == NULL)
+        errno = ENXIO;
+    return found;
+}
+
+/* A PCA954x has a single control register, written and read without a
+ * command byte.
+ */
+static int32_t
+pca954x_access (sim_device_t *device,
+                char read_write,
+                uint8_t command,
+                int size,
+                union i2c_smbus_data *data)
+{
+    if (size != I2C_SMBUS_BYTE) {
+        errno = EIO;
+        return -1;
+    }
+    if (read_write == I2C_SMBUS_WRITE)
+        device->control = command;
+    else if (data != NULL)
+        data->byte = device->control;
+    return 0;
+}
+
+static void
+ds1077l_e2_write (sim_device_t *device)
+{
+    device->e2_bus = device->bus;
+    device->e2_div = device->div;
+    device->e2_mux = device->mux_word;
+    ++device->e2_writes;
+}
+
+static int32_t
+ds1077l_access (sim_device_t *device,
+                char read_write,
+                uint8_t command,
+                int size,
+                union i2c_smbus_data *data)
+{
+    uint16_t *word = NULL;
+
+    switch (command) {
+    case COMMAND_DIV:
+        word = &device->div;
+        break;
+    case COMMAND_MUX:
+        word = &device->mux_word;
+        break;
+    case COMMAND_BUS:
+        if (size != I2C_SMBUS_BYTE_DATA || data == NULL)
+            goto err_out;
+        if (read_write == I2C_SMBUS_READ) {
+            data->byte = device->bus;
+            return 0;
+        }
+        device->bus = data->byte & 0x0f;
+        device->address = ADDRESS_UNPACK (device->bus);
+        if (!(device->bus & WC_PACK (true)))
+            ds1077l_e2_write (device);
+        return 0;
+    case COMMAND_E2_WRITE:
+        if (read_write != I2C_SMBUS_WRITE)
+            goto err_out;
+        ds1077l_e2_write (device);
+        return 0;
+    default:
+        goto err_out;
+    }
+    if (size != I2C_SMBUS_WORD_DATA || data == NULL)
+        goto err_out;
+    if (read_write == I2C_SMBUS_READ) {
+        data->word = *word;
+        return 0;
+    }
+    *word = data->word;
+    if (!(device->bus & WC_PACK (true)))
+        ds1077l_e2_write (device);
+    return 0;
+err_out:
+    errno = EIO;
+    return -1;
+}
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Uniform in [0, 1), xorshift64* so runs with the same seed repeat. */
+static double
+fault_random (void)
+{
+    fault_state ^= fault_state >> 12;
+    fault_state ^= fault_state << 25;
+    fault_state ^= fault_state >> 27;
+    return ((fault_state * 0x2545f4914f6cdd1dull) >> 11) * 0x1.0p-53;
+}
+
+static bool
+fault_matches (const sim_fault_t *fault, uint16_t adapter, uint8_t address)
+{
+    return fault->address == 0 ||
+           (fault->adapter == adapter && fault->address == address);
+}
+
+/* Parse one FAULT=VALUE into 'fault'. */
+static int
+fault_parse (char *item, sim_fault_t *fault)
+{
+    char *value = NULL;
+    char *end = NULL;
+
+    value = strchr (item, '=');
+    if (value == NULL)
+        goto err_inval;
+    *value++ = '\0';
+    errno = 0;
+    if (strcmp (item, "nak") == 0 || strcmp (item, "reset") == 0) {
+        fault->kind = item[0] == 'n' ? SIM_FAULT_NAK : SIM_FAULT_RESET;
+        fault->probability = strtod (value, &end);
+    } else if (strcmp (item, "spike") == 0) {
+        fault->kind = SIM_FAULT_SPIKE;
+        fault->probability = strtod (value, &end);
+        if (*end != ':')
+            goto err_inval;
+        value = end + 1;
+        fault->us = strtoul (value, &end, 10);
+    } else if (strcmp (item, "busy") == 0) {
+        fault->kind = SIM_FAULT_BUSY;
+        fault->us = strtoul (value, &end, 10);
+    } else if (strcmp (item, "vanish") == 0) {
+        fault->kind = SIM_FAULT_VANISH;
+        fault->after = strtoul (value, &end, 10);
+    } else {
+        goto err_inval;
+    }
+    if (errno != 0 || end == value || *end != '\0' ||
+        fault->probability < 0 || fault->probability > 1)
+        goto err_inval;
+    return 0;
+err_inval:
+    errno = EINVAL;
+    return -1;
+}
+
+/* Set the faults of this process from 'spec', see ds1077l-sim.h, replacing
+ * any set before and starting their counts over. Returns 0 or -1 with errno
+ * set, leaving no faults.
+ */
+int
+sim_faults_parse (const char *spec)
+{
+    topo_target_t target = { 0 };
+    sim_fault_t fault = { 0 };
+    char *list = NULL;
+    char *save = NULL;
+    char *item = NULL;
+    char *at = NULL;
+    char *end = NULL;
+    int ret = 0;
+
+    list = strdup (spec);
+    if (list == NULL)
+        return -1;
+    pthread_mutex_lock (&sim_lock);
+    fault_count = 0;
+    fault_state = 1;
+    memset (fault_seen, 0, sizeof (fault_seen));
+    memset (fault_busy_until, 0, sizeof (fault_busy_until));
+    memset (&fault_stats, 0, sizeof (fault_stats));
+    for (item = strtok_r (list, ",", &save);
+         item != NULL && ret == 0;
+         item = strtok_r (NULL, ",", &save)) {
+        fault = (sim_fault_t) { 0 };
+        if (strncmp (item, "seed=", 5) == 0) {
+            fault_state = strtoull (item + 5, &end, 10);
+            if (*end != '\0') {
+                errno = EINVAL;
+                ret = -1;
+            }
+            /* xorshift never leaves 0 */
+            fault_state += fault_state == 0;
+            continue;
+        }
+        at = strchr (item, '@');
+        if (at != NULL) {
+            *at++ = '\0';
+            if (topo_parse_target (at, &target)) {
+                errno = EINVAL;
+                ret = -1;
+                break;
+            }
+            fault.adapter = xfer_parse_adapter (target.bus_dev);
+            fault.address = target.address;
+        }
+        if (fault_count == SIM_FAULTS_MAX) {
+            errno = E2BIG;
+            ret = -1;
+        } else if ((ret = fault_parse (item, &fault)) == 0) {
+            faults[fault_count++] = fault;
+        }
+    }
+    if (ret)
+        fault_count = 0;
+    pthread_mutex_unlock (&sim_lock);
+    free (list);
+    return ret;
+}
+
+void
+sim_fault_stats (sim_fault_stats_t *stats)
+{
+    pthread_mutex_lock (&sim_lock);
+    *stats = fault_stats;
+    pthread_mutex_unlock (&sim_lock);
+}
+
+/* A DS1077L transaction with the faults set for the device. Spikes add to
+ * 'delay_us', to be slept off by the caller.
+ */
+static int32_t
+ds1077l_faulty_access (sim_device_t *device,
+                       uint16_t adapter,
+                       char read_write,
+                       uint8_t command,
+                       int size,
+                       union i2c_smbus_data *data,
+                       uint32_t *delay_us)
+{
+    size_t index = device - sim->devices;
+    uint32_t e2_writes = device->e2_writes;
+    const sim_fault_t *fault = NULL;
+    uint64_t now = 0;
+    int32_t ret = 0;
+    size_t i = 0;
+
+    if (fault_count == 0)
+        return ds1077l_access (device, read_write, command, size, data);
+    now = now_ns ();
+    ++fault_seen[index];
+    if (now < fault_busy_until[index]) {
+        ++fault_stats.busy;
+        goto err_nak;
+    }
+    for (i = 0; i < fault_count; ++i) {
+        fault = &faults[i];
+        if (!fault_matches (fault, adapter, device->address))
+            continue;
+        switch (fault->kind) {
+        case SIM_FAULT_VANISH:
+            if (fault_seen[index] <= fault->after)
+                break;
+            ++fault_stats.vanished;
+            goto err_nak;
+        case SIM_FAULT_NAK:
+            if (fault_random () >= fault->probability)
+                break;
+            ++fault_stats.naks;
+            goto err_nak;
+        case SIM_FAULT_RESET:
+            if (fault_random () >= fault->probability)
+                break;
+            ++fault_stats.resets;
+            ds1077l_defaults (device);
+            break;
+        case SIM_FAULT_SPIKE:
+            if (fault_random () >= fault->probability)
+                break;
+            ++fault_stats.spikes;
+            *delay_us += fault->us;
+            break;
+        case SIM_FAULT_BUSY:
+            break;
+        }
+    }
+    ret = ds1077l_access (device, read_write, command, size, data);
+    if (ret == 0 && device->e2_writes != e2_writes)
+        for (i = 0; i < fault_count; ++i)
+            if (faults[i].kind == SIM_FAULT_BUSY &&
+                fault_matches (&faults[i], adapter, device->address))
+                fault_busy_until[index] = now + faults[i].us * 1000ull;
+    return ret;
+err_nak:
+    *delay_us = 0;
+    errno = ENXIO;
+    return -1;
+}
+
+/* One transaction with whatever answers at 'address' on 'adapter'. Called
+ * with the model locked, spikes add to 'delay_us'.
+ */
+static int32_t
+sim_device_access (uint16_t adapter,
+                   uint8_t address,
+                   char read_write,
+                   uint8_t command,
+                   int size,
+                   union i2c_smbus_data *data,
+                   uint32_t *delay_us)
+{
+    sim_device_t *device = sim_find (adapter, address);
+
+    if (device == NULL)
+        return -1;
+    if (device->kind == SIM_PCA954X)
+        return pca954x_access (device, read_write, command, size, data);
+    return ds1077l_faulty_access (device, adapter, read_write, command, size,
+                                  data, delay_us);
+}
+
+static void
+sim_enter (void)
+{
+    pthread_mutex_lock (&sim_lock);
+    flock (sim_fd, LOCK_EX);
+}
+
+/* Unlock the model, then sleep off the spikes so that it is free for other
+ * adapters while this one is slow. Keeps errno.
+ */
+static void
+sim_leave (uint32_t delay_us)
+{
+    struct timespec delay = { 0 };
+    int err = errno;
+
+    flock (sim_fd, LOCK_UN);
+    pthread_mutex_unlock (&sim_lock);
+    if (delay_us != 0) {
+        delay.tv_sec = delay_us / 1000000;
+        delay.tv_nsec = (delay_us % 1000000) * 1000;
+        nanosleep (&delay, NULL);
+    }
+    errno = err;
+}
+
+static int32_t
+sim_access (int fd,
+            char read_write,
+            uint8_t command,
+            int size,
+            union i2c_smbus_data *data)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    uint32_t delay_us = 0;
+    int32_t ret = 0;
+
+    sim_enter ();
+    ret = sim_device_access (xfer_adapter_number (target->adapter),
+                             target->address, read_write, command, size, data,
+                             &delay_us);
+    sim_leave (delay_us);
+    return ret;
+}
+
+/* I2C_RDWR messages taken back apart into the SMBus transactions they stand
+ * for: a write followed by a read is a byte or word read depending on the
+ * length of the read, a lone write of 1, 2 or 3 bytes is a send byte, a byte
+ * write or a word write (low byte first). The whole transfer runs with the
+ * model locked, as the bus is held throughout.
+ */
+static int
+sim_transfer (int fd, struct i2c_rdwr_ioctl_data *rdwr)
+{
+    uint16_t adapter = xfer_adapter_number (xfer_target (fd)->adapter);
+    union i2c_smbus_data data = { 0 };
+    struct i2c_msg *msg = NULL;
+    struct i2c_msg *in = NULL;
+    uint32_t delay_us = 0;
+    int32_t ret = 0;
+    uint32_t i = 0;
+
+    sim_enter ();
+    for (i = 0; i < rdwr->nmsgs && ret == 0; ++i) {
+        msg = &rdwr->msgs[i];
+        in = i + 1 < rdwr->nmsgs && (rdwr->msgs[i + 1].flags & I2C_M_RD) ?
+             &rdwr->msgs[i + 1] : NULL;
+        if ((msg->flags & I2C_M_RD) || msg->len < 1 || msg->len > 3 ||
+            (in != NULL && (msg->len != 1 || in->len < 1 || in->len > 2))) {
+            errno = EINVAL;
+            ret = -1;
+        } else if (in != NULL) {
+            ret = sim_device_access (adapter, msg->addr, I2C_SMBUS_READ,
+                                     msg->buf[0], in->len == 2 ?
+                                     I2C_SMBUS_WORD_DATA : I2C_SMBUS_BYTE_DATA,
+                                     &data, &delay_us);
+            if (in->len == 2) {
+                in->buf[0] = data.word & 0xff;
+                in->buf[1] = data.word >> 8;
+            } else {
+                in->buf[0] = data.byte;
+            }
+            ++i;
+        } else if (msg->len == 1) {
+            ret = sim_device_access (adapter, msg->addr, I2C_SMBUS_WRITE,
+                                     msg->buf[0], I2C_SMBUS_BYTE, NULL,
+                                     &delay_us);
+        } else {
+            if (msg->len == 3)
+                data.word = msg->buf[1] | msg->buf[2] << 8;
+            else
+                data.byte = msg->buf[1];
+            ret = sim_device_access (adapter, msg->addr, I2C_SMBUS_WRITE,
+                                     msg->buf[0], msg->len == 3 ?
+                                     I2C_SMBUS_WORD_DATA : I2C_SMBUS_BYTE_DATA,
+                                     &data, &delay_us);
+        }
+    }
+    sim_leave (delay_us);
+    return ret == -1 ? -1 : (int)rdwr->nmsgs;
+}
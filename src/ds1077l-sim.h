@@ -0,0 +1,115 @@
+#ifndef _DS1077L_SIM_H_
+#define _DS1077L_SIM_H_
+
+#include "ds1077l-pool.h"
+#include "ds1077l-xfer.h"
+
+#include <stdint.h>
+
+/* Simulated bus.
+ *
+ * The simulator transport answers transactions from a model of DS1077Ls and
+ * PCA954x multiplexers instead of hardware. The state of the model lives in
+ * a memory mapped file so several processes (and runs) see the same
+ * devices, and accesses to it are serialized with flock. The file is created
+ * from a device list the first time it's used:
+ *
+ *   ADAPTER[/MUX/CHANNEL]/ADDRESS[,...]
+ *
+ * e.g. i2c-1/0x58,i2c-1/0x70/0/0x58,i2c-1/0x70/1/0x58. A PCA954x is added
+ * for every mux named in the list. Like the real thing a device behind a
+ * mux only answers when its channel is routed, a device nobody answers for
+ * NAKs with ENXIO and two devices answering at once fail with EIO. DS1077Ls
+ * keep EEPROM copies of their registers which are written by E2_WRITE or on
+ * every register write when WC is 0, and writing the address bits of the
+ * BUS register moves the device.
+ *
+ * Faults are injected into DS1077L transactions from a comma separated list
+ * of FAULT[@ADAPTER/ADDRESS], where FAULT applies to every device without a
+ * target and is one of:
+ *
+ *   nak=P        the transaction is NAKed (ENXIO) with probability P
+ *   busy=US      after each EEPROM write the device NAKs for US
+ *                microseconds, a write cycle that doesn't end
+ *   spike=P:US   with probability P the transaction takes US microseconds
+ *                longer, without holding up other adapters
+ *   vanish=N     the device stops answering after N transactions
+ *   reset=P      with probability P the device resets its registers to the
+ *                factory defaults, apart from the address, before the
+ *                transaction; the EEPROM keeps what it had
+ *   seed=N       seeds the random draws, so runs repeat
+ *
+ * e.g. nak=0.01,spike=0.001:5000@i2c-2/0x58. Faults are set per process,
+ * the model in the file stays healthy.
+ */
+#define SIM_ENV         "DS1077L_SIM"
+#define SIM_FAULTS_ENV  "DS1077L_SIM_FAULTS"
+#define SIM_MAGIC       0x4d495337373031ull
+#define SIM_VERSION     1
+#define SIM_DEVICES_MAX 64
+#define SIM_FAULTS_MAX  16
+
+typedef enum sim_kind {
+    SIM_DS1077L = 1,
+    SIM_PCA954X,
+} sim_kind_t;
+
+typedef struct sim_device {
+    uint16_t adapter;           /* see xfer_adapter_number */
+    uint8_t kind;
+    uint8_t mux;                /* PCA954x in front of the device, 0 for none */
+    uint8_t channel;
+    uint8_t address;            /* follows the BUS register */
+    uint8_t control;            /* PCA954x channel enable mask */
+    uint8_t bus;
+    uint16_t div;
+    uint16_t mux_word;
+    uint16_t e2_div;
+    uint16_t e2_mux;
+    uint8_t e2_bus;
+    uint8_t reserved;
+    uint32_t e2_writes;
+} sim_device_t;
+
+typedef struct sim_file {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+    sim_device_t devices[SIM_DEVICES_MAX];
+} sim_file_t;
+
+typedef enum sim_fault_kind {
+    SIM_FAULT_NAK = 0,
+    SIM_FAULT_BUSY,
+    SIM_FAULT_SPIKE,
+    SIM_FAULT_VANISH,
+    SIM_FAULT_RESET,
+} sim_fault_kind_t;
+
+typedef struct sim_fault {
+    sim_fault_kind_t kind;
+    uint16_t adapter;
+    uint8_t address;            /* 0 for every device */
+    double probability;
+    uint32_t us;
+    uint32_t after;
+} sim_fault_t;
+
+/* Transactions failed, slowed or preceded by a reset, by fault. */
+typedef struct sim_fault_stats {
+    uint64_t naks;
+    uint64_t busy;
+    uint64_t spikes;
+    uint64_t vanished;
+    uint64_t resets;
+} sim_fault_stats_t;
+
+extern const xfer_transport_t xfer_sim;
+/* Serves xfer_rdwr from the model, see pool_rdwr_set. */
+extern const pool_rdwr_ops_t sim_rdwr;
+
+int sim_init (const char *path, const char *devices);
+int sim_faults_parse (const char *spec);
+void sim_fault_stats (sim_fault_stats_t *stats);
+
+#endif // #ifndef _DS1077L_SIM_H_
@@ -0,0 +1,206 @@
+#include "ds1077l-state.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-writee2.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Parse one line of a state file. Returns 1 for blank lines and comments,
+ * -1 with errno set for invalid lines and named presets not in the index.
+ */
+int
+state_parse (const char *line, state_entry_t *entry)
+{
+    char buf[256] = { 0 };
+    char *save = NULL;
+    char *token = NULL;
+    char *rest = NULL;
+    const preset_t *preset = NULL;
+    int ret = 0;
+
+    memset (entry, 0, sizeof (*entry));
+    if (strlen (line) >= sizeof (buf) - 8) {
+        errno = EINVAL;
+        return -1;
+    }
+    strcpy (buf, line);
+    token = strtok_r (buf, " \t\r\n", &save);
+    if (token == NULL || token[0] == '#')
+        return 1;
+    if (topo_parse_target (token, &entry->target)) {
+        errno = EINVAL;
+        return -1;
+    }
+    rest = save + strspn (save, " \t");
+    token = strtok_r (NULL, " \t\r\n", &save);
+    if (token == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* a name alone is a preset from the index */
+    if (strchr (token, '=') == NULL &&
+        strtok_r (NULL, " \t\r\n", &save) == NULL) {
+        preset = preset_find (token);
+        if (preset == NULL) {
+            errno = ENOENT;
+            return -1;
+        }
+        entry->preset = *preset;
+        return 0;
+    }
+    /* settings are a preset without a name, parse them as one */
+    snprintf (buf, sizeof (buf), "state %s", line + (rest - buf));
+    ret = preset_parse (buf, &entry->preset);
+    if (ret) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+state_restore_fd (int fd,
+                  const state_entry_t *entry,
+                  bool commit,
+                  const transition_band_t *band,
+                  state_result_t *result)
+{
+    static const xfer_reg_t regs[] = {
+        { .command = COMMAND_DIV, .size = I2C_SMBUS_WORD_DATA },
+        { .command = COMMAND_MUX, .size = I2C_SMBUS_WORD_DATA },
+        { .command = COMMAND_BUS, .size = I2C_SMBUS_BYTE_DATA },
+    };
+    const preset_t *preset = &entry->preset;
+    const topo_target_t *target = &entry->target;
+    uint16_t values[3];
+    uint8_t wc = 0;
+
+    if (xfer_read_regs (fd, regs, 3, values))
+        return -1;
+    if ((!(preset->regs & PRESET_DIV) ||
+         (values[0] & STATE_DIV_MASK) == preset->div) &&
+        (!(preset->regs & PRESET_MUX) ||
+         (values[1] & STATE_MUX_MASK) == preset->mux) &&
+        (!(preset->regs & PRESET_BUS) ||
+         (values[2] & WC_PACK (true)) == preset->wc)) {
+        *result = STATE_SKIPPED;
+        return 0;
+    }
+    if (preset_apply_band (preset, target, band))
+        return -1;
+    /* with WC clear every write went to the EEPROM already */
+    wc = preset->regs & PRESET_BUS ? preset->wc : values[2] & WC_PACK (true);
+    if (commit && wc && xfer_command (fd, COMMAND_E2_WRITE) == -1)
+        return -1;
+    *result = STATE_WRITTEN;
+    return 0;
+}
+
+/* Bring the device of 'entry' to its state unless it's there already,
+ * keeping OUT1 inside 'band' on the way if one is given. What was done goes
+ * to 'result'. Returns 0 or -1 with errno set.
+ */
+int
+state_restore (const state_entry_t *entry,
+               bool commit,
+               const transition_band_t *band,
+               state_result_t *result)
+{
+    const topo_target_t *target = &entry->target;
+    int ret = 0;
+    int fd = 0;
+
+    fd = pool_get (target->bus_dev, target->mux, target->channel,
+                   target->address);
+    if (fd == -1)
+        return -1;
+    ret = state_restore_fd (fd, entry, commit, band, result);
+    pool_put (fd);
+    return ret;
+}
+
+/* Format the current state of 'target' as a line of a state file.
+ */
+int
+state_save (const topo_target_t *target, char *line, size_t size)
+{
+    static const xfer_reg_t regs[] = {
+        { .command = COMMAND_DIV, .size = I2C_SMBUS_WORD_DATA },
+        { .command = COMMAND_MUX, .size = I2C_SMBUS_WORD_DATA },
+        { .command = COMMAND_BUS, .size = I2C_SMBUS_BYTE_DATA },
+    };
+    uint16_t values[3];
+    int len = 0;
+    int fd = 0;
+
+    fd = pool_get (target->bus_dev, target->mux, target->channel,
+                   target->address);
+    if (fd == -1)
+        return -1;
+    len = xfer_read_regs (fd, regs, 3, values);
+    pool_put (fd);
+    if (len)
+        return -1;
+    if (target->mux == 0)
+        len = snprintf (line, size, "%s/%#x", target->bus_dev,
+                        target->address);
+    else
+        len = snprintf (line, size, "%s/%#x/%d/%#x", target->bus_dev,
+                        target->mux, target->channel, target->address);
+    if (len >= 0 && len < size)
+        len += snprintf (line + len, size - len,
+                         " n=%d m0=%d m1=%d div1=%d en0=%d sel0=%d pdn0=%d "
+                         "pdn1=%d wc=%d",
+                         DIV_UNPACK (values[0]), M0_UNPACK (values[1]),
+                         M1_UNPACK (values[1]), DIV1_UNPACK (values[1]),
+                         EN0_UNPACK (values[1]), SEL0_UNPACK (values[1]),
+                         PDN0_UNPACK (values[1]), PDN1_UNPACK (values[1]),
+                         WC_UNPACK (values[2]));
+    if (len < 0 || len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Tell the service manager about our 'state', e.g. "READY=1", the way
+ * sd_notify does: a datagram to the socket in $NOTIFY_SOCKET, abstract if
+ * it starts with '@'. Does nothing when not run by systemd.
+ */
+int
+state_notify (const char *state)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char *path = getenv ("NOTIFY_SOCKET");
+    socklen_t len = 0;
+    ssize_t sent = 0;
+    int fd = 0;
+
+    if (path == NULL || path[0] == '\0')
+        return 0;
+    if ((path[0] != '/' && path[0] != '@') ||
+        strlen (path) >= sizeof (addr.sun_path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    strcpy (addr.sun_path, path);
+    if (path[0] == '@')
+        addr.sun_path[0] = '\0';
+    len = offsetof (struct sockaddr_un, sun_path) + strlen (path);
+    fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    sent = sendto (fd, state, strlen (state), MSG_NOSIGNAL,
+                   (struct sockaddr *)&addr, len);
+    close (fd);
+    return sent == -1 ? -1 : 0;
+}
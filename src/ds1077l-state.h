@@ -0,0 +1,53 @@
+#ifndef _DS1077L_STATE_H_
+#define _DS1077L_STATE_H_
+
+#include "ds1077l-preset.h"
+#include "ds1077l-topo.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Restoring devices to their desired state at boot.
+ *
+ * The desired state is a text file with one device per line, followed by
+ * either the name of a preset from the compiled index or settings in the
+ * preset syntax:
+ *
+ *   # DEVICE           STATE
+ *   i2c-1/0x58         production
+ *   i2c-1/0x70/3/0x5a  n=10 m0=2 wc=1
+ *
+ * Right after power up a DS1077L's registers hold what its EEPROM holds, so
+ * state_restore reads them first, in one transfer, and leaves devices that
+ * already match alone. The others are written with preset_apply, which
+ * writes the words as they are without reading them back, or given a band
+ * with preset_apply_band, and committed with E2_WRITE unless asked not to,
+ * so they match on the next boot. With WC clear the writes commit
+ * themselves and E2_WRITE is skipped.
+ */
+#define STATE_ENV     "DS1077L_STATE"
+#define STATE_DEFAULT "/etc/ds1077l.state"
+
+/* DIV and MUX bits that exist, the others read back as anything */
+#define STATE_DIV_MASK 0xc0ff
+#define STATE_MUX_MASK 0xc07f
+
+typedef struct state_entry {
+    topo_target_t target;
+    preset_t preset;
+} state_entry_t;
+
+typedef enum state_result {
+    STATE_SKIPPED = 0,
+    STATE_WRITTEN,
+} state_result_t;
+
+int state_parse (const char *line, state_entry_t *entry);
+int state_restore (const state_entry_t *entry,
+                   bool commit,
+                   const transition_band_t *band,
+                   state_result_t *result);
+int state_save (const topo_target_t *target, char *line, size_t size);
+int state_notify (const char *state);
+
+#endif // #ifndef _DS1077L_STATE_H_
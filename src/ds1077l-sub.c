@@ -0,0 +1,456 @@
+/* accept4 */
+#define _GNU_SOURCE
+
+#include "ds1077l-sub.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct sub_entry {
+    int fd;                     /* client */
+    topo_target_t target;
+    uint8_t regs;
+    uint8_t pending;            /* changed registers not sent yet */
+    uint32_t changes;           /* changes folded into the pending event */
+    bool snapshot;              /* owes the client the current state */
+} sub_entry_t;
+
+typedef struct sub_device {
+    topo_target_t target;
+    watch_image_t image;
+} sub_device_t;
+
+static int listen_fd = -1;
+static char listen_path[sizeof (((struct sockaddr_un *)0)->sun_path)];
+static sub_subscribed_t on_subscribe = NULL;
+static void *on_subscribe_arg = NULL;
+static int clients[SUB_CLIENTS_MAX];
+static size_t client_count = 0;
+static sub_entry_t subs[SUB_SUBSCRIPTIONS_MAX];
+static size_t sub_count = 0;
+static sub_device_t devices[SUB_DEVICES_MAX];
+static size_t device_count = 0;
+
+static int
+sub_address (const char *path, struct sockaddr_un *addr)
+{
+    memset (addr, 0, sizeof (*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy (addr->sun_path, path);
+    return 0;
+}
+
+/* Connect to the subscription socket of a running ds1077l-monitor.
+ */
+int
+sub_connect (const char *path)
+{
+    struct sockaddr_un addr;
+    int fd = 0;
+    int err = 0;
+
+    if (sub_address (path, &addr))
+        return -1;
+    fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (connect (fd, (struct sockaddr *)&addr, sizeof (addr))) {
+        err = errno;
+        close (fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int
+sub_subscribe (int fd, const topo_target_t *target, uint8_t regs)
+{
+    sub_request_t request = { 0 };
+
+    request.version = SUB_VERSION;
+    request.regs = regs;
+    request.target = *target;
+    if (send (fd, &request, sizeof (request), MSG_NOSIGNAL) == -1)
+        return -1;
+    return 0;
+}
+
+/* Read the next event. Blocks unless the socket is non-blocking, returns -1
+ * with errno set to ECONNRESET once the daemon goes away.
+ */
+int
+sub_read (int fd, sub_event_t *event)
+{
+    ssize_t ret = 0;
+
+    do {
+        ret = recv (fd, event, sizeof (*event), 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1)
+        return -1;
+    if (ret == 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if (ret != sizeof (*event) || event->version != SUB_VERSION) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Create the socket subscribers connect to, readable and writable by its
+ * owner and 'group', or our own group if 'group' is -1. 'subscribed' is
+ * called for each subscription as it comes in and goes away.
+ */
+int
+sub_listen (const char *path,
+            gid_t group,
+            sub_subscribed_t subscribed,
+            void *arg)
+{
+    struct sockaddr_un addr;
+    int err = 0;
+
+    if (sub_address (path, &addr))
+        return -1;
+    listen_fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        0);
+    if (listen_fd == -1)
+        return -1;
+    /* left behind by a previous instance */
+    unlink (path);
+    if (bind (listen_fd, (struct sockaddr *)&addr, sizeof (addr)))
+        goto err_out;
+    if (chmod (path, 0660) || chown (path, -1, group) ||
+        listen (listen_fd, SUB_CLIENTS_MAX))
+        goto err_unlink;
+    strcpy (listen_path, path);
+    on_subscribe = subscribed;
+    on_subscribe_arg = arg;
+    return 0;
+err_unlink:
+    err = errno;
+    unlink (path);
+    errno = err;
+err_out:
+    err = errno;
+    close (listen_fd);
+    listen_fd = -1;
+    errno = err;
+    return -1;
+}
+
+static sub_device_t *
+device_find (const topo_target_t *target)
+{
+    size_t i = 0;
+
+    for (i = 0; i < device_count; ++i)
+        if (topo_compare (&devices[i].target, target) == 0)
+            return &devices[i];
+    return NULL;
+}
+
+static bool
+client_pending (int fd)
+{
+    size_t i = 0;
+
+    for (i = 0; i < sub_count; ++i)
+        if (subs[i].fd == fd && (subs[i].pending || subs[i].snapshot) &&
+            device_find (&subs[i].target) != NULL)
+            return true;
+    return false;
+}
+
+/* Poll descriptors for the listening socket and every client, asking for
+ * POLLOUT where events are waiting for room.
+ */
+size_t
+sub_pollfds (struct pollfd *fds, size_t max)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+    if (listen_fd == -1 || max == 0)
+        return 0;
+    fds[count].fd = listen_fd;
+    fds[count++].events = POLLIN;
+    for (i = 0; i < client_count && count < max; ++i) {
+        fds[count].fd = clients[i];
+        fds[count++].events = POLLIN |
+                              (client_pending (clients[i]) ? POLLOUT : 0);
+    }
+    return count;
+}
+
+static bool
+device_subscribed (const topo_target_t *target)
+{
+    size_t i = 0;
+
+    for (i = 0; i < sub_count; ++i)
+        if (topo_compare (&subs[i].target, target) == 0)
+            return true;
+    return false;
+}
+
+/* Forget a device once its last subscriber is gone, so devices subscribed
+ * to once don't keep their slots here and in the daemon.
+ */
+static void
+device_release (const topo_target_t *target)
+{
+    sub_device_t *device = NULL;
+    topo_target_t copy = *target;
+
+    if (device_subscribed (&copy))
+        return;
+    device = device_find (&copy);
+    if (device != NULL)
+        *device = devices[--device_count];
+    if (on_subscribe != NULL)
+        on_subscribe (&copy, false, on_subscribe_arg);
+}
+
+static void
+client_drop (int fd)
+{
+    topo_target_t target;
+    size_t i = 0;
+
+    for (i = 0; i < sub_count; ) {
+        if (subs[i].fd == fd) {
+            target = subs[i].target;
+            subs[i] = subs[--sub_count];
+            device_release (&target);
+        } else {
+            ++i;
+        }
+    }
+    for (i = 0; i < client_count; ++i) {
+        if (clients[i] == fd) {
+            clients[i] = clients[--client_count];
+            break;
+        }
+    }
+    close (fd);
+}
+
+static void
+event_fill (sub_event_t *event,
+            const sub_entry_t *sub,
+            const watch_image_t *image)
+{
+    uint16_t word = image->mux;
+
+    memset (event, 0, sizeof (*event));
+    event->version = SUB_VERSION;
+    event->snapshot = sub->snapshot;
+    event->regs = sub->snapshot ? sub->regs : sub->pending;
+    event->coalesced = sub->changes > 1 ? sub->changes - 1 : 0;
+    event->target = sub->target;
+    event->image = *image;
+    event->div.n = DIV_UNPACK (image->div);
+    event->mux.pdn1 = PDN1_UNPACK (word);
+    event->mux.pdn0 = PDN0_UNPACK (word);
+    event->mux.sel0 = SEL0_UNPACK (word);
+    event->mux.en0  = EN0_UNPACK (word);
+    event->mux.m0   = M0_UNPACK (word);
+    event->mux.m1   = M1_UNPACK (word);
+    event->mux.div1 = DIV1_UNPACK (word);
+    event->bus.address = ADDRESS_UNPACK (image->bus);
+    event->bus.wc = WC_UNPACK (image->bus);
+}
+
+/* Send a client whatever it's owed until its socket fills up. Whatever
+ * doesn't fit stays pending and keeps absorbing changes. Returns -1 if the
+ * client is gone.
+ */
+static int
+client_flush (int fd)
+{
+    sub_device_t *device = NULL;
+    sub_event_t event;
+    size_t i = 0;
+
+    for (i = 0; i < sub_count; ++i) {
+        if (subs[i].fd != fd || (!subs[i].pending && !subs[i].snapshot))
+            continue;
+        device = device_find (&subs[i].target);
+        if (device == NULL)
+            continue;
+        event_fill (&event, &subs[i], &device->image);
+        if (send (fd, &event, sizeof (event),
+                  MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        subs[i].pending = 0;
+        subs[i].changes = 0;
+        subs[i].snapshot = false;
+    }
+    return 0;
+}
+
+static void
+client_accept (void)
+{
+    int fd = 0;
+
+    fd = accept4 (listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+        return;
+    if (client_count == SUB_CLIENTS_MAX) {
+        close (fd);
+        return;
+    }
+    clients[client_count++] = fd;
+}
+
+static sub_entry_t *
+sub_find (int fd, const topo_target_t *target)
+{
+    size_t i = 0;
+
+    for (i = 0; i < sub_count; ++i)
+        if (subs[i].fd == fd && topo_compare (&subs[i].target, target) == 0)
+            return &subs[i];
+    return NULL;
+}
+
+/* Whether a request names a DS1077L on an I2C adapter: /dev/i2c-N, an
+ * address the part can have and, if behind a mux, a PCA954x channel.
+ */
+static bool
+request_valid (const topo_target_t *target)
+{
+    const char *p = target->bus_dev + 9;
+
+    if (strncmp (target->bus_dev, "/dev/i2c-", 9) != 0 || *p == '\0')
+        return false;
+    for (; *p != '\0'; ++p)
+        if (*p < '0' || *p > '9')
+            return false;
+    if (target->address < 0x58 || target->address > 0x5f)
+        return false;
+    if (target->mux == 0)
+        return target->channel == 0;
+    return target->mux >= TOPO_MUX_MIN && target->mux <= TOPO_MUX_MAX &&
+           target->channel < TOPO_CHANNELS;
+}
+
+/* Take a request off a client's socket. Returns -1 if the client is gone or
+ * misbehaving.
+ */
+static int
+client_request (int fd)
+{
+    sub_request_t request;
+    sub_entry_t *sub = NULL;
+    ssize_t ret = 0;
+
+    ret = recv (fd, &request, sizeof (request), MSG_DONTWAIT);
+    if (ret == -1)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    if (ret != sizeof (request) || request.version != SUB_VERSION)
+        return -1;
+    request.target.bus_dev[sizeof (request.target.bus_dev) - 1] = '\0';
+    if (!request_valid (&request.target))
+        return -1;
+    sub = sub_find (fd, &request.target);
+    if (sub == NULL) {
+        if (sub_count == SUB_SUBSCRIPTIONS_MAX)
+            return -1;
+        sub = &subs[sub_count++];
+        memset (sub, 0, sizeof (*sub));
+        sub->fd = fd;
+        sub->target = request.target;
+    }
+    sub->regs = request.regs;
+    sub->snapshot = true;
+    if (on_subscribe != NULL)
+        on_subscribe (&sub->target, true, on_subscribe_arg);
+    return client_flush (fd);
+}
+
+/* Handle what poll found on the descriptors from sub_pollfds.
+ */
+void
+sub_dispatch (const struct pollfd *fds, size_t count)
+{
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (fds[i].revents == 0)
+            continue;
+        if (fds[i].fd == listen_fd) {
+            client_accept ();
+            continue;
+        }
+        if ((fds[i].revents & (POLLHUP | POLLERR)) ||
+            ((fds[i].revents & POLLIN) && client_request (fds[i].fd)) ||
+            ((fds[i].revents & POLLOUT) && client_flush (fds[i].fd)))
+            client_drop (fds[i].fd);
+    }
+}
+
+/* Record the current register image of a device and notify subscribers of
+ * the registers that changed since the last one.
+ */
+void
+sub_publish (const topo_target_t *target, const watch_image_t *image)
+{
+    sub_device_t *device = device_find (target);
+    uint8_t changed = 0;
+    size_t i = 0;
+
+    if (device == NULL) {
+        if (device_count == SUB_DEVICES_MAX)
+            return;
+        device = &devices[device_count++];
+        device->target = *target;
+        changed = WATCH_DIV | WATCH_MUX | WATCH_BUS;
+    } else {
+        changed = watch_diff (&device->image, image);
+    }
+    device->image = *image;
+    if (changed == 0)
+        return;
+    for (i = 0; i < sub_count; ++i) {
+        if (topo_compare (&subs[i].target, target) != 0 ||
+            !(subs[i].regs & changed))
+            continue;
+        subs[i].pending |= subs[i].regs & changed;
+        ++subs[i].changes;
+    }
+    for (i = 0; i < client_count; ) {
+        if (client_flush (clients[i]))
+            client_drop (clients[i]);
+        else
+            ++i;
+    }
+}
+
+void
+sub_close (void)
+{
+    while (client_count > 0)
+        client_drop (clients[0]);
+    if (listen_fd == -1)
+        return;
+    close (listen_fd);
+    unlink (listen_path);
+    listen_fd = -1;
+}
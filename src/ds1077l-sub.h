@@ -0,0 +1,83 @@
+#ifndef _DS1077L_SUB_H_
+#define _DS1077L_SUB_H_
+
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-watch.h"
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Register change subscriptions.
+ *
+ * Instead of every service polling the devices it cares about, a resident
+ * ds1077l-monitor --socket polls each device once and tells subscribers
+ * when registers change. Clients connect to the SOCK_SEQPACKET Unix socket
+ * (sub_connect), send one request per device naming the registers they are
+ * interested in (sub_subscribe) and then read one sub_event_t per change
+ * (sub_read). The socket is an ordinary file descriptor to put in an epoll
+ * set. A new subscription is answered with the current state as soon as the
+ * device has been polled once.
+ *
+ * The socket is only open to its owner and group, see sub_listen, and
+ * requests are only taken for DS1077L addresses on /dev/i2c-N adapters, so
+ * subscribers can't have the daemon open arbitrary files or poke other
+ * devices. A client's subscriptions end when it disconnects.
+ *
+ * The daemon never blocks on a client. When a client's socket is full its
+ * pending changes are coalesced: once it drains, it gets a single event per
+ * device carrying the latest contents, all registers that changed in the
+ * meantime and the number of changes folded into it.
+ */
+#define SUB_VERSION          1
+#define SUB_CLIENTS_MAX      32
+#define SUB_SUBSCRIPTIONS_MAX 256
+#define SUB_DEVICES_MAX      WATCH_DEVICES_MAX
+
+typedef struct sub_request {
+    uint8_t version;
+    uint8_t regs;               /* WATCH_DIV | WATCH_MUX | WATCH_BUS */
+    topo_target_t target;
+} sub_request_t;
+
+typedef struct sub_event {
+    uint8_t version;
+    uint8_t regs;               /* registers that changed, all for a snapshot */
+    bool snapshot;              /* current state on subscribing */
+    uint32_t coalesced;         /* changes folded into this event */
+    topo_target_t target;
+    watch_image_t image;        /* packed register words */
+    ds1077l_div_t div;
+    ds1077l_mux_t mux;
+    ds1077l_bus_t bus;
+} sub_event_t;
+
+/* Called by the server for every new subscription, e.g. to start polling
+ * the device, and with 'subscribed' false once nobody is subscribed to the
+ * device any more.
+ */
+typedef void (*sub_subscribed_t) (const topo_target_t *target,
+                                  bool subscribed,
+                                  void *arg);
+
+/* client */
+int sub_connect (const char *path);
+int sub_subscribe (int fd, const topo_target_t *target, uint8_t regs);
+int sub_read (int fd, sub_event_t *event);
+
+/* server */
+int sub_listen (const char *path,
+                gid_t group,
+                sub_subscribed_t subscribed,
+                void *arg);
+size_t sub_pollfds (struct pollfd *fds, size_t max);
+void sub_dispatch (const struct pollfd *fds, size_t count);
+void sub_publish (const topo_target_t *target, const watch_image_t *image);
+void sub_close (void);
+
+#endif // #ifndef _DS1077L_SUB_H_
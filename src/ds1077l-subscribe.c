@@ -0,0 +1,186 @@
+#include "ds1077l-sub.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct subscribe_args {
+    char *socket;
+    uint8_t regs;
+    unsigned long count;
+    topo_target_t targets[SUB_SUBSCRIPTIONS_MAX];
+    size_t target_count;
+} subscribe_args_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "socket",
+        .key   = 'S',
+        .arg   = "PATH",
+        .flags = 0,
+        .doc   = "Socket of the ds1077l-monitor to subscribe with.",
+        .group = 1
+    },
+    {
+        .name  = "registers",
+        .key   = 'r',
+        .arg   = "div,mux,bus",
+        .flags = 0,
+        .doc   = "Registers to be notified about. Defaults to all of them.",
+        .group = 1
+    },
+    {
+        .name  = "count",
+        .key   = 'c',
+        .arg   = "EVENTS",
+        .flags = 0,
+        .doc   = "Exit after EVENTS events.",
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "ADAPTER[/MUX/CHANNEL]/ADDRESS...",
+    .doc         = "Print register changes of Maxim DS1077L programmable "
+                   "oscillators as reported by ds1077l-monitor --socket.",
+    .children    = NULL,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static int
+regs_parse (const char *arg, uint8_t *regs)
+{
+    char buf[32] = { 0 };
+    char *save = NULL;
+    char *reg = NULL;
+
+    if (strlen (arg) >= sizeof (buf))
+        return -1;
+    strcpy (buf, arg);
+    *regs = 0;
+    for (reg = strtok_r (buf, ",", &save); reg != NULL;
+         reg = strtok_r (NULL, ",", &save)) {
+        if (strcmp (reg, "div") == 0)
+            *regs |= WATCH_DIV;
+        else if (strcmp (reg, "mux") == 0)
+            *regs |= WATCH_MUX;
+        else if (strcmp (reg, "bus") == 0)
+            *regs |= WATCH_BUS;
+        else
+            return -1;
+    }
+    return *regs ? 0 : -1;
+}
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    subscribe_args_t *args = state->input;
+    char *end = NULL;
+
+    switch (key) {
+        case 'S':
+            args->socket = arg;
+            break;
+        case 'r':
+            if (regs_parse (arg, &args->regs))
+                argp_usage (state);
+            break;
+        case 'c':
+            args->count = strtoul (arg, &end, 10);
+            if (end == arg || *end != '\0')
+                argp_usage (state);
+            break;
+        case ARGP_KEY_ARG:
+            if (args->target_count == SUB_SUBSCRIPTIONS_MAX ||
+                topo_parse_target (arg, &args->targets[args->target_count]))
+                argp_usage (state);
+            ++args->target_count;
+            break;
+        case ARGP_KEY_END:
+            if (args->socket == NULL || args->target_count == 0)
+                argp_usage (state);
+            break;
+        case ARGP_KEY_INIT:
+            args->socket = NULL;
+            args->regs = WATCH_DIV | WATCH_MUX | WATCH_BUS;
+            args->count = 0;
+            args->target_count = 0;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static void
+event_pretty (const sub_event_t *event)
+{
+    const topo_target_t *target = &event->target;
+
+    if (target->mux == 0)
+        printf ("%s/%#x:", target->bus_dev, target->address);
+    else
+        printf ("%s/%#x/%d/%#x:", target->bus_dev, target->mux,
+                target->channel, target->address);
+    if (event->regs & WATCH_DIV)
+        printf (" DIV n=%d", event->div.n);
+    if (event->regs & WATCH_MUX)
+        printf (" MUX pdn1=%d pdn0=%d sel0=%d en0=%d m0=%d m1=%d div1=%d",
+                event->mux.pdn1, event->mux.pdn0, event->mux.sel0,
+                event->mux.en0, event->mux.m0, event->mux.m1,
+                event->mux.div1);
+    if (event->regs & WATCH_BUS)
+        printf (" BUS address=%#x wc=%d", event->bus.address, event->bus.wc);
+    if (event->snapshot)
+        printf (" (current)");
+    if (event->coalesced)
+        printf (" (%u changes coalesced)", event->coalesced);
+    printf ("\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+    static subscribe_args_t args;
+    sub_event_t event;
+    unsigned long events = 0;
+    size_t i = 0;
+    int fd = 0;
+
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    fd = sub_connect (args.socket);
+    if (fd == -1) {
+        perror ("sub_connect: ");
+        exit (1);
+    }
+    for (i = 0; i < args.target_count; ++i) {
+        if (sub_subscribe (fd, &args.targets[i], args.regs)) {
+            perror ("sub_subscribe: ");
+            exit (1);
+        }
+    }
+    while (args.count == 0 || events < args.count) {
+        if (sub_read (fd, &event)) {
+            perror ("sub_read: ");
+            exit (1);
+        }
+        event_pretty (&event);
+        fflush (stdout);
+        ++events;
+    }
+    close (fd);
+    exit (0);
+}
@@ -0,0 +1,361 @@
+#include "ds1077l.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-schedule.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct sweep_args {
+    ds1077l_common_args_t common_args;
+    uint32_t start;
+    uint32_t stop;
+    uint32_t step;
+    uint32_t master_hz;
+    schedule_output_t output;
+    char *save;
+    char *load;
+    bool play;
+    uint64_t dwell_ns;
+    uint32_t *hz;
+    size_t count;
+} sweep_args_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "start",
+        .key   = 's',
+        .arg   = "HZ",
+        .flags = 0,
+        .doc   = "First frequency of the sweep.",
+        .group = 1
+    },
+    {
+        .name  = "stop",
+        .key   = 'e',
+        .arg   = "HZ",
+        .flags = 0,
+        .doc   = "Last frequency of the sweep, below --start to sweep down.",
+        .group = 1
+    },
+    {
+        .name  = "step",
+        .key   = 't',
+        .arg   = "HZ",
+        .flags = 0,
+        .doc   = "Distance between the frequencies of the sweep.",
+        .group = 1
+    },
+    {
+        .name  = "out0",
+        .key   = '0',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Sweep OUT0 instead of OUT1.",
+        .group = 1
+    },
+    {
+        .name  = "master-hz",
+        .key   = 'm',
+        .arg   = "HZ",
+        .flags = 0,
+        .doc   = "Master clock of the device. Defaults to 66666667, the "
+                 "DS1077L-66.",
+        .group = 1
+    },
+    {
+        .name  = "output",
+        .key   = 'o',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Save the compiled schedule to FILE.",
+        .group = 1
+    },
+    {
+        .name  = "input",
+        .key   = 'i',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Use the schedule compiled to FILE instead of compiling "
+                 "one.",
+        .group = 1
+    },
+    {
+        .name  = "play",
+        .key   = 'p',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Play the schedule on the device.",
+        .group = 1
+    },
+    {
+        .name  = "dwell",
+        .key   = 'w',
+        .arg   = "US",
+        .flags = 0,
+        .doc   = "Time each step is played for. Defaults to 0, as fast as the "
+                 "bus goes.",
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "[HZ...]",
+    .doc         = "Compile a frequency sweep of a Maxim DS1077L programmable "
+                   "oscillator, from --start to --stop or over the given "
+                   "frequencies, into a schedule of register writes, few per "
+                   "step, and print, save or play it.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static int
+parse_hz (const char *arg, uint32_t *hz)
+{
+    char *end = NULL;
+    unsigned long value = 0;
+
+    errno = 0;
+    value = strtoul (arg, &end, 10);
+    if (errno != 0 || *end != '\0' || value == 0 || value > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    *hz = value;
+    return 0;
+}
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    sweep_args_t *args = state->input;
+    char *end = NULL;
+
+    switch (key) {
+        case 's':
+            if (parse_hz (arg, &args->start))
+                argp_failure (state, 1, errno, "--start %s", arg);
+            break;
+        case 'e':
+            if (parse_hz (arg, &args->stop))
+                argp_failure (state, 1, errno, "--stop %s", arg);
+            break;
+        case 't':
+            if (parse_hz (arg, &args->step))
+                argp_failure (state, 1, errno, "--step %s", arg);
+            break;
+        case '0':
+            args->output = SCHEDULE_OUT0;
+            break;
+        case 'm':
+            if (parse_hz (arg, &args->master_hz))
+                argp_failure (state, 1, errno, "--master-hz %s", arg);
+            break;
+        case 'o':
+            args->save = arg;
+            break;
+        case 'i':
+            args->load = arg;
+            break;
+        case 'p':
+            args->play = true;
+            break;
+        case 'w':
+            args->dwell_ns = strtoull (arg, &end, 10) * 1000;
+            if (*end != '\0')
+                argp_failure (state, 1, EINVAL, "--dwell %s", arg);
+            break;
+        case ARGP_KEY_ARG:
+            if (args->count == SCHEDULE_STEPS_MAX)
+                argp_failure (state, 1, E2BIG, "%s", arg);
+            if (parse_hz (arg, &args->hz[args->count++]))
+                argp_failure (state, 1, errno, "%s", arg);
+            break;
+        case ARGP_KEY_END:
+            if (args->load != NULL)
+                break;
+            if ((args->start != 0) != (args->stop != 0) ||
+                (args->start != 0) != (args->step != 0) ||
+                (args->start != 0) == (args->count != 0))
+                argp_error (state, "Give either --start, --stop and --step "
+                            "or frequencies.");
+            break;
+        case ARGP_KEY_INIT:
+            args->start = 0;
+            args->stop = 0;
+            args->step = 0;
+            args->output = SCHEDULE_OUT1;
+            args->master_hz = SCHEDULE_MASTER_HZ_DEFAULT;
+            args->save = NULL;
+            args->load = NULL;
+            args->play = false;
+            args->dwell_ns = 0;
+            state->child_inputs[0] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Fill in the frequencies from --start to --stop. */
+static int
+sweep_range (sweep_args_t *args)
+{
+    int64_t hz = args->start;
+    int64_t step = args->start <= args->stop ? args->step :
+                   -(int64_t)args->step;
+
+    while (step > 0 ? hz <= args->stop : hz >= args->stop) {
+        if (args->count == SCHEDULE_STEPS_MAX) {
+            errno = E2BIG;
+            return -1;
+        }
+        args->hz[args->count++] = hz;
+        hz += step;
+    }
+    return 0;
+}
+
+static void
+schedule_pretty (fmt_buf_t *out,
+                 const ds1077l_common_args_t *common_args,
+                 const schedule_header_t *header,
+                 const schedule_step_t *steps)
+{
+    size_t i = 0;
+
+    for (i = 0; i < header->count; ++i) {
+        fmt_record_t record = {
+            .bus_dev   = common_args->bus_dev,
+            .address   = common_args->address,
+            .reg       = "STEP",
+            .raw_width = 0,
+        };
+        fmt_field_t fields[] = {
+            { .name = "step", .type = FIELD_UINT, .value = i },
+            { .name = "hz", .type = FIELD_UINT, .value = steps[i].hz },
+            { .name = "DIV", .type = FIELD_HEX, .value = steps[i].div },
+            { .name = "MUX", .type = FIELD_HEX, .value = steps[i].mux },
+            { .name = "writes", .type = FIELD_HEX, .value = steps[i].regs },
+        };
+
+        if (common_args->format != FORMAT_HUMAN) {
+            fmt_register (out, common_args->format, &record, fields,
+                          sizeof (fields) / sizeof (fields[0]));
+            continue;
+        }
+        printf ("%6zu %10u Hz  DIV 0x%04x%s  MUX 0x%04x%s\n", i,
+                steps[i].hz, steps[i].div,
+                steps[i].regs & SCHEDULE_DIV ? "*" : " ", steps[i].mux,
+                steps[i].regs & SCHEDULE_MUX ? "*" : " ");
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    static uint32_t hz[SCHEDULE_STEPS_MAX];
+    static schedule_step_t steps[SCHEDULE_STEPS_MAX];
+    static fmt_buf_t out;
+    sweep_args_t args = { .hz = hz };
+    ds1077l_common_args_t *common_args = &args.common_args;
+    schedule_header_t header = { 0 };
+    schedule_stats_t stats = { 0 };
+    int32_t div = 0;
+    int32_t mux = 0;
+    int fd = -1;
+
+    fmt_init (&out, STDOUT_FILENO);
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    if (common_args->verbose)
+        dump_common_opts (common_args);
+    if (args.load != NULL) {
+        if (schedule_load (args.load, &header, steps, SCHEDULE_STEPS_MAX)) {
+            perror ("schedule_load: ");
+            exit (1);
+        }
+    } else {
+        if (args.count == 0 && sweep_range (&args)) {
+            perror ("sweep_range: ");
+            exit (1);
+        }
+        /* compiled from where the device is */
+        fd = handle_get_common (common_args);
+        if (fd == -1) {
+            perror ("handle_get: ");
+            exit (1);
+        }
+        if ((div = xfer_read_word (fd, COMMAND_DIV)) == -1 ||
+            (mux = xfer_read_word (fd, COMMAND_MUX)) == -1) {
+            perror ("xfer_read_word: ");
+            exit (1);
+        }
+        header = (schedule_header_t) {
+            .magic     = SCHEDULE_MAGIC,
+            .version   = SCHEDULE_VERSION,
+            .count     = args.count,
+            .master_hz = args.master_hz,
+            .output    = args.output,
+            .div       = div,
+            .mux       = mux,
+        };
+        if (schedule_compile (&header, hz, steps)) {
+            perror ("schedule_compile: ");
+            exit (1);
+        }
+        schedule_stats (&header, hz, steps, &stats);
+        if (common_args->verbose)
+            printf ("%u steps, %llu writes, %llu steps of one, %llu of none, "
+                    "at most %u ppm off\n", header.count,
+                    (unsigned long long)stats.writes,
+                    (unsigned long long)stats.single,
+                    (unsigned long long)stats.unchanged,
+                    stats.max_error_ppm);
+    }
+    if (args.save != NULL && schedule_save (args.save, &header, steps)) {
+        perror ("schedule_save: ");
+        exit (1);
+    }
+    if (!args.play) {
+        if (args.save == NULL || common_args->verbose)
+            schedule_pretty (&out, common_args, &header, steps);
+        if (fmt_flush (&out)) {
+            perror ("fmt_flush: ");
+            exit (1);
+        }
+        exit (0);
+    }
+    if (fd == -1 && (fd = handle_get_common (common_args)) == -1) {
+        perror ("handle_get: ");
+        exit (1);
+    }
+    if (schedule_play (fd, &header, steps, args.dwell_ns)) {
+        perror ("schedule_play: ");
+        exit (1);
+    }
+    exit (0);
+}
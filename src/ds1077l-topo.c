@@ -0,0 +1,267 @@
+#include "ds1077l-topo.h"
+#include "ds1077l-lock.h"
+#include "ds1077l-pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Channel currently routed on each adapter, mux 0 when nothing is known to
+ * be routed, and the adapter's selects as last seen in the lock file. Index
+ * XFER_ADAPTERS_MAX catches unbound descriptors.
+ */
+static struct {
+    pthread_mutex_t lock;
+    uint8_t mux;
+    uint8_t channel;
+    lock_adapter_t shared;
+} routed[XFER_ADAPTERS_MAX + 1] = {
+    [0 ... XFER_ADAPTERS_MAX] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+static topo_stats_t stats = { 0 };
+
+static int
+parse_hex (const char *arg, uint8_t min, uint8_t max, uint8_t *out)
+{
+    char *end = NULL;
+    long value = 0;
+
+    value = strtol (arg, &end, 16);
+    if (end == arg || (*end != '\0' && *end != ':' && *end != '/'))
+        return -1;
+    if (value < min || value > max)
+        return -1;
+    *out = value;
+    return 0;
+}
+
+static int
+parse_channel (const char *arg, uint8_t *out)
+{
+    if (arg[0] < '0' || arg[0] >= '0' + TOPO_CHANNELS ||
+        (arg[1] != '\0' && arg[1] != '/'))
+        return -1;
+    *out = arg[0] - '0';
+    return 0;
+}
+
+/* Parse the argument to --mux: MUX:CHANNEL, e.g. 0x70:3.
+ */
+int
+topo_parse_mux (const char *arg, uint8_t *mux, uint8_t *channel)
+{
+    const char *colon = strchr (arg, ':');
+
+    if (colon == NULL)
+        return -1;
+    if (parse_hex (arg, TOPO_MUX_MIN, TOPO_MUX_MAX, mux))
+        return -1;
+    return parse_channel (colon + 1, channel);
+}
+
+/* Parse a device written as ADAPTER[/MUX/CHANNEL]/ADDRESS. The adapter may
+ * be given as a device node or just its name, in which case /dev/ is
+ * prepended. Components are taken from the right since device nodes contain
+ * slashes themselves.
+ */
+int
+topo_parse_target (const char *arg, topo_target_t *target)
+{
+    const char *parts[3] = { NULL, NULL, NULL };
+    const char *end = arg + strlen (arg);
+    const char *p = end;
+    size_t count = 0;
+    size_t len = 0;
+
+    memset (target, 0, sizeof (*target));
+    /* find up to three trailing components */
+    while (p > arg && count < 3) {
+        --p;
+        if (*p == '/') {
+            parts[count++] = p + 1;
+            end = p;
+        }
+    }
+    if (count == 0)
+        return -1;
+    if (parse_hex (parts[0], 0x58, 0x5f, &target->address))
+        return -1;
+    end = parts[0] - 1;
+    if (count == 3 &&
+        parse_hex (parts[2], TOPO_MUX_MIN, TOPO_MUX_MAX, &target->mux) == 0 &&
+        parse_channel (parts[1], &target->channel) == 0) {
+        end = parts[2] - 1;
+    } else {
+        target->mux = 0;
+    }
+    len = end - arg;
+    if (len == 0)
+        return -1;
+    if (arg[0] != '/') {
+        if (len + 5 >= sizeof (target->bus_dev))
+            return -1;
+        memcpy (target->bus_dev, "/dev/", 5);
+        memcpy (target->bus_dev + 5, arg, len);
+    } else {
+        if (len >= sizeof (target->bus_dev))
+            return -1;
+        memcpy (target->bus_dev, arg, len);
+    }
+    return 0;
+}
+
+/* Order devices by adapter, mux, channel and address.
+ */
+int
+topo_compare (const topo_target_t *a, const topo_target_t *b)
+{
+    int ret = 0;
+
+    ret = strcmp (a->bus_dev, b->bus_dev);
+    if (ret != 0)
+        return ret;
+    if (a->mux != b->mux)
+        return a->mux - b->mux;
+    if (a->channel != b->channel)
+        return a->channel - b->channel;
+    return a->address - b->address;
+}
+
+/* Whether two devices on the same adapter sit on the same segment, i.e. they
+ * both answer while one of them is routed.
+ */
+bool
+topo_visible (const topo_target_t *a, const topo_target_t *b)
+{
+    if (strcmp (a->bus_dev, b->bus_dev) != 0)
+        return false;
+    if (a->mux == 0 || b->mux == 0)
+        return true;
+    return a->mux == b->mux && a->channel == b->channel;
+}
+
+static int
+target_compare (const void *first, const void *second)
+{
+    return topo_compare (first, second);
+}
+
+/* Order a batch of devices so that everything behind the same mux channel is
+ * handled back to back, which keeps channel switches to one per channel.
+ */
+void
+topo_sort (topo_target_t *targets, size_t count)
+{
+    qsort (targets, count, sizeof (*targets), target_compare);
+}
+
+/* Serialize channel selection and the transaction that depends on it for
+ * all users of an adapter, threads with a mutex and processes with the
+ * adapter's lock. What we remember as routed only holds if nobody else
+ * selected since, otherwise it's forgotten and topo_select writes the mux
+ * again. Returns 0 or -1 with errno set, the adapter unlocked.
+ */
+int
+topo_lock (const xfer_target_t *target)
+{
+    lock_adapter_t shared = { 0 };
+    int err = 0;
+
+    pthread_mutex_lock (&routed[target->adapter].lock);
+    shared = routed[target->adapter].shared;
+    if (lock_adapter_acquire (target, &shared)) {
+        err = errno;
+        pthread_mutex_unlock (&routed[target->adapter].lock);
+        errno = err;
+        return -1;
+    }
+    if (shared.selects != routed[target->adapter].shared.selects)
+        routed[target->adapter].mux = 0;
+    routed[target->adapter].shared = shared;
+    return 0;
+}
+
+void
+topo_unlock (const xfer_target_t *target)
+{
+    lock_adapter_release (target);
+    pthread_mutex_unlock (&routed[target->adapter].lock);
+}
+
+static int
+mux_write (uint8_t adapter, uint8_t mux, uint8_t mask)
+{
+    int32_t ret = 0;
+    int fd = 0;
+
+    fd = pool_get (xfer_adapter_name (adapter), 0, 0, mux);
+    if (fd == -1)
+        return -1;
+    ret = xfer_send_byte (fd, mask);
+    pool_put (fd);
+    return ret;
+}
+
+/* Route the channel 'target' sits behind, if it sits behind a mux and the
+ * channel isn't routed already. When switching between muxes on the same
+ * adapter the previous one, ours or the one another process selected last,
+ * is disconnected first so two downstream segments are never joined. Called
+ * with the adapter locked.
+ */
+int
+topo_select (const xfer_target_t *target)
+{
+    uint8_t adapter = target->adapter;
+    uint8_t previous = 0;
+
+    if (target->mux == 0)
+        return 0;
+    if (routed[adapter].mux == target->mux &&
+        routed[adapter].channel == target->channel) {
+        __atomic_add_fetch (&stats.skipped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    previous = routed[adapter].mux ? routed[adapter].mux :
+                                     routed[adapter].shared.mux;
+    /* stored before the mux changes, so a failed select still tells the
+     * other processes to look again
+     */
+    ++routed[adapter].shared.selects;
+    routed[adapter].shared.mux = target->mux;
+    routed[adapter].shared.channel = target->channel;
+    if (lock_adapter_update (target, &routed[adapter].shared))
+        goto err_out;
+    if (previous != 0 && previous != target->mux) {
+        if (mux_write (adapter, previous, 0))
+            goto err_out;
+        routed[adapter].mux = 0;
+    }
+    if (mux_write (adapter, target->mux, 1 << target->channel))
+        goto err_out;
+    routed[adapter].mux = target->mux;
+    routed[adapter].channel = target->channel;
+    __atomic_add_fetch (&stats.selects, 1, __ATOMIC_RELAXED);
+    return 0;
+err_out:
+    routed[adapter].mux = 0;
+    return -1;
+}
+
+/* Forget what's routed on the adapter of 'target', e.g. after a failed
+ * transaction that may have been caused by the mux being reset.
+ */
+void
+topo_invalidate (const xfer_target_t *target)
+{
+    routed[target->adapter].mux = 0;
+}
+
+void
+topo_stats (topo_stats_t *out)
+{
+    out->selects = __atomic_load_n (&stats.selects, __ATOMIC_RELAXED);
+    out->skipped = __atomic_load_n (&stats.skipped, __ATOMIC_RELAXED);
+}
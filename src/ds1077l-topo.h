@@ -0,0 +1,54 @@
+#ifndef _DS1077L_TOPO_H_
+#define _DS1077L_TOPO_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bus topology: DS1077Ls sitting behind PCA954x i2c multiplexers.
+ *
+ * The 0x58 - 0x5f address range limits a bus segment to eight DS1077Ls so
+ * larger boards put them behind PCA9548 (or compatible) multiplexers at
+ * 0x70 - 0x77. Before a device behind a mux can be addressed the mux has to
+ * route the right downstream channel, which is a single byte write of the
+ * channel bit mask to the mux. The transaction layer calls topo_select
+ * before every transaction, which remembers the channel currently routed on
+ * each adapter and only writes the mux when it actually changes. The adapter
+ * stays locked against other threads and, through its byte in the lock file,
+ * other processes until the transaction is done. Every select is recorded
+ * in the lock file, so a process finding a select it didn't make selects
+ * again, disconnecting whatever mux was routed last.
+ *
+ * Devices are written as ADAPTER[/MUX/CHANNEL]/ADDRESS, e.g. i2c-1/0x58 or
+ * /dev/i2c-1/0x70/3/0x5a.
+ */
+#define TOPO_MUX_MIN  0x70
+#define TOPO_MUX_MAX  0x77
+#define TOPO_CHANNELS 8
+
+typedef struct topo_target {
+    char bus_dev[32];
+    uint8_t mux;        /* 0 when not behind a mux */
+    uint8_t channel;
+    uint8_t address;
+} topo_target_t;
+
+typedef struct topo_stats {
+    uint64_t selects;   /* channel changes written to a mux */
+    uint64_t skipped;   /* selects avoided because the channel was routed */
+} topo_stats_t;
+
+int topo_parse_mux (const char *arg, uint8_t *mux, uint8_t *channel);
+int topo_parse_target (const char *arg, topo_target_t *target);
+int topo_compare (const topo_target_t *a, const topo_target_t *b);
+bool topo_visible (const topo_target_t *a, const topo_target_t *b);
+void topo_sort (topo_target_t *targets, size_t count);
+int topo_select (const xfer_target_t *target);
+void topo_invalidate (const xfer_target_t *target);
+int topo_lock (const xfer_target_t *target);
+void topo_unlock (const xfer_target_t *target);
+void topo_stats (topo_stats_t *stats);
+
+#endif // #ifndef _DS1077L_TOPO_H_
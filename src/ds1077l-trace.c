@@ -0,0 +1,218 @@
+#include "ds1077l.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-tracer.h"
+#include "ds1077l-writee2.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <linux/i2c-dev.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct trace_args {
+    char *file;
+    bool decode;
+} trace_args_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "file",
+        .key   = 'f',
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Trace file to dump. Defaults to $" TRACER_ENV ".",
+        .group = 0
+    },
+    {
+        .name  = "no-decode",
+        .key   = 'r',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Don't decode register payloads.",
+        .group = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = NULL,
+    .doc         = "Dump the transaction rings recorded by the DS1077L "
+                   "utilities in chronological order.",
+    .children    = NULL,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    trace_args_t *trace_args = state->input;
+
+    switch (key) {
+        case 'f':
+            trace_args->file = arg;
+            break;
+        case 'r':
+            trace_args->decode = false;
+            break;
+        case ARGP_KEY_INIT:
+            trace_args->file = getenv (TRACER_ENV);
+            trace_args->decode = true;
+            break;
+        case ARGP_KEY_END:
+            if (trace_args->file == NULL)
+                argp_error (state, "No trace file given and $" TRACER_ENV
+                            " is not set.");
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Copy all published entries out of the mapped rings. Writers may still be
+ * running, an entry is only kept if its sequence number is the same before
+ * and after the copy.
+ */
+static size_t
+trace_snapshot (tracer_file_t *file, tracer_entry_t *entries)
+{
+    tracer_entry_t *entry = NULL;
+    uint64_t seq = 0;
+    size_t count = 0;
+    size_t r = 0;
+    size_t i = 0;
+
+    for (r = 0; r < TRACER_RINGS; ++r) {
+        for (i = 0; i < TRACER_RING_SIZE; ++i) {
+            entry = &file->ring[r].entries[i];
+            seq = atomic_load_explicit (&entry->seq, memory_order_acquire);
+            if (seq == 0)
+                continue;
+            memcpy (&entries[count], entry, sizeof (*entry));
+            atomic_thread_fence (memory_order_acquire);
+            if (atomic_load_explicit (&entry->seq, memory_order_relaxed) != seq)
+                continue;
+            entries[count].seq = seq;
+            ++count;
+        }
+    }
+    return count;
+}
+
+static int
+entry_compare (const void *first, const void *second)
+{
+    const tracer_entry_t *a = first;
+    const tracer_entry_t *b = second;
+
+    if (a->timestamp_ns != b->timestamp_ns)
+        return a->timestamp_ns < b->timestamp_ns ? -1 : 1;
+    return 0;
+}
+
+/* Decode the payload of a transaction using the register (un)pack macros.
+ */
+static void
+entry_decode (tracer_entry_t *entry)
+{
+    uint16_t word = entry->payload;
+
+    if (entry->size == 0)
+        return;
+    if (entry->err != 0 && entry->read_write == I2C_SMBUS_READ)
+        return;
+    if (entry->address >= TOPO_MUX_MIN && entry->address <= TOPO_MUX_MAX) {
+        printf (" channels=%#x", entry->command);
+        return;
+    }
+    switch (entry->command) {
+    case COMMAND_DIV:
+        printf (" N=%d", DIV_UNPACK(word));
+        break;
+    case COMMAND_MUX:
+        printf (" PDN1=%d PDN0=%d SEL0=%d EN0=%d M0=%d M1=%d DIV1=%d",
+                PDN1_UNPACK(word), PDN0_UNPACK(word), SEL0_UNPACK(word),
+                EN0_UNPACK(word), M0_UNPACK(word), M1_UNPACK(word),
+                DIV1_UNPACK(word));
+        break;
+    case COMMAND_BUS:
+        printf (" address=%#x WC=%d", ADDRESS_UNPACK(word), WC_UNPACK(word));
+        break;
+    }
+}
+
+static void
+entry_print (tracer_entry_t *entry, bool decode)
+{
+    time_t sec = entry->timestamp_ns / 1000000000;
+    struct tm tm;
+    char stamp[32];
+
+    gmtime_r (&sec, &tm);
+    strftime (stamp, sizeof (stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf ("%s.%09llu tid %u ", stamp,
+            (unsigned long long)(entry->timestamp_ns % 1000000000),
+            entry->tid);
+    if (entry->adapter == XFER_ADAPTER_UNKNOWN)
+        printf ("i2c-? ");
+    else
+        printf ("i2c-%u ", entry->adapter);
+    if (entry->mux != 0)
+        printf ("0x%02x/%u/", entry->mux, entry->channel);
+    printf ("0x%02x %-10s %-5s ", entry->address,
+            xfer_command_name (entry->address, entry->command),
+            entry->read_write == I2C_SMBUS_READ ? "read" : "write");
+    if (entry->size == I2C_SMBUS_WORD_DATA)
+        printf ("0x%04x ", entry->payload);
+    else if (entry->size == I2C_SMBUS_BYTE_DATA)
+        printf ("0x%02x   ", entry->payload);
+    else
+        printf ("-      ");
+    printf ("%8.1fus %s", entry->duration_ns / 1000.0,
+            xfer_result_name (entry->err));
+    if (entry->err != 0)
+        printf (" (%s)", strerror (entry->err));
+    if (decode)
+        entry_decode (entry);
+    printf ("\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+    trace_args_t trace_args = { 0 };
+    tracer_file_t *file = NULL;
+    tracer_entry_t *entries = NULL;
+    size_t count = 0;
+    size_t i = 0;
+
+    if (argp_parse (&argps, argc, argv, 0, NULL, &trace_args)) {
+        perror ("argp_parse: \n");
+        exit (1);
+    }
+    file = tracer_map (trace_args.file, false);
+    if (file == NULL) {
+        perror ("tracer_map: ");
+        exit (1);
+    }
+    entries = calloc (TRACER_RINGS * TRACER_RING_SIZE, sizeof (*entries));
+    if (entries == NULL) {
+        perror ("calloc: ");
+        exit (1);
+    }
+    count = trace_snapshot (file, entries);
+    qsort (entries, count, sizeof (*entries), entry_compare);
+    for (i = 0; i < count; ++i)
+        entry_print (&entries[i], trace_args.decode);
+    exit (0);
+}
@@ -0,0 +1,120 @@
+#include "ds1077l-tracer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+bool tracer_on = false;
+static tracer_file_t *tracer = NULL;
+static __thread uint32_t tracer_tid = 0;
+
+/* Map the trace file at 'path'. With 'create' set the file is created and
+ * initialized if it doesn't exist or has an unexpected layout, otherwise such
+ * a file is an error. Returns NULL with errno set on failure.
+ */
+tracer_file_t *
+tracer_map (const char *path, bool create)
+{
+    tracer_file_t *file = NULL;
+    struct stat st;
+    int fd = 0;
+
+    fd = open (path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd == -1)
+        return NULL;
+    if (create && flock (fd, LOCK_EX))
+        goto err_close;
+    if (fstat (fd, &st))
+        goto err_close;
+    if (st.st_size != sizeof (tracer_file_t)) {
+        if (!create) {
+            errno = EINVAL;
+            goto err_close;
+        }
+        if (ftruncate (fd, 0) || ftruncate (fd, sizeof (tracer_file_t)))
+            goto err_close;
+    }
+    file = mmap (NULL, sizeof (tracer_file_t),
+                 create ? PROT_READ | PROT_WRITE : PROT_READ,
+                 MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED)
+        goto err_close;
+    if (file->magic != TRACER_MAGIC || file->version != TRACER_VERSION ||
+        file->rings != TRACER_RINGS || file->ring_size != TRACER_RING_SIZE) {
+        if (!create) {
+            munmap (file, sizeof (tracer_file_t));
+            errno = EINVAL;
+            goto err_close;
+        }
+        memset (file, 0, sizeof (tracer_file_t));
+        file->version = TRACER_VERSION;
+        file->rings = TRACER_RINGS;
+        file->ring_size = TRACER_RING_SIZE;
+        /* publish the header last so readers never see a partial one */
+        __atomic_store_n (&file->magic, TRACER_MAGIC, __ATOMIC_RELEASE);
+    }
+    close (fd);
+    return file;
+err_close:
+    close (fd);
+    return NULL;
+}
+
+/* Enable tracing of all transactions to the trace file at 'path'.
+ */
+int
+tracer_init (const char *path)
+{
+    tracer = tracer_map (path, true);
+    if (tracer == NULL)
+        return -1;
+    tracer_on = true;
+    return 0;
+}
+
+/* Record one transaction in the ring belonging to the calling thread.
+ */
+void
+tracer_record (const xfer_target_t *target,
+               uint8_t command,
+               char read_write,
+               int size,
+               uint16_t payload,
+               int err,
+               uint64_t duration_ns)
+{
+    tracer_ring_t *ring = NULL;
+    tracer_entry_t *entry = NULL;
+    struct timespec ts;
+    uint64_t head = 0;
+
+    if (tracer_tid == 0)
+        tracer_tid = syscall (SYS_gettid);
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ring = &tracer->ring[tracer_tid % TRACER_RINGS];
+    head = atomic_fetch_add_explicit (&ring->head, 1, memory_order_relaxed);
+    entry = &ring->entries[head % TRACER_RING_SIZE];
+    /* invalidate the slot while it's being rewritten */
+    atomic_store_explicit (&entry->seq, 0, memory_order_relaxed);
+    atomic_thread_fence (memory_order_release);
+    entry->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec -
+                          duration_ns;
+    entry->duration_ns = duration_ns > UINT32_MAX ? UINT32_MAX : duration_ns;
+    entry->tid         = tracer_tid;
+    entry->adapter     = xfer_adapter_number (target->adapter);
+    entry->payload     = payload;
+    entry->mux         = target->mux;
+    entry->channel     = target->channel;
+    entry->address     = target->address;
+    entry->command     = command;
+    entry->read_write  = read_write;
+    entry->size        = size;
+    entry->err         = err;
+    atomic_store_explicit (&entry->seq, head + 1, memory_order_release);
+}
@@ -0,0 +1,73 @@
+#ifndef _DS1077L_TRACER_H_
+#define _DS1077L_TRACER_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Transaction tracer.
+ *
+ * Every transaction is recorded in a ring buffer living in a shared memory
+ * mapped file so the trace outlives the process that wrote it. The file holds
+ * TRACER_RINGS rings and each thread writes to the ring selected by its
+ * thread id, so threads only ever contend on a ring when their ids collide.
+ * Claiming a slot is a single atomic increment, after which the entry is
+ * filled in and published by storing its sequence number last. There are no
+ * locks and no system calls on the hot path.
+ *
+ * Use ds1077l-trace to dump and decode the rings.
+ */
+#define TRACER_ENV        "DS1077L_TRACE"
+#define TRACER_MAGIC      0x45434152544c37ull
+#define TRACER_VERSION    2
+#define TRACER_RINGS      8
+#define TRACER_RING_SIZE  1024
+
+typedef struct tracer_entry {
+    /* 1 + the value of the ring head used to claim this slot, 0 if the
+     * slot has never been written */
+    _Atomic uint64_t seq;
+    uint64_t timestamp_ns;      /* CLOCK_REALTIME at start */
+    uint32_t duration_ns;
+    uint32_t tid;
+    uint16_t adapter;           /* see xfer_adapter_number */
+    uint16_t payload;
+    uint8_t address;
+    uint8_t command;
+    uint8_t read_write;
+    uint8_t size;
+    uint16_t err;
+    uint8_t mux;                /* 0 when not behind a mux */
+    uint8_t channel;
+} tracer_entry_t;
+
+typedef struct tracer_ring {
+    _Atomic uint64_t head;
+    uint64_t reserved[7];
+    tracer_entry_t entries[TRACER_RING_SIZE];
+} tracer_ring_t;
+
+typedef struct tracer_file {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t rings;
+    uint32_t ring_size;
+    uint32_t reserved[11];
+    tracer_ring_t ring[TRACER_RINGS];
+} tracer_file_t;
+
+extern bool tracer_on;
+
+tracer_file_t *tracer_map (const char *path, bool create);
+int tracer_init (const char *path);
+void tracer_record (const xfer_target_t *target,
+                    uint8_t command,
+                    char read_write,
+                    int size,
+                    uint16_t payload,
+                    int err,
+                    uint64_t duration_ns);
+
+#endif // #ifndef _DS1077L_TRACER_H_
@@ -0,0 +1,235 @@
+#include "ds1077l-transition.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-xfer.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* Every N, P1, DIV1 and whether MUX has the target's other fields yet. */
+#define TRANSITION_NODES (1024 * 4 * 2 * 2)
+#define TRANSITION_NONE  0xffff
+
+/* DIV and MUX bits that exist, and the MUX bits OUT1 doesn't depend on */
+#define DIV_MASK   0xc0ff
+#define MUX_MASK   0xc07f
+#define OTHER_MASK 0x007e
+
+typedef struct transition_node {
+    uint16_t n;
+    uint8_t p;
+    bool div1;
+    bool other;                 /* MUX has the target's other fields */
+} transition_node_t;
+
+static uint16_t
+node_pack (transition_node_t node)
+{
+    return ((node.n - 2) << 4) | (__builtin_ctz (node.p) << 2) |
+           (node.div1 << 1) | node.other;
+}
+
+static transition_node_t
+node_unpack (uint16_t index)
+{
+    return (transition_node_t) {
+        .n     = (index >> 4) + 2,
+        .p     = 1 << ((index >> 2) & 0x3),
+        .div1  = index & 0x2,
+        .other = index & 0x1,
+    };
+}
+
+static bool
+node_in_band (const transition_band_t *band, transition_node_t node)
+{
+    uint64_t divisor = node.div1 ? node.p : (uint64_t)node.p * node.n;
+
+    return band->min_hz * divisor <= band->master_hz &&
+           band->master_hz <= band->max_hz * divisor;
+}
+
+/* What OUT1 runs at with 'div' and 'mux', rounded to the nearest Hz.
+ */
+uint32_t
+transition_hz (uint32_t master_hz, uint16_t div, uint16_t mux)
+{
+    uint32_t divisor = M1_UNPACK (mux);
+
+    if (!DIV1_UNPACK (mux))
+        divisor *= DIV_UNPACK (div);
+    return ((uint64_t)master_hz + divisor / 2) / divisor;
+}
+
+/* Parse a band given as MIN-MAX in Hz. The master clock is left alone.
+ * Returns 0 or -1 with errno set.
+ */
+int
+transition_parse_band (const char *arg, transition_band_t *band)
+{
+    unsigned long min = 0;
+    unsigned long max = 0;
+    char *end = NULL;
+
+    errno = 0;
+    min = strtoul (arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '-')
+        goto err_inval;
+    arg = end + 1;
+    max = strtoul (arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || max == 0 || min > max ||
+        max > UINT32_MAX)
+        goto err_inval;
+    band->min_hz = min;
+    band->max_hz = max;
+    return 0;
+err_inval:
+    errno = EINVAL;
+    return -1;
+}
+
+/* The writes of the direct order, DIV then MUX, skipping what's there. */
+static void
+transition_direct (uint16_t div,
+                   uint16_t mux,
+                   uint16_t div_target,
+                   uint16_t mux_target,
+                   transition_t *transition)
+{
+    transition->count = 0;
+    if ((div & DIV_MASK) != (div_target & DIV_MASK))
+        transition->writes[transition->count++] = (transition_write_t) {
+            .command = COMMAND_DIV,
+            .word    = div_target,
+        };
+    if ((mux & MUX_MASK) != (mux_target & MUX_MASK))
+        transition->writes[transition->count++] = (transition_write_t) {
+            .command = COMMAND_MUX,
+            .word    = mux_target,
+        };
+}
+
+/* Plan the writes taking OUT1 from 'div' and 'mux' to 'div_target' and
+ * 'mux_target' without leaving 'band', or in the direct order without one.
+ * Returns 0 or -1 with errno set, ERANGE when the target is out of the band
+ * or can't be reached inside it.
+ */
+int
+transition_plan (const transition_band_t *band,
+                 uint16_t div,
+                 uint16_t mux,
+                 uint16_t div_target,
+                 uint16_t mux_target,
+                 transition_t *transition)
+{
+    uint16_t prev[TRANSITION_NODES];
+    uint16_t queue[TRANSITION_NODES];
+    uint16_t path[TRANSITION_NODES];
+    transition_node_t start = {
+        .n     = DIV_UNPACK (div & DIV_MASK),
+        .p     = M1_UNPACK (mux),
+        .div1  = DIV1_UNPACK (mux),
+        .other = ((mux ^ mux_target) & OTHER_MASK) == 0,
+    };
+    transition_node_t target = {
+        .n     = DIV_UNPACK (div_target & DIV_MASK),
+        .p     = M1_UNPACK (mux_target),
+        .div1  = DIV1_UNPACK (mux_target),
+        .other = true,
+    };
+    transition_node_t node;
+    transition_node_t next;
+    uint16_t from = 0;
+    uint16_t to = 0;
+    size_t head = 0;
+    size_t tail = 0;
+    size_t length = 0;
+    int n = 0;
+    int i = 0;
+
+    if (band == NULL) {
+        transition_direct (div, mux, div_target, mux_target, transition);
+        return 0;
+    }
+    if (!node_in_band (band, target)) {
+        errno = ERANGE;
+        return -1;
+    }
+    for (i = 0; i < TRANSITION_NODES; ++i)
+        prev[i] = TRANSITION_NONE;
+    from = node_pack (start);
+    to = node_pack (target);
+    prev[from] = from;
+    queue[tail++] = from;
+    /* every write is one step, the first way to reach the target is among
+     * the shortest. Ns are tried outward from the target's, so states in
+     * between stay close to it, and DIV before MUX, as without a band.
+     */
+    while (head < tail && prev[to] == TRANSITION_NONE) {
+        node = node_unpack (queue[head++]);
+        for (i = 0; i < 2048 + 8; ++i) {
+            next = node;
+            if (i < 2048) {
+                n = target.n + (i & 1 ? -((i + 1) >> 1) : i >> 1);
+                if (n < 2 || n > 1025 || n == node.n)
+                    continue;
+                next.n = n;
+            } else {
+                /* the target's P1 and DIV1 first */
+                next.p = target.p << ((i - 2048) & 0x3);
+                next.p = next.p > 8 ? next.p >> 4 : next.p;
+                next.div1 = target.div1 ^ ((i - 2048) >> 2);
+                next.other = true;
+            }
+            from = node_pack (next);
+            if (prev[from] != TRANSITION_NONE || !node_in_band (band, next))
+                continue;
+            prev[from] = node_pack (node);
+            queue[tail++] = from;
+        }
+    }
+    if (prev[to] == TRANSITION_NONE) {
+        errno = ERANGE;
+        return -1;
+    }
+    for (from = to; from != node_pack (start); from = prev[from])
+        path[length++] = from;
+    if (length > TRANSITION_WRITES_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+    transition->count = 0;
+    node = start;
+    while (length > 0) {
+        next = node_unpack (path[--length]);
+        if (next.n != node.n)
+            transition->writes[transition->count++] = (transition_write_t) {
+                .command = COMMAND_DIV,
+                .word    = DIV_PACK (next.n),
+            };
+        else
+            transition->writes[transition->count++] = (transition_write_t) {
+                .command = COMMAND_MUX,
+                .word    = (mux_target & OTHER_MASK) | M1_PACK (next.p) |
+                           DIV1_PACK (next.div1),
+            };
+        node = next;
+    }
+    return 0;
+}
+
+/* Issue the writes of 'transition' on 'fd', in order. Returns 0 or -1 with
+ * errno set, the device is left wherever the failed write found it.
+ */
+int
+transition_apply (int fd, const transition_t *transition)
+{
+    size_t i = 0;
+
+    for (i = 0; i < transition->count; ++i)
+        if (xfer_write_word (fd, transition->writes[i].command,
+                             transition->writes[i].word) == -1)
+            return -1;
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef _DS1077L_TRANSITION_H_
+#define _DS1077L_TRANSITION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Moving OUT1 between two register states without leaving a band.
+ *
+ * OUT1 runs at MCLK / P1 / N, or MCLK / P1 with DIV1 set. P1 and DIV1 live
+ * in MUX and N in DIV, so a change of both takes two writes and for the
+ * time between them OUT1 runs at a mix of the old and the new state, e.g.
+ * going from P1 = 1, N = 400 to P1 = 8, N = 50 by way of P1 = 8, N = 400 or
+ * P1 = 1, N = 50. transition_plan picks the writes for a change so that OUT1
+ * stays inside a band in between: the direct order that does, or else the
+ * fewest writes through states of its own, found with a breadth first search
+ * over every N, P1 and DIV1. The starting state may be outside the band, the
+ * target may not. Without a band DIV is written before MUX, as presets are.
+ *
+ * MUX writes on the way carry the target's other fields, so OUT0 changes
+ * with the first of them. With WC clear every write, those in between too,
+ * reaches the EEPROM.
+ */
+#define TRANSITION_WRITES_MAX        8
+#define TRANSITION_MASTER_HZ_DEFAULT 66666667
+
+/* Help of the --band and --master-hz options of the tools taking a band */
+#define TRANSITION_BAND_DOC \
+    "Keep OUT1 between MIN and MAX Hz while writing, with writes in an " \
+    "order or through states in between that do."
+#define TRANSITION_MASTER_HZ_DOC \
+    "Master clock of the devices, for --band. Defaults to 66666667, the " \
+    "DS1077L-66."
+
+typedef struct transition_band {
+    uint32_t master_hz;
+    uint32_t min_hz;
+    uint32_t max_hz;
+} transition_band_t;
+
+typedef struct transition_write {
+    uint8_t command;
+    uint16_t word;
+} transition_write_t;
+
+typedef struct transition {
+    size_t count;
+    transition_write_t writes[TRANSITION_WRITES_MAX];
+} transition_t;
+
+uint32_t transition_hz (uint32_t master_hz, uint16_t div, uint16_t mux);
+int transition_parse_band (const char *arg, transition_band_t *band);
+int transition_plan (const transition_band_t *band,
+                     uint16_t div,
+                     uint16_t mux,
+                     uint16_t div_target,
+                     uint16_t mux_target,
+                     transition_t *transition);
+int transition_apply (int fd, const transition_t *transition);
+
+#endif // #ifndef _DS1077L_TRANSITION_H_
@@ -0,0 +1,246 @@
+#include "ds1077l-watch.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-lock.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-xfer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const xfer_reg_t image_regs[] = {
+    { .command = COMMAND_DIV, .size = I2C_SMBUS_WORD_DATA },
+    { .command = COMMAND_MUX, .size = I2C_SMBUS_WORD_DATA },
+    { .command = COMMAND_BUS, .size = I2C_SMBUS_BYTE_DATA },
+};
+
+static int
+parse_word (const char *arg, char end, const char **stop, uint16_t *word)
+{
+    char *tail = NULL;
+    long value = 0;
+
+    value = strtol (arg, &tail, 16);
+    if (tail == arg || *tail != end || value < 0 || value > 0xffff)
+        return -1;
+    *word = value;
+    *stop = tail;
+    return 0;
+}
+
+/* Parse a device to watch: ADAPTER[/MUX/CHANNEL]/ADDRESS[=DIV:MUX:BUS] with
+ * the expected packed register words in hex. Without them the first poll
+ * sets the expectation.
+ */
+int
+watch_parse (const char *arg, watch_device_t *device)
+{
+    char buf[64] = { 0 };
+    const char *equals = strchr (arg, '=');
+    size_t len = equals ? equals - arg : strlen (arg);
+    const char *stop = NULL;
+    uint16_t bus = 0;
+
+    memset (device, 0, sizeof (*device));
+    if (len >= sizeof (buf))
+        return -1;
+    memcpy (buf, arg, len);
+    if (topo_parse_target (buf, &device->target))
+        return -1;
+    if (equals == NULL)
+        return 0;
+    if (parse_word (equals + 1, ':', &stop, &device->expected.div) ||
+        parse_word (stop + 1, ':', &stop, &device->expected.mux) ||
+        parse_word (stop + 1, '\0', &stop, &bus) || bus > 0xff)
+        return -1;
+    /* the device answers at its address so that part can't drift */
+    if (ADDRESS_UNPACK (bus) != device->target.address)
+        return -1;
+    device->expected.bus = bus;
+    device->expected_set = true;
+    return 0;
+}
+
+/* Parse the argument to --interval: MIN_MS[:MAX_MS].
+ */
+int
+watch_interval_parse (const char *arg, watch_policy_t *policy)
+{
+    char *stop = NULL;
+    long min = 0;
+    long max = 0;
+
+    min = strtol (arg, &stop, 10);
+    if (stop == arg || (*stop != '\0' && *stop != ':') || min <= 0)
+        return -1;
+    max = min > policy->max_ms ? min : policy->max_ms;
+    if (*stop == ':') {
+        arg = stop + 1;
+        max = strtol (arg, &stop, 10);
+        if (stop == arg || *stop != '\0' || max < min)
+            return -1;
+    }
+    policy->min_ms = min;
+    policy->max_ms = max;
+    return 0;
+}
+
+const char *
+watch_event_name (watch_event_t event)
+{
+    switch (event) {
+    case WATCH_BASELINE:
+        return "baseline";
+    case WATCH_STABLE:
+        return "stable";
+    case WATCH_DRIFT:
+        return "drift";
+    case WATCH_REMEDIATED:
+        return "remediated";
+    case WATCH_ERROR:
+        return "error";
+    }
+    return "unknown";
+}
+
+/* Read the register image of the device 'fd' is bound to in one combined
+ * read.
+ */
+int
+watch_read (int fd, watch_image_t *image)
+{
+    uint16_t values[3] = { 0 };
+
+    if (xfer_read_regs (fd, image_regs, 3, values))
+        return -1;
+    image->div = values[0];
+    image->mux = values[1];
+    image->bus = values[2];
+    return 0;
+}
+
+uint8_t
+watch_diff (const watch_image_t *a, const watch_image_t *b)
+{
+    return (a->div != b->div ? WATCH_DIV : 0) |
+           (a->mux != b->mux ? WATCH_MUX : 0) |
+           (a->bus != b->bus ? WATCH_BUS : 0);
+}
+
+/* Write the drifted registers back. BUS goes first: if WC is being set
+ * again, DIV and MUX must not be written while it's still clear or every
+ * remediation would cost an EEPROM write.
+ */
+static int
+watch_remediate (int fd, const watch_device_t *device)
+{
+    int ret = 0;
+    int err = 0;
+
+    if (lock_acquire (fd))
+        return -1;
+    if (device->drifted & WATCH_BUS)
+        ret = xfer_write_byte (fd, COMMAND_BUS, device->expected.bus);
+    if (ret != -1 && device->drifted & WATCH_DIV)
+        ret = xfer_write_word (fd, COMMAND_DIV, device->expected.div);
+    if (ret != -1 && device->drifted & WATCH_MUX)
+        ret = xfer_write_word (fd, COMMAND_MUX, device->expected.mux);
+    err = errno;
+    lock_release (fd);
+    errno = err;
+    return ret == -1 ? -1 : 0;
+}
+
+/* Back off after a stable poll, drop to the minimum after an anomaly. One
+ * good poll after an anomaly doesn't make a device healthy, it has to be
+ * stable WATCH_SETTLE_POLLS times in a row before the interval grows.
+ */
+static void
+watch_schedule (watch_device_t *device,
+                const watch_policy_t *policy,
+                bool anomaly,
+                uint64_t now_ns)
+{
+    if (anomaly) {
+        device->interval_ms = policy->min_ms;
+        device->settle = WATCH_SETTLE_POLLS;
+    } else if (device->settle > 0 && --device->settle > 0)
+        device->interval_ms = policy->min_ms;
+    else if (device->interval_ms < policy->max_ms / 2)
+        device->interval_ms *= 2;
+    else
+        device->interval_ms = policy->max_ms;
+    device->next_ns = now_ns + (uint64_t)device->interval_ms * 1000000;
+}
+
+/* Set up the schedule. First polls are spread over the minimum interval so a
+ * large fleet doesn't hit the bus all at once.
+ */
+void
+watch_start (watch_device_t *devices,
+             size_t count,
+             const watch_policy_t *policy,
+             uint64_t now_ns)
+{
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i) {
+        devices[i].interval_ms = policy->min_ms;
+        devices[i].settle = 0;
+        devices[i].next_ns = now_ns +
+                             (uint64_t)policy->min_ms * 1000000 * i / count;
+    }
+}
+
+/* Poll a device and schedule its next poll. WATCH_ERROR leaves errno set,
+ * 'drifted' tells whether the device drifted before remediating it failed.
+ */
+watch_event_t
+watch_poll (watch_device_t *device,
+            const watch_policy_t *policy,
+            uint64_t now_ns)
+{
+    topo_target_t *target = &device->target;
+    watch_image_t image = { 0 };
+    watch_event_t event = WATCH_ERROR;
+    int fd = 0;
+
+    ++device->polls;
+    device->drifted = 0;
+    fd = pool_get (target->bus_dev, target->mux, target->channel,
+                   target->address);
+    if (fd == -1 || watch_read (fd, &image))
+        goto err_out;
+    device->image = image;
+    if (!device->expected_set) {
+        device->expected = image;
+        device->expected_set = true;
+        watch_schedule (device, policy, false, now_ns);
+        event = WATCH_BASELINE;
+        goto out;
+    }
+    device->drifted = watch_diff (&device->expected, &image);
+    if (device->drifted == 0) {
+        watch_schedule (device, policy, false, now_ns);
+        event = WATCH_STABLE;
+        goto out;
+    }
+    ++device->drifts;
+    watch_schedule (device, policy, true, now_ns);
+    event = WATCH_DRIFT;
+    if (!policy->remediate)
+        goto out;
+    if (watch_remediate (fd, device))
+        goto err_out;
+    event = WATCH_REMEDIATED;
+    goto out;
+err_out:
+    ++device->errors;
+    watch_schedule (device, policy, true, now_ns);
+    event = WATCH_ERROR;
+out:
+    pool_put (fd);
+    return event;
+}
@@ -0,0 +1,82 @@
+#ifndef _DS1077L_WATCH_H_
+#define _DS1077L_WATCH_H_
+
+#include "ds1077l-topo.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Watching devices for register drift.
+ *
+ * A DS1077L that browns out comes back with whatever its EEPROM holds, which
+ * isn't what it was running with if that was set with WC on. Nothing tells
+ * us, so devices are polled: each poll reads the DIV, MUX and BUS registers
+ * in one combined read (xfer_read_regs) and compares the packed words with
+ * the expected image, either given up front or taken from the first poll.
+ *
+ * Every device keeps its own polling interval. A poll that finds nothing
+ * wrong doubles it, up to the maximum, so a healthy fleet settles at a low
+ * bus load. A drifted or unreachable device drops back to the minimum and
+ * only starts backing off again with its WATCH_SETTLE_POLLS-th stable poll
+ * in a row. Drift can optionally be remediated by writing the expected words
+ * back; the next poll then verifies the fix.
+ */
+#define WATCH_INTERVAL_MS_DEFAULT     1000
+#define WATCH_INTERVAL_MAX_MS_DEFAULT 60000
+#define WATCH_DEVICES_MAX             XFER_TARGETS_MAX
+#define WATCH_SETTLE_POLLS            3
+
+/* Registers of the image, as a bit mask of drifted ones. */
+#define WATCH_DIV 0x1
+#define WATCH_MUX 0x2
+#define WATCH_BUS 0x4
+
+typedef struct watch_image {
+    uint16_t div;
+    uint16_t mux;
+    uint8_t bus;
+} watch_image_t;
+
+typedef enum watch_event {
+    WATCH_BASELINE = 0,         /* first poll, image taken as expected */
+    WATCH_STABLE,
+    WATCH_DRIFT,
+    WATCH_REMEDIATED,           /* drifted and written back */
+    WATCH_ERROR,                /* device couldn't be read, errno is set */
+} watch_event_t;
+
+typedef struct watch_device {
+    topo_target_t target;
+    watch_image_t expected;
+    bool expected_set;
+    watch_image_t image;        /* from the last successful poll */
+    uint8_t drifted;            /* WATCH_* registers that differed */
+    unsigned interval_ms;
+    unsigned settle;            /* stable polls left before backing off */
+    uint64_t next_ns;           /* CLOCK_MONOTONIC time of the next poll */
+    uint64_t polls;
+    uint64_t drifts;
+    uint64_t errors;
+} watch_device_t;
+
+typedef struct watch_policy {
+    unsigned min_ms;
+    unsigned max_ms;
+    bool remediate;
+} watch_policy_t;
+
+int watch_parse (const char *arg, watch_device_t *device);
+int watch_interval_parse (const char *arg, watch_policy_t *policy);
+const char *watch_event_name (watch_event_t event);
+int watch_read (int fd, watch_image_t *image);
+uint8_t watch_diff (const watch_image_t *a, const watch_image_t *b);
+void watch_start (watch_device_t *devices,
+                  size_t count,
+                  const watch_policy_t *policy,
+                  uint64_t now_ns);
+watch_event_t watch_poll (watch_device_t *device,
+                          const watch_policy_t *policy,
+                          uint64_t now_ns);
+
+#endif // #ifndef _DS1077L_WATCH_H_
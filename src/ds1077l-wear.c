@@ -0,0 +1,333 @@
+#include "ds1077l-wear.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-writee2.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* BUS register contents as last seen by this process. */
+typedef struct wear_bus {
+    char bus_dev[32];
+    uint8_t mux;
+    uint8_t channel;
+    uint8_t address;
+    uint8_t bus;
+} wear_bus_t;
+
+bool wear_on = false;
+static bool write_behind = false;
+static wear_file_t *wear = NULL;
+static int wear_fd = -1;
+/* flock only serializes processes, threads share the open file */
+static pthread_mutex_t wear_lock = PTHREAD_MUTEX_INITIALIZER;
+static wear_bus_t bus_cache[WEAR_DEVICES_MAX];
+static size_t bus_count = 0;
+
+/* Map the wear file, creating it if need be, and start accounting.
+ */
+int
+wear_init (const char *path, bool behind)
+{
+    struct stat st;
+    void *map = NULL;
+    int fd = 0;
+
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    if (flock (fd, LOCK_EX))
+        goto err_close;
+    if (fstat (fd, &st))
+        goto err_close;
+    if (st.st_size == 0) {
+        if (ftruncate (fd, sizeof (wear_file_t)))
+            goto err_close;
+    } else if (st.st_size != sizeof (wear_file_t)) {
+        errno = EINVAL;
+        goto err_close;
+    }
+    map = mmap (NULL, sizeof (wear_file_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto err_close;
+    wear = map;
+    if (st.st_size == 0) {
+        wear->magic = WEAR_MAGIC;
+        wear->version = WEAR_VERSION;
+    }
+    if (wear->magic != WEAR_MAGIC || wear->version != WEAR_VERSION) {
+        munmap (map, sizeof (wear_file_t));
+        wear = NULL;
+        errno = EINVAL;
+        goto err_close;
+    }
+    flock (fd, LOCK_UN);
+    wear_fd = fd;
+    write_behind = behind;
+    wear_on = true;
+    return 0;
+err_close:
+    close (fd);
+    return -1;
+}
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+wear_lock_file (void)
+{
+    pthread_mutex_lock (&wear_lock);
+    flock (wear_fd, LOCK_EX);
+}
+
+static void
+wear_unlock_file (void)
+{
+    flock (wear_fd, LOCK_UN);
+    pthread_mutex_unlock (&wear_lock);
+}
+
+static bool
+wear_match (const char *bus_dev,
+            uint8_t mux,
+            uint8_t channel,
+            uint8_t address,
+            const xfer_target_t *target)
+{
+    return strcmp (bus_dev, xfer_adapter_name (target->adapter)) == 0 &&
+           mux == target->mux && channel == target->channel &&
+           address == target->address;
+}
+
+static wear_bus_t *
+bus_find (const xfer_target_t *target)
+{
+    size_t i = 0;
+
+    for (i = 0; i < bus_count; ++i)
+        if (wear_match (bus_cache[i].bus_dev, bus_cache[i].mux,
+                        bus_cache[i].channel, bus_cache[i].address, target))
+            return &bus_cache[i];
+    return NULL;
+}
+
+/* Find the entry for a device, adding it if 'create' is set. Called with
+ * the file locked.
+ */
+static wear_device_t *
+device_find (const xfer_target_t *target, bool create)
+{
+    wear_device_t *device = NULL;
+    uint32_t i = 0;
+
+    for (i = 0; i < wear->count; ++i)
+        if (wear_match (wear->devices[i].bus_dev, wear->devices[i].mux,
+                        wear->devices[i].channel, wear->devices[i].address,
+                        target))
+            return &wear->devices[i];
+    if (!create || wear->count == WEAR_DEVICES_MAX)
+        return NULL;
+    device = &wear->devices[wear->count++];
+    memset (device, 0, sizeof (*device));
+    strncpy (device->bus_dev, xfer_adapter_name (target->adapter),
+             sizeof (device->bus_dev) - 1);
+    device->mux = target->mux;
+    device->channel = target->channel;
+    device->address = target->address;
+    return device;
+}
+
+/* Get ready for a write of register 'command' to the device 'fd' is bound
+ * to: learn its WC bit and with write-behind make sure it's set before DIV
+ * or MUX are written.
+ */
+int
+wear_prepare (int fd, uint8_t command)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    wear_bus_t *cached = NULL;
+    int32_t bus = 0;
+
+    if (command != COMMAND_DIV && command != COMMAND_MUX &&
+        command != COMMAND_BUS)
+        return 0;
+    pthread_mutex_lock (&wear_lock);
+    cached = bus_find (target);
+    bus = cached ? cached->bus : -1;
+    pthread_mutex_unlock (&wear_lock);
+    if (bus == -1) {
+        bus = xfer_read_byte (fd, COMMAND_BUS);
+        if (bus == -1)
+            return -1;
+        pthread_mutex_lock (&wear_lock);
+        cached = bus_find (target);
+        if (cached == NULL && bus_count < WEAR_DEVICES_MAX) {
+            cached = &bus_cache[bus_count++];
+            strncpy (cached->bus_dev, xfer_adapter_name (target->adapter),
+                     sizeof (cached->bus_dev) - 1);
+            cached->mux = target->mux;
+            cached->channel = target->channel;
+            cached->address = target->address;
+        }
+        if (cached != NULL)
+            cached->bus = bus;
+        pthread_mutex_unlock (&wear_lock);
+    }
+    if (!write_behind || command == COMMAND_BUS || WC_UNPACK (bus))
+        return 0;
+    /* setting WC doesn't write the EEPROM, see wear_written */
+    return xfer_write_byte (fd, COMMAND_BUS, bus | WC_PACK (true)) == -1 ?
+           -1 : 0;
+}
+
+/* Follow a device to its new address. Called with the file locked.
+ */
+static void
+wear_move (wear_device_t *device, wear_bus_t *cached, uint8_t address)
+{
+    wear_device_t *stale = NULL;
+    uint32_t i = 0;
+
+    if (cached != NULL)
+        cached->address = address;
+    if (device == NULL)
+        return;
+    for (i = 0; i < wear->count; ++i) {
+        stale = &wear->devices[i];
+        if (stale != device &&
+            strcmp (stale->bus_dev, device->bus_dev) == 0 &&
+            stale->mux == device->mux && stale->channel == device->channel &&
+            stale->address == address)
+            break;
+    }
+    if (i < wear->count) {
+        /* whoever was there before has moved on */
+        *stale = wear->devices[--wear->count];
+        if (device == &wear->devices[wear->count])
+            device = stale;
+    }
+    device->address = address;
+}
+
+/* Account for a successful write of 'value' to register 'command'. A write
+ * reaches the EEPROM if WC is clear once it's done, which for BUS is the
+ * new value of the bit.
+ */
+void
+wear_written (int fd, uint8_t command, uint16_t value)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    wear_device_t *device = NULL;
+    wear_bus_t *cached = NULL;
+    bool e2 = false;
+    uint64_t now = now_ns ();
+
+    if (command != COMMAND_DIV && command != COMMAND_MUX &&
+        command != COMMAND_BUS && command != COMMAND_E2_WRITE)
+        return;
+    wear_lock_file ();
+    device = device_find (target, true);
+    cached = bus_find (target);
+    switch (command) {
+    case COMMAND_E2_WRITE:
+        e2 = true;
+        break;
+    case COMMAND_BUS:
+        e2 = !WC_UNPACK (value);
+        if (!e2 && device != NULL && cached != NULL && cached->bus != value) {
+            device->dirty = 1;
+            device->changed_ns = now;
+        }
+        if (cached != NULL)
+            cached->bus = value;
+        if (ADDRESS_UNPACK (value) != target->address)
+            wear_move (device, cached, ADDRESS_UNPACK (value));
+        break;
+    default:
+        e2 = cached == NULL || !WC_UNPACK (cached->bus);
+        if (!e2 && device != NULL) {
+            device->dirty = 1;
+            device->changed_ns = now;
+        }
+        break;
+    }
+    if (e2 && device != NULL) {
+        ++device->e2_writes;
+        device->dirty = 0;
+        device->committed_ns = now;
+    }
+    wear_unlock_file ();
+}
+
+/* Copy out the device entries. Returns the number copied.
+ */
+size_t
+wear_list (wear_device_t *devices, size_t max)
+{
+    size_t count = 0;
+
+    if (wear == NULL)
+        return 0;
+    wear_lock_file ();
+    count = wear->count < max ? wear->count : max;
+    memcpy (devices, wear->devices, count * sizeof (*devices));
+    wear_unlock_file ();
+    return count;
+}
+
+/* Issue one E2_WRITE to every dirty device that hasn't changed for
+ * 'quiet_ms'. Devices that fail are left dirty for the next round, the
+ * return value is -1 with errno set if there were any.
+ */
+int
+wear_commit (uint64_t quiet_ms, size_t *committed)
+{
+    static wear_device_t due[WEAR_DEVICES_MAX];
+    uint64_t now = now_ns ();
+    size_t count = 0;
+    size_t i = 0;
+    int err = 0;
+    int fd = 0;
+
+    *committed = 0;
+    if (wear == NULL)
+        return 0;
+    wear_lock_file ();
+    for (i = 0; i < wear->count; ++i)
+        if (wear->devices[i].dirty &&
+            wear->devices[i].changed_ns + quiet_ms * 1000000 <= now)
+            due[count++] = wear->devices[i];
+    wear_unlock_file ();
+    for (i = 0; i < count; ++i) {
+        fd = pool_get (due[i].bus_dev, due[i].mux, due[i].channel,
+                       due[i].address);
+        if (fd == -1 || xfer_command (fd, COMMAND_E2_WRITE) == -1) {
+            err = errno;
+            pool_put (fd);
+            continue;
+        }
+        pool_put (fd);
+        ++*committed;
+    }
+    if (err == 0)
+        return 0;
+    errno = err;
+    return -1;
+}
@@ -0,0 +1,61 @@
+#ifndef _DS1077L_WEAR_H_
+#define _DS1077L_WEAR_H_
+
+#include "ds1077l-xfer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* EEPROM wear accounting and write-behind.
+ *
+ * The DS1077L's EEPROM is good for a limited number of write cycles. With
+ * WC clear every register write is one of them, with WC set only E2_WRITE
+ * is. When a wear file is configured the transaction layer counts every
+ * EEPROM write it causes per device (adapter, mux, channel, address) in
+ * that file, which persists across runs and is shared by all processes. To
+ * tell the two cases apart the BUS register of a device is read once per
+ * process before the first write to it.
+ *
+ * Write-behind keeps devices in WC=1: before a register write to a device
+ * with WC clear, WC is set, so the write only changes SRAM and the device is
+ * marked dirty instead. wear_commit issues a single E2_WRITE per dirty
+ * device once it has been left alone for a quiet period, ds1077l-monitor
+ * --commit-after does this in the background and commits everything on
+ * shutdown, ds1077l-writee2 --pending on demand.
+ *
+ * Devices moved to a new address take their count with them.
+ */
+#define WEAR_FILE_ENV    "DS1077L_WEAR_FILE"
+#define WEAR_MAGIC       0x5241455737373031ull
+#define WEAR_VERSION     1
+#define WEAR_DEVICES_MAX 256
+
+typedef struct wear_device {
+    char bus_dev[32];
+    uint8_t mux;
+    uint8_t channel;
+    uint8_t address;
+    uint8_t dirty;              /* changed in SRAM only */
+    uint32_t reserved;
+    uint64_t e2_writes;
+    uint64_t changed_ns;        /* CLOCK_REALTIME of the last SRAM change */
+    uint64_t committed_ns;      /* and of the last EEPROM write */
+} wear_device_t;
+
+typedef struct wear_file {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+    wear_device_t devices[WEAR_DEVICES_MAX];
+} wear_file_t;
+
+extern bool wear_on;
+
+int wear_init (const char *path, bool write_behind);
+int wear_prepare (int fd, uint8_t command);
+void wear_written (int fd, uint8_t command, uint16_t value);
+size_t wear_list (wear_device_t *devices, size_t max);
+int wear_commit (uint64_t quiet_ms, size_t *committed);
+
+#endif // #ifndef _DS1077L_WEAR_H_
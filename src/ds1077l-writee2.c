@@ -1,8 +1,90 @@
 #include "ds1077l.h"
 #include "ds1077l-writee2.h"
 
+#include <argp.h>
 #include <linux/i2c-dev.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+typedef struct writee2_args {
+    ds1077l_common_args_t common_args;
+    bool pending;
+    bool wear;
+} writee2_args_t;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "pending",
+        .key   = 'p',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Commit every device with register changes left in SRAM by "
+                 "--write-behind instead of just the selected one.",
+        .group = 1
+    },
+    {
+        .name  = "wear",
+        .key   = 'w',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "List the EEPROM writes counted in the wear file instead of "
+                 "writing.",
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = NULL,
+    .doc         = "Write the registers of a Maxim DS1077L programmable "
+                   "oscillator to its EEPROM.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    writee2_args_t *args = state->input;
+
+    switch (key) {
+        case 'p':
+            args->pending = true;
+            break;
+        case 'w':
+            args->wear = true;
+            break;
+        case ARGP_KEY_END:
+            if ((args->pending || args->wear) && !wear_on)
+                argp_error (state, "--pending and --wear need a "
+                                   "--wear-file.");
+            break;
+        case ARGP_KEY_INIT:
+            args->pending = false;
+            args->wear = false;
+            state->child_inputs[0] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
 
 static int
 writee2 (int fd)
@@ -14,24 +96,88 @@ writee2 (int fd)
      * 'command': set to the 'write E2' command from the DS1077L spec sheet
      * 'size': is set to 0
      * 'data': is a null pointer.
+     * xfer_command does exactly this.
      */
-    return i2c_smbus_access (fd, I2C_SMBUS_WRITE, COMMAND_E2_WRITE, 0, NULL);
+    return xfer_command (fd, COMMAND_E2_WRITE);
+}
+
+/* Print the wear file entries, one per device.
+ */
+static int
+wear_dump (fmt_buf_t *out, ds1077l_format_t format)
+{
+    static wear_device_t devices[WEAR_DEVICES_MAX];
+    size_t count = wear_list (devices, WEAR_DEVICES_MAX);
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i) {
+        fmt_record_t record = {
+            .bus_dev   = devices[i].bus_dev,
+            .address   = devices[i].address,
+            .reg       = "E2",
+            .raw_width = 0,
+        };
+        fmt_field_t fields[] = {
+            { .name = "writes", .type = FIELD_UINT,
+              .value = devices[i].e2_writes },
+            { .name = "dirty", .type = FIELD_BOOL,
+              .value = devices[i].dirty },
+        };
+
+        if (format != FORMAT_HUMAN) {
+            fmt_register (out, format, &record, fields,
+                          sizeof (fields) / sizeof (fields[0]));
+            continue;
+        }
+        if (devices[i].mux == 0)
+            printf ("%s/%#x: ", devices[i].bus_dev, devices[i].address);
+        else
+            printf ("%s/%#x/%d/%#x: ", devices[i].bus_dev, devices[i].mux,
+                    devices[i].channel, devices[i].address);
+        printf ("%llu EEPROM writes%s\n",
+                (unsigned long long)devices[i].e2_writes,
+                devices[i].dirty ? ", uncommitted changes" : "");
+    }
+    return fmt_flush (out);
 }
 
 int
 main (int argc, char* argv[])
 {
     int fd = 0;
-    /* just the common arguments */
-    ds1077l_common_args_t common_args = { 0 };
+    writee2_args_t args = { 0 };
+    ds1077l_common_args_t *common_args = &args.common_args;
+    size_t committed = 0;
+    static fmt_buf_t out;
+    fmt_record_t record = { .reg = "E2", .raw_width = 0 };
+    fmt_field_t fields[] = {
+        { .name = "written", .type = FIELD_BOOL, .value = true },
+    };
 
-    if (argp_parse (&common_argp, argc, argv, 0, NULL, &common_args)) {
+    fmt_init (&out, STDOUT_FILENO);
+    if (argp_parse (&argps, argc, argv, 0, NULL, &args)) {
         perror ("argp_parse: \n");
         exit (1);
     }
-    if (common_args.verbose)
-        dump_common_opts (&common_args);
-    fd = handle_get (common_args.bus_dev, common_args.address);
+    if (common_args->verbose)
+        dump_common_opts (common_args);
+    if (args.wear) {
+        if (wear_dump (&out, common_args->format)) {
+            perror ("wear_dump: ");
+            exit (1);
+        }
+        exit (0);
+    }
+    if (args.pending) {
+        if (wear_commit (0, &committed)) {
+            perror ("wear_commit: ");
+            exit (1);
+        }
+        if (common_args->verbose)
+            printf ("writee2: committed %zu devices\n", committed);
+        exit (0);
+    }
+    fd = handle_get_common (common_args);
     if (fd == -1) {
         perror ("handle_get: ");
         exit (1);
@@ -40,7 +186,17 @@ main (int argc, char* argv[])
         perror ("writee2: \n");
         exit (1);
     }
-    if (common_args.verbose)
+    if (common_args->format != FORMAT_HUMAN) {
+        record.bus_dev = common_args->bus_dev;
+        record.address = common_args->address;
+        fmt_register (&out, common_args->format, &record, fields,
+                      sizeof (fields) / sizeof (fields[0]));
+        if (fmt_flush (&out)) {
+            perror ("fmt_flush: ");
+            exit (1);
+        }
+    } else if (common_args->verbose) {
         printf ("writee2: success!\n");
+    }
     exit (0);
 }
@@ -1,2 +1,7 @@
+#ifndef _DS1077L_WRITEE2_H_
+#define _DS1077L_WRITEE2_H_
+
 /* commands */
 #define COMMAND_E2_WRITE 0x3f
+
+#endif // #ifndef _DS1077L_WRITEE2_H_
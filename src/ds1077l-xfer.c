@@ -0,0 +1,629 @@
+#include "ds1077l-xfer.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-cache.h"
+#include "ds1077l-div.h"
+#include "ds1077l-metrics.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-probe.h"
+#include "ds1077l-record.h"
+#include "ds1077l-retry.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-tracer.h"
+#include "ds1077l-wear.h"
+#include "ds1077l-writee2.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Interned adapter names. Entries are only ever added so an index handed out
+ * by xfer_bind stays valid for the life of the process.
+ */
+static char adapters[XFER_ADAPTERS_MAX][32];
+static uint16_t adapter_numbers[XFER_ADAPTERS_MAX];
+static uint8_t adapter_count = 0;
+/* Bound descriptors. Entries never move, an unbound one is left with fd -1
+ * for the next bind, so the pointer xfer_target returns stays good for as
+ * long as the descriptor is held.
+ */
+static xfer_target_t targets[XFER_TARGETS_MAX];
+static size_t target_count = 0;
+static pthread_mutex_t bind_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef HAVE_SYS_SDT_H
+DS1077L_SEMAPHORE_DEFINE (xfer__start);
+DS1077L_SEMAPHORE_DEFINE (xfer__done);
+DS1077L_SEMAPHORE_DEFINE (xfer__retry);
+DS1077L_SEMAPHORE_DEFINE (div__decode);
+DS1077L_SEMAPHORE_DEFINE (div__encode);
+DS1077L_SEMAPHORE_DEFINE (mux__decode);
+DS1077L_SEMAPHORE_DEFINE (mux__encode);
+DS1077L_SEMAPHORE_DEFINE (bus__decode);
+DS1077L_SEMAPHORE_DEFINE (bus__encode);
+DS1077L_SEMAPHORE_DEFINE (lock__wait);
+DS1077L_SEMAPHORE_DEFINE (lock__conflict);
+#endif
+
+static int smbus_open (const char *bus_dev, uint8_t address);
+
+const xfer_transport_t xfer_smbus = {
+    .name   = "smbus",
+    .open   = smbus_open,
+    .access = i2c_smbus_access,
+};
+
+static const xfer_transport_t *transport = &xfer_smbus;
+
+/* Used for file descriptors that were never bound so instrumentation always
+ * has a target to attribute a transaction to.
+ */
+static const xfer_target_t target_unknown = {
+    .fd      = -1,
+    .adapter = XFER_ADAPTERS_MAX,
+    .address = 0,
+};
+
+/* Open the i2c-dev node for an adapter and point it at a slave address.
+ */
+static int
+smbus_open (const char *bus_dev, uint8_t address)
+{
+    int fd = 0;
+
+    fd = open (bus_dev, O_RDWR);
+    if (fd == -1)
+        return -1;
+    if (ioctl (fd, I2C_SLAVE, address)) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Select the transport used for all subsequent transactions. Must be called
+ * before any file descriptors are opened.
+ */
+void
+xfer_transport_set (const xfer_transport_t *new_transport)
+{
+    transport = new_transport;
+}
+
+/* Get a file descriptor for a device from the current transport and bind it
+ * to the device.
+ */
+int
+xfer_open (const char *bus_dev, uint8_t address)
+{
+    int fd = 0;
+
+    fd = transport->open (bus_dev, address);
+    if (fd == -1)
+        return -1;
+    if (retry_configure (fd, bus_dev) || xfer_bind (fd, bus_dev, address)) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int
+adapter_intern (const char *bus_dev)
+{
+    uint8_t i = 0;
+
+    for (i = 0; i < adapter_count; ++i)
+        if (strncmp (adapters[i], bus_dev, sizeof (adapters[i]) - 1) == 0)
+            return i;
+    if (adapter_count == XFER_ADAPTERS_MAX)
+        return -1;
+    strncpy (adapters[adapter_count], bus_dev, sizeof (adapters[0]) - 1);
+    adapter_numbers[adapter_count] = xfer_parse_adapter (bus_dev);
+    return adapter_count++;
+}
+
+/* Record the bus device and slave address associated with a file descriptor.
+ * Called by handle_get, returns 0 on success and -1 if the tables are full.
+ */
+int
+xfer_bind (int fd, const char *bus_dev, uint8_t address)
+{
+    size_t unused = XFER_TARGETS_MAX;
+    int adapter = 0;
+    size_t i = 0;
+
+    pthread_mutex_lock (&bind_lock);
+    adapter = adapter_intern (bus_dev);
+    if (adapter == -1)
+        goto err_out;
+    for (i = 0; i < target_count; ++i) {
+        if (targets[i].fd == fd)
+            break;
+        if (targets[i].fd == -1 && unused == XFER_TARGETS_MAX)
+            unused = i;
+    }
+    if (i == target_count && unused != XFER_TARGETS_MAX)
+        i = unused;
+    if (i == XFER_TARGETS_MAX)
+        goto err_out;
+    targets[i].fd      = fd;
+    targets[i].adapter = adapter;
+    targets[i].address = address;
+    targets[i].mux     = 0;
+    targets[i].channel = 0;
+    if (i == target_count)
+        ++target_count;
+    pthread_mutex_unlock (&bind_lock);
+    return 0;
+err_out:
+    pthread_mutex_unlock (&bind_lock);
+    errno = ENOSPC;
+    return -1;
+}
+
+/* Record that the device bound to 'fd' sits behind channel 'channel' of the
+ * PCA954x at 'mux'. See ds1077l-topo.h.
+ */
+int
+xfer_route (int fd, uint8_t mux, uint8_t channel)
+{
+    size_t i = 0;
+
+    pthread_mutex_lock (&bind_lock);
+    for (i = 0; i < target_count; ++i) {
+        if (targets[i].fd == fd) {
+            targets[i].mux     = mux;
+            targets[i].channel = channel;
+            pthread_mutex_unlock (&bind_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock (&bind_lock);
+    errno = EBADF;
+    return -1;
+}
+
+void
+xfer_unbind (int fd)
+{
+    size_t i = 0;
+
+    pthread_mutex_lock (&bind_lock);
+    for (i = 0; i < target_count; ++i) {
+        if (targets[i].fd == fd) {
+            targets[i].fd = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&bind_lock);
+}
+
+/* The device 'fd' is bound to. The entry is only reused once 'fd' has been
+ * unbound, see pool_put.
+ */
+const xfer_target_t *
+xfer_target (int fd)
+{
+    const xfer_target_t *target = &target_unknown;
+    size_t i = 0;
+
+    if (fd < 0)
+        return target;
+    pthread_mutex_lock (&bind_lock);
+    for (i = 0; i < target_count; ++i) {
+        if (targets[i].fd == fd) {
+            target = &targets[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock (&bind_lock);
+    return target;
+}
+
+const char *
+xfer_adapter_name (uint8_t adapter)
+{
+    if (adapter >= adapter_count)
+        return "unknown";
+    return adapters[adapter];
+}
+
+/* Extract N from a bus device node of the form /dev/i2c-N.
+ */
+uint16_t
+xfer_parse_adapter (const char *bus_dev)
+{
+    const char *dash = strrchr (bus_dev, '-');
+    char *end = NULL;
+    long number = 0;
+
+    if (dash == NULL || dash[1] == '\0')
+        return XFER_ADAPTER_UNKNOWN;
+    number = strtol (dash + 1, &end, 10);
+    if (*end != '\0' || number < 0 || number >= XFER_ADAPTER_UNKNOWN)
+        return XFER_ADAPTER_UNKNOWN;
+    return number;
+}
+
+uint16_t
+xfer_adapter_number (uint8_t adapter)
+{
+    if (adapter >= adapter_count)
+        return XFER_ADAPTER_UNKNOWN;
+    return adapter_numbers[adapter];
+}
+
+/* Name of the register 'command' stands for at 'address'. Written to a
+ * PCA954x the command byte is a mask of channels to route, not a register.
+ */
+const char *
+xfer_command_name (uint8_t address, uint8_t command)
+{
+    if (address >= TOPO_MUX_MIN && address <= TOPO_MUX_MAX)
+        return "MUX_SELECT";
+    switch (command) {
+    case COMMAND_DIV:
+        return "DIV";
+    case COMMAND_MUX:
+        return "MUX";
+    case COMMAND_BUS:
+        return "BUS";
+    case COMMAND_E2_WRITE:
+        return "E2_WRITE";
+    default:
+        return "unknown";
+    }
+}
+
+/* Coarse classification of the errno values returned by i2c adapters. Most
+ * bus drivers report a missing ACK as ENXIO or EREMOTEIO and a stuck or
+ * contested bus as ETIMEDOUT or EAGAIN.
+ */
+const char *
+xfer_result_name (int err)
+{
+    switch (err) {
+    case 0:
+        return "ok";
+    case ENXIO:
+    case EREMOTEIO:
+        return "nak";
+    case ETIMEDOUT:
+        return "timeout";
+    case EAGAIN:
+        return "busy";
+    case EIO:
+        return "io";
+    default:
+        return "error";
+    }
+}
+
+static inline uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Register word carried by a transaction, 0 if there is none or it isn't
+ * known yet (reads before they complete or fail).
+ */
+static inline uint16_t
+xfer_payload (char read_write,
+              int size,
+              union i2c_smbus_data *data,
+              int32_t ret)
+{
+    if (data == NULL || (read_write == I2C_SMBUS_READ && ret != 0))
+        return 0;
+    return size == I2C_SMBUS_WORD_DATA ? data->word : data->byte;
+}
+
+/* Route the mux channel the target sits behind, if any. On success the
+ * adapter stays locked until xfer_deselect.
+ */
+static int
+xfer_select (const xfer_target_t *target)
+{
+    int err = 0;
+
+    if (target->mux == 0)
+        return 0;
+    if (topo_lock (target))
+        return -1;
+    if (topo_select (target)) {
+        err = errno;
+        topo_unlock (target);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+xfer_deselect (const xfer_target_t *target, int32_t ret)
+{
+    if (target->mux == 0)
+        return;
+    if (ret == -1)
+        topo_invalidate (target);
+    topo_unlock (target);
+}
+
+static void
+xfer_observe (const xfer_target_t *target,
+              uint8_t command,
+              char read_write,
+              int size,
+              uint16_t payload,
+              int err,
+              uint64_t start,
+              uint64_t duration)
+{
+    DS1077L_PROBE7 (xfer__done, xfer_adapter_name (target->adapter),
+                    target->address, command, read_write, payload, err,
+                    duration);
+    if (metrics_on)
+        metrics_observe (target, command, read_write, err, duration);
+    if (tracer_on)
+        tracer_record (target, command, read_write, size, payload, err,
+                       duration);
+    if (record_on)
+        record_write (target, command, read_write, size, payload, err, start,
+                      duration);
+}
+
+/* The one place where transactions are handed to the adapter. Every
+ * attempt is observed on its own so retries show up in metrics and traces.
+ */
+static int32_t
+xfer_once (int fd,
+           const xfer_target_t *target,
+           char read_write,
+           uint8_t command,
+           int size,
+           union i2c_smbus_data *data)
+{
+    bool observed = metrics_on || tracer_on || record_on ||
+                    DS1077L_PROBE_ENABLED (xfer__start) ||
+                    DS1077L_PROBE_ENABLED (xfer__done);
+    int32_t ret = 0;
+    uint64_t start = 0;
+    int err = 0;
+
+    if (xfer_select (target))
+        return -1;
+    if (observed) {
+        DS1077L_PROBE5 (xfer__start, xfer_adapter_name (target->adapter),
+                        target->address, command, read_write,
+                        xfer_payload (read_write, size, data, -1));
+        start = now_ns ();
+    }
+    ret = transport->access (fd, read_write, command, size, data);
+    err = ret == -1 ? errno : 0;
+    xfer_deselect (target, ret);
+    if (observed)
+        xfer_observe (target, command, read_write, size,
+                      xfer_payload (read_write, size, data, ret), err, start,
+                      now_ns () - start);
+    errno = err;
+    return ret;
+}
+
+/* Combined read of several registers. The mux channel is selected once and,
+ * if the transport can, all registers come back in one bus transfer. Each
+ * register is still observed as a read of its own, sharing the duration of
+ * the transfer between them, so captures replay with any transport.
+ */
+static int32_t
+xfer_regs_once (int fd,
+                const xfer_target_t *target,
+                const xfer_reg_t *regs,
+                size_t count,
+                uint16_t *values)
+{
+    bool observed = metrics_on || tracer_on || record_on ||
+                    DS1077L_PROBE_ENABLED (xfer__start) ||
+                    DS1077L_PROBE_ENABLED (xfer__done);
+    union i2c_smbus_data data;
+    int32_t ret = 0;
+    uint64_t start = 0;
+    uint64_t duration = 0;
+    size_t done = 0;
+    size_t i = 0;
+    int err = 0;
+
+    if (xfer_select (target))
+        return -1;
+    if (observed)
+        start = now_ns ();
+    if (transport->read_regs != NULL) {
+        ret = transport->read_regs (fd, regs, count, values);
+        done = ret == -1 ? 0 : count;
+    } else {
+        for (done = 0; done < count; ++done) {
+            ret = transport->access (fd, I2C_SMBUS_READ, regs[done].command,
+                                     regs[done].size, &data);
+            if (ret == -1)
+                break;
+            values[done] = regs[done].size == I2C_SMBUS_WORD_DATA ?
+                           data.word : data.byte;
+        }
+    }
+    err = ret == -1 ? errno : 0;
+    xfer_deselect (target, ret);
+    if (observed) {
+        duration = (now_ns () - start) / count;
+        for (i = 0; i < count && i <= done; ++i)
+            xfer_observe (target, regs[i].command, I2C_SMBUS_READ,
+                          regs[i].size, i < done ? values[i] : 0,
+                          i < done ? 0 : err, start + i * duration, duration);
+    }
+    errno = err;
+    return ret;
+}
+
+/* Run a transaction, or a combined read if 'regs' is set, with retries.
+ */
+static int32_t
+xfer_retried (int fd,
+              char read_write,
+              uint8_t command,
+              int size,
+              union i2c_smbus_data *data,
+              const xfer_reg_t *regs,
+              size_t count,
+              uint16_t *values)
+{
+    const xfer_target_t *target = xfer_target (fd);
+    unsigned attempt = 0;
+    int32_t ret = 0;
+    int err = 0;
+
+    if (retry_admit (target))
+        return -1;
+    for (attempt = 0; ; ++attempt) {
+        if (regs != NULL)
+            ret = xfer_regs_once (fd, target, regs, count, values);
+        else
+            ret = xfer_once (fd, target, read_write, command, size, data);
+        err = ret == -1 ? errno : 0;
+        if (!retry_again (target, err, attempt))
+            break;
+        DS1077L_PROBE5 (xfer__retry, xfer_adapter_name (target->adapter),
+                        target->address, command, attempt + 1, err);
+    }
+    retry_done (target, err, attempt);
+    errno = err;
+    return ret;
+}
+
+static int32_t
+xfer (int fd,
+      char read_write,
+      uint8_t command,
+      int size,
+      union i2c_smbus_data *data)
+{
+    uint16_t value = 0;
+    int32_t ret = 0;
+
+    /* mux selects are sent as bare bytes and aren't DS1077L registers */
+    if (size == I2C_SMBUS_BYTE)
+        return xfer_retried (fd, read_write, command, size, data, NULL, 0,
+                             NULL);
+    if (read_write == I2C_SMBUS_READ) {
+        if (cache_on && cache_lookup (fd, command, &value) == 0) {
+            if (size == I2C_SMBUS_WORD_DATA)
+                data->word = value;
+            else
+                data->byte = value;
+            return 0;
+        }
+        ret = xfer_retried (fd, read_write, command, size, data, NULL, 0,
+                            NULL);
+        if (cache_on && ret != -1)
+            cache_read (fd, command, xfer_payload (read_write, size, data,
+                                                   ret));
+        return ret;
+    }
+    if (wear_on && wear_prepare (fd, command))
+        return -1;
+    ret = xfer_retried (fd, read_write, command, size, data, NULL, 0, NULL);
+    value = xfer_payload (read_write, size, data, ret);
+    if (wear_on && ret != -1)
+        wear_written (fd, command, value);
+    if (cache_on)
+        cache_written (fd, command, value, ret != -1);
+    return ret;
+}
+
+int32_t
+xfer_read_byte (int fd, uint8_t command)
+{
+    union i2c_smbus_data data;
+
+    if (xfer (fd, I2C_SMBUS_READ, command, I2C_SMBUS_BYTE_DATA, &data))
+        return -1;
+    return 0xff & data.byte;
+}
+
+int32_t
+xfer_read_word (int fd, uint8_t command)
+{
+    union i2c_smbus_data data;
+
+    if (xfer (fd, I2C_SMBUS_READ, command, I2C_SMBUS_WORD_DATA, &data))
+        return -1;
+    return 0xffff & data.word;
+}
+
+int32_t
+xfer_write_byte (int fd, uint8_t command, uint8_t value)
+{
+    union i2c_smbus_data data;
+
+    data.byte = value;
+    return xfer (fd, I2C_SMBUS_WRITE, command, I2C_SMBUS_BYTE_DATA, &data);
+}
+
+int32_t
+xfer_write_word (int fd, uint8_t command, uint16_t value)
+{
+    union i2c_smbus_data data;
+
+    data.word = value;
+    return xfer (fd, I2C_SMBUS_WRITE, command, I2C_SMBUS_WORD_DATA, &data);
+}
+
+/* Send a command byte with no data, see writee2 for details.
+ */
+int32_t
+xfer_command (int fd, uint8_t command)
+{
+    return xfer (fd, I2C_SMBUS_WRITE, command, 0, NULL);
+}
+
+/* Write a single byte with no command, as used to program a PCA954x.
+ */
+int32_t
+xfer_send_byte (int fd, uint8_t value)
+{
+    return xfer (fd, I2C_SMBUS_WRITE, value, I2C_SMBUS_BYTE, NULL);
+}
+
+/* Read 'count' registers of the device 'fd' is bound to in one go, see
+ * xfer_regs_once. Returns 0 and the register contents in 'values' or -1 with
+ * errno set.
+ */
+int
+xfer_read_regs (int fd,
+                const xfer_reg_t *regs,
+                size_t count,
+                uint16_t *values)
+{
+    size_t i = 0;
+
+    if (count == 0)
+        return 0;
+    /* never answered from the cache: callers look for changes behind our
+     * back, but what they find keeps it fresh
+     */
+    if (xfer_retried (fd, I2C_SMBUS_READ, regs[0].command, regs[0].size,
+                      NULL, regs, count, values))
+        return -1;
+    if (cache_on)
+        for (i = 0; i < count; ++i)
+            cache_read (fd, regs[i].command, values[i]);
+    return 0;
+}
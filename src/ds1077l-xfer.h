@@ -0,0 +1,88 @@
+#ifndef _DS1077L_XFER_H_
+#define _DS1077L_XFER_H_
+
+#include <linux/i2c-dev.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Transaction layer. Every register access made by the utilities goes through
+ * the xfer_* functions so that instrumentation only has to be added in one
+ * place. They take the same arguments and return the same values as the
+ * i2c_smbus_* functions they replace: -1 with errno set on failure.
+ */
+
+/* Upper bound on the number of distinct adapters and file descriptors the
+ * transaction layer keeps track of.
+ */
+#define XFER_ADAPTERS_MAX 16
+#define XFER_TARGETS_MAX  64
+
+/* No adapter number could be parsed from the bus device node. */
+#define XFER_ADAPTER_UNKNOWN 0xffff
+
+/* Device a file descriptor is bound to. 'adapter' is an index into the
+ * interned adapter table, see xfer_adapter_name.
+ */
+typedef struct xfer_target {
+    int fd;
+    uint8_t adapter;
+    uint8_t address;
+    uint8_t mux;        /* PCA954x in front of the device, 0 for none */
+    uint8_t channel;
+} xfer_target_t;
+
+/* One register of a combined read, see xfer_read_regs. 'size' is
+ * I2C_SMBUS_BYTE_DATA or I2C_SMBUS_WORD_DATA.
+ */
+typedef struct xfer_reg {
+    uint8_t command;
+    int size;
+} xfer_reg_t;
+
+/* A transport moves transactions between the transaction layer and a bus.
+ * 'open' returns a file descriptor addressing 'address' on 'bus_dev' and
+ * 'access' has the semantics of i2c_smbus_access. xfer_smbus is the Linux
+ * i2c-dev transport used unless another one is selected. 'read_regs' is
+ * optional and reads 'count' registers in a single bus transfer, transports
+ * without it have the registers read one after the other.
+ */
+typedef struct xfer_transport {
+    const char *name;
+    int (*open) (const char *bus_dev, uint8_t address);
+    int32_t (*access) (int fd,
+                       char read_write,
+                       uint8_t command,
+                       int size,
+                       union i2c_smbus_data *data);
+    int (*read_regs) (int fd,
+                      const xfer_reg_t *regs,
+                      size_t count,
+                      uint16_t *values);
+} xfer_transport_t;
+
+extern const xfer_transport_t xfer_smbus;
+
+void xfer_transport_set (const xfer_transport_t *transport);
+int xfer_open (const char *bus_dev, uint8_t address);
+int xfer_bind (int fd, const char *bus_dev, uint8_t address);
+int xfer_route (int fd, uint8_t mux, uint8_t channel);
+void xfer_unbind (int fd);
+const xfer_target_t *xfer_target (int fd);
+const char *xfer_adapter_name (uint8_t adapter);
+uint16_t xfer_adapter_number (uint8_t adapter);
+uint16_t xfer_parse_adapter (const char *bus_dev);
+const char *xfer_command_name (uint8_t address, uint8_t command);
+const char *xfer_result_name (int err);
+
+int32_t xfer_read_byte (int fd, uint8_t command);
+int32_t xfer_read_word (int fd, uint8_t command);
+int32_t xfer_write_byte (int fd, uint8_t command, uint8_t value);
+int32_t xfer_write_word (int fd, uint8_t command, uint16_t value);
+int32_t xfer_command (int fd, uint8_t command);
+int32_t xfer_send_byte (int fd, uint8_t value);
+int xfer_read_regs (int fd,
+                    const xfer_reg_t *regs,
+                    size_t count,
+                    uint16_t *values);
+
+#endif // #ifndef _DS1077L_XFER_H_
@@ -1,10 +1,18 @@
 #include "ds1077l.h"
 #include "ds1077l-bus.h"
 #include "ds1077l-div.h"
+#include "ds1077l-metrics.h"
+#include "ds1077l-plan.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-sim.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-tracer.h"
 
 #include <argp.h>
 #include <linux/i2c-dev.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
 
 const struct argp_option common_options[] = {
@@ -25,6 +33,15 @@ const struct argp_option common_options[] = {
         .doc   = "Path to the i2c bus the oscillator is attached to.",
         .group = 0
     },
+    {
+        .name  = "mux",
+        .key   = OPT_MUX,
+        .arg   = "0x7[0-7]:[0-7]",
+        .flags = 0,
+        .doc   = "Address of the PCA954x i2c multiplexer the timer sits "
+                 "behind and the channel it's attached to.",
+        .group = 0
+    },
     {
         .name  = "verbose",
         .key   = 'v',
@@ -33,6 +50,181 @@ const struct argp_option common_options[] = {
         .doc   = "Produce verbose output.",
         .group = 0
     },
+    {
+        .name  = "format",
+        .key   = 'o',
+        .arg   = "human|json|kv|raw",
+        .flags = 0,
+        .doc   = "Format used to display register contents. Defaults to "
+                 "human.",
+        .group = 0
+    },
+    {
+        .name  = "metrics-dir",
+        .key   = OPT_METRICS_DIR,
+        .arg   = "DIR",
+        .flags = 0,
+        .doc   = "Directory to write Prometheus metrics for bus operations "
+                 "to. Defaults to $" METRICS_DIR_ENV ", disabled if unset.",
+        .group = 0
+    },
+    {
+        .name  = "trace",
+        .key   = OPT_TRACE,
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Record bus transactions in the trace ring buffer FILE. "
+                 "Defaults to $" TRACER_ENV ", disabled if unset.",
+        .group = 0
+    },
+    {
+        .name  = "record",
+        .key   = OPT_RECORD,
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Append all bus transactions to the capture FILE.",
+        .group = 0
+    },
+    {
+        .name  = "replay",
+        .key   = OPT_REPLAY,
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Answer bus transactions from the capture FILE instead of "
+                 "the bus.",
+        .group = 0
+    },
+    {
+        .name  = "replay-pacing",
+        .key   = OPT_PACING,
+        .arg   = "fast|recorded",
+        .flags = 0,
+        .doc   = "Replay as fast as possible or with the recorded timing. "
+                 "Defaults to fast.",
+        .group = 0
+    },
+    {
+        .name  = "rdwr",
+        .key   = OPT_RDWR,
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Address each message with I2C_RDWR instead of setting the "
+                 "slave address with I2C_SLAVE. With --sim the model answers "
+                 "the messages.",
+        .group = 0
+    },
+    {
+        .name  = "sim",
+        .key   = OPT_SIM,
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Talk to simulated devices kept in FILE instead of hardware. "
+                 "Defaults to $" SIM_ENV ".",
+        .group = 0
+    },
+    {
+        .name  = "sim-devices",
+        .key   = OPT_SIM_DEVICES,
+        .arg   = "ADAPTER[/MUX/CHANNEL]/ADDRESS[,...]",
+        .flags = 0,
+        .doc   = "Devices to populate a new --sim file with.",
+        .group = 0
+    },
+    {
+        .name  = "sim-faults",
+        .key   = OPT_SIM_FAULTS,
+        .arg   = "FAULT[@ADAPTER/ADDRESS][,...]",
+        .flags = 0,
+        .doc   = "Inject faults into --sim devices: nak=P, busy=US, "
+                 "spike=P:US, vanish=N, reset=P and seed=N. Defaults to $"
+                 SIM_FAULTS_ENV ".",
+        .group = 0
+    },
+    {
+        .name  = "locking",
+        .key   = OPT_LOCKING,
+        .arg   = "exclusive|optimistic|none",
+        .flags = 0,
+        .doc   = "How register updates are protected from other processes "
+                 "updating the same device. Defaults to exclusive.",
+        .group = 0
+    },
+    {
+        .name  = "lock-file",
+        .key   = OPT_LOCK_FILE,
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "File holding the device locks. Defaults to $" LOCK_FILE_ENV
+                 " or " LOCK_FILE_DEFAULT ".",
+        .group = 0
+    },
+    {
+        .name  = "retry",
+        .key   = OPT_RETRY,
+        .arg   = "ATTEMPTS[:BASE_US[:MAX_US]]",
+        .flags = 0,
+        .doc   = "Attempts made at transactions failing with transient "
+                 "errors and the exponential backoff between them. Defaults "
+                 "to 3:500:50000.",
+        .group = 0
+    },
+    {
+        .name  = "i2c-timeout",
+        .key   = OPT_I2C_TIMEOUT,
+        .arg   = "[ADAPTER=]MS",
+        .flags = 0,
+        .doc   = "Set the kernel's transfer timeout of all or just the given "
+                 "adapter. May be repeated.",
+        .group = 0
+    },
+    {
+        .name  = "i2c-retries",
+        .key   = OPT_I2C_RETRIES,
+        .arg   = "[ADAPTER=]COUNT",
+        .flags = 0,
+        .doc   = "Set the kernel's retry count on arbitration loss of all or "
+                 "just the given adapter. May be repeated.",
+        .group = 0
+    },
+    {
+        .name  = "wear-file",
+        .key   = OPT_WEAR_FILE,
+        .arg   = "FILE",
+        .flags = 0,
+        .doc   = "Count EEPROM writes per device in FILE. Defaults to $"
+                 WEAR_FILE_ENV ", disabled if unset.",
+        .group = 0
+    },
+    {
+        .name  = "write-behind",
+        .key   = OPT_WRITE_BEHIND,
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Keep devices in WC=1 and leave committing register changes "
+                 "to EEPROM to ds1077l-monitor --commit-after or "
+                 "ds1077l-writee2 --pending. Needs a wear file.",
+        .group = 0
+    },
+    {
+        .name  = "plan",
+        .key   = OPT_PLAN,
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Print the transactions that would be issued and estimate "
+                 "the time they keep the bus busy instead of touching "
+                 "hardware.",
+        .group = 0
+    },
+    {
+        .name  = "cache-ttl",
+        .key   = OPT_CACHE_TTL,
+        .arg   = "MS",
+        .flags = 0,
+        .doc   = "Answer register reads from what was last read or written "
+                 "within MS milliseconds. Defaults to 0, always reading the "
+                 "device.",
+        .group = 0
+    },
     {0}
 };
 
@@ -43,10 +235,34 @@ const struct argp common_argp = {
     "Comon arguments for utilities communicating with the Maxim DS1077L."
 };
 
+/* Only the utilities that stage their writes take --at, the others leave it
+ * to argp to reject.
+ */
+const struct argp_option at_options[] = {
+    {
+        .name  = "at",
+        .key   = OPT_AT,
+        .arg   = "[tai:|realtime:]SECONDS[.FRACTION]|+SECONDS",
+        .flags = 0,
+        .doc   = "Stage the change and issue the writes at this time, since "
+                 "the epoch of CLOCK_TAI or CLOCK_REALTIME or from now.",
+        .group = 0
+    },
+    {0}
+};
+
+const struct argp at_argp = {
+    at_options,
+    parse_at_opts,
+    NULL,
+    NULL
+};
+
 error_t
 parse_common_opts (int key, char *arg, struct argp_state *state)
 {
     ds1077l_common_args_t *args = state->input;
+    char *end = NULL;
 
     switch (key) {
     case 'a':
@@ -62,10 +278,163 @@ parse_common_opts (int key, char *arg, struct argp_state *state)
     case 'v':
         args->verbose = true;
         break;
+    case 'o':
+        if (format_parse (arg, &args->format))
+            argp_usage (state);
+        break;
+    case OPT_METRICS_DIR:
+        args->metrics_dir = arg;
+        break;
+    case OPT_TRACE:
+        args->trace = arg;
+        break;
+    case OPT_RECORD:
+        args->record = arg;
+        break;
+    case OPT_REPLAY:
+        args->replay = arg;
+        break;
+    case OPT_PACING:
+        if (replay_pacing_parse (arg, &args->pacing))
+            argp_usage (state);
+        break;
+    case OPT_RDWR:
+        args->rdwr = true;
+        break;
+    case OPT_SIM:
+        args->sim = arg;
+        break;
+    case OPT_SIM_DEVICES:
+        args->sim_devices = arg;
+        break;
+    case OPT_SIM_FAULTS:
+        args->sim_faults = arg;
+        break;
+    case OPT_LOCKING:
+        if (lock_mode_parse (arg, &args->locking))
+            argp_usage (state);
+        break;
+    case OPT_LOCK_FILE:
+        args->lock_file = arg;
+        break;
+    case OPT_RETRY:
+        if (retry_policy_parse (arg, &args->retry))
+            argp_usage (state);
+        break;
+    case OPT_I2C_TIMEOUT:
+    case OPT_I2C_RETRIES:
+        if (retry_adapter_parse (arg, key == OPT_I2C_TIMEOUT))
+            argp_usage (state);
+        break;
+    case OPT_WEAR_FILE:
+        args->wear_file = arg;
+        break;
+    case OPT_WRITE_BEHIND:
+        args->write_behind = true;
+        break;
+    case OPT_PLAN:
+        args->plan = true;
+        break;
+    case OPT_CACHE_TTL:
+        args->cache_ttl = strtoul (arg, &end, 10);
+        if (*arg == '\0' || *end != '\0')
+            argp_usage (state);
+        break;
+    case OPT_MUX:
+        if (topo_parse_mux (arg, &args->mux, &args->channel))
+            argp_usage (state);
+        break;
+    case ARGP_KEY_END:
+        if (args->replay != NULL && (args->rdwr || args->sim != NULL))
+            argp_error (state, "--replay can't be combined with --rdwr or "
+                               "--sim.");
+        if (args->rdwr)
+            xfer_transport_set (&xfer_rdwr);
+        if (args->plan && (args->sim != NULL || args->replay != NULL))
+            argp_error (state, "--plan can't be combined with --sim or "
+                               "--replay.");
+        if (args->write_behind && args->wear_file == NULL)
+            argp_error (state, "--write-behind needs a --wear-file.");
+        lock_init (args->lock_file, args->locking);
+        retry_init (&args->retry);
+        cache_init (args->cache_ttl);
+        if (args->verbose && atexit (dump_pool_stats))
+            argp_failure (state, 1, errno, "atexit");
+        if (args->metrics_dir != NULL && metrics_init (args->metrics_dir))
+            argp_failure (state, 1, errno, "metrics_init: %s",
+                          args->metrics_dir);
+        if (args->trace != NULL && tracer_init (args->trace))
+            argp_failure (state, 1, errno, "tracer_init: %s", args->trace);
+        if (args->record != NULL && record_init (args->record))
+            argp_failure (state, 1, errno, "record_init: %s", args->record);
+        if (args->replay != NULL &&
+            replay_init (args->replay, args->pacing))
+            argp_failure (state, 1, errno, "replay_init: %s", args->replay);
+        if (args->sim != NULL && sim_init (args->sim, args->sim_devices))
+            argp_failure (state, 1, errno, "sim_init: %s", args->sim);
+        /* messages built for I2C_RDWR, answered by the model */
+        if (args->sim != NULL && args->rdwr) {
+            xfer_transport_set (&xfer_rdwr);
+            pool_rdwr_set (&sim_rdwr);
+        }
+        if (args->sim != NULL && args->sim_faults != NULL &&
+            sim_faults_parse (args->sim_faults))
+            argp_failure (state, 1, errno, "sim_faults_parse: %s",
+                          args->sim_faults);
+        if (args->wear_file != NULL &&
+            wear_init (args->wear_file, args->write_behind))
+            argp_failure (state, 1, errno, "wear_init: %s", args->wear_file);
+        /* last so it replaces whatever transport was set up above */
+        if (args->plan && (plan_init (args->rdwr) || atexit (plan_report)))
+            argp_failure (state, 1, errno, "plan_init");
+        break;
     case ARGP_KEY_INIT:
         args->address = DS1077L_ADDR_DEFAULT;
         args->bus_dev = I2C_BUS_DEVICE;
+        args->mux = 0;
+        args->channel = 0;
         args->verbose = false;
+        args->format = FORMAT_HUMAN;
+        args->metrics_dir = getenv (METRICS_DIR_ENV);
+        args->trace = getenv (TRACER_ENV);
+        args->record = NULL;
+        args->replay = NULL;
+        args->pacing = REPLAY_FAST;
+        args->rdwr = false;
+        args->sim = getenv (SIM_ENV);
+        args->sim_devices = NULL;
+        args->sim_faults = getenv (SIM_FAULTS_ENV);
+        args->locking = LOCK_EXCLUSIVE;
+        args->lock_file = getenv (LOCK_FILE_ENV);
+        args->retry = (retry_policy_t) {
+            .attempts = RETRY_ATTEMPTS_DEFAULT,
+            .base_us  = RETRY_BASE_US_DEFAULT,
+            .max_us   = RETRY_MAX_US_DEFAULT,
+        };
+        args->wear_file = getenv (WEAR_FILE_ENV);
+        args->write_behind = false;
+        args->plan = false;
+        args->cache_ttl = 0;
+        args->scheduled = false;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Parse --at into the common arguments given as the child's input.
+ */
+error_t
+parse_at_opts (int key, char *arg, struct argp_state *state)
+{
+    ds1077l_common_args_t *args = state->input;
+
+    switch (key) {
+    case OPT_AT:
+        if (at_parse (arg, &args->at))
+            argp_failure (state, 1, errno, "--at %s", arg);
+        args->scheduled = true;
+        break;
     default:
         return ARGP_ERR_UNKNOWN;
     }
@@ -80,12 +449,114 @@ dump_common_opts (ds1077l_common_args_t* common_args)
     printf ("Common arguments:\n");
     printf ("  address: 0x%x\n", common_args->address);
     printf ("  bus-dev: %s\n", common_args->bus_dev);
+    if (common_args->mux != 0)
+        printf ("  mux:     0x%x:%d\n", common_args->mux, common_args->channel);
     printf ("  verbose: %s\n", common_args->verbose ? "true" : "false");
+    printf ("  format:  %s\n", format_name (common_args->format));
+    printf ("  metrics: %s\n", common_args->metrics_dir ?
+                                common_args->metrics_dir : "disabled");
+    printf ("  trace:   %s\n", common_args->trace ?
+                                common_args->trace : "disabled");
+    printf ("  record:  %s\n", common_args->record ?
+                                common_args->record : "disabled");
+    printf ("  replay:  %s\n", common_args->replay ?
+                                common_args->replay : "disabled");
+    printf ("  rdwr:    %s\n", common_args->rdwr ? "true" : "false");
+    printf ("  sim:     %s\n", common_args->sim ?
+                                common_args->sim : "disabled");
+    if (common_args->sim != NULL && common_args->sim_faults != NULL)
+        printf ("  faults:  %s\n", common_args->sim_faults);
+    printf ("  locking: %s\n", lock_mode_name (common_args->locking));
+    printf ("  retry:   %u:%u:%u\n", common_args->retry.attempts,
+            common_args->retry.base_us, common_args->retry.max_us);
+    printf ("  wear:    %s%s\n", common_args->wear_file ?
+                                 common_args->wear_file : "disabled",
+            common_args->write_behind ? ", write-behind" : "");
+    printf ("  plan:    %s\n", common_args->plan ? "true" : "false");
+    printf ("  cache:   %u ms\n", common_args->cache_ttl);
+    if (common_args->scheduled)
+        printf ("  at:      %lld.%09ld %s\n",
+                (long long)common_args->at.deadline.tv_sec,
+                common_args->at.deadline.tv_nsec,
+                at_clock_name (&common_args->at));
+}
+
+/* Report when the writes of a change scheduled with --at were issued and
+ * when they were done, against the deadline.
+ */
+void
+dump_at (ds1077l_common_args_t *common_args, const struct timespec *issued)
+{
+    struct timespec done = { 0 };
+
+    clock_gettime (common_args->at.clock, &done);
+    printf ("Issued at %lld.%09ld %s, %+lld ns from the deadline, done "
+            "%+lld ns.\n", (long long)issued->tv_sec, issued->tv_nsec,
+            at_clock_name (&common_args->at),
+            (long long)at_late_ns (&common_args->at, issued),
+            (long long)at_late_ns (&common_args->at, &done));
+}
+
+/* Display handle pool statistics, registered to run at exit in verbose mode.
+ */
+void
+dump_pool_stats (void)
+{
+    pool_stats_t stats = { 0 };
+    topo_stats_t topo = { 0 };
+    lock_stats_t lock = { 0 };
+    retry_stats_t retry = { 0 };
+    cache_stats_t cache = { 0 };
+    sim_fault_stats_t faults = { 0 };
+
+    pool_stats (&stats);
+    printf ("Handle pool:\n");
+    printf ("  hits:      %llu\n", (unsigned long long)stats.hits);
+    printf ("  misses:    %llu\n", (unsigned long long)stats.misses);
+    printf ("  evictions: %llu\n", (unsigned long long)stats.evictions);
+    topo_stats (&topo);
+    printf ("Mux channel selects:\n");
+    printf ("  written:   %llu\n", (unsigned long long)topo.selects);
+    printf ("  skipped:   %llu\n", (unsigned long long)topo.skipped);
+    lock_stats (&lock);
+    printf ("Device locks:\n");
+    printf ("  acquired:  %llu\n", (unsigned long long)lock.acquired);
+    printf ("  contended: %llu\n", (unsigned long long)lock.contended);
+    printf ("  waited:    %llu us\n", (unsigned long long)lock.wait_ns / 1000);
+    printf ("  conflicts: %llu\n", (unsigned long long)lock.conflicts);
+    printf ("  fallbacks: %llu\n", (unsigned long long)lock.fallbacks);
+    retry_stats (&retry);
+    printf ("Retries:\n");
+    printf ("  retries:   %llu\n", (unsigned long long)retry.retries);
+    printf ("  recovered: %llu\n", (unsigned long long)retry.recovered);
+    printf ("  exhausted: %llu\n", (unsigned long long)retry.exhausted);
+    printf ("  fatal:     %llu\n", (unsigned long long)retry.fatal);
+    printf ("  trips:     %llu\n", (unsigned long long)retry.trips);
+    printf ("  rejected:  %llu\n", (unsigned long long)retry.rejected);
+    sim_fault_stats (&faults);
+    if (faults.naks + faults.busy + faults.spikes + faults.vanished +
+        faults.resets != 0) {
+        printf ("Injected faults:\n");
+        printf ("  naks:      %llu\n", (unsigned long long)faults.naks);
+        printf ("  busy:      %llu\n", (unsigned long long)faults.busy);
+        printf ("  spikes:    %llu\n", (unsigned long long)faults.spikes);
+        printf ("  vanished:  %llu\n", (unsigned long long)faults.vanished);
+        printf ("  resets:    %llu\n", (unsigned long long)faults.resets);
+    }
+    if (!cache_on)
+        return;
+    cache_stats (&cache);
+    printf ("Register cache:\n");
+    printf ("  hits:      %llu\n", (unsigned long long)cache.hits);
+    printf ("  misses:    %llu\n", (unsigned long long)cache.misses);
+    printf ("  expired:   %llu\n", (unsigned long long)cache.expired);
+    printf ("  moves:     %llu\n", (unsigned long long)cache.moves);
 }
 
 /* Convenience function to get a file descriptor for an i2c bus. Set the device
    address (second parameter) to 0 and the default address for the DS1077L will
-   be used.
+   be used. Handles come from the handle pool so asking for the same device
+   twice doesn't open the adapter again.
  */
 int handle_get(char* dev_node, uint8_t dev_addr)
 {
@@ -97,10 +568,20 @@ int handle_get(char* dev_node, uint8_t dev_addr)
     else
         addr = DS1077L_ADDR_DEFAULT;
 
-    fd = open(dev_node, O_RDWR);
+    fd = pool_get(dev_node, 0, 0, addr);
     if (fd == -1)
         return -1;
-    if (ioctl(fd, I2C_SLAVE, addr))
-        return -1;
     return fd;
 }
+
+/* Get a file descriptor for the timer identified by the common arguments,
+ * including the mux channel it sits behind if any.
+ */
+int
+handle_get_common (ds1077l_common_args_t *common_args)
+{
+    return pool_get (common_args->bus_dev,
+                     common_args->mux,
+                     common_args->channel,
+                     common_args->address);
+}
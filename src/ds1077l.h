@@ -1,6 +1,15 @@
 #ifndef _DS1077L_H_
 #define _DS1077L_H_
 
+#include "ds1077l-at.h"
+#include "ds1077l-cache.h"
+#include "ds1077l-fmt.h"
+#include "ds1077l-lock.h"
+#include "ds1077l-record.h"
+#include "ds1077l-retry.h"
+#include "ds1077l-wear.h"
+#include "ds1077l-xfer.h"
+
 #include <argp.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -13,18 +22,71 @@
 /* stuff */
 #define I2C_BUS_DEVICE "/dev/i2c-1"
 
+/* Keys for common options that only have a long form. */
+#define OPT_METRICS_DIR 0x100
+#define OPT_TRACE       0x101
+#define OPT_RECORD      0x102
+#define OPT_REPLAY      0x103
+#define OPT_PACING      0x104
+#define OPT_RDWR        0x105
+#define OPT_MUX         0x106
+#define OPT_SIM         0x107
+#define OPT_SIM_DEVICES 0x108
+#define OPT_LOCKING     0x109
+#define OPT_LOCK_FILE   0x10a
+#define OPT_RETRY       0x10b
+#define OPT_I2C_TIMEOUT 0x10c
+#define OPT_I2C_RETRIES 0x10d
+#define OPT_WEAR_FILE   0x10e
+#define OPT_WRITE_BEHIND 0x10f
+#define OPT_PLAN        0x110
+#define OPT_CACHE_TTL   0x111
+#define OPT_SIM_FAULTS  0x112
+#define OPT_AT          0x113
+
 typedef struct ds1077l_common_args {
     uint16_t address;
     char *bus_dev;
+    uint8_t mux;
+    uint8_t channel;
     bool verbose;
+    ds1077l_format_t format;
+    char *metrics_dir;
+    char *trace;
+    char *record;
+    char *replay;
+    replay_pacing_t pacing;
+    bool rdwr;
+    char *sim;
+    char *sim_devices;
+    char *sim_faults;
+    lock_mode_t locking;
+    char *lock_file;
+    retry_policy_t retry;
+    char *wear_file;
+    bool write_behind;
+    bool plan;
+    unsigned cache_ttl;
+    at_t at;
+    bool scheduled;
 } ds1077l_common_args_t;
 
 /* If memory serves I'm not supposed to do this. */
 extern const struct argp common_argp;
 extern const struct argp_option common_options[];
+/* --at, a second child of the utilities that can schedule their writes,
+ * sharing their common arguments as input.
+ */
+extern const struct argp at_argp;
+extern const struct argp_option at_options[];
 
 int handle_get(char* dev, uint8_t addr);
+int handle_get_common (ds1077l_common_args_t *common_args);
 error_t parse_common_opts (int key, char *arg, struct argp_state *state);
+error_t parse_at_opts (int key, char *arg, struct argp_state *state);
 void dump_common_opts (ds1077l_common_args_t* common_args);
+void dump_at (ds1077l_common_args_t *common_args,
+              const struct timespec *issued);
+void dump_pool_stats (void);
 
 #endif // #ifndef _DS1077L_H_
@@ -0,0 +1,611 @@
+#ifndef _DS1077L_HPP_
+#define _DS1077L_HPP_
+
+extern "C" {
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-lock.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-xfer.h"
+}
+
+#include <cerrno>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+/* C++20 interface.
+ *
+ * The registers are value types built from the layouts in ds1077l-div.h,
+ * ds1077l-mux.h and ds1077l-bus.h. Values checked at compile time come from
+ * the templates, prescaler_of<4> (), div::of<1025> () or bus::of<0x5a> ();
+ * anything else doesn't compile. Values only known at run time go through
+ * div::checked and bus::checked, which return nothing when out of range.
+ * pack and unpack are constexpr and do the same masks and shifts as the
+ * macros, so a register costs what the macros cost.
+ *
+ * A device is a handle from the pool. Its registers are read and written
+ * in the calling thread with read, write and modify, the latter through
+ * lock_rmw, or from coroutines with the *_async awaitables. Like the
+ * provisioning tools, these give every adapter a thread of its own: a
+ * suspended coroutine is queued on its adapter's thread, which does the
+ * transfer and resumes the coroutine there. Transfers on one adapter run in
+ * the order they were awaited, different adapters don't wait on each other.
+ * The operation lives in the awaiting coroutine's frame and is linked into
+ * the queue as is, nothing is allocated per operation.
+ *
+ * Nothing throws; failures come back as errno values.
+ */
+namespace ds1077l {
+
+/* Output prescaler, the value is the 2 bit code stored in M0 and M1. */
+enum class prescaler : std::uint8_t { p1 = 0, p2 = 1, p4 = 2, p8 = 3 };
+
+constexpr unsigned
+divisor (prescaler p)
+{
+    return 1u << static_cast<unsigned> (p);
+}
+
+template <unsigned P>
+constexpr prescaler
+prescaler_of ()
+{
+    static_assert (P == 1 || P == 2 || P == 4 || P == 8,
+                   "prescaler must be 1, 2, 4 or 8");
+    return P == 1 ? prescaler::p1 : P == 2 ? prescaler::p2 :
+           P == 4 ? prescaler::p4 : prescaler::p8;
+}
+
+/* A register field of 'Width' bits starting at bit 'Shift' of the word. */
+template <unsigned Shift, unsigned Width = 1>
+struct field {
+    static constexpr std::uint16_t mask = ((1u << Width) - 1) << Shift;
+
+    static constexpr unsigned
+    get (std::uint16_t word)
+    {
+        return (word & mask) >> Shift;
+    }
+
+    static constexpr std::uint16_t
+    set (std::uint16_t word, unsigned value)
+    {
+        return (word & ~mask) | (value << Shift & mask);
+    }
+};
+
+/* DIV, the N divider of OUT1. See ds1077l-div.h for the layout: N - 2 with
+ * its top 8 bits in the first data byte and the bottom 2 in the second.
+ */
+class div {
+public:
+    using hi = field<0, 8>;
+    using lo = field<14, 2>;
+
+    static constexpr std::uint8_t command = COMMAND_DIV;
+    static constexpr int size = I2C_SMBUS_WORD_DATA;
+    static constexpr unsigned n_min = 2;
+    static constexpr unsigned n_max = 1025;
+
+    constexpr div () = default;
+
+    template <unsigned N>
+    static constexpr div
+    of ()
+    {
+        static_assert (N >= n_min && N <= n_max,
+                       "N must be between 2 and 1025");
+        return div (N);
+    }
+
+    static constexpr std::optional<div>
+    checked (unsigned n)
+    {
+        if (n < n_min || n > n_max)
+            return std::nullopt;
+        return div (n);
+    }
+
+    static constexpr div
+    unpack (std::uint16_t word)
+    {
+        return div ((hi::get (word) << 2 | lo::get (word)) + 2);
+    }
+
+    constexpr std::uint16_t
+    pack () const
+    {
+        return hi::set (0, (n_ - 2) >> 2) | lo::set (0, n_ - 2);
+    }
+
+    constexpr unsigned n () const { return n_; }
+
+    constexpr bool operator== (const div &) const = default;
+
+private:
+    constexpr explicit div (unsigned n) : n_ (n) {}
+
+    std::uint16_t n_ = DS1077L_N_DEFAULT;
+};
+
+/* MUX, the output configuration. See ds1077l-mux.h for the layout. The M1
+ * code is split across the two data bytes: 1M1 in bit 0, 1M0 in bit 15.
+ */
+class mux {
+public:
+    using pdn1_f = field<6>;
+    using pdn0_f = field<5>;
+    using sel0_f = field<4>;
+    using en0_f = field<3>;
+    using m0_f = field<1, 2>;
+    using m1_hi_f = field<0>;
+    using m1_lo_f = field<15>;
+    using div1_f = field<14>;
+
+    static constexpr std::uint8_t command = COMMAND_MUX;
+    static constexpr int size = I2C_SMBUS_WORD_DATA;
+
+    /* power on defaults */
+    constexpr mux () = default;
+
+    static constexpr mux
+    unpack (std::uint16_t word)
+    {
+        return mux (word & (pdn1_f::mask | pdn0_f::mask | sel0_f::mask |
+                            en0_f::mask | m0_f::mask | m1_hi_f::mask |
+                            m1_lo_f::mask | div1_f::mask));
+    }
+
+    constexpr std::uint16_t pack () const { return word_; }
+
+    constexpr bool pdn1 () const { return pdn1_f::get (word_); }
+    constexpr bool pdn0 () const { return pdn0_f::get (word_); }
+    constexpr bool sel0 () const { return sel0_f::get (word_); }
+    constexpr bool en0 () const { return en0_f::get (word_); }
+    constexpr bool div1 () const { return div1_f::get (word_); }
+
+    constexpr prescaler
+    m0 () const
+    {
+        return static_cast<prescaler> (m0_f::get (word_));
+    }
+
+    constexpr prescaler
+    m1 () const
+    {
+        return static_cast<prescaler> (m1_hi_f::get (word_) << 1 |
+                                       m1_lo_f::get (word_));
+    }
+
+    constexpr mux
+    with_pdn1 (bool v) const
+    {
+        return mux (pdn1_f::set (word_, v));
+    }
+
+    constexpr mux
+    with_pdn0 (bool v) const
+    {
+        return mux (pdn0_f::set (word_, v));
+    }
+
+    constexpr mux
+    with_sel0 (bool v) const
+    {
+        return mux (sel0_f::set (word_, v));
+    }
+
+    constexpr mux
+    with_en0 (bool v) const
+    {
+        return mux (en0_f::set (word_, v));
+    }
+
+    constexpr mux
+    with_div1 (bool v) const
+    {
+        return mux (div1_f::set (word_, v));
+    }
+
+    constexpr mux
+    with_m0 (prescaler p) const
+    {
+        return mux (m0_f::set (word_, static_cast<unsigned> (p)));
+    }
+
+    constexpr mux
+    with_m1 (prescaler p) const
+    {
+        unsigned code = static_cast<unsigned> (p);
+
+        return mux (m1_lo_f::set (m1_hi_f::set (word_, code >> 1), code));
+    }
+
+    constexpr bool operator== (const mux &) const = default;
+
+private:
+    constexpr explicit mux (std::uint16_t word) : word_ (word) {}
+
+    std::uint16_t word_ = sel0_f::set (0, DS1077L_SEL0_DEFAULT) |
+                          en0_f::set (0, DS1077L_EN0_DEFAULT);
+};
+
+/* BUS, the slave address and write control. See ds1077l-bus.h. The address
+ * is kept whole, 0x58 to 0x5f, only its bottom 3 bits are stored.
+ */
+class bus {
+public:
+    using address_f = field<0, 3>;
+    using wc_f = field<3>;
+
+    static constexpr std::uint8_t command = COMMAND_BUS;
+    static constexpr int size = I2C_SMBUS_BYTE_DATA;
+    static constexpr unsigned address_min = DS1077L_ADDR_DEFAULT;
+    static constexpr unsigned address_max = DS1077L_ADDR_DEFAULT | 0x07;
+
+    constexpr bus () = default;
+
+    template <unsigned Address, bool WC = DS1077L_WC_DEFAULT>
+    static constexpr bus
+    of ()
+    {
+        static_assert (Address >= address_min && Address <= address_max,
+                       "address must be between 0x58 and 0x5f");
+        return bus (address_f::set (0, Address) | wc_f::set (0, WC));
+    }
+
+    static constexpr std::optional<bus>
+    checked (unsigned address, bool wc = DS1077L_WC_DEFAULT)
+    {
+        if (address < address_min || address > address_max)
+            return std::nullopt;
+        return bus (address_f::set (0, address) | wc_f::set (0, wc));
+    }
+
+    static constexpr bus
+    unpack (std::uint16_t word)
+    {
+        return bus (word & (address_f::mask | wc_f::mask));
+    }
+
+    constexpr std::uint16_t pack () const { return word_; }
+
+    constexpr std::uint8_t
+    address () const
+    {
+        return address_f::get (word_) | DS1077L_ADDR_DEFAULT;
+    }
+
+    constexpr bool wc () const { return wc_f::get (word_); }
+
+    constexpr bus with_wc (bool v) const { return bus (wc_f::set (word_, v)); }
+
+    constexpr bool operator== (const bus &) const = default;
+
+private:
+    constexpr explicit bus (std::uint16_t word) : word_ (word) {}
+
+    std::uint16_t word_ = 0;
+};
+
+/* A register value or why there isn't one. */
+template <typename R>
+struct result {
+    R value;
+    int error;                  /* errno, 0 on success */
+
+    explicit constexpr operator bool () const { return error == 0; }
+};
+
+namespace detail {
+
+inline int32_t
+transfer (int fd, char read_write, std::uint8_t command, int size,
+          std::uint16_t value)
+{
+    if (read_write == I2C_SMBUS_READ)
+        return size == I2C_SMBUS_WORD_DATA ? xfer_read_word (fd, command) :
+                                             xfer_read_byte (fd, command);
+    return size == I2C_SMBUS_WORD_DATA ?
+           xfer_write_word (fd, command, value) :
+           xfer_write_byte (fd, command, value);
+}
+
+template <typename R, typename F>
+int
+rmw_update (std::uint16_t current, std::uint16_t *next, void *arg)
+{
+    R before = R::unpack (current);
+    R after = (*static_cast<F *> (arg)) (before);
+
+    *next = after.pack ();
+    return after == before ? 1 : 0;
+}
+
+/* A transfer queued on its adapter's thread, and the coroutine waiting for
+ * it. Lives in the coroutine frame of the awaiter.
+ */
+struct operation {
+    operation *next = nullptr;
+    std::coroutine_handle<> waiter;
+    int fd;
+    int error = 0;
+
+    explicit operation (int fd) : fd (fd) {}
+
+    virtual void run () = 0;
+
+protected:
+    ~operation () = default;
+};
+
+/* One thread per adapter running the queued operations in order. The
+ * thread is started with the first operation and stopped at exit.
+ */
+class adapter_thread {
+public:
+    ~adapter_thread ()
+    {
+        {
+            std::lock_guard<std::mutex> guard (lock_);
+            stop_ = true;
+        }
+        wake_.notify_one ();
+        if (thread_.joinable ())
+            thread_.join ();
+    }
+
+    void
+    post (operation *op)
+    {
+        {
+            std::lock_guard<std::mutex> guard (lock_);
+            if (!thread_.joinable ())
+                thread_ = std::thread ([this] { loop (); });
+            if (tail_ == nullptr)
+                head_ = op;
+            else
+                tail_->next = op;
+            tail_ = op;
+        }
+        wake_.notify_one ();
+    }
+
+private:
+    void
+    loop ()
+    {
+        std::unique_lock<std::mutex> guard (lock_);
+        operation *op = nullptr;
+
+        for (;;) {
+            wake_.wait (guard, [this] { return stop_ || head_ != nullptr; });
+            if (head_ == nullptr)
+                return;
+            op = head_;
+            head_ = op->next;
+            if (head_ == nullptr)
+                tail_ = nullptr;
+            guard.unlock ();
+            op->run ();
+            /* the frame holding 'op' may be gone after this */
+            op->waiter.resume ();
+            guard.lock ();
+        }
+    }
+
+    std::mutex lock_;
+    std::condition_variable wake_;
+    operation *head_ = nullptr;
+    operation *tail_ = nullptr;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+inline adapter_thread adapters[XFER_ADAPTERS_MAX];
+
+/* Queue 'op' on the thread of its adapter. Handles that aren't bound to one
+ * all share the first.
+ */
+inline void
+post (operation *op)
+{
+    const xfer_target_t *target = xfer_target (op->fd);
+
+    adapters[target == nullptr ? 0 : target->adapter].post (op);
+}
+
+/* Awaitable base: suspends, has 'run' done on the adapter thread and resumes
+ * there.
+ */
+struct awaitable : operation {
+    using operation::operation;
+
+    bool await_ready () const noexcept { return false; }
+
+    void
+    await_suspend (std::coroutine_handle<> h)
+    {
+        waiter = h;
+        post (this);
+    }
+};
+
+} // namespace detail
+
+template <typename R>
+class read_op : detail::awaitable {
+public:
+    explicit read_op (int fd) : awaitable (fd) {}
+
+    using awaitable::await_ready;
+    using awaitable::await_suspend;
+
+    result<R>
+    await_resume () const noexcept
+    {
+        return { R::unpack (word_), error };
+    }
+
+private:
+    void
+    run () override
+    {
+        int32_t ret = detail::transfer (fd, I2C_SMBUS_READ, R::command,
+                                        R::size, 0);
+
+        if (ret == -1)
+            error = errno;
+        else
+            word_ = ret;
+    }
+
+    std::uint16_t word_ = 0;
+};
+
+template <typename R>
+class write_op : detail::awaitable {
+public:
+    write_op (int fd, R value) : awaitable (fd), value_ (value) {}
+
+    using awaitable::await_ready;
+    using awaitable::await_suspend;
+
+    int await_resume () const noexcept { return error; }
+
+private:
+    void
+    run () override
+    {
+        if (detail::transfer (fd, I2C_SMBUS_WRITE, R::command, R::size,
+                              value_.pack ()) == -1)
+            error = errno;
+    }
+
+    R value_;
+};
+
+template <typename R, typename F>
+class modify_op : detail::awaitable {
+public:
+    modify_op (int fd, F update) : awaitable (fd), update_ (update) {}
+
+    using awaitable::await_ready;
+    using awaitable::await_suspend;
+
+    int await_resume () const noexcept { return error; }
+
+private:
+    void
+    run () override
+    {
+        if (lock_rmw (fd, R::command, R::size, detail::rmw_update<R, F>,
+                      &update_) == -1)
+            error = errno;
+    }
+
+    F update_;
+};
+
+/* A DS1077L, by its pooled handle. Cheap to copy, the pool owns the file
+ * descriptor and every copy holds it, so it's not evicted while one is
+ * around.
+ */
+class device {
+public:
+    static result<device>
+    open (const char *bus_dev, std::uint8_t address, std::uint8_t mux = 0,
+          std::uint8_t channel = 0)
+    {
+        int fd = pool_get (bus_dev, mux, channel, address);
+
+        return { device (fd), fd == -1 ? errno : 0 };
+    }
+
+    /* takes over a handle held with pool_get */
+    explicit device (int fd) : fd_ (fd) {}
+
+    device (const device &other) : fd_ (other.fd_) { pool_hold (fd_); }
+
+    device (device &&other) noexcept : fd_ (other.fd_) { other.fd_ = -1; }
+
+    device &
+    operator= (device other) noexcept
+    {
+        std::swap (fd_, other.fd_);
+        return *this;
+    }
+
+    ~device () { pool_put (fd_); }
+
+    int fd () const { return fd_; }
+
+    template <typename R>
+    result<R>
+    read () const
+    {
+        int32_t ret = detail::transfer (fd_, I2C_SMBUS_READ, R::command,
+                                        R::size, 0);
+
+        if (ret == -1)
+            return { R (), errno };
+        return { R::unpack (ret), 0 };
+    }
+
+    template <typename R>
+    int
+    write (R value) const
+    {
+        if (detail::transfer (fd_, I2C_SMBUS_WRITE, R::command, R::size,
+                              value.pack ()) == -1)
+            return errno;
+        return 0;
+    }
+
+    /* Read-modify-write in the current lock mode: 'update' maps the current
+     * value to the new one and is called again on conflicts.
+     */
+    template <typename R, typename F>
+    int
+    modify (F update) const
+    {
+        if (lock_rmw (fd_, R::command, R::size, detail::rmw_update<R, F>,
+                      &update) == -1)
+            return errno;
+        return 0;
+    }
+
+    template <typename R>
+    read_op<R>
+    read_async () const
+    {
+        return read_op<R> (fd_);
+    }
+
+    template <typename R>
+    write_op<R>
+    write_async (R value) const
+    {
+        return write_op<R> (fd_, value);
+    }
+
+    template <typename R, typename F>
+    modify_op<R, F>
+    modify_async (F update) const
+    {
+        return modify_op<R, F> (fd_, update);
+    }
+
+private:
+    int fd_;
+};
+
+} // namespace ds1077l
+
+#endif // #ifndef _DS1077L_HPP_
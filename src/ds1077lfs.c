@@ -0,0 +1,748 @@
+/* libfuse 3 API */
+#define FUSE_USE_VERSION 31
+
+#include "ds1077l.h"
+#include "ds1077l-bus.h"
+#include "ds1077l-div.h"
+#include "ds1077l-mux.h"
+#include "ds1077l-pool.h"
+#include "ds1077l-topo.h"
+#include "ds1077l-writee2.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* ds1077lfs: oscillators as files.
+ *
+ * Every device gets a directory named after its adapter, mux channel and
+ * address, e.g. i2c-1-0x58 or i2c-1-0x70-3-0x5a, holding one file per
+ * register field:
+ *
+ *   div/n                          divisor, 2 to 1025
+ *   mux/p0 mux/p1                  prescalers, 1, 2, 4 or 8
+ *   mux/en0 mux/sel0 mux/pdn0 mux/pdn1 mux/div1
+ *   bus/wc                         0 or 1
+ *   bus/address                    read only
+ *   freq/out0 freq/out1            output frequencies in Hz, read only
+ *   commit                         clean, dirty or unknown, see below
+ *
+ * Reads are answered from the register cache, so reading a handful of fields
+ * costs at most one transaction per register and TTL. Writes to fields are
+ * staged per register and applied when the file is closed, with one
+ * read-modify-write of each register they touch and nothing at all if the
+ * register already holds the value. Writing anything to 'commit' applies what
+ * is staged and copies the registers to EEPROM with E2_WRITE; reading it
+ * tells whether the EEPROM is known to match the registers.
+ *
+ * Requests are served one at a time as the bus serialises them anyway.
+ */
+#define FS_MASTER_HZ_DEFAULT 66666667   /* DS1077L-66 */
+#define FS_CACHE_TTL_DEFAULT 1000
+#define FS_NAME_LEN          48
+
+typedef enum fs_field_id {
+    FIELD_N,
+    FIELD_P0,
+    FIELD_P1,
+    FIELD_EN0,
+    FIELD_SEL0,
+    FIELD_PDN0,
+    FIELD_PDN1,
+    FIELD_DIV1,
+    FIELD_WC,
+    FIELD_ADDRESS,
+    FIELD_OUT0,
+    FIELD_OUT1,
+    FIELD_COMMIT,
+    FIELD_COUNT
+} fs_field_id_t;
+
+typedef struct fs_field {
+    const char *dir;            /* NULL for files in the device directory */
+    const char *name;
+    uint8_t command;            /* register holding the field, 0 for none */
+    uint16_t max;               /* largest value, 0 if read only */
+} fs_field_t;
+
+static const fs_field_t fields[FIELD_COUNT] = {
+    [FIELD_N]       = { "div",  "n",       COMMAND_DIV, 1025 },
+    [FIELD_P0]      = { "mux",  "p0",      COMMAND_MUX, 8 },
+    [FIELD_P1]      = { "mux",  "p1",      COMMAND_MUX, 8 },
+    [FIELD_EN0]     = { "mux",  "en0",     COMMAND_MUX, 1 },
+    [FIELD_SEL0]    = { "mux",  "sel0",    COMMAND_MUX, 1 },
+    [FIELD_PDN0]    = { "mux",  "pdn0",    COMMAND_MUX, 1 },
+    [FIELD_PDN1]    = { "mux",  "pdn1",    COMMAND_MUX, 1 },
+    [FIELD_DIV1]    = { "mux",  "div1",    COMMAND_MUX, 1 },
+    [FIELD_WC]      = { "bus",  "wc",      COMMAND_BUS, 1 },
+    [FIELD_ADDRESS] = { "bus",  "address", COMMAND_BUS, 0 },
+    [FIELD_OUT0]    = { "freq", "out0",    0,           0 },
+    [FIELD_OUT1]    = { "freq", "out1",    0,           0 },
+    [FIELD_COMMIT]  = { NULL,   "commit",  0,           1 },
+};
+
+static const char *dirs[] = { "div", "mux", "bus", "freq" };
+
+/* Changes to one register waiting for the file to be closed. */
+typedef struct fs_pending {
+    uint8_t command;
+    int size;
+    uint16_t mask;              /* bits to change */
+    uint16_t value;
+} fs_pending_t;
+
+typedef struct fs_device {
+    topo_target_t target;
+    char name[FS_NAME_LEN];
+    int fd;
+    fs_pending_t pending[3];
+} fs_device_t;
+
+typedef struct fs_args {
+    ds1077l_common_args_t common_args;
+    char *mountpoint;
+    char *fuse_opts;
+    bool foreground;
+    uint32_t master_hz;
+    topo_target_t *targets;
+    size_t count;
+} fs_args_t;
+
+typedef enum fs_node {
+    NODE_ROOT,
+    NODE_DEVICE,
+    NODE_DIR,
+    NODE_FILE
+} fs_node_t;
+
+static fs_device_t *devices = NULL;
+static size_t device_count = 0;
+static uint32_t master_hz = FS_MASTER_HZ_DEFAULT;
+
+static error_t parse_opts (int key, char *arg, struct argp_state *state);
+
+const struct argp_option options[] = {
+    {
+        .name  = "master-hz",
+        .key   = 'm',
+        .arg   = "HZ",
+        .flags = 0,
+        .doc   = "Master clock of the devices for the freq files. Defaults "
+                 "to 66666667 (DS1077L-66).",
+        .group = 1
+    },
+    {
+        .name  = "foreground",
+        .key   = 'f',
+        .arg   = 0,
+        .flags = 0,
+        .doc   = "Stay in the foreground.",
+        .group = 1
+    },
+    {
+        .name  = "options",
+        .key   = 'O',
+        .arg   = "OPTIONS",
+        .flags = 0,
+        .doc   = "Comma separated mount options passed on to FUSE, e.g. "
+                 "allow_other.",
+        .group = 1
+    },
+    { 0 }
+};
+
+const struct argp_child argp_children[] = {
+    {
+        .argp   = &common_argp,
+        .flags  = 0,
+        .header = NULL,
+        .group  = 0
+    },
+    { 0 }
+};
+
+const struct argp argps = {
+    .options     = options,
+    .parser      = parse_opts,
+    .args_doc    = "MOUNTPOINT [ADAPTER[/MUX/CHANNEL]/ADDRESS...]",
+    .doc         = "Mount Maxim DS1077L programmable oscillators as a "
+                   "filesystem with a directory per device and a file per "
+                   "register field. Without devices the one selected by the "
+                   "common options is mounted. Register reads are cached for "
+                   "--cache-ttl, 1000 ms unless given.",
+    .children    = argp_children,
+    .help_filter = NULL,
+    .argp_domain = NULL
+};
+
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    fs_args_t *args = state->input;
+    char *end = NULL;
+
+    switch (key) {
+        case 'm':
+            args->master_hz = strtoul (arg, &end, 10);
+            if (*end != '\0' || args->master_hz == 0)
+                argp_usage (state);
+            break;
+        case 'f':
+            args->foreground = true;
+            break;
+        case 'O':
+            args->fuse_opts = arg;
+            break;
+        case ARGP_KEY_ARG:
+            if (args->mountpoint == NULL) {
+                args->mountpoint = arg;
+                break;
+            }
+            if (args->count == XFER_TARGETS_MAX)
+                argp_failure (state, 1, E2BIG, "%s", arg);
+            if (topo_parse_target (arg, &args->targets[args->count]))
+                argp_failure (state, 1, EINVAL, "%s", arg);
+            ++args->count;
+            break;
+        case ARGP_KEY_END:
+            if (args->mountpoint == NULL)
+                argp_usage (state);
+            break;
+        case ARGP_KEY_INIT:
+            args->mountpoint = NULL;
+            args->fuse_opts = NULL;
+            args->foreground = false;
+            args->master_hz = FS_MASTER_HZ_DEFAULT;
+            state->child_inputs[0] = &(args->common_args);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Encode 'value' of field 'id' as register bits. */
+static uint16_t
+field_pack (fs_field_id_t id, unsigned value)
+{
+    switch (id) {
+    case FIELD_N:
+        return DIV_PACK (value);
+    case FIELD_P0:
+        return M0_PACK (value);
+    case FIELD_P1:
+        return M1_PACK (value);
+    case FIELD_EN0:
+        return EN0_PACK (value);
+    case FIELD_SEL0:
+        return SEL0_PACK (value);
+    case FIELD_PDN0:
+        return PDN0_PACK (value);
+    case FIELD_PDN1:
+        return PDN1_PACK (value);
+    case FIELD_DIV1:
+        return DIV1_PACK (value);
+    case FIELD_WC:
+        return WC_PACK (value);
+    default:
+        return 0;
+    }
+}
+
+static unsigned
+field_unpack (fs_field_id_t id, uint16_t reg)
+{
+    switch (id) {
+    case FIELD_N:
+        return DIV_UNPACK (reg);
+    case FIELD_P0:
+        return M0_UNPACK (reg);
+    case FIELD_P1:
+        return M1_UNPACK (reg);
+    case FIELD_EN0:
+        return EN0_UNPACK (reg);
+    case FIELD_SEL0:
+        return SEL0_UNPACK (reg);
+    case FIELD_PDN0:
+        return PDN0_UNPACK (reg);
+    case FIELD_PDN1:
+        return PDN1_UNPACK (reg);
+    case FIELD_DIV1:
+        return DIV1_UNPACK (reg);
+    case FIELD_WC:
+        return WC_UNPACK (reg);
+    case FIELD_ADDRESS:
+        return ADDRESS_UNPACK (reg);
+    default:
+        return 0;
+    }
+}
+
+static bool
+field_valid (fs_field_id_t id, unsigned long value)
+{
+    switch (id) {
+    case FIELD_N:
+        return value >= 2 && value <= 1025;
+    case FIELD_P0:
+    case FIELD_P1:
+        return value == 1 || value == 2 || value == 4 || value == 8;
+    default:
+        return value <= fields[id].max;
+    }
+}
+
+static fs_pending_t *
+pending_get (fs_device_t *device, uint8_t command)
+{
+    size_t i = 0;
+
+    for (i = 0; i < 3; ++i)
+        if (device->pending[i].command == command)
+            return &device->pending[i];
+    return NULL;
+}
+
+static const char *
+dir_find (const char *name)
+{
+    size_t i = 0;
+
+    for (i = 0; i < sizeof (dirs) / sizeof (dirs[0]); ++i)
+        if (strcmp (dirs[i], name) == 0)
+            return dirs[i];
+    return NULL;
+}
+
+static int
+field_find (const char *dir, const char *name, fs_field_id_t *field)
+{
+    size_t i = 0;
+
+    for (i = 0; i < FIELD_COUNT; ++i) {
+        if (strcmp (fields[i].name, name) != 0)
+            continue;
+        if (dir == NULL ? fields[i].dir != NULL :
+                          fields[i].dir == NULL || strcmp (fields[i].dir, dir))
+            continue;
+        *field = i;
+        return 0;
+    }
+    return -1;
+}
+
+/* Split 'path' into the device, directory and field it names. Returns the
+ * kind of node or -1 if there is no such thing.
+ */
+static int
+fs_lookup (const char *path,
+           fs_device_t **device,
+           const char **dir,
+           fs_field_id_t *field)
+{
+    char copy[3 * FS_NAME_LEN];
+    char *part[4] = { NULL };
+    char *save = NULL;
+    size_t depth = 0;
+    size_t i = 0;
+
+    if (strlen (path) >= sizeof (copy))
+        return -1;
+    strcpy (copy, path);
+    part[0] = strtok_r (copy, "/", &save);
+    while (part[depth] != NULL && depth < 3)
+        part[++depth] = strtok_r (NULL, "/", &save);
+    if (part[depth] != NULL)
+        return -1;
+    if (depth == 0)
+        return NODE_ROOT;
+    for (i = 0; i < device_count; ++i)
+        if (strcmp (devices[i].name, part[0]) == 0)
+            break;
+    if (i == device_count)
+        return -1;
+    *device = &devices[i];
+    if (depth == 1)
+        return NODE_DEVICE;
+    *dir = dir_find (part[1]);
+    if (depth == 2 && *dir != NULL)
+        return NODE_DIR;
+    if (depth == 2)
+        return field_find (NULL, part[1], field) ? -1 : NODE_FILE;
+    if (*dir == NULL)
+        return -1;
+    return field_find (*dir, part[2], field) ? -1 : NODE_FILE;
+}
+
+/* Apply what's staged for one register, see lock_rmw. */
+static int
+fs_update (uint16_t current, uint16_t *next, void *arg)
+{
+    fs_pending_t *pending = arg;
+
+    *next = (current & ~pending->mask) | pending->value;
+    return *next == current ? 1 : 0;
+}
+
+/* Write out everything staged for 'device'. Returns 0 or -errno. */
+static int
+fs_flush (fs_device_t *device)
+{
+    fs_pending_t *pending = NULL;
+    size_t i = 0;
+    int err = 0;
+
+    for (i = 0; i < 3; ++i) {
+        pending = &device->pending[i];
+        if (pending->mask == 0)
+            continue;
+        if (lock_rmw (device->fd, pending->command, pending->size, fs_update,
+                      pending) == -1)
+            err = errno;
+        pending->mask = 0;
+        pending->value = 0;
+    }
+    return err ? -err : 0;
+}
+
+static int32_t
+fs_read_reg (fs_device_t *device, uint8_t command)
+{
+    if (command == COMMAND_BUS)
+        return xfer_read_byte (device->fd, command);
+    return xfer_read_word (device->fd, command);
+}
+
+/* Format the contents of 'field' into 'buf'. Returns the length or -errno. */
+static int
+fs_format (fs_device_t *device, fs_field_id_t field, char *buf, size_t size)
+{
+    cache_entry_t entry = { 0 };
+    const char *state = "unknown";
+    int32_t div = 0;
+    int32_t mux = 0;
+    int32_t bus = 0;
+    uint32_t hz = 0;
+
+    if (fields[field].command != 0) {
+        div = fs_read_reg (device, fields[field].command);
+        if (div == -1)
+            return -errno;
+        if (field == FIELD_ADDRESS)
+            return snprintf (buf, size, "%#x\n", field_unpack (field, div));
+        return snprintf (buf, size, "%u\n", field_unpack (field, div));
+    }
+    if ((div = fs_read_reg (device, COMMAND_DIV)) == -1 ||
+        (mux = fs_read_reg (device, COMMAND_MUX)) == -1)
+        return -errno;
+    switch (field) {
+    case FIELD_OUT0:
+        hz = master_hz / M0_UNPACK (mux);
+        return snprintf (buf, size, "%u\n", hz);
+    case FIELD_OUT1:
+        hz = master_hz / M1_UNPACK (mux);
+        if (!DIV1_UNPACK (mux))
+            hz /= DIV_UNPACK (div);
+        return snprintf (buf, size, "%u\n", hz);
+    case FIELD_COMMIT:
+        if ((bus = fs_read_reg (device, COMMAND_BUS)) == -1)
+            return -errno;
+        /* the cache knows what went to EEPROM if it saw it go */
+        if (cache_get (device->fd, &entry) == 0 &&
+            entry.committed_valid == (CACHE_DIV | CACHE_MUX | CACHE_BUS))
+            state = entry.committed[0] == div && entry.committed[1] == mux &&
+                    entry.committed[2] == bus ? "clean" : "dirty";
+        return snprintf (buf, size, "%s\n", state);
+    default:
+        return -EINVAL;
+    }
+}
+
+static int
+fs_getattr (const char *path, struct stat *st, struct fuse_file_info *fi)
+{
+    fs_device_t *device = NULL;
+    const char *dir = NULL;
+    fs_field_id_t field = 0;
+
+    memset (st, 0, sizeof (*st));
+    switch (fs_lookup (path, &device, &dir, &field)) {
+    case NODE_ROOT:
+    case NODE_DEVICE:
+    case NODE_DIR:
+        st->st_mode = S_IFDIR | 0755;
+        st->st_nlink = 2;
+        return 0;
+    case NODE_FILE:
+        st->st_mode = S_IFREG | (fields[field].max ? 0644 : 0444);
+        st->st_nlink = 1;
+        /* contents are generated on read, see fs_open */
+        st->st_size = 0;
+        return 0;
+    default:
+        return -ENOENT;
+    }
+}
+
+static int
+fs_readdir (const char *path,
+            void *buf,
+            fuse_fill_dir_t filler,
+            off_t offset,
+            struct fuse_file_info *fi,
+            enum fuse_readdir_flags flags)
+{
+    fs_device_t *device = NULL;
+    const char *dir = NULL;
+    fs_field_id_t field = 0;
+    size_t i = 0;
+
+    switch (fs_lookup (path, &device, &dir, &field)) {
+    case NODE_ROOT:
+        filler (buf, ".", NULL, 0, 0);
+        filler (buf, "..", NULL, 0, 0);
+        for (i = 0; i < device_count; ++i)
+            filler (buf, devices[i].name, NULL, 0, 0);
+        return 0;
+    case NODE_DEVICE:
+        filler (buf, ".", NULL, 0, 0);
+        filler (buf, "..", NULL, 0, 0);
+        for (i = 0; i < sizeof (dirs) / sizeof (dirs[0]); ++i)
+            filler (buf, dirs[i], NULL, 0, 0);
+        for (i = 0; i < FIELD_COUNT; ++i)
+            if (fields[i].dir == NULL)
+                filler (buf, fields[i].name, NULL, 0, 0);
+        return 0;
+    case NODE_DIR:
+        filler (buf, ".", NULL, 0, 0);
+        filler (buf, "..", NULL, 0, 0);
+        for (i = 0; i < FIELD_COUNT; ++i)
+            if (fields[i].dir != NULL && strcmp (fields[i].dir, dir) == 0)
+                filler (buf, fields[i].name, NULL, 0, 0);
+        return 0;
+    case NODE_FILE:
+        return -ENOTDIR;
+    default:
+        return -ENOENT;
+    }
+}
+
+static int
+fs_open (const char *path, struct fuse_file_info *fi)
+{
+    fs_device_t *device = NULL;
+    const char *dir = NULL;
+    fs_field_id_t field = 0;
+
+    if (fs_lookup (path, &device, &dir, &field) != NODE_FILE)
+        return -ENOENT;
+    if ((fi->flags & O_ACCMODE) != O_RDONLY && fields[field].max == 0)
+        return -EACCES;
+    /* bypass the page cache, the size is unknown until read */
+    fi->direct_io = 1;
+    return 0;
+}
+
+static int
+fs_read (const char *path,
+         char *buf,
+         size_t size,
+         off_t offset,
+         struct fuse_file_info *fi)
+{
+    fs_device_t *device = NULL;
+    const char *dir = NULL;
+    fs_field_id_t field = 0;
+    char text[32];
+    int len = 0;
+
+    if (fs_lookup (path, &device, &dir, &field) != NODE_FILE)
+        return -ENOENT;
+    len = fs_format (device, field, text, sizeof (text));
+    if (len < 0)
+        return len;
+    if (offset >= len)
+        return 0;
+    if (size > (size_t)(len - offset))
+        size = len - offset;
+    memcpy (buf, text + offset, size);
+    return size;
+}
+
+static int
+fs_write (const char *path,
+          const char *buf,
+          size_t size,
+          off_t offset,
+          struct fuse_file_info *fi)
+{
+    fs_device_t *device = NULL;
+    fs_pending_t *pending = NULL;
+    const char *dir = NULL;
+    fs_field_id_t field = 0;
+    unsigned long value = 0;
+    uint16_t mask = 0;
+    char text[32];
+    char *end = NULL;
+    int ret = 0;
+
+    if (fs_lookup (path, &device, &dir, &field) != NODE_FILE)
+        return -ENOENT;
+    if (field == FIELD_COMMIT) {
+        ret = fs_flush (device);
+        if (ret)
+            return ret;
+        if (xfer_command (device->fd, COMMAND_E2_WRITE) == -1)
+            return -errno;
+        return size;
+    }
+    if (size == 0 || size >= sizeof (text))
+        return -EINVAL;
+    memcpy (text, buf, size);
+    text[size] = '\0';
+    value = strtoul (text, &end, 0);
+    if (end == text || (*end != '\0' && strcmp (end, "\n") != 0) ||
+        !field_valid (field, value))
+        return -EINVAL;
+    pending = pending_get (device, fields[field].command);
+    mask = field_pack (field, fields[field].max);
+    pending->mask |= mask;
+    pending->value = (pending->value & ~mask) | field_pack (field, value);
+    return size;
+}
+
+static int
+fs_truncate (const char *path, off_t size, struct fuse_file_info *fi)
+{
+    fs_device_t *device = NULL;
+    const char *dir = NULL;
+    fs_field_id_t field = 0;
+
+    /* accept O_TRUNC from the shell's redirections, there's nothing to cut */
+    if (fs_lookup (path, &device, &dir, &field) != NODE_FILE)
+        return -ENOENT;
+    return fields[field].max ? 0 : -EACCES;
+}
+
+static int
+fs_flush_file (const char *path, struct fuse_file_info *fi)
+{
+    fs_device_t *device = NULL;
+    const char *dir = NULL;
+    fs_field_id_t field = 0;
+
+    if (fs_lookup (path, &device, &dir, &field) != NODE_FILE)
+        return -ENOENT;
+    return fs_flush (device);
+}
+
+static const struct fuse_operations fs_operations = {
+    .getattr  = fs_getattr,
+    .readdir  = fs_readdir,
+    .open     = fs_open,
+    .read     = fs_read,
+    .write    = fs_write,
+    .truncate = fs_truncate,
+    .flush    = fs_flush_file,
+};
+
+/* Name the directory of 'target', e.g. i2c-1-0x70-3-0x5a. */
+static void
+device_name (const topo_target_t *target, char *name, size_t size)
+{
+    const char *adapter = strrchr (target->bus_dev, '/');
+
+    adapter = adapter == NULL ? target->bus_dev : adapter + 1;
+    if (target->mux != 0)
+        snprintf (name, size, "%.31s-%#x-%d-%#x", adapter, target->mux,
+                  target->channel, target->address);
+    else
+        snprintf (name, size, "%.31s-%#x", adapter, target->address);
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct fuse_args fuse_args = FUSE_ARGS_INIT (0, NULL);
+    topo_target_t targets[XFER_TARGETS_MAX];
+    fs_args_t fs_args = { .targets = targets };
+    fs_device_t *device = NULL;
+    struct fuse *fuse = NULL;
+    size_t i = 0;
+    int ret = 0;
+
+    argp_parse (&argps, argc, argv, 0, 0, &fs_args);
+    if (fs_args.common_args.verbose)
+        dump_common_opts (&fs_args.common_args);
+    if (!cache_on)
+        cache_init (FS_CACHE_TTL_DEFAULT);
+    master_hz = fs_args.master_hz;
+    if (fs_args.count == 0) {
+        snprintf (targets[0].bus_dev, sizeof (targets[0].bus_dev), "%s",
+                  fs_args.common_args.bus_dev);
+        targets[0].mux = fs_args.common_args.mux;
+        targets[0].channel = fs_args.common_args.channel;
+        targets[0].address = fs_args.common_args.address;
+        fs_args.count = 1;
+    }
+
+    devices = calloc (fs_args.count, sizeof (*devices));
+    if (devices == NULL) {
+        perror ("calloc");
+        exit (1);
+    }
+    for (i = 0; i < fs_args.count; ++i) {
+        device = &devices[i];
+        device->target = targets[i];
+        device_name (&targets[i], device->name, sizeof (device->name));
+        device->fd = pool_get (targets[i].bus_dev, targets[i].mux,
+                               targets[i].channel, targets[i].address);
+        if (device->fd == -1) {
+            perror (device->name);
+            exit (1);
+        }
+        device->pending[0].command = COMMAND_DIV;
+        device->pending[0].size = I2C_SMBUS_WORD_DATA;
+        device->pending[1].command = COMMAND_MUX;
+        device->pending[1].size = I2C_SMBUS_WORD_DATA;
+        device->pending[2].command = COMMAND_BUS;
+        device->pending[2].size = I2C_SMBUS_BYTE_DATA;
+    }
+    device_count = fs_args.count;
+
+    if (fuse_opt_add_arg (&fuse_args, argv[0]) ||
+        (fs_args.fuse_opts != NULL &&
+         (fuse_opt_add_arg (&fuse_args, "-o") ||
+          fuse_opt_add_arg (&fuse_args, fs_args.fuse_opts)))) {
+        fprintf (stderr, "fuse_opt_add_arg: out of memory\n");
+        exit (1);
+    }
+    fuse = fuse_new (&fuse_args, &fs_operations, sizeof (fs_operations),
+                     NULL);
+    if (fuse == NULL)
+        exit (1);
+    if (fuse_mount (fuse, fs_args.mountpoint)) {
+        fuse_destroy (fuse);
+        exit (1);
+    }
+    if (fuse_daemonize (fs_args.foreground) ||
+        fuse_set_signal_handlers (fuse_get_session (fuse))) {
+        fuse_unmount (fuse);
+        fuse_destroy (fuse);
+        exit (1);
+    }
+    ret = fuse_loop (fuse);
+    fuse_remove_signal_handlers (fuse_get_session (fuse));
+    fuse_unmount (fuse);
+    fuse_destroy (fuse);
+    fuse_opt_free_args (&fuse_args);
+    for (i = 0; i < device_count; ++i)
+        fs_flush (&devices[i]);
+    free (devices);
+    exit (ret ? 1 : 0);
+}
@@ -0,0 +1,62 @@
+#include "../src/ds1077l-addrplan.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static addrplan_device_t devices[ADDRPLAN_DEVICES_MAX];
+static addrplan_step_t steps[ADDRPLAN_STEPS_MAX];
+
+static void
+plan_print (size_t count, addrplan_scope_t scope)
+{
+    size_t step_count = 0;
+    size_t i = 0;
+
+    if (addrplan_make (devices, count, scope, steps, &step_count)) {
+        printf ("%s\n", strerror (errno));
+        return;
+    }
+    for (i = 0; i < step_count; ++i)
+        printf ("%s%d:%#x>%#x%s", i ? " " : "",
+                devices[steps[i].device].target.channel, steps[i].from,
+                steps[i].to, steps[i].commit ? "" : "*");
+    printf ("\n");
+}
+
+int main(void)
+{
+    /* fresh devices on three channels made unique across the adapter */
+    addrplan_parse ("i2c-1/0x70/2/0x58", &devices[0]);
+    addrplan_parse ("i2c-1/0x70/0/0x58", &devices[1]);
+    addrplan_parse ("i2c-1/0x70/1/0x58", &devices[2]);
+    printf ("expect: 1:0x58>0x59 2:0x58>0x5a\n");
+    plan_print (3, SCOPE_ADAPTER);
+    /* per segment nothing has to move */
+    addrplan_parse ("i2c-1/0x70/2/0x58", &devices[0]);
+    addrplan_parse ("i2c-1/0x70/0/0x58", &devices[1]);
+    addrplan_parse ("i2c-1/0x70/1/0x58", &devices[2]);
+    printf ("expect: \n");
+    plan_print (3, SCOPE_SEGMENT);
+    /* a swap is broken up through a spare address, committed once each */
+    addrplan_parse ("i2c-1/0x58=0x59", &devices[0]);
+    addrplan_parse ("i2c-1/0x59=0x58", &devices[1]);
+    printf ("expect: 0:0x58>0x5a* 0:0x59>0x58 0:0x5a>0x59\n");
+    plan_print (2, SCOPE_SEGMENT);
+    /* moves wait for the address they need to be vacated */
+    addrplan_parse ("i2c-1/0x58=0x59", &devices[0]);
+    addrplan_parse ("i2c-1/0x59=0x5a", &devices[1]);
+    printf ("expect: 0:0x59>0x5a 0:0x58>0x59\n");
+    plan_print (2, SCOPE_SEGMENT);
+    /* bare adapter devices are visible from every channel */
+    addrplan_parse ("i2c-1/0x58", &devices[0]);
+    addrplan_parse ("i2c-1/0x70/3/0x58", &devices[1]);
+    printf ("expect: %s\n", strerror (ENOTUNIQ));
+    plan_print (2, SCOPE_SEGMENT);
+    addrplan_parse ("i2c-1/0x58=0x5a", &devices[0]);
+    addrplan_parse ("i2c-1/0x59=0x5a", &devices[1]);
+    printf ("expect: %s\n", strerror (EADDRINUSE));
+    plan_print (2, SCOPE_SEGMENT);
+    exit (0);
+}
@@ -0,0 +1,146 @@
+#include "../src/ds1077l.h"
+#include "../src/ds1077l-at.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-lock.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-preset.h"
+#include "../src/ds1077l-sim.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Hand the common arguments to every child, like the utilities do.
+ */
+static error_t
+parse_opts (int key, char *arg, struct argp_state *state)
+{
+    size_t i = 0;
+
+    if (key != ARGP_KEY_INIT)
+        return ARGP_ERR_UNKNOWN;
+    for (i = 0; state->root_argp->children[i].argp != NULL; i++)
+        state->child_inputs[i] = state->input;
+    return 0;
+}
+
+/* Parse "--at +1" for a utility with the given children, returning what
+ * argp_parse did and setting 'scheduled' from the common arguments.
+ */
+static int
+parse_at (const struct argp_child *children, bool *scheduled)
+{
+    char *argv[] = { "ds1077l-at_test", "--at", "+1", NULL };
+    struct argp argp = {
+        .parser   = parse_opts,
+        .children = children,
+    };
+    ds1077l_common_args_t common_args = { 0 };
+    int ret = argp_parse (&argp, 3, argv, ARGP_SILENT, NULL, &common_args);
+
+    *scheduled = common_args.scheduled;
+    return ret;
+}
+
+int main(void)
+{
+    /* like ds1077l-writee2, and like the set commands */
+    const struct argp_child plain[] = {
+        { .argp = &common_argp },
+        { 0 }
+    };
+    const struct argp_child staging[] = {
+        { .argp = &common_argp },
+        { .argp = &at_argp },
+        { 0 }
+    };
+    bool scheduled = false;
+    char sim_path[] = "/tmp/ds1077l-at_test.sim.XXXXXX";
+    topo_target_t target = { .bus_dev = "/dev/i2c-1", .address = 0x58 };
+    transition_band_t band = { .master_hz = 66666667 };
+    preset_staged_t staged = { 0 };
+    preset_t preset = { 0 };
+    struct timespec now = { 0 };
+    struct timespec issued = { 0 };
+    at_t at = { 0 };
+    int64_t late = 0;
+    int ret = 0;
+    int fd = 0;
+
+    ret = at_parse ("1700000000.25", &at);
+    printf ("expect: 0 realtime 1700000000 250000000\n");
+    printf ("%d %s %lld %ld\n", ret, at_clock_name (&at),
+            (long long)at.deadline.tv_sec, at.deadline.tv_nsec);
+    ret = at_parse ("tai:12.0000000015", &at);
+    printf ("expect: 0 tai 12 1\n");
+    printf ("%d %s %lld %ld\n", ret, at_clock_name (&at),
+            (long long)at.deadline.tv_sec, at.deadline.tv_nsec);
+    printf ("expect: %d %d %d\n", EINVAL, EINVAL, EINVAL);
+    at_parse ("utc:12", &at);
+    printf ("%d", errno);
+    at_parse ("12s", &at);
+    printf (" %d", errno);
+    at_parse ("+", &at);
+    printf (" %d\n", errno);
+
+    /* late is refused, on time is no sooner than asked */
+    at_parse ("realtime:1", &at);
+    printf ("expect: -1 %d\n", ETIME);
+    ret = at_wait (&at, &issued);
+    printf ("%d %d\n", ret, errno);
+    at_parse ("+0.02", &at);
+    ret = at_wait (&at, &issued);
+    late = at_late_ns (&at, &issued);
+    printf ("expect: 0 1\n");
+    printf ("%d %d\n", ret, late >= 0 && late < 10000000);
+    clock_gettime (CLOCK_TAI, &now);
+    at_parse ("tai:+0.001", &at);
+    ret = at_wait (&at, &issued);
+    printf ("expect: 0 1\n");
+    printf ("%d %d\n", ret, issued.tv_sec * 1000000000ll + issued.tv_nsec -
+            now.tv_sec * 1000000000ll - now.tv_nsec >= 1000000);
+
+    /* staging writes nothing, firing does */
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58")) {
+        perror ("init");
+        exit (1);
+    }
+    lock_init ("/dev/null", LOCK_NONE);
+    fd = pool_get (target.bus_dev, 0, 0, target.address);
+    preset_parse ("fast n=50 m1=2", &preset);
+    ret = preset_stage (&preset, &target, NULL, &staged);
+    printf ("expect: 0 2 2 1\n");
+    printf ("%d %zu %d", ret, staged.transition.count,
+            DIV_UNPACK (xfer_read_word (fd, COMMAND_DIV)));
+    ret = preset_fire (&staged);
+    printf (" %d\n", ret == 0 && DIV_UNPACK (xfer_read_word (fd, COMMAND_DIV))
+                     == 50);
+
+    /* with a band the plan is made from the device as staged */
+    band.min_hz = 100000;
+    band.max_hz = 700000;
+    preset_parse ("slow n=200 m1=2", &preset);
+    ret = preset_stage (&preset, &target, &band, &staged);
+    printf ("expect: 0 1 1\n");
+    printf ("%d %zu", ret, staged.transition.count);
+    preset_cancel (&staged);
+    printf (" %d\n", DIV_UNPACK (xfer_read_word (fd, COMMAND_DIV)) == 50);
+    band.max_hz = 150000;
+    ret = preset_stage (&preset, &target, &band, &staged) ? errno : 0;
+    printf ("expect: %d\n", ERANGE);
+    printf ("%d\n", ret);
+
+    /* only utilities that stage their writes take --at */
+    ret = parse_at (plain, &scheduled);
+    printf ("expect: %d 0\n", EINVAL);
+    printf ("%d %d\n", ret, scheduled);
+    ret = parse_at (staging, &scheduled);
+    printf ("expect: 0 1\n");
+    printf ("%d %d\n", ret, scheduled);
+    unlink (sim_path);
+    exit (0);
+}
@@ -0,0 +1,97 @@
+#include "../src/ds1077l-bulk.h"
+#include "../src/ds1077l-bus.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-writee2.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define OPS 6
+
+int main(void)
+{
+    char sim_path[] = "/tmp/ds1077l-bulk_test.sim.XXXXXX";
+    static uint16_t many_adapters[1024];
+    static uint8_t many_addresses[1024];
+    static uint8_t many_commands[1024];
+    static uint16_t many_words[1024];
+    static int many_errs[1024];
+    uint16_t adapters[OPS] = { 1, 2, 1, 1, 3, 2 };
+    uint8_t addresses[OPS] = { 0x58, 0x58, 0x59, 0x59, 0x58, 0x58 };
+    uint8_t commands[OPS] = {
+        COMMAND_DIV, COMMAND_MUX, COMMAND_BUS, COMMAND_E2_WRITE, COMMAND_DIV,
+        0x05
+    };
+    uint16_t words[OPS] = {
+        DIV_PACK (100), M1_PACK (4) | SEL0_PACK (true),
+        ADDRESS_PACK (0x59) | WC_PACK (true), 0, DIV_PACK (3), 0
+    };
+    int errs[OPS];
+    pool_stats_t before = { 0 };
+    pool_stats_t after = { 0 };
+    size_t i = 0;
+    int ret = 0;
+    int fd = 0;
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58,i2c-1/0x59,i2c-2/0x58")) {
+        perror ("init");
+        exit (1);
+    }
+
+    /* every operation has its own status, the others go on */
+    ret = bulk_write (OPS, adapters, addresses, commands, words, errs);
+    printf ("expect: 2 0 0 0 0 1 %d\n", EINVAL);
+    printf ("%d", ret);
+    for (i = 0; i < OPS; ++i)
+        printf (" %d", i == 4 ? errs[i] != 0 : errs[i]);
+    printf ("\n");
+
+    /* and read back, E2_WRITE can't be */
+    for (i = 0; i < OPS; ++i)
+        words[i] = 0;
+    ret = bulk_read (OPS, adapters, addresses, commands, words, errs);
+    printf ("expect: 3 100 4 1 %d\n", EINVAL);
+    printf ("%d %d %d %d %d\n", ret, DIV_UNPACK (words[0]),
+            M1_UNPACK (words[1]), WC_UNPACK (words[2]), errs[3]);
+
+    /* a write and a read of the same register on one adapter stay in order,
+     * however many operations the other adapters have
+     */
+    for (i = 0; i < 1024; ++i) {
+        many_adapters[i] = i % 2 ? 1 : 2;
+        many_addresses[i] = 0x58;
+        many_commands[i] = COMMAND_DIV;
+        many_words[i] = DIV_PACK (2 + i);
+    }
+    pool_stats (&before);
+    ret = bulk_write (1024, many_adapters, many_addresses, many_commands,
+                      many_words, many_errs);
+    pool_stats (&after);
+    printf ("expect: 0 1025 1024\n");
+    printf ("%d", ret);
+    ret = bulk_read (2, many_adapters, many_addresses, many_commands,
+                     many_words, many_errs);
+    printf (" %d %d\n", DIV_UNPACK (many_words[1]),
+            DIV_UNPACK (many_words[0]));
+    /* each device's handle is taken from the pool once per job */
+    printf ("expect: 2\n");
+    printf ("%llu\n", (unsigned long long)(after.hits + after.misses -
+                                           before.hits - before.misses));
+
+    /* at most one thread per adapter */
+    for (i = 0; i < XFER_ADAPTERS_MAX + 1; ++i)
+        many_adapters[i] = i;
+    errno = 0;
+    ret = bulk_read (XFER_ADAPTERS_MAX + 1, many_adapters, many_addresses,
+                     many_commands, many_words, many_errs);
+    printf ("expect: -1 %d\n", E2BIG);
+    printf ("%d %d\n", ret, errno);
+    unlink (sim_path);
+    exit (0);
+}
@@ -0,0 +1,134 @@
+#include "../src/ds1077l-bus.h"
+#include "../src/ds1077l-cache.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-writee2.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static char sim_path[] = "/tmp/ds1077l-cache_test.sim.XXXXXX";
+
+/* The simulated device at 'address', straight from the file. */
+static sim_device_t *
+sim_get (uint8_t address)
+{
+    static sim_file_t sim;
+    uint32_t i = 0;
+    int fd = 0;
+
+    fd = open (sim_path, O_RDONLY);
+    if (fd == -1 || read (fd, &sim, sizeof (sim)) != sizeof (sim))
+        exit (1);
+    close (fd);
+    for (i = 0; i < sim.count; ++i)
+        if (sim.devices[i].kind == SIM_DS1077L &&
+            sim.devices[i].address == address)
+            return &sim.devices[i];
+    return NULL;
+}
+
+/* Print the committed DIV and BUS the cache thinks the EEPROM holds, and
+ * what the simulated EEPROM holds.
+ */
+static void
+committed_print (int fd, uint8_t address)
+{
+    cache_entry_t entry = { 0 };
+    sim_device_t *device = sim_get (address);
+
+    if (cache_get (fd, &entry)) {
+        printf ("none\n");
+        return;
+    }
+    printf ("%#x", entry.committed_valid);
+    if (entry.committed_valid & CACHE_DIV)
+        printf (" %d", DIV_UNPACK (entry.committed[0]));
+    if (entry.committed_valid & CACHE_BUS)
+        printf (" %#x", entry.committed[2]);
+    printf (" / %d %#x\n", DIV_UNPACK (device->e2_div), device->e2_bus);
+}
+
+int main(void)
+{
+    cache_stats_t stats = { 0 };
+    int32_t div = 0;
+    int fd = 0;
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58")) {
+        perror ("init");
+        exit (1);
+    }
+    cache_init (1000);
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x58);
+
+    /* the second read is served from the cache, writes go through */
+    xfer_read_word (fd, COMMAND_DIV);
+    xfer_read_word (fd, COMMAND_DIV);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (10));
+    div = xfer_read_word (fd, COMMAND_DIV);
+    cache_stats (&stats);
+    printf ("expect: 10 10 2 1\n");
+    printf ("%d %d %llu %llu\n", DIV_UNPACK (div),
+            DIV_UNPACK (sim_get (0x58)->div),
+            (unsigned long long)stats.hits,
+            (unsigned long long)stats.misses);
+
+    /* WC unknown, so is the EEPROM; once BUS is known with WC clear every
+     * write is committed
+     */
+    printf ("expect: 0 / 10 0\n");
+    committed_print (fd, 0x58);
+    xfer_read_byte (fd, COMMAND_BUS);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (20));
+    printf ("expect: 0x1 20 / 20 0\n");
+    committed_print (fd, 0x58);
+
+    /* with WC set only E2_WRITE commits, and it commits everything */
+    xfer_write_byte (fd, COMMAND_BUS, WC_PACK (true));
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (30));
+    printf ("expect: 0x1 20 / 20 0\n");
+    committed_print (fd, 0x58);
+    xfer_command (fd, COMMAND_E2_WRITE);
+    printf ("expect: 0x5 30 0x8 / 30 0x8\n");
+    committed_print (fd, 0x58);
+
+    /* clearing WC commits with the BUS write, a new address moves the
+     * entry
+     */
+    xfer_write_byte (fd, COMMAND_BUS, ADDRESS_PACK (0x5a));
+    printf ("expect: none\n");
+    committed_print (fd, 0x58);
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x5a);
+    div = xfer_read_word (fd, COMMAND_DIV);
+    cache_stats (&stats);
+    printf ("expect: 0x5 30 0x2 / 30 0x2\n");
+    committed_print (fd, 0x5a);
+    printf ("expect: 30 3 1\n");
+    printf ("%d %llu %llu\n", DIV_UNPACK (div),
+            (unsigned long long)stats.hits,
+            (unsigned long long)stats.moves);
+
+    /* expired registers, by hand or by age, are read from the device */
+    cache_expire (fd, COMMAND_DIV);
+    xfer_read_word (fd, COMMAND_DIV);
+    cache_init (1);
+    usleep (2000);
+    xfer_read_word (fd, COMMAND_DIV);
+    cache_stats (&stats);
+    printf ("expect: 3 1\n");
+    printf ("%llu %llu\n", (unsigned long long)stats.hits,
+            (unsigned long long)stats.expired);
+
+    /* forgetting the device drops what we knew about the EEPROM too */
+    cache_invalidate (fd);
+    printf ("expect: 0 / 30 0x2\n");
+    committed_print (fd, 0x5a);
+    unlink (sim_path);
+    exit (0);
+}
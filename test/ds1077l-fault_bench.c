@@ -0,0 +1,211 @@
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-retry.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How the retry, breaker and pool paths hold up against a misbehaving bus.
+ * Every scenario runs one thread per adapter for a fixed time, each writing
+ * DIV on its devices in turn and reading it back, against the same faults
+ * injected into the simulator. Not part of the tests, run with 'make bench'.
+ */
+#define ADAPTERS    4
+#define DEVICES     2
+#define RUN_MS      500
+#define SAMPLES_MAX (1 << 17)
+
+typedef struct scenario {
+    const char *name;
+    const char *faults;
+} scenario_t;
+
+typedef struct job {
+    uint16_t adapter;
+    uint64_t deadline;
+    uint64_t ops;
+    uint64_t failed;
+    uint64_t mismatched;
+    uint64_t *samples;          /* latency of each op in ns */
+} job_t;
+
+/* the devices stay vanished, so that one goes last */
+static const scenario_t scenarios[] = {
+    { "healthy", "" },
+    { "nak",     "seed=1,nak=0.05" },
+    { "busy",    "busy=300" },
+    { "spike",   "seed=1,spike=0.2:2000@i2c-1/0x58,spike=0.2:2000@i2c-1/0x59" },
+    { "reset",   "seed=1,reset=0.01" },
+    { "vanish",  "vanish=1000@i2c-1/0x58" },
+};
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+sample_cmp (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void *
+job_run (void *arg)
+{
+    job_t *job = arg;
+    char bus_dev[32];
+    uint64_t start = 0;
+    uint16_t n = 2;
+    int fds[DEVICES];
+    int32_t div = 0;
+    size_t i = 0;
+
+    snprintf (bus_dev, sizeof (bus_dev), "/dev/i2c-%d", job->adapter);
+    for (i = 0; i < DEVICES; ++i)
+        fds[i] = pool_get (bus_dev, 0, 0, 0x58 + i);
+    for (i = 0; (start = now_ns ()) < job->deadline; ++i) {
+        n = n == 1025 ? 2 : n + 1;
+        div = xfer_write_word (fds[i % DEVICES], COMMAND_DIV, DIV_PACK (n));
+        if (div != -1)
+            div = xfer_read_word (fds[i % DEVICES], COMMAND_DIV);
+        if (job->ops < SAMPLES_MAX)
+            job->samples[job->ops] = now_ns () - start;
+        ++job->ops;
+        if (div == -1)
+            ++job->failed;
+        else if (DIV_UNPACK (div) != n)
+            ++job->mismatched;
+    }
+    return NULL;
+}
+
+static void
+scenario_run (const scenario_t *scenario, job_t *jobs)
+{
+    pthread_t threads[ADAPTERS];
+    retry_stats_t before = { 0 };
+    retry_stats_t after = { 0 };
+    sim_fault_stats_t faults = { 0 };
+    static uint64_t samples[ADAPTERS * SAMPLES_MAX];
+    uint64_t deadline = 0;
+    uint64_t ops = 0;
+    uint64_t failed = 0;
+    uint64_t mismatched = 0;
+    size_t count = 0;
+    double sum = 0;
+    double squares = 0;
+    size_t i = 0;
+
+    if (sim_faults_parse (scenario->faults)) {
+        perror (scenario->faults);
+        exit (1);
+    }
+    retry_stats (&before);
+    deadline = now_ns () + RUN_MS * 1000000ull;
+    for (i = 0; i < ADAPTERS; ++i) {
+        jobs[i].adapter = i + 1;
+        jobs[i].deadline = deadline;
+        jobs[i].ops = jobs[i].failed = jobs[i].mismatched = 0;
+        pthread_create (&threads[i], NULL, job_run, &jobs[i]);
+    }
+    for (i = 0; i < ADAPTERS; ++i)
+        pthread_join (threads[i], NULL);
+    retry_stats (&after);
+    sim_fault_stats (&faults);
+
+    for (i = 0; i < ADAPTERS; ++i) {
+        ops += jobs[i].ops;
+        failed += jobs[i].failed;
+        mismatched += jobs[i].mismatched;
+        sum += jobs[i].ops;
+        squares += (double)jobs[i].ops * jobs[i].ops;
+        memcpy (samples + count, jobs[i].samples,
+                (jobs[i].ops < SAMPLES_MAX ? jobs[i].ops : SAMPLES_MAX) *
+                sizeof (samples[0]));
+        count += jobs[i].ops < SAMPLES_MAX ? jobs[i].ops : SAMPLES_MAX;
+    }
+    qsort (samples, count, sizeof (samples[0]), sample_cmp);
+    printf ("%s (%s)\n", scenario->name,
+            *scenario->faults ? scenario->faults : "no faults");
+    printf ("  ops:        %llu, %llu failed, %llu read back wrong\n",
+            (unsigned long long)ops, (unsigned long long)failed,
+            (unsigned long long)mismatched);
+    printf ("  throughput: %.0f ops/s\n", ops * 1000.0 / RUN_MS);
+    if (count > 0)
+        printf ("  latency:    p50 %llu us, p99 %llu us, max %llu us\n",
+                (unsigned long long)samples[count / 2] / 1000,
+                (unsigned long long)samples[count * 99 / 100] / 1000,
+                (unsigned long long)samples[count - 1] / 1000);
+    /* Jain's index, 1 when every adapter got as much done */
+    printf ("  fairness:   %.3f (", squares ? sum * sum /
+                                      (ADAPTERS * squares) : 0);
+    for (i = 0; i < ADAPTERS; ++i)
+        printf ("%si2c-%d %llu", i ? ", " : "", jobs[i].adapter,
+                (unsigned long long)jobs[i].ops);
+    printf (")\n");
+    printf ("  retries:    %llu, %llu recovered, %llu exhausted, "
+            "%llu trips, %llu rejected\n",
+            (unsigned long long)(after.retries - before.retries),
+            (unsigned long long)(after.recovered - before.recovered),
+            (unsigned long long)(after.exhausted - before.exhausted),
+            (unsigned long long)(after.trips - before.trips),
+            (unsigned long long)(after.rejected - before.rejected));
+    printf ("  injected:   %llu naks, %llu busy, %llu spikes, %llu vanished, "
+            "%llu resets\n", (unsigned long long)faults.naks,
+            (unsigned long long)faults.busy, (unsigned long long)faults.spikes,
+            (unsigned long long)faults.vanished,
+            (unsigned long long)faults.resets);
+}
+
+int main(void)
+{
+    char sim_path[] = "/tmp/ds1077l-fault_bench.sim.XXXXXX";
+    retry_policy_t policy = {
+        .attempts = 4,
+        .base_us  = 50,
+        .max_us   = 1000,
+    };
+    static job_t jobs[ADAPTERS];
+    char devices[256] = "";
+    size_t i = 0;
+    size_t j = 0;
+    int fd = 0;
+
+    for (i = 0; i < ADAPTERS; ++i)
+        for (j = 0; j < DEVICES; ++j)
+            snprintf (devices + strlen (devices),
+                      sizeof (devices) - strlen (devices), "%si2c-%zu/%#zx",
+                      i + j ? "," : "", i + 1, 0x58 + j);
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, devices)) {
+        perror ("init");
+        exit (1);
+    }
+    retry_init (&policy);
+    for (i = 0; i < ADAPTERS; ++i) {
+        jobs[i].samples = calloc (SAMPLES_MAX, sizeof (uint64_t));
+        if (jobs[i].samples == NULL) {
+            perror ("calloc");
+            exit (1);
+        }
+    }
+    for (i = 0; i < sizeof (scenarios) / sizeof (scenarios[0]); ++i)
+        scenario_run (&scenarios[i], jobs);
+    unlink (sim_path);
+    exit (0);
+}
@@ -0,0 +1,77 @@
+#include "../src/ds1077l-fmt.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(void)
+{
+    static fmt_buf_t out;
+    static char big[FMT_BUF_SIZE * 2 + 1];
+    int ret = 0;
+    fmt_record_t record = {
+        .bus_dev   = "/dev/i2c-1",
+        .address   = 0x5a,
+        .reg       = "MUX",
+        .raw       = 0x0018,
+        .raw_width = 4,
+    };
+    fmt_field_t fields[] = {
+        { .name = "sel0", .type = FIELD_BOOL, .value = true },
+        { .name = "m0",   .type = FIELD_UINT, .value = 8 },
+        { .name = "addr", .type = FIELD_HEX,  .value = 0x5d },
+    };
+
+    fmt_init (&out, STDOUT_FILENO);
+    /* json */
+    printf ("expect: {\"bus_dev\":\"/dev/i2c-1\",\"address\":\"0x5a\","
+            "\"register\":\"MUX\",\"raw\":\"0x0018\",\"sel0\":true,\"m0\":8,"
+            "\"addr\":\"0x5d\"}\n");
+    fflush (stdout);
+    fmt_register (&out, FORMAT_JSON, &record, fields, 3);
+    fmt_flush (&out);
+    /* kv */
+    printf ("expect: bus_dev=/dev/i2c-1 address=0x5a register=MUX raw=0x0018 "
+            "sel0=1 m0=8 addr=0x5d\n");
+    fflush (stdout);
+    fmt_register (&out, FORMAT_KV, &record, fields, 3);
+    fmt_flush (&out);
+    /* raw */
+    printf ("expect: 0x0018\n");
+    fflush (stdout);
+    fmt_register (&out, FORMAT_RAW, &record, fields, 3);
+    fmt_flush (&out);
+    /* json string escaping */
+    record.bus_dev = "/dev/\"i2c\"\n";
+    printf ("expect: bus_dev \"/dev/\\\"i2c\\\"\\u000a\"\n");
+    fflush (stdout);
+    fmt_register (&out, FORMAT_JSON, &record, fields, 0);
+    fmt_flush (&out);
+    /* hex padding and integers */
+    printf ("expect: 0x005d 0x12345678 0 4294967295\n");
+    fflush (stdout);
+    fmt_hex (&out, 0x5d, 4);
+    fmt_str (&out, " ");
+    fmt_hex (&out, 0x12345678, 2);
+    fmt_str (&out, " ");
+    fmt_uint (&out, 0);
+    fmt_str (&out, " ");
+    fmt_uint (&out, 4294967295u);
+    fmt_str (&out, "\n");
+    fmt_flush (&out);
+    /* a failed write stops appending and is reported by the next flush */
+    memset (big, 'x', sizeof (big) - 1);
+    fmt_init (&out, -1);
+    fmt_str (&out, big);
+    fmt_uint (&out, 1);
+    printf ("expect: 0 -1 %d 0\n", EBADF);
+    printf ("%zu", out.len);
+    ret = fmt_flush (&out);
+    printf (" %d %d", ret, errno);
+    printf (" %d\n", fmt_flush (&out));
+
+    return 0;
+}
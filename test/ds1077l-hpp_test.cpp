@@ -0,0 +1,107 @@
+#include "../src/ds1077l.hpp"
+
+extern "C" {
+#include "../src/ds1077l-sim.h"
+}
+
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <unistd.h>
+
+namespace ds = ds1077l;
+
+static char sim_path[] = "/tmp/ds1077l-hpp_test.sim.XXXXXX";
+
+/* checked when compiling */
+static_assert (ds::div ().pack () == DIV_PACK (DS1077L_N_DEFAULT));
+static_assert (ds::div::of<1025> ().pack () == DIV_PACK (1025));
+static_assert (ds::div::unpack (DIV_PACK (300)) == ds::div::of<300> ());
+static_assert (!ds::div::checked (1).has_value ());
+static_assert (!ds::div::checked (1026).has_value ());
+static_assert (ds::mux ().pack () == (SEL0_PACK (true) | EN0_PACK (true)));
+static_assert (ds::mux ().with_div1 (true).pack () ==
+               (ds::mux ().pack () | DIV1_PACK (true)));
+static_assert (ds::bus::of<0x5a, true> ().pack () ==
+               (ADDRESS_PACK (0x5a) | WC_PACK (true)));
+static_assert (ds::bus::unpack (0x0b).address () == 0x5b);
+static_assert (ds::divisor (ds::prescaler_of<8> ()) == 8);
+
+/* Just enough of a coroutine to run one to its end from main. */
+struct task {
+    struct promise_type {
+        std::promise<void> done;
+
+        task get_return_object () { return { done.get_future () }; }
+        std::suspend_never initial_suspend () { return {}; }
+        std::suspend_never final_suspend () noexcept { return {}; }
+        void return_void () { done.set_value (); }
+        void unhandled_exception () { std::terminate (); }
+    };
+
+    std::future<void> done;
+};
+
+static task
+program (ds::device dev, int *errors, unsigned *n, bool *div1)
+{
+    auto wrote = co_await dev.write_async (ds::div::of<100> ());
+    auto read = co_await dev.read_async<ds::div> ();
+
+    *errors = wrote + read.error;
+    *n = read.value.n ();
+    *errors += co_await dev.modify_async<ds::mux> ([] (ds::mux m) {
+        return m.with_div1 (true);
+    });
+    *div1 = dev.read<ds::mux> ().value.div1 ();
+}
+
+int main(void)
+{
+    unsigned mismatches = 0;
+    unsigned n = 0;
+    bool div1 = false;
+    int errors = 0;
+    int fd = 0;
+
+    /* same words as the macros */
+    for (n = ds::div::n_min; n <= ds::div::n_max; ++n)
+        if (ds::div::checked (n)->pack () != DIV_PACK (n) ||
+            ds::div::unpack (DIV_PACK (n)).n () != n)
+            ++mismatches;
+    for (unsigned p = 1; p <= 8; p <<= 1) {
+        ds::prescaler code =
+            static_cast<ds::prescaler> (encode_prescalar (p));
+        ds::mux m = ds::mux ().with_m0 (code).with_m1 (code);
+        uint16_t word = SEL0_PACK (true) | EN0_PACK (true) | M0_PACK (p) |
+                        M1_PACK (p);
+
+        if (m.pack () != word ||
+            ds::divisor (ds::mux::unpack (word).m0 ()) != p ||
+            ds::divisor (ds::mux::unpack (word).m1 ()) != p)
+            ++mismatches;
+    }
+    printf ("expect: 0\n");
+    printf ("%u\n", mismatches);
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58")) {
+        perror ("init");
+        exit (1);
+    }
+    auto dev = ds::device::open ("/dev/i2c-1", 0x58);
+    auto none = ds::device::open ("/dev/i2c-1", 0x59);
+
+    /* run on the adapter's thread, main waits */
+    program (dev.value, &errors, &n, &div1).done.wait ();
+    printf ("expect: 0 100 1\n");
+    printf ("%d %u %d\n", errors, n, div1);
+
+    /* nobody at 0x59 */
+    printf ("expect: 1\n");
+    printf ("%d\n", none.value.read<ds::div> ().error != 0);
+    unlink (sim_path);
+    exit (0);
+}
@@ -0,0 +1,94 @@
+#include "../src/ds1077l-inventory.h"
+#include "../src/ds1077l-retry.h"
+#include "../src/ds1077l-sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char add[] = "add@/devices/platform/i2c-gpio.3/i2c-3/i2c-dev/"
+                          "i2c-3\0"
+                          "ACTION=add\0"
+                          "DEVPATH=/devices/platform/i2c-gpio.3/i2c-3/i2c-dev/"
+                          "i2c-3\0"
+                          "SUBSYSTEM=i2c-dev\0"
+                          "MAJOR=89\0"
+                          "MINOR=3\0"
+                          "DEVNAME=i2c-3\0"
+                          "SEQNUM=4711";
+static const char other[] = "bind@/devices/platform/i2c-gpio.3\0"
+                            "ACTION=bind\0"
+                            "SUBSYSTEM=platform\0"
+                            "DEVNAME=i2c-3";
+static const char remove_node[] = "remove@/devices/.../i2c-dev/i2c-3\0"
+                                  "ACTION=remove\0"
+                                  "SUBSYSTEM=i2c-dev\0"
+                                  "DEVNAME=i2c-3";
+
+static void
+inventory_print (void)
+{
+    static inventory_device_t devices[INVENTORY_DEVICES_MAX];
+    size_t count = inventory_list (devices, INVENTORY_DEVICES_MAX);
+    size_t i = 0;
+
+    printf ("%zu", count);
+    for (i = 0; i < count; ++i)
+        printf (" %s/%#x:%#x", devices[i].target.bus_dev,
+                devices[i].target.address, devices[i].bus);
+    printf ("\n");
+}
+
+int main(void)
+{
+    char sim_path[] = "/tmp/ds1077l-inventory_test.sim.XXXXXX";
+    char path[] = "/tmp/ds1077l-inventory_test.inv.XXXXXX";
+    /* absent devices don't need retrying */
+    retry_policy_t policy = { .attempts = 1 };
+    inventory_event_t event = { 0 };
+    size_t found = 0;
+    size_t removed = 0;
+    int fd = 0;
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        (fd = mkstemp (path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58,i2c-1/0x5b,i2c-2/0x59") ||
+        inventory_open (path)) {
+        perror ("init");
+        exit (1);
+    }
+    retry_init (&policy);
+
+    printf ("expect: 0 1 0 2\n");
+    printf ("%d", inventory_scan ("/dev/i2c-2", &found));
+    printf (" %zu", found);
+    printf (" %d", inventory_scan ("/dev/i2c-1", &found));
+    printf (" %zu\n", found);
+    printf ("expect: 3 /dev/i2c-1/0x58:0 /dev/i2c-1/0x5b:0x3 "
+            "/dev/i2c-2/0x59:0x1\n");
+    inventory_print ();
+
+    /* what's in the file survives the process */
+    inventory_close ();
+    inventory_open (path);
+    printf ("expect: 3 /dev/i2c-1/0x58:0 /dev/i2c-1/0x5b:0x3 "
+            "/dev/i2c-2/0x59:0x1\n");
+    inventory_print ();
+
+    printf ("expect: 0 1 2 /dev/i2c-1/0x58:0 /dev/i2c-1/0x5b:0x3\n");
+    printf ("%d", inventory_forget ("/dev/i2c-2", &removed));
+    printf (" %zu ", removed);
+    inventory_print ();
+
+    printf ("expect: 0 1 /dev/i2c-3 -1 0 1\n");
+    printf ("%d", inventory_uevent_parse (add, sizeof (add), &event));
+    printf (" %d %s", event.action == INVENTORY_ADD, event.bus_dev);
+    printf (" %d", inventory_uevent_parse (other, sizeof (other), &event));
+    printf (" %d", inventory_uevent_parse (remove_node, sizeof (remove_node),
+                                           &event));
+    printf (" %d\n", event.action == INVENTORY_REMOVE);
+    inventory_close ();
+    unlink (sim_path);
+    unlink (path);
+    exit (0);
+}
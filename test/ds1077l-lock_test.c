@@ -0,0 +1,72 @@
+#include "../src/ds1077l-lock.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define THREADS 4
+#define ROUNDS  250
+
+static int fd = 0;
+
+static int
+increment (uint16_t current, uint16_t *next, void *arg)
+{
+    *next = current + 1;
+    return 0;
+}
+
+static void *
+worker (void *arg)
+{
+    int i = 0;
+
+    for (i = 0; i < ROUNDS; ++i)
+        if (lock_rmw (fd, 0x01, I2C_SMBUS_WORD_DATA, increment, NULL) == -1)
+            perror ("lock_rmw");
+    return NULL;
+}
+
+int main(void)
+{
+    char sim[] = "/tmp/ds1077l-lock_test.sim.XXXXXX";
+    char lock[] = "/tmp/ds1077l-lock_test.lock.XXXXXX";
+    pthread_t threads[THREADS];
+    lock_stats_t stats = { 0 };
+    int i = 0;
+
+    close (mkstemp (sim));
+    close (mkstemp (lock));
+    if (sim_init (sim, "i2c-1/0x58")) {
+        perror ("sim_init");
+        exit (1);
+    }
+    lock_init (lock, LOCK_EXCLUSIVE);
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x58);
+    for (i = 0; i < THREADS; ++i)
+        pthread_create (&threads[i], NULL, worker, NULL);
+    for (i = 0; i < THREADS; ++i)
+        pthread_join (threads[i], NULL);
+    /* no update is lost */
+    printf ("expect: %d\n", THREADS * ROUNDS);
+    printf ("%d\n", xfer_read_word (fd, 0x01));
+    lock_stats (&stats);
+    printf ("expect: acquired %d\n", THREADS * ROUNDS);
+    printf ("acquired %llu\n", (unsigned long long)stats.acquired);
+    /* a device's lock doesn't block other devices */
+    lock_acquire (fd);
+    lock_acquire (pool_get ("/dev/i2c-1", 0, 0, 0x59));
+    lock_acquire (pool_get ("/dev/i2c-2", 0, 0, 0x58));
+    lock_acquire (pool_get ("/dev/i2c-1", 0x70, 0, 0x58));
+    lock_stats (&stats);
+    printf ("expect: acquired %d\n", THREADS * ROUNDS + 4);
+    printf ("acquired %llu\n", (unsigned long long)stats.acquired);
+    unlink (sim);
+    unlink (lock);
+    exit (0);
+}
@@ -0,0 +1,144 @@
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-metrics.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-retry.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Print the rest of the ds1077l_ops_total samples of the text file in
+ * 'dir' whose labels after the adapter start with 'labels'.
+ */
+static void
+print_ops (const char *dir, const char *labels)
+{
+    char path[PATH_MAX];
+    char prefix[128];
+    char *line = NULL;
+    size_t size = 0;
+    FILE *file = NULL;
+
+    snprintf (path, sizeof (path), "%s/%s", dir, METRICS_PROM_FILE);
+    snprintf (prefix, sizeof (prefix), "ds1077l_ops_total{adapter="
+              "\"/dev/i2c-1\",%s", labels);
+    file = fopen (path, "r");
+    if (file == NULL) {
+        perror (path);
+        return;
+    }
+    while (getline (&line, &size, file) != -1)
+        if (strncmp (line, prefix, strlen (prefix)) == 0)
+            printf ("%s", line + strlen (prefix));
+    free (line);
+    fclose (file);
+}
+
+static void
+read_div (uint8_t mux, uint8_t channel, uint8_t address, int times)
+{
+    int fd = pool_get ("/dev/i2c-1", mux, channel, address);
+
+    while (times-- > 0)
+        xfer_read_word (fd, COMMAND_DIV);
+    pool_put (fd);
+}
+
+static void *
+read_div_thread (void *arg)
+{
+    read_div (0x70, 3, 0x59, *(int *)arg);
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t thread;
+    int times = 2000;
+    char sim_path[] = "/tmp/ds1077l-metrics_test.sim.XXXXXX";
+    char dir[] = "/tmp/ds1077l-metrics_test.XXXXXX";
+    char path[PATH_MAX];
+    static char deep[PATH_MAX];
+    size_t i = 0;
+    int ret = 0;
+    int fd = 0;
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58,i2c-1/0x70/1/0x59,"
+                            "i2c-1/0x70/2/0x59,i2c-1/0x70/3/0x59") || mkdtemp (dir) == NULL) {
+        perror ("init");
+        exit (1);
+    }
+
+    /* a directory, "./././...", whose files don't fit in PATH_MAX fails the
+     * flush before anything is folded
+     */
+    deep[0] = '.';
+    for (i = 1; i + 2 < PATH_MAX - 1; i += 2)
+        memcpy (deep + i, "/.", 2);
+    ret = metrics_init (deep);
+    printf ("expect: 0 -1 %d\n", ENAMETOOLONG);
+    printf ("%d", ret);
+    read_div (0, 0, 0x58, 1);
+    ret = metrics_flush ();
+    printf (" %d %d\n", ret, errno);
+
+    /* what wasn't flushed then is now, and nothing is counted twice */
+    metrics_init (dir);
+    read_div (0, 0, 0x58, 1);
+    metrics_flush ();
+    read_div (0, 0, 0x58, 1);
+    read_div (0, 0, 0x5a, 1);
+    ret = metrics_flush ();
+    printf ("expect: 0\n");
+    printf ("%d\n", ret);
+    printf ("expect: ,result=\"ok\"} 3\n");
+    print_ops (dir, "address=\"0x58\",mux=\"\",channel=\"\","
+               "register=\"DIV\",op=\"read\"");
+    /* every attempt is counted, naks are retried */
+    printf ("expect: ,result=\"nak\"} %d\n", RETRY_ATTEMPTS_DEFAULT);
+    print_ops (dir, "address=\"0x5a\",mux=\"\",channel=\"\","
+               "register=\"DIV\",op=\"read\"");
+
+    /* devices behind a mux are series of their own, the channel selects
+     * aren't taken for register accesses
+     */
+    read_div (0x70, 1, 0x59, 2);
+    read_div (0x70, 2, 0x59, 1);
+    metrics_flush ();
+    printf ("expect: ,result=\"ok\"} 2\n");
+    print_ops (dir, "address=\"0x59\",mux=\"0x70\",channel=\"1\","
+               "register=\"DIV\",op=\"read\"");
+    printf ("expect: ,result=\"ok\"} 1\n");
+    print_ops (dir, "address=\"0x59\",mux=\"0x70\",channel=\"2\","
+               "register=\"DIV\",op=\"read\"");
+    printf ("expect: ,result=\"ok\"} 2\n");
+    print_ops (dir, "address=\"0x70\",mux=\"\",channel=\"\","
+               "register=\"MUX_SELECT\",op=\"write\"");
+
+    /* flushing while another thread counts loses and repeats nothing */
+    pthread_create (&thread, NULL, read_div_thread, &times);
+    for (i = 0; i < 50; ++i)
+        metrics_flush ();
+    pthread_join (thread, NULL);
+    metrics_flush ();
+    printf ("expect: ,result=\"ok\"} %d\n", times);
+    print_ops (dir, "address=\"0x59\",mux=\"0x70\",channel=\"3\","
+               "register=\"DIV\",op=\"read\"");
+
+    /* leave nothing for the flush at exit */
+    metrics_on = false;
+    snprintf (path, sizeof (path), "%s/%s", dir, METRICS_PROM_FILE);
+    unlink (path);
+    snprintf (path, sizeof (path), "%s/%s", dir, METRICS_STATE_FILE);
+    unlink (path);
+    rmdir (dir);
+    unlink (sim_path);
+    exit (0);
+}
@@ -0,0 +1,70 @@
+#include "../src/ds1077l-bus.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-plan.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-writee2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void
+stats_print (int fd)
+{
+    plan_stats_t stats = { 0 };
+
+    plan_stats (xfer_target (fd)->adapter, &stats);
+    printf ("%llu %llu %llu\n", (unsigned long long)stats.transactions,
+            (unsigned long long)stats.cycles,
+            (unsigned long long)stats.eeprom_writes);
+}
+
+int main(void)
+{
+    static const xfer_reg_t regs[] = {
+        { COMMAND_DIV, I2C_SMBUS_WORD_DATA },
+        { COMMAND_MUX, I2C_SMBUS_WORD_DATA },
+        { COMMAND_BUS, I2C_SMBUS_BYTE_DATA },
+    };
+    uint16_t values[3] = { 0 };
+    int32_t div = 0;
+    int32_t mux = 0;
+    int32_t bus = 0;
+    int fd = 0;
+
+    printf ("expect: 38 48 29 20\n");
+    printf ("%u %u %u %u\n", plan_cycles (I2C_SMBUS_WRITE, I2C_SMBUS_WORD_DATA),
+            plan_cycles (I2C_SMBUS_READ, I2C_SMBUS_WORD_DATA),
+            plan_cycles (I2C_SMBUS_WRITE, I2C_SMBUS_BYTE_DATA),
+            plan_cycles (I2C_SMBUS_WRITE, I2C_SMBUS_QUICK));
+    plan_init (false);
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x58);
+    /* reads come from the power-on image */
+    printf ("expect: 2 0x0018 0x00\n");
+    div = xfer_read_word (fd, COMMAND_DIV);
+    mux = xfer_read_word (fd, COMMAND_MUX);
+    bus = xfer_read_byte (fd, COMMAND_BUS);
+    printf ("%d 0x%04x 0x%02x\n", DIV_UNPACK (div), mux, bus);
+    /* with WC clear every write is an EEPROM write, with WC set only
+     * E2_WRITE
+     */
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (10));
+    xfer_write_byte (fd, COMMAND_BUS, WC_PACK (true));
+    xfer_write_word (fd, COMMAND_MUX, 0x001c);
+    xfer_command (fd, COMMAND_E2_WRITE);
+    printf ("expect: 10 0x001c\n");
+    div = xfer_read_word (fd, COMMAND_DIV);
+    mux = xfer_read_word (fd, COMMAND_MUX);
+    printf ("%d 0x%04x\n", DIV_UNPACK (div), mux);
+    printf ("expect: 9 356 2\n");
+    stats_print (fd);
+
+    /* a combined read is one transfer */
+    plan_init (true);
+    xfer_read_regs (fd, regs, 3, values);
+    printf ("expect: 0x0002 0x001c 0x08\n");
+    printf ("0x%04x 0x%04x 0x%02x\n", values[0], values[1], values[2]);
+    printf ("expect: 10 489 2\n");
+    stats_print (fd);
+    exit (0);
+}
@@ -0,0 +1,126 @@
+#include "../src/ds1077l-bus.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const xfer_reg_t regs[] = {
+    { COMMAND_DIV, I2C_SMBUS_WORD_DATA },
+    { COMMAND_MUX, I2C_SMBUS_WORD_DATA },
+    { COMMAND_BUS, I2C_SMBUS_BYTE_DATA },
+};
+
+/* DIV, MUX and BUS of both devices with the transport set now */
+static void
+read_both (uint16_t values[2][3])
+{
+    int fd = pool_get ("/dev/i2c-1", 0, 0, 0x58);
+
+    if (xfer_read_regs (fd, regs, 3, values[0]))
+        perror ("0x58");
+    pool_put (fd);
+    fd = pool_get ("/dev/i2c-1", 0x70, 1, 0x59);
+    if (xfer_read_regs (fd, regs, 3, values[1]))
+        perror ("0x70/1/0x59");
+    pool_put (fd);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/ds1077l-pool_test.XXXXXX";
+    int fds[POOL_SIZE + 1] = { 0 };
+    uint16_t smbus[2][3] = { { 0 } };
+    uint16_t rdwr[2][3] = { { 0 } };
+    pool_stats_t stats = { 0 };
+    uint64_t hits = 0;
+    int32_t div = 0;
+    int fd = 0;
+    size_t i = 0;
+
+    fd = mkstemp (path);
+    if (fd == -1) {
+        perror ("mkstemp");
+        exit (1);
+    }
+    close (fd);
+    if (sim_init (path, "i2c-1/0x58,i2c-1/0x70/1/0x59")) {
+        perror ("sim_init");
+        exit (1);
+    }
+
+    /* a device used again gets the same descriptor */
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x58);
+    pool_put (fd);
+    printf ("expect: 1 1 1\n");
+    printf ("%d", pool_get ("/dev/i2c-1", 0, 0, 0x58) == fd);
+    pool_put (fd);
+    pool_stats (&stats);
+    printf (" %llu %llu\n", (unsigned long long)stats.hits,
+            (unsigned long long)stats.misses);
+    pool_close ();
+
+    /* held handles are never evicted, the least recently used free one is */
+    for (i = 0; i < POOL_SIZE; ++i)
+        fds[i] = pool_get ("/dev/i2c-2", 0, 0, 0x08 + i);
+    fd = pool_get ("/dev/i2c-2", 0, 0, 0x08 + POOL_SIZE);
+    printf ("expect: -1 %d\n", EBUSY);
+    printf ("%d %d\n", fd, errno);
+    pool_put (fds[3]);
+    pool_put (fds[1]);
+    pool_get ("/dev/i2c-2", 0, 0, 0x08 + 3);
+    pool_put (fds[3]);
+    fds[POOL_SIZE] = pool_get ("/dev/i2c-2", 0, 0, 0x08 + POOL_SIZE);
+    pool_stats (&stats);
+    printf ("expect: 1 1\n");
+    printf ("%d %llu\n", fds[POOL_SIZE] != -1,
+            (unsigned long long)stats.evictions);
+    /* 0x0b was used after 0x09, so it's still there */
+    hits = stats.hits;
+    fd = pool_get ("/dev/i2c-2", 0, 0, 0x08 + 3);
+    pool_put (fd);
+    printf ("expect: 1 1\n");
+    printf ("%d", fd == fds[3]);
+    pool_stats (&stats);
+    printf (" %llu\n", (unsigned long long)(stats.hits - hits));
+    pool_close ();
+
+    /* the same registers over I2C_RDWR as over SMBus, mux selects included */
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x58);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (100));
+    pool_put (fd);
+    fd = pool_get ("/dev/i2c-1", 0x70, 1, 0x59);
+    xfer_write_word (fd, COMMAND_MUX, EN0_PACK (true) | DIV1_PACK (true));
+    pool_put (fd);
+    read_both (smbus);
+    pool_close ();
+    xfer_transport_set (&xfer_rdwr);
+    pool_rdwr_set (&sim_rdwr);
+    read_both (rdwr);
+    printf ("expect: 100 1\n");
+    printf ("%d %d\n", DIV_UNPACK (rdwr[0][0]),
+            rdwr[0][0] == smbus[0][0] && rdwr[0][1] == smbus[0][1] &&
+            rdwr[0][2] == smbus[0][2] && rdwr[1][0] == smbus[1][0] &&
+            rdwr[1][1] == smbus[1][1] && rdwr[1][2] == smbus[1][2]);
+    /* writes land as well */
+    fd = pool_get ("/dev/i2c-1", 0x70, 1, 0x59);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (300));
+    div = xfer_read_word (fd, COMMAND_DIV);
+    pool_put (fd);
+    printf ("expect: 300\n");
+    printf ("%d\n", DIV_UNPACK (div));
+    /* and nobody answers at an empty address either way */
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x5a);
+    div = xfer_read_word (fd, COMMAND_DIV);
+    printf ("expect: -1 nak\n");
+    printf ("%d %s\n", div, xfer_result_name (errno));
+    pool_put (fd);
+    pool_close ();
+    unlink (path);
+    exit (0);
+}
@@ -0,0 +1,81 @@
+#include "../src/ds1077l-bus.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-preset.h"
+#include "../src/ds1077l-sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(void)
+{
+    char sim_path[] = "/tmp/ds1077l-preset_test.sim.XXXXXX";
+    char text_path[] = "/tmp/ds1077l-preset_test.txt.XXXXXX";
+    char index_path[] = "/tmp/ds1077l-preset_test.idx.XXXXXX";
+    topo_target_t target = { .bus_dev = "/dev/i2c-1", .address = 0x59 };
+    const preset_t *preset = NULL;
+    preset_t parsed = { 0 };
+    FILE *text = NULL;
+    size_t count = 0;
+    int fd = 0;
+
+    printf ("expect: 0 0x0002 0x001a 1 1\n");
+    printf ("%d", preset_parse ("test-clock n=10 m0=2 # fast", &parsed));
+    printf (" 0x%04x 0x%04x %d", parsed.div, parsed.mux,
+            parsed.regs == (PRESET_DIV | PRESET_MUX));
+    printf (" %d\n", preset_parse ("  # comment", &parsed));
+    printf ("expect: -1 -1 -1\n");
+    printf ("%d %d %d\n", preset_parse ("bad m0=3", &parsed),
+            preset_parse ("bad n=1", &parsed),
+            preset_parse ("bad", &parsed));
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        (fd = mkstemp (index_path)) == -1 || close (fd) ||
+        (fd = mkstemp (text_path)) == -1 ||
+        (text = fdopen (fd, "w")) == NULL) {
+        perror ("mkstemp");
+        exit (1);
+    }
+    fprintf (text, "# NAME SETTING...\n"
+                   "production n=4 wc=1\n"
+                   "\n"
+                   "low-power pdn0=1 pdn1=1\n"
+                   "test-clock n=10 m0=2\n");
+    fclose (text);
+    if (sim_init (sim_path, "i2c-1/0x59") ||
+        preset_compile (text_path, index_path) || preset_open (index_path)) {
+        perror ("init");
+        exit (1);
+    }
+    /* sorted for the binary search */
+    preset = preset_list (&count);
+    printf ("expect: 3 low-power production test-clock\n");
+    printf ("%zu %s %s %s\n", count, preset[0].name, preset[1].name,
+            preset[2].name);
+    printf ("expect: 1 1\n");
+    printf ("%d %d\n", preset_find ("nope") == NULL,
+            preset_find ("production") == &preset[1]);
+
+    /* only the registers the preset sets are written */
+    fd = pool_get (target.bus_dev, 0, 0, target.address);
+    xfer_write_word (fd, COMMAND_MUX, M0_PACK (8));
+    preset_apply (preset_find ("production"), &target);
+    printf ("expect: 4 8 1 0x59\n");
+    printf ("%d %d %d %#x\n", DIV_UNPACK (xfer_read_word (fd, COMMAND_DIV)),
+            M0_UNPACK (xfer_read_word (fd, COMMAND_MUX)),
+            WC_UNPACK (xfer_read_byte (fd, COMMAND_BUS)),
+            ADDRESS_UNPACK (xfer_read_byte (fd, COMMAND_BUS)));
+    preset_apply (preset_find ("low-power"), &target);
+    printf ("expect: 4 1 1 1\n");
+    printf ("%d %d %d %d\n", DIV_UNPACK (xfer_read_word (fd, COMMAND_DIV)),
+            M0_UNPACK (xfer_read_word (fd, COMMAND_MUX)),
+            PDN0_UNPACK (xfer_read_word (fd, COMMAND_MUX)),
+            PDN1_UNPACK (xfer_read_word (fd, COMMAND_MUX)));
+    preset_close ();
+    unlink (sim_path);
+    unlink (text_path);
+    unlink (index_path);
+    exit (0);
+}
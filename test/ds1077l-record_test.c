@@ -0,0 +1,222 @@
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-lock.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-record.h"
+#include "../src/ds1077l-retry.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* more than a capture buffer's worth between the threads */
+#define THREAD_READS 3000
+
+typedef struct job {
+    const char *bus_dev;
+    int32_t div;                /* last read */
+    size_t failed;
+} job_t;
+
+static void *
+job_run (void *arg)
+{
+    job_t *job = arg;
+    int fd = pool_get (job->bus_dev, 0, 0, 0x58);
+    size_t i = 0;
+
+    for (i = 0; i < THREAD_READS; ++i)
+        if ((job->div = xfer_read_word (fd, COMMAND_DIV)) == -1)
+            ++job->failed;
+    pool_put (fd);
+    return NULL;
+}
+
+/* both threads reading their adapter at once */
+static void
+jobs_run (job_t *jobs)
+{
+    pthread_t threads[2];
+    size_t i = 0;
+
+    for (i = 0; i < 2; ++i) {
+        jobs[i].failed = 0;
+        pthread_create (&threads[i], NULL, job_run, &jobs[i]);
+    }
+    for (i = 0; i < 2; ++i)
+        pthread_join (threads[i], NULL);
+}
+
+static uint64_t
+now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* three reads of the slow device, in ms */
+static uint64_t
+slow_reads (void)
+{
+    uint64_t start = now_ms ();
+    int fd = pool_get ("/dev/i2c-4", 0, 0, 0x58);
+    size_t i = 0;
+
+    for (i = 0; i < 3; ++i)
+        xfer_read_word (fd, COMMAND_DIV);
+    pool_put (fd);
+    return now_ms () - start;
+}
+
+/* Record the slow reads in a process of its own, a run of the capture.
+ */
+static void
+slow_run (const char *capture)
+{
+    pid_t pid = 0;
+
+    fflush (stdout);
+    pid = fork ();
+    if (pid == 0) {
+        if (record_init (capture))
+            exit (1);
+        slow_reads ();
+        exit (0);
+    }
+    waitpid (pid, NULL, 0);
+}
+
+int main(void)
+{
+    char sim_path[] = "/tmp/ds1077l-record_test.sim.XXXXXX";
+    char lock_path[] = "/tmp/ds1077l-record_test.lock.XXXXXX";
+    char capture[] = "/tmp/ds1077l-record_test.cap.XXXXXX";
+    char runs[] = "/tmp/ds1077l-record_test.runs.XXXXXX";
+    retry_policy_t once = { .attempts = 1 };
+    job_t jobs[2] = {
+        { .bus_dev = "/dev/i2c-2" },
+        { .bus_dev = "/dev/i2c-3" },
+    };
+    int32_t div0 = 0, div1 = 0;
+    uint64_t ms = 0;
+    int fd0 = 0, fd1 = 0, fd = 0;
+    int err = 0;
+    int ret = 0;
+
+    /* a file that isn't a capture is refused and left closed, the lowest
+     * descriptor is free again afterwards
+     */
+    if ((fd = mkstemp (runs)) == -1 || write (fd, "not a capture", 13) != 13 ||
+        close (fd) || (fd0 = open ("/dev/null", O_RDONLY)) == -1 ||
+        close (fd0)) {
+        perror ("runs");
+        exit (1);
+    }
+    ret = record_init (runs);
+    err = errno;
+    fd = open ("/dev/null", O_RDONLY);
+    printf ("expect: -1 %d 1\n", EINVAL);
+    printf ("%d %d %d\n", ret, err, fd == fd0);
+    close (fd);
+    unlink (runs);
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        (fd = mkstemp (lock_path)) == -1 || close (fd) ||
+        (fd = mkstemp (capture)) == -1 || close (fd) || unlink (capture) ||
+        sim_init (sim_path, "i2c-1/0x70/0/0x58,i2c-1/0x70/1/0x58,"
+                            "i2c-2/0x58,i2c-3/0x58,i2c-4/0x58") ||
+        sim_faults_parse ("spike=1:20000@i2c-4/0x58") ||
+        record_init (capture)) {
+        perror ("init");
+        exit (1);
+    }
+    lock_init (lock_path, LOCK_EXCLUSIVE);
+    retry_init (&once);
+
+    /* record against the simulator */
+    fd0 = pool_get ("/dev/i2c-1", 0x70, 0, 0x58);
+    fd1 = pool_get ("/dev/i2c-1", 0x70, 1, 0x58);
+    xfer_write_word (fd0, COMMAND_DIV, DIV_PACK (10));
+    xfer_write_word (fd1, COMMAND_DIV, DIV_PACK (20));
+    xfer_read_word (fd0, COMMAND_DIV);
+    xfer_read_word (fd1, COMMAND_DIV);
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x59);
+    xfer_read_word (fd, COMMAND_DIV);
+    fd = pool_get ("/dev/i2c-3", 0, 0, 0x58);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (30));
+    jobs_run (jobs);
+    ms = slow_reads ();
+    printf ("expect: 0 0 1\n");
+    printf ("%zu %zu %d\n", jobs[0].failed, jobs[1].failed, ms >= 60);
+    record_on = false;
+    if (record_flush ()) {
+        perror ("record_flush");
+        exit (1);
+    }
+    pool_close ();
+
+    /* and replay it, the other channel first */
+    if (replay_init (capture, REPLAY_FAST)) {
+        perror ("replay_init");
+        exit (1);
+    }
+    fd0 = pool_get ("/dev/i2c-1", 0x70, 0, 0x58);
+    fd1 = pool_get ("/dev/i2c-1", 0x70, 1, 0x58);
+    div1 = xfer_read_word (fd1, COMMAND_DIV);
+    div0 = xfer_read_word (fd0, COMMAND_DIV);
+    printf ("expect: 10 20\n");
+    printf ("%d %d\n", DIV_UNPACK (div0), DIV_UNPACK (div1));
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x59);
+    div0 = xfer_read_word (fd, COMMAND_DIV);
+    printf ("expect: -1 nak\n");
+    printf ("%d %s\n", div0, xfer_result_name (errno));
+    /* every record made by the threads is there, and no more */
+    jobs_run (jobs);
+    printf ("expect: 0 0 2 30\n");
+    printf ("%zu %zu %d %d\n", jobs[0].failed, jobs[1].failed,
+            DIV_UNPACK (jobs[0].div), DIV_UNPACK (jobs[1].div));
+    fd = pool_get ("/dev/i2c-2", 0, 0, 0x58);
+    div0 = xfer_read_word (fd, COMMAND_DIV);
+    err = errno;
+    printf ("expect: -1 %d\n", EPROTO);
+    printf ("%d %d\n", div0, err);
+    /* fast doesn't sleep off the recorded durations, recorded does */
+    ms = slow_reads ();
+    printf ("expect: 1\n");
+    printf ("%d\n", ms < 20);
+    pool_close ();
+    replay_init (capture, REPLAY_RECORDED);
+    ms = slow_reads ();
+    printf ("expect: 1\n");
+    printf ("%d\n", ms >= 50);
+
+    /* two runs a second apart replay back to back */
+    pool_close ();
+    xfer_transport_set (&xfer_sim);
+    slow_run (runs);
+    usleep (1000000);
+    slow_run (runs);
+    pool_close ();
+    if (replay_init (runs, REPLAY_RECORDED)) {
+        perror ("replay_init");
+        exit (1);
+    }
+    ms = slow_reads ();
+    ms += slow_reads ();
+    printf ("expect: 1\n");
+    printf ("%d\n", ms >= 100 && ms < 500);
+    unlink (runs);
+
+    unlink (capture);
+    unlink (lock_path);
+    unlink (sim_path);
+    exit (0);
+}
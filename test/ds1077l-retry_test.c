@@ -0,0 +1,103 @@
+#include "../src/ds1077l-retry.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* transport failing the next 'failures' transactions with 'failure' */
+static int failures = 0;
+static int failure = 0;
+
+static int
+flaky_open (const char *bus_dev, uint8_t address)
+{
+    return open ("/dev/null", O_RDWR);
+}
+
+static int32_t
+flaky_access (int fd,
+              char read_write,
+              uint8_t command,
+              int size,
+              union i2c_smbus_data *data)
+{
+    if (failures > 0) {
+        --failures;
+        errno = failure;
+        return -1;
+    }
+    if (data != NULL)
+        data->word = 0x1234;
+    return 0;
+}
+
+static const xfer_transport_t flaky = {
+    .name   = "flaky",
+    .open   = flaky_open,
+    .access = flaky_access,
+};
+
+static void
+stats_print (void)
+{
+    retry_stats_t stats = { 0 };
+
+    retry_stats (&stats);
+    printf ("retries %llu recovered %llu exhausted %llu fatal %llu trips %llu "
+            "rejected %llu\n", (unsigned long long)stats.retries,
+            (unsigned long long)stats.recovered,
+            (unsigned long long)stats.exhausted,
+            (unsigned long long)stats.fatal, (unsigned long long)stats.trips,
+            (unsigned long long)stats.rejected);
+}
+
+int main(void)
+{
+    retry_policy_t policy = { 0 };
+    int32_t ret = 0;
+    int fd = 0;
+    int i = 0;
+
+    printf ("expect: 0 5:0:0 -1\n");
+    printf ("%d", retry_policy_parse ("5:0:0", &policy));
+    printf (" %u:%u:%u", policy.attempts, policy.base_us, policy.max_us);
+    printf (" %d\n", retry_policy_parse ("0", &policy));
+    printf ("expect: 1 1 2\n");
+    printf ("%d %d %d\n", retry_classify (ENXIO), retry_classify (EAGAIN),
+            retry_classify (EINVAL));
+    /* no backoff so the test doesn't sleep */
+    retry_policy_parse ("3:0:0", &policy);
+    retry_init (&policy);
+    xfer_transport_set (&flaky);
+    fd = xfer_open ("/dev/i2c-1", 0x58);
+    /* two transient failures are absorbed */
+    failures = 2;
+    failure = EAGAIN;
+    ret = xfer_read_word (fd, 0x01);
+    printf ("expect: 0x1234\n");
+    printf ("%#x\n", ret);
+    printf ("expect: retries 2 recovered 1 exhausted 0 fatal 0 trips 0 "
+            "rejected 0\n");
+    stats_print ();
+    /* fatal errors aren't retried */
+    failures = 1;
+    failure = EINVAL;
+    ret = xfer_read_word (fd, 0x01);
+    printf ("expect: -1 %s\n", strerror (EINVAL));
+    printf ("%d %s\n", ret, strerror (errno));
+    /* a dead device trips its breaker after five failed transactions */
+    failures = 1000;
+    failure = ENXIO;
+    for (i = 0; i < 7; ++i)
+        ret = xfer_read_word (fd, 0x01);
+    printf ("expect: -1 %s\n", strerror (EHOSTDOWN));
+    printf ("%d %s\n", ret, strerror (errno));
+    printf ("expect: retries 12 recovered 1 exhausted 5 fatal 1 trips 1 "
+            "rejected 2\n");
+    stats_print ();
+    exit (0);
+}
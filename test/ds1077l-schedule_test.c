@@ -0,0 +1,102 @@
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-schedule.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MCLK 66666667
+
+static schedule_step_t steps[16];
+static schedule_step_t loaded[16];
+
+static void
+steps_print (const schedule_header_t *header)
+{
+    size_t i = 0;
+
+    for (i = 0; i < header->count; ++i)
+        printf ("%s%d/%d:%x", i ? " " : "", M1_UNPACK (steps[i].mux),
+                DIV1_UNPACK (steps[i].mux) ? 0 : DIV_UNPACK (steps[i].div),
+                steps[i].regs);
+    printf ("\n");
+}
+
+int main(void)
+{
+    char path[] = "/tmp/ds1077l-schedule_test.XXXXXX";
+    schedule_header_t header = {
+        .magic     = SCHEDULE_MAGIC,
+        .version   = SCHEDULE_VERSION,
+        .master_hz = MCLK,
+        .output    = SCHEDULE_OUT1,
+        .div       = DIV_PACK (2),
+        .mux       = SEL0_PACK (true) | EN0_PACK (true),
+    };
+    schedule_header_t header_loaded = { 0 };
+    schedule_stats_t stats = { 0 };
+    uint32_t hz[16];
+    int fd = 0;
+
+    /* within one prescaler range every step is a DIV write */
+    hz[0] = MCLK / 100;
+    hz[1] = MCLK / 200;
+    hz[2] = MCLK / 300;
+    header.count = 3;
+    schedule_compile (&header, hz, steps);
+    printf ("expect: 1/100:1 1/200:1 1/300:1\n");
+    steps_print (&header);
+
+    /* P1 = 2 is kept where N can make up for it, DIV1 bypasses N and
+     * leaves DIV alone, and the closest divisor wins over fewer writes
+     */
+    header.mux |= M1_PACK (2);
+    hz[0] = MCLK / 400;
+    hz[1] = MCLK / 2;
+    hz[2] = MCLK / 3000;
+    hz[3] = MCLK / 3000;
+    header.count = 4;
+    schedule_compile (&header, hz, steps);
+    printf ("expect: 2/200:1 2/0:2 4/750:3 4/750:0\n");
+    steps_print (&header);
+    schedule_stats (&header, hz, steps, &stats);
+    printf ("expect: 4 2 1 10\n");
+    printf ("%llu %llu %llu %u\n", (unsigned long long)stats.writes,
+            (unsigned long long)stats.single,
+            (unsigned long long)stats.unchanged, stats.max_error_ppm);
+
+    /* frequencies out of reach come as close as they can */
+    hz[0] = 1000;
+    header.count = 1;
+    schedule_compile (&header, hz, steps);
+    printf ("expect: 8/1025 8130\n");
+    printf ("%d/%d %u\n", M1_UNPACK (steps[0].mux),
+            DIV_UNPACK (steps[0].div), steps[0].hz);
+
+    /* OUT0 only ever writes MUX, and only when P0 changes */
+    header.output = SCHEDULE_OUT0;
+    hz[0] = MCLK / 4;
+    hz[1] = MCLK / 4;
+    hz[2] = MCLK / 5;
+    header.count = 3;
+    schedule_compile (&header, hz, steps);
+    printf ("expect: 4 4 4 2 0 0\n");
+    printf ("%d %d %d %x %x %x\n", M0_UNPACK (steps[0].mux),
+            M0_UNPACK (steps[1].mux), M0_UNPACK (steps[2].mux),
+            steps[0].regs, steps[1].regs, steps[2].regs);
+
+    /* schedules are saved as they are */
+    if ((fd = mkstemp (path)) == -1 || close (fd)) {
+        perror ("mkstemp");
+        exit (1);
+    }
+    schedule_save (path, &header, steps);
+    printf ("expect: 0 3 0\n");
+    printf ("%d", schedule_load (path, &header_loaded, loaded, 16));
+    printf (" %u %d\n", header_loaded.count,
+            memcmp (steps, loaded, 3 * sizeof (steps[0])));
+    unlink (path);
+    exit (0);
+}
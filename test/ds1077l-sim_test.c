@@ -0,0 +1,193 @@
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-lock.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-retry.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-topo.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Read DIV of every device in turn, as the batch tools go through their
+ * devices, and return the channel selects it took.
+ */
+static uint64_t
+batch_selects (const topo_target_t *batch, size_t count)
+{
+    topo_stats_t before = { 0 };
+    topo_stats_t after = { 0 };
+    size_t i = 0;
+    int fd = 0;
+
+    topo_stats (&before);
+    for (i = 0; i < count; ++i) {
+        fd = pool_get (batch[i].bus_dev, batch[i].mux, batch[i].channel,
+                       batch[i].address);
+        xfer_read_word (fd, COMMAND_DIV);
+        pool_put (fd);
+    }
+    topo_stats (&after);
+    return after.selects - before.selects;
+}
+
+int main(void)
+{
+    char path[] = "/tmp/ds1077l-sim_test.XXXXXX";
+    char lock[] = "/tmp/ds1077l-sim_test.lock.XXXXXX";
+    topo_target_t batch[4] = { 0 };
+    topo_stats_t stats = { 0 };
+    retry_policy_t once = { .attempts = 1 };
+    sim_fault_stats_t faults = { 0 };
+    int fd0 = 0, fd1 = 0, fd = 0;
+    int32_t div0 = 0, div1 = 0;
+    int32_t mux = 0;
+    int status = 0;
+    pid_t pid = 0;
+    int err = 0;
+    size_t i = 0;
+
+    fd = mkstemp (path);
+    if (fd == -1 || close (fd) || (fd = mkstemp (lock)) == -1) {
+        perror ("mkstemp");
+        exit (1);
+    }
+    close (fd);
+    lock_init (lock, LOCK_EXCLUSIVE);
+    if (sim_init (path, "i2c-1/0x70/0/0x58,i2c-1/0x70/1/0x58,i2c-1/0x5f,"
+                  "i2c-1/0x70/0/0x5a,i2c-1/0x70/1/0x5a,i2c-1/0x70/0/0x5b,"
+                  "i2c-1/0x70/1/0x5b")) {
+        perror ("sim_init");
+        exit (1);
+    }
+    /* same address on two channels, told apart by the mux */
+    fd0 = pool_get ("/dev/i2c-1", 0x70, 0, 0x58);
+    fd1 = pool_get ("/dev/i2c-1", 0x70, 1, 0x58);
+    xfer_write_word (fd0, COMMAND_DIV, DIV_PACK (10));
+    xfer_write_word (fd1, COMMAND_DIV, DIV_PACK (20));
+    div0 = xfer_read_word (fd0, COMMAND_DIV);
+    div1 = xfer_read_word (fd1, COMMAND_DIV);
+    printf ("expect: 10 20\n");
+    printf ("%d %d\n", DIV_UNPACK (div0), DIV_UNPACK (div1));
+    /* repeated accesses on one channel only select it once */
+    topo_stats (&stats);
+    printf ("expect: selects 4 skipped 0\n");
+    printf ("selects %llu skipped %llu\n", (unsigned long long)stats.selects,
+            (unsigned long long)stats.skipped);
+    for (i = 0; i < 3; ++i)
+        xfer_read_word (fd1, COMMAND_DIV);
+    topo_stats (&stats);
+    printf ("expect: selects 4 skipped 3\n");
+    printf ("selects %llu skipped %llu\n", (unsigned long long)stats.selects,
+            (unsigned long long)stats.skipped);
+    /* not behind the mux */
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x5f);
+    div0 = xfer_read_word (fd, COMMAND_DIV);
+    printf ("expect: 2\n");
+    printf ("%d\n", DIV_UNPACK (div0));
+    /* nothing at 0x59 */
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x59);
+    div0 = xfer_read_word (fd, COMMAND_DIV);
+    printf ("expect: -1 nak\n");
+    printf ("%d %s\n", div0, xfer_result_name (errno));
+    /* batches are grouped by adapter, mux and channel */
+    topo_parse_target ("i2c-1/0x70/1/0x58", &batch[0]);
+    topo_parse_target ("i2c-1/0x5f", &batch[1]);
+    topo_parse_target ("i2c-1/0x70/0/0x59", &batch[2]);
+    topo_parse_target ("/dev/i2c-1/0x70/0/0x58", &batch[3]);
+    topo_sort (batch, 4);
+    printf ("expect: /dev/i2c-1/0x5f /dev/i2c-1/0x70/0/0x58 "
+            "/dev/i2c-1/0x70/0/0x59 /dev/i2c-1/0x70/1/0x58\n");
+    for (i = 0; i < 4; ++i) {
+        if (batch[i].mux == 0)
+            printf ("%s/%#x", batch[i].bus_dev, batch[i].address);
+        else
+            printf ("%s/%#x/%d/%#x", batch[i].bus_dev, batch[i].mux,
+                    batch[i].channel, batch[i].address);
+        printf (i == 3 ? "\n" : " ");
+    }
+
+    /* another process switching channels makes us select again */
+    pid = fork ();
+    if (pid == 0)
+        exit (DIV_UNPACK (xfer_read_word (fd0, COMMAND_DIV)) == 10 ? 0 : 1);
+    waitpid (pid, &status, 0);
+    div1 = xfer_read_word (fd1, COMMAND_DIV);
+    topo_stats (&stats);
+    printf ("expect: 0 20 selects 5\n");
+    printf ("%d %d selects %llu\n", WEXITSTATUS (status), DIV_UNPACK (div1),
+            (unsigned long long)stats.selects);
+
+    /* an interleaved batch switches channels for every device, sorted it
+     * selects each channel once
+     */
+    topo_parse_target ("i2c-1/0x70/0/0x5a", &batch[0]);
+    topo_parse_target ("i2c-1/0x70/1/0x5a", &batch[1]);
+    topo_parse_target ("i2c-1/0x70/0/0x5b", &batch[2]);
+    topo_parse_target ("i2c-1/0x70/1/0x5b", &batch[3]);
+    printf ("expect: 4\n");
+    printf ("%llu\n", (unsigned long long)batch_selects (batch, 4));
+    topo_sort (batch, 4);
+    printf ("expect: 2\n");
+    printf ("%llu\n", (unsigned long long)batch_selects (batch, 4));
+
+    /* faults, without retries so every one shows */
+    retry_init (&once);
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x5f);
+    sim_faults_parse ("nak=1@i2c-1/0x5f");
+    div0 = xfer_read_word (fd, COMMAND_DIV);
+    err = errno;
+    div1 = xfer_read_word (fd0, COMMAND_DIV);
+    printf ("expect: -1 nak 10\n");
+    printf ("%d %s %d\n", div0, xfer_result_name (err), DIV_UNPACK (div1));
+    /* gone after two transactions */
+    sim_faults_parse ("vanish=2");
+    printf ("expect: 0 0 -1\n");
+    for (i = 0; i < 3; ++i)
+        printf ("%d%s", xfer_read_word (fd, COMMAND_DIV) < 0 ? -1 : 0,
+                i == 2 ? "\n" : " ");
+    /* busy right after an EEPROM write, not after a read */
+    sim_faults_parse ("busy=200000");
+    xfer_read_word (fd, COMMAND_DIV);
+    div0 = xfer_read_word (fd, COMMAND_DIV);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (30));
+    div1 = xfer_read_word (fd, COMMAND_DIV);
+    printf ("expect: 2 -1\n");
+    printf ("%d %d\n", DIV_UNPACK (div0), div1);
+    /* a reset brings the factory defaults back */
+    sim_faults_parse ("reset=1@i2c-1/0x5f");
+    div0 = xfer_read_word (fd, COMMAND_DIV);
+    mux = xfer_read_word (fd, COMMAND_MUX);
+    printf ("expect: 2 1 1\n");
+    printf ("%d %d %d\n", DIV_UNPACK (div0), SEL0_UNPACK (mux),
+            EN0_UNPACK (mux));
+    /* the same seed draws the same faults */
+    sim_faults_parse ("seed=7,nak=0.5,spike=0.5:1");
+    for (i = 0; i < 100; ++i)
+        xfer_read_word (fd, COMMAND_DIV);
+    sim_fault_stats (&faults);
+    div0 = faults.naks;
+    div1 = faults.spikes;
+    sim_faults_parse ("seed=7,nak=0.5,spike=0.5:1");
+    for (i = 0; i < 100; ++i)
+        xfer_read_word (fd, COMMAND_DIV);
+    sim_fault_stats (&faults);
+    printf ("expect: 1 1 1\n");
+    printf ("%d %d %d\n", div0 == faults.naks, div1 == faults.spikes,
+            div0 > 0 && div0 < 100);
+    printf ("expect: %d %d %d\n", EINVAL, EINVAL, E2BIG);
+    sim_faults_parse ("nak=2");
+    printf ("%d", errno);
+    sim_faults_parse ("vanish=1@i2c-1");
+    printf (" %d", errno);
+    sim_faults_parse ("nak=0,nak=0,nak=0,nak=0,nak=0,nak=0,nak=0,nak=0,"
+                      "nak=0,nak=0,nak=0,nak=0,nak=0,nak=0,nak=0,nak=0,nak=0");
+    printf (" %d\n", errno);
+    unlink (lock);
+    unlink (path);
+    exit (0);
+}
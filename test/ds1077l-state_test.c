@@ -0,0 +1,96 @@
+#include "../src/ds1077l-bus.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static char sim_path[] = "/tmp/ds1077l-state_test.sim.XXXXXX";
+
+/* The simulated device at 'address', straight from the file. */
+static sim_device_t *
+sim_get (uint8_t address)
+{
+    static sim_file_t sim;
+    uint32_t i = 0;
+    int fd = 0;
+
+    fd = open (sim_path, O_RDONLY);
+    if (fd == -1 || read (fd, &sim, sizeof (sim)) != sizeof (sim))
+        exit (1);
+    close (fd);
+    for (i = 0; i < sim.count; ++i)
+        if (sim.devices[i].kind == SIM_DS1077L &&
+            sim.devices[i].address == address)
+            return &sim.devices[i];
+    return NULL;
+}
+
+int main(void)
+{
+    state_entry_t entry = { 0 };
+    state_result_t result = STATE_SKIPPED;
+    sim_device_t *device = NULL;
+    char line[256];
+    int ret = 0;
+    int fd = 0;
+
+    /* settings, comments and presets missing from the index */
+    ret = state_parse ("i2c-1/0x70/3/0x5a  n=10 m0=2  # test", &entry);
+    printf ("expect: 0 0x70 3 0x5a 3 10\n");
+    printf ("%d %#x %d %#x %d %d\n", ret, entry.target.mux,
+            entry.target.channel, entry.target.address, entry.preset.regs,
+            DIV_UNPACK (entry.preset.div));
+    printf ("expect: 1 -1 -1 %d\n", ENOENT);
+    printf ("%d", state_parse ("  # DEVICE STATE", &entry));
+    printf (" %d", state_parse ("i2c-1/0x58", &entry));
+    printf (" %d", state_parse ("i2c-1/0x58 n=1", &entry));
+    errno = 0;
+    state_parse ("i2c-1/0x58 production", &entry);
+    printf (" %d\n", errno);
+
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58")) {
+        perror ("init");
+        exit (1);
+    }
+
+    /* out of state: written, and with WC set committed with E2_WRITE */
+    state_parse ("/dev/i2c-1/0x58 n=100 m1=4 wc=1", &entry);
+    ret = state_restore (&entry, true, NULL, &result);
+    device = sim_get (0x58);
+    printf ("expect: 0 1 100 100 4 0x8\n");
+    printf ("%d %d %d %d %d %#x\n", ret, result, DIV_UNPACK (device->div),
+            DIV_UNPACK (device->e2_div), M1_UNPACK (device->e2_mux),
+            device->e2_bus);
+
+    /* in state: nothing written, the EEPROM was written once */
+    ret = state_restore (&entry, true, NULL, &result);
+    printf ("expect: 0 0 1\n");
+    printf ("%d %d %u\n", ret, result, sim_get (0x58)->e2_writes);
+
+    /* live only: the EEPROM keeps what it had */
+    state_parse ("/dev/i2c-1/0x58 n=20", &entry);
+    ret = state_restore (&entry, false, NULL, &result);
+    device = sim_get (0x58);
+    printf ("expect: 0 1 20 100\n");
+    printf ("%d %d %d %d\n", ret, result, DIV_UNPACK (device->div),
+            DIV_UNPACK (device->e2_div));
+
+    /* what's saved parses back to the same state */
+    state_save (&entry.target, line, sizeof (line));
+    printf ("expect: /dev/i2c-1/0x58 n=20 m0=1 m1=4 div1=0 en0=1 sel0=1 "
+            "pdn0=0 pdn1=0 wc=1\n");
+    printf ("%s\n", line);
+    state_parse (line, &entry);
+    state_restore (&entry, true, NULL, &result);
+    printf ("expect: 0\n");
+    printf ("%d\n", result);
+    unlink (sim_path);
+    exit (0);
+}
@@ -0,0 +1,142 @@
+#include "../src/ds1077l-sub.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int subscribed = 0;
+static int released = 0;
+
+static void
+on_subscribe (const topo_target_t *target, bool on, void *arg)
+{
+    if (on)
+        ++subscribed;
+    else
+        ++released;
+}
+
+/* Let the server accept, take requests and flush what it can. */
+static void
+serve (void)
+{
+    struct pollfd fds[SUB_CLIENTS_MAX + 1];
+    size_t count = 0;
+
+    count = sub_pollfds (fds, SUB_CLIENTS_MAX + 1);
+    if (poll (fds, count, 100) > 0)
+        sub_dispatch (fds, count);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/ds1077l-sub_test.XXXXXX";
+    topo_target_t target = { 0 };
+    watch_image_t image = { .div = DIV_PACK (100), .mux = 0x0018,
+                            .bus = 0x00 };
+    sub_event_t event = { 0 };
+    topo_target_t bogus = { 0 };
+    struct stat st;
+    uint32_t events = 0;
+    uint32_t changes = 0;
+    int ret = 0;
+    int fd = 0;
+    int i = 0;
+
+    fd = mkstemp (path);
+    if (fd == -1) {
+        perror ("mkstemp");
+        exit (1);
+    }
+    close (fd);
+    if (sub_listen (path, -1, on_subscribe, NULL)) {
+        perror ("sub_listen");
+        exit (1);
+    }
+    /* only owner and group may connect */
+    stat (path, &st);
+    printf ("expect: 660\n");
+    printf ("%o\n", st.st_mode & 0777);
+    topo_parse_target ("i2c-1/0x70/2/0x58", &target);
+    /* the state known before subscribing is sent right away */
+    sub_publish (&target, &image);
+    fd = sub_connect (path);
+    serve ();
+    sub_subscribe (fd, &target, WATCH_DIV);
+    serve ();
+    sub_read (fd, &event);
+    printf ("expect: 1 1 100 1\n");
+    printf ("%d %d %d %d\n", subscribed, event.snapshot, event.div.n,
+            event.regs);
+    /* changes to registers nobody asked for aren't sent */
+    image.mux = 0x0010;
+    sub_publish (&target, &image);
+    image.div = DIV_PACK (200);
+    sub_publish (&target, &image);
+    sub_read (fd, &event);
+    printf ("expect: 0 200 1 0\n");
+    printf ("%d %d %d %u\n", event.snapshot, event.div.n, event.regs,
+            event.coalesced);
+    /* a client that doesn't keep up gets its changes coalesced */
+    for (i = 0; i < 10000; ++i) {
+        image.div = DIV_PACK (2 + i % 1000);
+        sub_publish (&target, &image);
+    }
+    fcntl (fd, F_SETFL, O_NONBLOCK);
+    while (event.div.n != DIV_UNPACK (image.div)) {
+        if (sub_read (fd, &event)) {
+            if (errno != EAGAIN)
+                break;
+            serve ();
+            continue;
+        }
+        ++events;
+        changes += event.coalesced + 1;
+    }
+    printf ("expect: 1 10000 1\n");
+    printf ("%d %u %d\n", events < 10000, changes,
+            event.div.n == DIV_UNPACK (image.div));
+
+    /* a client dropping its subscriptions releases the device, and
+     * subscribing again takes it back, answered once it's polled again
+     */
+    close (fd);
+    serve ();
+    fd = sub_connect (path);
+    serve ();
+    sub_subscribe (fd, &target, WATCH_DIV);
+    serve ();
+    sub_publish (&target, &image);
+    sub_read (fd, &event);
+    printf ("expect: 1 2 1\n");
+    printf ("%d %d %d\n", released, subscribed, event.snapshot);
+    close (fd);
+    serve ();
+
+    /* anything but a DS1077L on /dev/i2c-N gets the client dropped */
+    topo_parse_target ("/etc/shadow/0x58", &bogus);
+    fd = sub_connect (path);
+    serve ();
+    sub_subscribe (fd, &bogus, WATCH_DIV);
+    serve ();
+    ret = sub_read (fd, &event);
+    printf ("expect: -1 %d 2\n", ECONNRESET);
+    printf ("%d %d %d\n", ret, errno, subscribed);
+    close (fd);
+    topo_parse_target ("i2c-1/0x70/2/0x40", &bogus);
+    bogus.address = 0x40;
+    fd = sub_connect (path);
+    serve ();
+    sub_subscribe (fd, &bogus, WATCH_DIV);
+    serve ();
+    ret = sub_read (fd, &event);
+    printf ("expect: -1 %d 2\n", ECONNRESET);
+    printf ("%d %d %d\n", ret, errno, subscribed);
+    close (fd);
+    sub_close ();
+    exit (0);
+}
@@ -0,0 +1,132 @@
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-lock.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-preset.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-transition.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MCLK 66666667
+
+/* OUT1 at P1 / N, or P1 / 0 for DIV1 set */
+#define OUT1(p1, n) DIV_PACK (((n) ? (n) : 2)), \
+                    SEL0_PACK (true) | EN0_PACK (true) | M1_PACK (p1) | \
+                    DIV1_PACK ((n) == 0)
+
+static void
+writes_print (int ret, const transition_t *transition)
+{
+    size_t i = 0;
+
+    if (ret) {
+        printf ("%d\n", errno);
+        return;
+    }
+    for (i = 0; i < transition->count; ++i) {
+        if (transition->writes[i].command == COMMAND_DIV)
+            printf ("%sn=%d", i ? " " : "",
+                    DIV_UNPACK (transition->writes[i].word));
+        else
+            printf ("%sm1=%d%s", i ? " " : "",
+                    M1_UNPACK (transition->writes[i].word),
+                    DIV1_UNPACK (transition->writes[i].word) ? ",div1" : "");
+    }
+    printf ("\n");
+}
+
+int main(void)
+{
+    char sim_path[] = "/tmp/ds1077l-transition_test.sim.XXXXXX";
+    topo_target_t target = { .bus_dev = "/dev/i2c-1", .address = 0x58 };
+    transition_band_t band = { .master_hz = MCLK };
+    transition_t transition = { 0 };
+    preset_t preset = { 0 };
+    int ret = 0;
+    int fd = 0;
+
+    ret = transition_parse_band ("1000-1000", &band);
+    printf ("expect: 0 1000 1000 %d\n", EINVAL);
+    printf ("%d %u %u", ret, band.min_hz, band.max_hz);
+    transition_parse_band ("2000-1000", &band);
+    printf (" %d\n", errno);
+    printf ("expect: 333333 66666667\n");
+    printf ("%u %u\n", transition_hz (MCLK, OUT1 (1, 200)),
+            transition_hz (MCLK, OUT1 (1, 0)));
+
+    /* without a band DIV goes first, unchanged registers aren't written */
+    ret = transition_plan (NULL, OUT1 (1, 400), OUT1 (8, 50), &transition);
+    printf ("expect: n=50 m1=8\n");
+    writes_print (ret, &transition);
+    ret = transition_plan (NULL, OUT1 (1, 400), OUT1 (1, 400), &transition);
+    printf ("expect: \n");
+    writes_print (ret, &transition);
+
+    /* DIV first where that stays inside, MUX first where only that does */
+    band.min_hz = 100000;
+    band.max_hz = 700000;
+    ret = transition_plan (&band, OUT1 (1, 100), OUT1 (2, 200), &transition);
+    printf ("expect: n=200 m1=2\n");
+    writes_print (ret, &transition);
+    band.min_hz = 300000;
+    ret = transition_plan (&band, OUT1 (1, 100), OUT1 (2, 50), &transition);
+    printf ("expect: m1=2 n=50\n");
+    writes_print (ret, &transition);
+
+    /* neither order does: 333 kHz to 333 kHz by way of 667 or 167 kHz, so
+     * through N = 134 at 498 kHz and then 249 kHz
+     */
+    band.min_hz = 200000;
+    band.max_hz = 500000;
+    ret = transition_plan (&band, OUT1 (1, 200), OUT1 (2, 100), &transition);
+    printf ("expect: n=134 m1=2 n=100\n");
+    writes_print (ret, &transition);
+
+    /* the start may be out of the band, but not the target, and a band too
+     * narrow to get P1 from 1 to 8 inside it leaves no way there
+     */
+    ret = transition_plan (&band, OUT1 (1, 2), OUT1 (1, 0), &transition);
+    printf ("expect: %d\n", ERANGE);
+    writes_print (ret, &transition);
+    band.min_hz = 150000;
+    band.max_hz = 180000;
+    ret = transition_plan (&band, OUT1 (1, 400), OUT1 (8, 50), &transition);
+    printf ("expect: %d\n", ERANGE);
+    writes_print (ret, &transition);
+
+    /* fields OUT1 doesn't depend on take one MUX write */
+    ret = transition_plan (&band, OUT1 (1, 400), OUT1 (1, 400) | M0_PACK (4),
+                           &transition);
+    printf ("expect: 1 m1=1 4\n");
+    printf ("%zu m1=%d %d\n", transition.count,
+            M1_UNPACK (transition.writes[0].word),
+            M0_UNPACK (transition.writes[0].word));
+
+    /* presets on a device, through the same state in between */
+    if ((fd = mkstemp (sim_path)) == -1 || close (fd) ||
+        sim_init (sim_path, "i2c-1/0x58")) {
+        perror ("init");
+        exit (1);
+    }
+    lock_init ("/dev/null", LOCK_NONE);
+    fd = pool_get (target.bus_dev, 0, 0, target.address);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (200));
+    preset_parse ("glide n=100 m1=2", &preset);
+    band.min_hz = 200000;
+    band.max_hz = 500000;
+    ret = preset_apply_band (&preset, &target, &band);
+    printf ("expect: 0 100 2\n");
+    printf ("%d %d %d\n", ret, DIV_UNPACK (xfer_read_word (fd, COMMAND_DIV)),
+            M1_UNPACK (xfer_read_word (fd, COMMAND_MUX)));
+    preset_parse ("glide n=200 m1=1", &preset);
+    band.max_hz = 300000;
+    ret = preset_apply_band (&preset, &target, &band) ? errno : 0;
+    printf ("expect: %d 100\n", ERANGE);
+    printf ("%d %d\n", ret, DIV_UNPACK (xfer_read_word (fd, COMMAND_DIV)));
+    unlink (sim_path);
+    exit (0);
+}
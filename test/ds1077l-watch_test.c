@@ -0,0 +1,90 @@
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-lock.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-watch.h"
+#include "../src/ds1077l-xfer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(void)
+{
+    char path[] = "/tmp/ds1077l-watch_test.XXXXXX";
+    watch_policy_t policy = {
+        .min_ms    = 100,
+        .max_ms    = 400,
+        .remediate = false,
+    };
+    watch_device_t device = { 0 };
+    watch_event_t event = WATCH_STABLE;
+    int fd = 0;
+    int i = 0;
+
+    fd = mkstemp (path);
+    if (fd == -1) {
+        perror ("mkstemp");
+        exit (1);
+    }
+    close (fd);
+    if (sim_init (path, "i2c-1/0x70/3/0x59")) {
+        perror ("sim_init");
+        exit (1);
+    }
+    lock_init ("/dev/null", LOCK_NONE);
+    printf ("expect: -1 -1 0 1\n");
+    printf ("%d", watch_parse ("i2c-1/0x70/3/0x59=0x8018:0x0018", &device));
+    /* BUS has to agree with the address */
+    printf (" %d", watch_parse ("i2c-1/0x70/3/0x59=0x8018:0x0018:0x00",
+                                &device));
+    printf (" %d", watch_parse ("i2c-1/0x70/3/0x59", &device));
+    printf (" %d\n", device.expected_set ? 0 : 1);
+    watch_start (&device, 1, &policy, 0);
+    /* stable devices back off to the maximum interval */
+    printf ("expect: baseline 200 stable 400 stable 400\n");
+    for (i = 0; i < 3; ++i) {
+        event = watch_poll (&device, &policy, 0);
+        printf ("%s%s %u", i ? " " : "", watch_event_name (event),
+                device.interval_ms);
+        printf (i == 2 ? "\n" : "");
+    }
+    /* drift tightens the interval until the device is stable again */
+    fd = pool_get ("/dev/i2c-1", 0x70, 3, 0x59);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (100));
+    event = watch_poll (&device, &policy, 0);
+    printf ("expect: drift 1 100\n");
+    printf ("%s %d %u\n", watch_event_name (event), device.drifted,
+            device.interval_ms);
+    policy.remediate = true;
+    event = watch_poll (&device, &policy, 0);
+    printf ("expect: remediated 100\n");
+    printf ("%s %u\n", watch_event_name (event), device.interval_ms);
+    /* and stays there until it has been stable a few polls in a row */
+    printf ("expect: stable 100 stable 100 stable 200 stable 400\n");
+    for (i = 0; i < 4; ++i) {
+        event = watch_poll (&device, &policy, 0);
+        printf ("%s%s %u", i ? " " : "", watch_event_name (event),
+                device.interval_ms);
+        printf (i == 3 ? "\n" : "");
+    }
+    /* drift in between starts the count over */
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (100));
+    watch_poll (&device, &policy, 0);
+    watch_poll (&device, &policy, 0);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (100));
+    watch_poll (&device, &policy, 0);
+    printf ("expect: stable 100 stable 100 stable 200\n");
+    for (i = 0; i < 3; ++i) {
+        event = watch_poll (&device, &policy, 0);
+        printf ("%s%s %u", i ? " " : "", watch_event_name (event),
+                device.interval_ms);
+        printf (i == 2 ? "\n" : "");
+    }
+    printf ("expect: 15 4 0\n");
+    printf ("%llu %llu %llu\n", (unsigned long long)device.polls,
+            (unsigned long long)device.drifts,
+            (unsigned long long)device.errors);
+    unlink (path);
+    exit (0);
+}
@@ -0,0 +1,126 @@
+#include "../src/ds1077l-bus.h"
+#include "../src/ds1077l-div.h"
+#include "../src/ds1077l-mux.h"
+#include "../src/ds1077l-pool.h"
+#include "../src/ds1077l-sim.h"
+#include "../src/ds1077l-wear.h"
+#include "../src/ds1077l-writee2.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static char sim_path[] = "/tmp/ds1077l-wear_test.sim.XXXXXX";
+static char wear_path[] = "/tmp/ds1077l-wear_test.wear.XXXXXX";
+
+/* EEPROM writes as seen by the simulated device */
+static unsigned
+sim_e2_writes (uint8_t address)
+{
+    static sim_file_t sim;
+    uint32_t i = 0;
+    int fd = 0;
+
+    fd = open (sim_path, O_RDONLY);
+    if (fd == -1 || read (fd, &sim, sizeof (sim)) != sizeof (sim))
+        exit (1);
+    close (fd);
+    for (i = 0; i < sim.count; ++i)
+        if (sim.devices[i].kind == SIM_DS1077L &&
+            sim.devices[i].address == address)
+            return sim.devices[i].e2_writes;
+    return 0;
+}
+
+static const wear_device_t *
+wear_get (uint8_t address)
+{
+    static wear_device_t devices[WEAR_DEVICES_MAX];
+    size_t count = wear_list (devices, WEAR_DEVICES_MAX);
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i)
+        if (devices[i].address == address)
+            return &devices[i];
+    return NULL;
+}
+
+static void
+wear_print (uint8_t address)
+{
+    const wear_device_t *device = wear_get (address);
+
+    printf ("%llu %d %u\n",
+            device ? (unsigned long long)device->e2_writes : 0ull,
+            device ? device->dirty : 0, sim_e2_writes (address));
+}
+
+int main(void)
+{
+    size_t committed = 0;
+    int ret = 0;
+    int fd = 0;
+
+    fd = mkstemp (sim_path);
+    if (fd == -1 || close (fd) || (fd = mkstemp (wear_path)) == -1 ||
+        close (fd)) {
+        perror ("mkstemp");
+        exit (1);
+    }
+    if (sim_init (sim_path, "i2c-1/0x58,i2c-1/0x59") ||
+        wear_init (wear_path, false)) {
+        perror ("init");
+        exit (1);
+    }
+    /* WC clear: every register write and E2_WRITE hits the EEPROM */
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x58);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (10));
+    xfer_write_word (fd, COMMAND_MUX, 0x1800);
+    xfer_command (fd, COMMAND_E2_WRITE);
+    printf ("expect: 3 0 3\n");
+    wear_print (0x58);
+    /* setting WC is free, the writes after it only change SRAM */
+    xfer_write_byte (fd, COMMAND_BUS, ADDRESS_PACK (0x58) | WC_PACK (true));
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (20));
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (30));
+    printf ("expect: 3 1 3\n");
+    wear_print (0x58);
+    /* devices changed less than a minute ago aren't due yet */
+    printf ("expect: 0 0\n");
+    ret = wear_commit (60000, &committed);
+    printf ("%d %zu\n", ret, committed);
+    printf ("expect: 0 1\n");
+    ret = wear_commit (0, &committed);
+    printf ("%d %zu\n", ret, committed);
+    printf ("expect: 4 0 4\n");
+    wear_print (0x58);
+
+    /* write-behind sets WC before the first DIV write, a single commit
+     * covers all of them
+     */
+    if (wear_init (wear_path, true)) {
+        perror ("wear_init");
+        exit (1);
+    }
+    fd = pool_get ("/dev/i2c-1", 0, 0, 0x59);
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (10));
+    xfer_write_word (fd, COMMAND_DIV, DIV_PACK (20));
+    xfer_write_word (fd, COMMAND_MUX, 0x1800);
+    printf ("expect: 0 1 0 1\n");
+    printf ("%llu %d %u %d\n",
+            (unsigned long long)wear_get (0x59)->e2_writes,
+            wear_get (0x59)->dirty, sim_e2_writes (0x59),
+            WC_UNPACK (xfer_read_byte (fd, COMMAND_BUS)));
+    wear_commit (0, &committed);
+    printf ("expect: 1 0 1\n");
+    wear_print (0x59);
+    /* the count moves along with the device */
+    xfer_write_byte (fd, COMMAND_BUS, ADDRESS_PACK (0x5a) | WC_PACK (true));
+    printf ("expect: 1 0\n");
+    printf ("%llu %d\n", (unsigned long long)wear_get (0x5a)->e2_writes,
+            wear_get (0x59) != NULL);
+    unlink (sim_path);
+    unlink (wear_path);
+    exit (0);
+}